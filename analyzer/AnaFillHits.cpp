@@ -66,31 +66,21 @@ TAFlowEvent* AnaFillHits::Analyze(TARunInfo* runinfo, TMEvent* event, TAFlags* f
     // ----------------------------------------
     event->FindAllBanks();
 
-    std::vector<hit> hits_;
+    // The flow event only points into the bank data, no hit is copied
+    HitVectorFlowEvent* hitevent = new HitVectorFlowEvent(flow);
 
     for(const auto& bank : event->banks) {
-        const std::string firstTwoChars = bank.name.substr(0, 1);
-        const char* rawData = event->GetBankData(&bank);
-
         // ----------------------------------------
         // HTxx bank: mixed hit bank
         // ----------------------------------------
-        if(firstTwoChars == "H") {
+        if(bank.name[0] == 'H') {
+            const char* rawData = event->GetBankData(&bank);
             const hit* dataStart = reinterpret_cast<const hit*>(rawData);
-            const hit* dataEnd   = reinterpret_cast<const hit*>(rawData + bank.data_size);
-
-            hits_.reserve(hits_.size() + (dataEnd - dataStart));
+            const hit* dataEnd   = dataStart + bank.data_size / sizeof(hit);
 
-            for(const hit* current = dataStart; current != dataEnd; ++current) {
-                hits_.emplace_back(*current);
-            }
+            hitevent->AddBank(dataStart, dataEnd);
         }
     }
 
-    flow = new HitVectorFlowEvent(flow, std::move(hits_));
-    // After a std::move, objects are in an undefined state. So we
-    // reset as default constructed vectors.
-    hits_ = std::vector<hit>();
-
-    return flow;
+    return hitevent;
 }
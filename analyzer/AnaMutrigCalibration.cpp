@@ -0,0 +1,288 @@
+#include "AnaMutrigCalibration.h"
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include "HitVectorFlowEvent.h"
+
+#include "musip/dqm/PlotCollection.hpp"
+#include "musip/dqm/DQMManager.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+
+namespace {
+
+MutrigTimeCalibration::Settings calibrationSettings(const boost::property_tree::ptree& config) {
+    MutrigTimeCalibration::Settings settings;
+    settings.energy_bins = config.get<unsigned>("energy_bins", settings.energy_bins);
+    settings.min_rate = config.get<double>("min_learning_rate", settings.min_rate);
+    settings.outlier = config.get<double>("outlier_ns", 5) / 50e-3;
+    settings.warmup = config.get<uint32_t>("warmup", settings.warmup);
+    return settings;
+}
+
+} // end of the unnamed namespace
+
+AnaMutrigCalibration::AnaMutrigCalibration(const boost::property_tree::ptree& config, TARunInfo* runinfo)
+    : TARunObject(runinfo),
+      enabled_(config.get<bool>("enabled", true)),
+      coincidence_window_ns_(config.get<double>("coincidence_window_ns", 10.0)),
+      min_energy_(config.get<uint16_t>("min_energy", 0)),
+      publish_every_(config.get<size_t>("publish_every", 10000)),
+      calibration_(calibrationSettings(config))
+{
+    fModuleName = "MutrigCalibration";
+
+    printf("<Beginning of %s Module configuration>\n", fModuleName.c_str());
+    boost::property_tree::write_json(std::cout, config);
+    printf("<End of %s Module configuration>\n", fModuleName.c_str());
+
+    if(!enabled_) return;
+
+    // Same format as mutrig.channelpairs, {"name": [channelA, channelB]}
+    if (auto pairs_opt = config.get_child_optional("channelpairs")) {
+        for (const auto &entry : *pairs_opt) {
+            std::vector<int> vals;
+            for (const auto &elem : entry.second) {
+                try {
+                    vals.push_back(elem.second.get_value<int>());
+                } catch (...) {
+                    // ignore malformed element
+                }
+            }
+            if (vals.size() == 2) {
+                channelpairs_[std::pair<int,int>(vals[0], vals[1])] = entry.first;
+            }
+        }
+    }
+
+    pPlotCollection_ = musip::dqm::DQMManager::instance().getOrCreateCollection("mutrigcal");
+}
+
+AnaMutrigCalibration::~AnaMutrigCalibration() {};
+
+void AnaMutrigCalibration::BeginRun(TARunInfo* runinfo) {
+    if(!enabled_) {
+        printf("AnaMutrigCalibration::BeginRun, run %d - module is disabled\n", runinfo->fRunNo);
+        return;
+    }
+
+    printf("MutrigCalibration::BeginRun, run %d, file %s\n", runinfo->fRunNo, runinfo->fFileName.c_str());
+
+    // Note: This error_code isn't checked anywhere yet, but we need it for DQM API.
+    std::error_code error; // TODO: actually check this error code and print warnings
+    using MD = musip::dqm::Metadata;
+
+    const unsigned energyBins = calibration_.energy_bins();
+    h_calibratedTimeDelta = pPlotCollection_->getOrCreateHistogram1DD("CalibratedTimeDelta",
+        401, -2e2 * binsize_ns, 2e2 * binsize_ns, error,
+        MD::Title("Calibrated time difference, all pairs"), MD::AxisTitleX("ns"));
+    h_channelOffset = pPlotCollection_->getOrCreateHistogram1DD("ChannelOffset",
+        n_CHANNELS, -0.5, n_CHANNELS - 0.5, error,
+        MD::Title("Time offset"), MD::AxisTitleX("Channel"), MD::AxisTitleY("ns"));
+    h_timewalk = pPlotCollection_->getOrCreateHistogram2DF("Timewalk",
+        n_CHANNELS, -0.5, n_CHANNELS - 0.5,
+        energyBins, 0, 512,
+        error,
+        MD::Title("Timewalk correction in ns"),
+        MD::AxisTitleX("Channel"),
+        MD::AxisTitleY("Energy")
+    );
+    h_entries = pPlotCollection_->getOrCreateHistogram2DF("CalibrationEntries",
+        n_CHANNELS, -0.5, n_CHANNELS - 0.5,
+        energyBins, 0, 512,
+        error,
+        MD::Title("Coincidences learned from"),
+        MD::AxisTitleX("Channel"),
+        MD::AxisTitleY("Energy")
+    );
+
+    pairs_.assign(n_CHANNELS * n_CHANNELS, PairState());
+    for (int a = 0; a < n_CHANNELS; a++)
+        for (int b = a + 1; b < n_CHANNELS; b++) pairs_[a * n_CHANNELS + b].learn = channelpairs_.empty();
+
+    // A pair may be configured in either order, it is filled as (lower, higher)
+    int index = 0;
+    for (const auto &chpair : channelpairs_) {
+        const int a = std::min(chpair.first.first, chpair.first.second);
+        const int b = std::max(chpair.first.first, chpair.first.second);
+        if (a < 0 || b >= n_CHANNELS || a == b) continue;
+        PairState& pair = pairs_[a * n_CHANNELS + b];
+        pair.learn = true;
+        pair.index = index++;
+        pair.tdiff = pPlotCollection_->getOrCreateHistogram1DD("TimeStampDelta_Calibrated_" + chpair.second,
+            401, -2e2 * binsize_ns, 2e2 * binsize_ns, error,
+            MD::Title("Calibrated time difference " + chpair.second), MD::AxisTitleX("ns"));
+    }
+    h_resolution = pPlotCollection_->getOrCreateHistogram1DD("Resolution",
+        std::max(index, 1), -0.5, std::max(index, 1) - 0.5, error,
+        MD::Title("Sigma of the calibrated time difference, pairs in configuration order"),
+        MD::AxisTitleX("Pair"), MD::AxisTitleY("ns"));
+
+    h_correctionWeighted = pPlotCollection_->getOrCreateHistogram2DD("MergeWeights/Correction",
+        n_CHANNELS, -0.5, n_CHANNELS - 0.5,
+        energyBins, 0, 512,
+        error,
+        MD::Title("Time correction in ns times entries, for merging partial results"),
+        MD::AxisTitleX("Channel"),
+        MD::AxisTitleY("Energy")
+    );
+    h_pairVarianceWeighted = pPlotCollection_->getOrCreateHistogram1DD("MergeWeights/PairVariance",
+        std::max(index, 1), -0.5, std::max(index, 1) - 0.5, error,
+        MD::Title("Variance of the calibrated time difference times entries, for merging partial results"),
+        MD::AxisTitleX("Pair"), MD::AxisTitleY("ns^2"));
+    h_pairEntries = pPlotCollection_->getOrCreateHistogram1DD("MergeWeights/PairEntries",
+        std::max(index, 1), -0.5, std::max(index, 1) - 0.5, error,
+        MD::Title("Entries of the calibrated time difference, for merging partial results"),
+        MD::AxisTitleX("Pair"));
+
+    calibration_.reset();
+    events_ = 0;
+}
+
+void AnaMutrigCalibration::EndRun(TARunInfo* runinfo) {
+    if(!enabled_) return;
+
+    // Without events nothing was learned, and publishing would overwrite what was added from elsewhere
+    if (events_ > 0) publish();
+    else merge();
+    printf("AnaMutrigCalibration::EndRun, run %d, %lu coincidences rejected\n", runinfo->fRunNo, (unsigned long)calibration_.rejected());
+}
+
+TAFlowEvent* AnaMutrigCalibration::AnalyzeFlowEvent(TARunInfo*, TAFlags* flags, TAFlowEvent* flow) {
+    if(!enabled_) {
+        *flags |= TAFlag_SKIP_PROFILE; // Set the profiler to ignore this module
+        return flow;
+    }
+
+    if(!flow) return flow;
+
+    HitVectorFlowEvent* hitevent = flow->Find<HitVectorFlowEvent>();
+    if(!hitevent) return flow;
+
+    fill_coincidences(hitevent->columns().mutrig);
+
+    if (publish_every_ && ++events_ % publish_every_ == 0) publish();
+
+    return flow;
+}
+
+void AnaMutrigCalibration::fill_coincidences(const MutrigColumns& hits) {
+    const size_t n = hits.size();
+    if (n < 2) return;
+
+    // Calibrate all hits in one pass over the columns, then pair them within the coincidence
+    // window in calibrated time, as AnaMutrigHistos does with the raw time
+    calibrated_.resize(n);
+    calibration_.apply(hits.channel.data(), hits.energy.data(), hits.timestamp.data(), n, calibrated_.data());
+    order_.resize(n);
+    std::iota(order_.begin(), order_.end(), 0);
+    std::sort(order_.begin(), order_.end(), [this](uint32_t a, uint32_t b) { return calibrated_[a] < calibrated_[b]; });
+
+    const double window = coincidence_window_ns_ / binsize_ns; // in units of 50ps
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = i + 1; j < n; j++) {
+            uint32_t hit = order_[i];
+            uint32_t hitB = order_[j];
+            if (calibrated_[hitB] - calibrated_[hit] >= window) break;
+            if (hits.channel[hit] == hits.channel[hitB] || hits.channel[hitB] >= n_CHANNELS || hits.channel[hit] >= n_CHANNELS) continue;
+            if (hits.channel[hit] > hits.channel[hitB]) std::swap(hit, hitB);
+
+            PairState& pair = pairs_[hits.channel[hit] * n_CHANNELS + hits.channel[hitB]];
+            if (!pair.learn) continue;
+
+            const double delta = (calibrated_[hit] - calibrated_[hitB]) * binsize_ns;
+            h_calibratedTimeDelta->Fill(delta);
+            if (pair.tdiff) {
+                pair.tdiff->Fill(delta);
+                const double rate = std::max(1. / ++pair.entries, 0.01);
+                const double deviation = delta - pair.mean;
+                pair.mean += rate * deviation;
+                pair.variance = (1 - rate) * (pair.variance + rate * deviation * deviation);
+            }
+
+            if (hits.energy[hit] < min_energy_ || hits.energy[hitB] < min_energy_) continue;
+            calibration_.learn(hits.channel[hit], hits.energy[hit], hits.timestamp[hit],
+                               hits.channel[hitB], hits.energy[hitB], hits.timestamp[hitB]);
+        }
+    }
+}
+
+void AnaMutrigCalibration::publish() {
+    calibration_.normalise();
+
+    // The snapshot histograms hold the current state, so they are refilled rather than added to
+    h_channelOffset->clear();
+    h_timewalk->clear();
+    h_entries->clear();
+    h_resolution->clear();
+    h_correctionWeighted->clear();
+    h_pairVarianceWeighted->clear();
+    h_pairEntries->clear();
+
+    const unsigned energyBins = calibration_.energy_bins();
+    const double energyBinWidth = 512. / energyBins;
+    for (int channel = 0; channel < n_CHANNELS; channel++) {
+        h_channelOffset->Fill(channel, calibration_.offset(channel) * binsize_ns);
+        for (unsigned e = 0; e < energyBins; e++) {
+            const double energy = (e + 0.5) * energyBinWidth;
+            h_timewalk->Fill(channel, energy, calibration_.timewalk(channel, e) * binsize_ns);
+            h_entries->Fill(channel, energy, calibration_.entries(channel, e));
+            const double correction = (calibration_.offset(channel) + calibration_.timewalk(channel, e)) * binsize_ns;
+            h_correctionWeighted->Fill(channel, energy, correction * calibration_.entries(channel, e));
+        }
+    }
+    for (const PairState& pair : pairs_) {
+        if (pair.index < 0 || pair.entries <= 1) continue;
+        h_resolution->Fill(pair.index, std::sqrt(pair.variance));
+        h_pairVarianceWeighted->Fill(pair.index, pair.variance * pair.entries);
+        h_pairEntries->Fill(pair.index, pair.entries);
+    }
+}
+
+void AnaMutrigCalibration::merge() {
+    // The entries and the weighted sums were added up, so they hold the whole run. The snapshots
+    // are the weighted averages, normalised like MutrigTimeCalibration::normalise does.
+    const unsigned energyBins = calibration_.energy_bins();
+    const std::vector<float> entries = h_entries->binContents(); // at channel * energyBins + energy bin
+    const std::vector<double> correctionWeighted = h_correctionWeighted->binContents();
+    if (std::accumulate(entries.begin(), entries.end(), 0.0) == 0) return;
+
+    std::vector<double> offsets(n_CHANNELS, 0);
+    std::vector<bool> calibrated(n_CHANNELS, false);
+    double offsetSum = 0;
+    int calibratedChannels = 0;
+    for (int channel = 0; channel < n_CHANNELS; channel++) {
+        double channelEntries = 0;
+        for (unsigned e = 0; e < energyBins; e++) {
+            offsets[channel] += correctionWeighted[channel * energyBins + e];
+            channelEntries += entries[channel * energyBins + e];
+        }
+        if (channelEntries == 0) continue;
+        offsets[channel] /= channelEntries;
+        calibrated[channel] = true;
+        offsetSum += offsets[channel];
+        calibratedChannels++;
+    }
+    const double meanOffset = offsetSum / calibratedChannels;
+
+    h_channelOffset->clear();
+    h_timewalk->clear();
+    h_resolution->clear();
+
+    const double energyBinWidth = 512. / energyBins;
+    for (int channel = 0; channel < n_CHANNELS; channel++) {
+        h_channelOffset->Fill(channel, calibrated[channel] ? offsets[channel] - meanOffset : 0);
+        for (unsigned e = 0; e < energyBins; e++) {
+            const size_t bin = channel * energyBins + e;
+            const double timewalk = (entries[bin] > 0 ? correctionWeighted[bin] / entries[bin] - offsets[channel] : 0);
+            h_timewalk->Fill(channel, (e + 0.5) * energyBinWidth, timewalk);
+        }
+    }
+
+    const std::vector<double> pairVarianceWeighted = h_pairVarianceWeighted->binContents();
+    const std::vector<double> pairEntries = h_pairEntries->binContents();
+    for (size_t index = 0; index < pairEntries.size(); index++)
+        if (pairEntries[index] > 0) h_resolution->Fill(index, std::sqrt(pairVarianceWeighted[index] / pairEntries[index]));
+}
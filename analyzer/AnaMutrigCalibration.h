@@ -0,0 +1,80 @@
+#ifndef ANAMUTRIGCALIBRATION_H
+#define ANAMUTRIGCALIBRATION_H
+
+#include "manalyzer.h"
+#include "musip/dqm/dqmfwd.hpp"
+#include <boost/property_tree/ptree_fwd.hpp>
+#include "MutrigTimeCalibration.h"
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct MutrigColumns;
+
+// Learns per-channel time offsets and timewalk curves of the MuTRiG hits during the run with
+// MutrigTimeCalibration, from the coincidences that AnaMutrigHistos plots uncorrected. The
+// calibrated time differences of the configured channel pairs are filled event by event, the
+// calibration itself and the resolution per pair are published every `publish_every` events and
+// at the end of the run. If the module saw no events but the histograms were added up from partial
+// results, as quadreplay does, EndRun makes the snapshots from the sums instead.
+class AnaMutrigCalibration : public TARunObject {
+public:
+    AnaMutrigCalibration(const boost::property_tree::ptree& config, TARunInfo* runinfo);
+    ~AnaMutrigCalibration();
+    void BeginRun(TARunInfo* runinfo);
+    void EndRun(TARunInfo* runinfo);
+    TAFlowEvent* Analyze(TARunInfo*, TMEvent*, TAFlags* flags, TAFlowEvent* flow) {
+        // This function doesn't analyze anything, so we use flags
+        // to have the profiler ignore it
+        *flags |= TAFlag_SKIP_PROFILE;
+        return flow;
+    };
+    TAFlowEvent* AnalyzeFlowEvent(TARunInfo*, TAFlags* flags, TAFlowEvent* flow);
+
+private:
+    static const int n_CHANNELS = MutrigTimeCalibration::kChannels;
+    const double binsize_ns = 50e-3; //50ps
+
+    bool enabled_;
+    double coincidence_window_ns_ = 10; // filled from config mutrigcal.coincidence_window_ns
+    uint16_t min_energy_ = 0; // filled from config mutrigcal.min_energy, hits below are not learned from
+    size_t publish_every_ = 10000; // filled from config mutrigcal.publish_every, in events
+    std::map<std::pair<int,int>,std::string> channelpairs_; // filled from config mutrigcal.channelpairs
+    MutrigTimeCalibration calibration_;
+
+    musip::dqm::PlotCollection* pPlotCollection_ {};
+
+    musip::dqm::Histogram1DD* h_calibratedTimeDelta {}; // calibrated time difference of all coincidences
+    musip::dqm::Histogram1DD* h_channelOffset {}; // offset per channel, snapshot
+    musip::dqm::Histogram2DF* h_timewalk {}; // timewalk per channel and energy bin, snapshot
+    musip::dqm::Histogram2DF* h_entries {}; // entries per channel and energy bin, snapshot
+    musip::dqm::Histogram1DD* h_resolution {}; // sigma of the calibrated time difference per pair, snapshot
+
+    // The snapshots can't be added up when quadreplay merges the partial results of a run. These are
+    // what can, the snapshots times their weights, so that `merge` can make the weighted averages.
+    musip::dqm::Histogram2DD* h_correctionWeighted {}; // (offset + timewalk) * entries per channel and energy bin
+    musip::dqm::Histogram1DD* h_pairVarianceWeighted {}; // variance * entries per pair
+    musip::dqm::Histogram1DD* h_pairEntries {}; // entries per pair
+
+    // Calibrated pairs, looked up by lower channel * n_CHANNELS + higher channel. The mean and
+    // variance of the time difference are exponential averages, so they follow the calibration.
+    struct PairState {
+        bool learn = false; // all pairs if no channelpairs are configured
+        musip::dqm::Histogram1DD* tdiff = nullptr;
+        int index = -1; // bin in h_resolution
+        double mean = 0;
+        double variance = 0;
+        uint64_t entries = 0;
+    };
+    std::vector<PairState> pairs_;
+    std::vector<double> calibrated_; // scratch, calibrated times of the current event
+    std::vector<uint32_t> order_; // scratch, hit indices sorted by calibrated time
+    size_t events_ = 0;
+
+    void fill_coincidences(const MutrigColumns& hits);
+    void publish();
+    void merge();
+};
+
+#endif
@@ -10,6 +10,8 @@
 
 #include "musip/dqm/PlotCollection.hpp"
 #include "musip/dqm/DQMManager.hpp"
+#include <algorithm>
+#include <cmath>
 #include <numeric>
 #include <unordered_map>
 
@@ -75,6 +77,7 @@ AnaMutrigHistos::AnaMutrigHistos(const boost::property_tree::ptree& config, TARu
     timewalk_enabled_ = config.get<bool>("timewalk_enabled", false);
     tdiff_timewalk_enabled_ = config.get<bool>("tdiff_timewalk_enabled", false);
     ecorrelation_enabled_ = config.get<bool>("ecorrelation_enabled", false);
+    coincidence_window_ns_ = config.get<double>("coincidence_window_ns", 10.0);
     
     //parse energy cuts for timewalk correction
     if (auto cuts_opt = config.get_child_optional("timewalk_energycuts")) {
@@ -188,6 +191,30 @@ void AnaMutrigHistos::BeginRun(TARunInfo* runinfo) {
     }
     
 
+    // Dense lookup of the pair histograms, indexed by lower channel * n_CHANNELS + higher channel.
+    // A tdiff pair may be configured in either order, timewalk and e-e pairs only as (lower, higher).
+    pair_histos_.assign(n_CHANNELS * n_CHANNELS, PairHistos());
+    pairs_enabled_ = false;
+    for (int a = 0; a < n_CHANNELS; a++) {
+        for (int b = a + 1; b < n_CHANNELS; b++) {
+            PairHistos& histos = pair_histos_[a * n_CHANNELS + b];
+            auto itA = h_tdiff_channelpairs_.find(std::make_pair(a, b));
+            auto itB = h_tdiff_channelpairs_.find(std::make_pair(b, a));
+            if (itA != h_tdiff_channelpairs_.end()) histos.tdiff = itA->second;
+            else if (itB != h_tdiff_channelpairs_.end()) histos.tdiff = itB->second;
+            auto twIt = h_timewalk_.find(std::make_pair(a, b));
+            if (twIt != h_timewalk_.end()) histos.timewalk = twIt->second;
+            auto eeIt = h_ecorrelation_.find(std::make_pair(a, b));
+            if (eeIt != h_ecorrelation_.end()) histos.ecorrelation = eeIt->second;
+            pairs_enabled_ |= histos.tdiff || histos.timewalk || histos.ecorrelation;
+        }
+    }
+    timewalk_cuts_.assign(n_CHANNELS, EnergyCut());
+    for (const auto& cut : timewalk_energycuts_) {
+        if (cut.first < 0 || cut.first >= n_CHANNELS) continue;
+        timewalk_cuts_[cut.first] = EnergyCut{cut.second.first, cut.second.second, true};
+    }
+
     /////////  2D histos  ///////////
     //ToT (Energy) vs Channel:
     TString histoname = "Channel_ToT";
@@ -230,109 +257,105 @@ TAFlowEvent* AnaMutrigHistos::AnalyzeFlowEvent(TARunInfo*, TAFlags* flags, TAFlo
     HitVectorFlowEvent* hitevent = flow->Find<HitVectorFlowEvent>();
     if(!hitevent) return flow;
 
-    std::vector<mutrighit> mutrighits;
-    for ( auto& cur_hit : hitevent->hits )
-        if (cur_hit.is_mutrig())
-            mutrighits.push_back(cur_hit.as_mutrig());
+    // decoded once per event into columns, see HitColumns.h
+    const MutrigColumns& hits = hitevent->columns().mutrig;
+    const size_t nmutrighits = hits.size();
 
     //calculate event-based observables
-    double average_timestamp = std::accumulate(
-           mutrighits.begin(),
-           mutrighits.end(),
-           0.0,
-           [](double a, mutrighit const b) -> double{ return a+b.timestamp();}
-        ) / mutrighits.size();
+    double average_timestamp = std::accumulate(hits.timestamp.begin(), hits.timestamp.end(), 0.0) / nmutrighits;
 
     double rms_timestamp = sqrt(std::accumulate(
-           mutrighits.begin(),
-           mutrighits.end(),
+           hits.timestamp.begin(),
+           hits.timestamp.end(),
            0.0,
-           [average_timestamp](double a, mutrighit const b) -> double{ return a + (average_timestamp - b.timestamp())*(average_timestamp - b.timestamp());}
-        ) / mutrighits.size());
+           [average_timestamp](double a, uint64_t b) -> double{ return a + (average_timestamp - b)*(average_timestamp - b);}
+        ) / nmutrighits);
 
 
     //fill event-based observables
-    h_nHits->Fill(mutrighits.size());
+    h_nHits->Fill(nmutrighits);
 
-    //loop over hits
-    for(auto& hit : mutrighits) {
-        int cnt =0;
-        auto last_hit = last_hits[hit.channel()];
+    // the plain column histograms are filled in bulk
+    h_asic->fillN(hits.asic.data(), nmutrighits);
+    h_channel->fillN(hits.channel.data(), nmutrighits);
+    h_ASIC_FineTime->fillN(hits.asic.data(), hits.finetime.data(), nmutrighits);
 
-        h_asic->Fill(hit.asic());
-        h_channel->Fill(hit.channel());
+    //loop over hits
+    for(size_t i = 0; i < nmutrighits; i++) {
+        const uint8_t channel = hits.channel[i];
+        const uint8_t asic = hits.asic[i];
+        const uint16_t tot = hits.energy[i];
+        const uint64_t timestamp = hits.timestamp[i];
+        auto last_hit = last_hits[channel];
 
-        h_channel_tot->Fill(hit.channel(), hit.tot());
-        h_channel_TimeStampDeltaAverageTime->Fill(hit.channel(), hit.timestamp() - average_timestamp);
-        h_channel_TimeStampRMSTime->Fill(hit.channel(), rms_timestamp);
+        h_channel_tot->Fill(channel, tot);
+        h_channel_TimeStampDeltaAverageTime->Fill(channel, timestamp - average_timestamp);
+        h_channel_TimeStampRMSTime->Fill(channel, rms_timestamp);
 
         h_nHitsDuplicate->Fill(
-               (hit.timestamp() == last_hit.timestamp())
-            && (hit.tot()    == last_hit.tot())
-            && (hit.channel()   == last_hit.channel())
+               (timestamp == last_hit.timestamp())
+            && (tot    == last_hit.tot())
+            && (channel   == last_hit.channel())
         );
 
         // fill per-channel ToT histogram only if this channel is in tot_channels_
-        auto it = h_tot_.find(hit.channel());
+        auto it = h_tot_.find(channel);
         if (it != h_tot_.end()) {
-            it->second->Fill(hit.tot());
+            it->second->Fill(tot);
         }
 
-        h_channel_tot->Fill(hit.channel(), hit.tot()); // in units of 50ps
+        h_channel_tot->Fill(channel, tot); // in units of 50ps
 
-        h_ASIC_CoarseTime->Fill(hit.asic(), hit.timestamp()/32); // in units of 1.6ns
-        h_ASIC_FineTime->Fill(hit.asic(), hit.finetime_extended());
+        h_ASIC_CoarseTime->Fill(asic, timestamp/32); // in units of 1.6ns
 
         //differences to previous hit
-        if((last_hits.find(hit.channel()) != last_hits.end()) && ((last_hit.timestamp()) != 0)) {
-            int64_t timeStampDelta = hit.timestamp() - last_hit.timestamp(); // in units of 50ps
-            h_channel_TimeStampDeltaSameChannel->Fill(hit.channel(), timeStampDelta*binsize_ns);
-        }
-
-        //time differences of hits in paired channel
-        for (auto& hitB : mutrighits) {
-            if ( (hit.channel() >= hitB.channel()) ) continue;
-            int64_t timeStampDelta = ((int64_t) hit.timestamp()) - hitB.timestamp(); // in units of 50ps
-            if(abs(timeStampDelta * binsize_ns) >= 10) continue; // cut out 10ns
-
-            
-            auto itA = h_tdiff_channelpairs_.find(std::make_pair(hit.channel(), hitB.channel()));
-            auto itB = h_tdiff_channelpairs_.find(std::make_pair(hitB.channel(), hit.channel()));
-            //fill time difference histogram, if found
-            if (itA != h_tdiff_channelpairs_.end())
-                itA->second->Fill( timeStampDelta * binsize_ns );
-                else if (itB != h_tdiff_channelpairs_.end())
-                    itB->second->Fill( timeStampDelta * binsize_ns );
-
-            //get energy cuts for timewalk correction
-            auto cutItB = timewalk_energycuts_.find(hitB.channel());
-            if( (cutItB != timewalk_energycuts_.end()) &&
-                (cutItB->second.first < hitB.tot()) &&
-                (cutItB->second.second > hitB.tot()) ) {
-                    //fill timewalk 2D histogram for hitB
-                    auto twItB = h_timewalk_.find(std::make_pair(hit.channel(), hitB.channel()));
-                    if(twItB != h_timewalk_.end()) {
-                        twItB->second->Fill(
-                            hit.tot(),
-                            timeStampDelta * binsize_ns
-                        );
-                    }
-            }
-	    //fill energy correlations
-	    {
-	        auto eeItB = h_ecorrelation_.find(std::make_pair(hit.channel(), hitB.channel()));
-                if(eeItB != h_ecorrelation_.end()) {
-                    eeItB->second->Fill(hit.tot(),hitB.tot());
-                }
-            }
+        if((last_hits.find(channel) != last_hits.end()) && ((last_hit.timestamp()) != 0)) {
+            int64_t timeStampDelta = timestamp - last_hit.timestamp(); // in units of 50ps
+            h_channel_TimeStampDeltaSameChannel->Fill(channel, timeStampDelta*binsize_ns);
         }
 
-        last_hits[hit.channel()]=hit;
+        last_hits[channel]=mutrighit(hits.raw[i]);
     }
 
+    if(pairs_enabled_) fill_coincidences(hits);
+
     return flow;
 
 }
 
-
-
+void AnaMutrigHistos::fill_coincidences(const MutrigColumns& hits) {
+    // Sort the hits by time, then only pair hits within the coincidence window. This is linear in
+    // the number of hits as long as the window is short compared to the event length.
+    sorted_hits_.assign(hits.raw.begin(), hits.raw.end());
+    std::sort(sorted_hits_.begin(), sorted_hits_.end(),
+        [](const mutrighit& a, const mutrighit& b) { return a.timestamp() < b.timestamp(); });
+
+    const uint64_t window = std::llround(coincidence_window_ns_ / binsize_ns); // in units of 50ps
+    for (size_t i = 0; i < sorted_hits_.size(); i++) {
+        for (size_t j = i + 1; j < sorted_hits_.size(); j++) {
+            if (sorted_hits_[j].timestamp() - sorted_hits_[i].timestamp() >= window) break;
+
+            // Pairs are always taken with the lower channel first, like the pair histograms
+            const mutrighit* hit = &sorted_hits_[i];
+            const mutrighit* hitB = &sorted_hits_[j];
+            if (hit->channel() == hitB->channel()) continue;
+            if (hit->channel() > hitB->channel()) std::swap(hit, hitB);
+
+            const PairHistos& histos = pair_histos_[hit->channel() * n_CHANNELS + hitB->channel()];
+            int64_t timeStampDelta = ((int64_t) hit->timestamp()) - hitB->timestamp(); // in units of 50ps
+
+            //fill time difference histogram, if configured
+            if (histos.tdiff)
+                histos.tdiff->Fill( timeStampDelta * binsize_ns );
+
+            //fill timewalk 2D histogram for hitB, within the energy cuts for hitB
+            const EnergyCut& cut = timewalk_cuts_[hitB->channel()];
+            if (histos.timewalk && cut.enabled && (cut.low < hitB->tot()) && (cut.high > hitB->tot()))
+                histos.timewalk->Fill( hit->tot(), timeStampDelta * binsize_ns );
+
+            //fill energy correlations
+            if (histos.ecorrelation)
+                histos.ecorrelation->Fill( hit->tot(), hitB->tot() );
+        }
+    }
+}
@@ -12,6 +12,7 @@
 
 // Forward declarations
 class TH1D;
+struct MutrigColumns;
 
 class AnaMutrigHistos : public TARunObject {
 public:
@@ -92,6 +93,25 @@ private:
     bool timewalk_enabled_ = true; // filled from config mutrig.timewalk_enabled
     bool tdiff_timewalk_enabled_ = true; // filled from config mutrig.tdiff_timewalk_enabled
     std::map<int, std::pair<int,int>> timewalk_energycuts_; // filled from config mutrig.timewalk_energycuts
+    double coincidence_window_ns_ = 10; // filled from config mutrig.coincidence_window_ns
+
+    // Pair histograms of two channels, looked up by lower channel * n_CHANNELS + higher channel
+    struct PairHistos {
+        musip::dqm::Histogram1DD* tdiff = nullptr;
+        musip::dqm::Histogram2DF* timewalk = nullptr;
+        musip::dqm::Histogram2DF* ecorrelation = nullptr;
+    };
+    std::vector<PairHistos> pair_histos_; // built in BeginRun from the maps above
+    bool pairs_enabled_ = false; // true if any pair histogram exists
+    struct EnergyCut {
+        int low = 0;
+        int high = 0;
+        bool enabled = false;
+    };
+    std::vector<EnergyCut> timewalk_cuts_; // timewalk_energycuts_ by channel
+    std::vector<mutrighit> sorted_hits_; // scratch buffer for the coincidence search, reused between events
+
+    void fill_coincidences(const MutrigColumns& hits);
 
 };
 
@@ -0,0 +1,126 @@
+#include "AnaPixelClusters.h"
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include "HitVectorFlowEvent.h"
+
+#include "musip/dqm/PlotCollection.hpp"
+#include "musip/dqm/DQMManager.hpp"
+#include <cmath>
+#include <iostream>
+
+AnaPixelClusters::AnaPixelClusters(const boost::property_tree::ptree& config, TARunInfo* runinfo)
+    : TARunObject(runinfo),
+      enabled_(config.get<bool>("enabled", true)),
+      time_window_ns_(config.get<double>("time_window_ns", 40)),
+      max_open_hits_(config.get<size_t>("max_open_hits", 4096)),
+      finder_(std::llround(time_window_ns_ / kPixelTickNs), max_open_hits_)
+{
+    fModuleName = "PixelClusters";
+
+    printf("<Beginning of %s Module configuration>\n", fModuleName.c_str());
+    boost::property_tree::write_json(std::cout, config);
+    printf("<End of %s Module configuration>\n", fModuleName.c_str());
+
+    if(!enabled_) return;
+
+    pPlotCollection_ = musip::dqm::DQMManager::instance().getOrCreateCollection("clusters");
+}
+
+AnaPixelClusters::~AnaPixelClusters() {};
+
+void AnaPixelClusters::BeginRun(TARunInfo* runinfo) {
+    if(!enabled_) {
+        printf("AnaPixelClusters::BeginRun, run %d - module is disabled\n", runinfo->fRunNo);
+        return;
+    }
+
+    printf("PixelClusters::BeginRun, run %d, file %s\n", runinfo->fRunNo, runinfo->fFileName.c_str());
+
+    // Note: This error_code isn't checked anywhere yet, but we need it for DQM API.
+    std::error_code error; // TODO: actually check this error code and print warnings
+    using MD = musip::dqm::Metadata;
+
+    h_nClusters = pPlotCollection_->getOrCreateHistogram1DD("nClusters", 201, -0.5, 200.5, error,
+        MD::Title("Clusters completed per event"), MD::AxisTitleX("Clusters"));
+    h_clusterSize = pPlotCollection_->getOrCreateHistogram1DD("clusterSize", 64, 0.5, 64.5, error,
+        MD::Title("Cluster size"), MD::AxisTitleX("Hits"));
+    h_clusterCharge = pPlotCollection_->getOrCreateHistogram1DD("clusterCharge", 256, -0.5, 255.5, error,
+        MD::Title("Cluster charge"), MD::AxisTitleX("Sum of ToT"));
+    h_clusterSizeCharge = pPlotCollection_->getOrCreateHistogram2DF("clusterSizeCharge",
+        32, 0.5, 32.5,
+        128, -0.5, 255.5,
+        error,
+        MD::Title("Cluster charge vs size"),
+        MD::AxisTitleX("Hits"),
+        MD::AxisTitleY("Sum of ToT")
+    );
+
+    h_clusterSize_.clear();
+    h_clusterCharge_.clear();
+    for (size_t i = 0; i < kNChips; i++) {
+        char chipIDString[256];
+        snprintf(chipIDString, sizeof(chipIDString), "%05zu", i);
+        h_clusterSize_.push_back(pPlotCollection_->getOrCreateHistogram1DD(
+            std::string("clusterSize_") + chipIDString,
+            64, 0.5, 64.5,
+            error,
+            MD::Title("Cluster size"),
+            MD::AxisTitleX("Hits")
+        ));
+        h_clusterCharge_.push_back(pPlotCollection_->getOrCreateHistogram1DD(
+            std::string("clusterCharge_") + chipIDString,
+            256, -0.5, 255.5,
+            error,
+            MD::Title("Cluster charge"),
+            MD::AxisTitleX("Sum of ToT")
+        ));
+    }
+
+    finder_ = PixelClusterFinder(std::llround(time_window_ns_ / kPixelTickNs), max_open_hits_);
+}
+
+void AnaPixelClusters::EndRun(TARunInfo* runinfo) {
+    if(!enabled_) return;
+
+    finder_.flush();
+    fill_clusters();
+
+    printf("AnaPixelClusters::EndRun, run %d, %lu hits out of time order\n", runinfo->fRunNo, (unsigned long)finder_.out_of_order());
+}
+
+void AnaPixelClusters::fill_clusters() {
+    auto& clusters = finder_.clusters();
+    for (const auto& cluster : clusters) {
+        h_clusterSize->Fill(cluster.size);
+        h_clusterCharge->Fill(cluster.charge);
+        h_clusterSizeCharge->Fill(cluster.size, cluster.charge);
+        if (cluster.chip < kNChips) {
+            h_clusterSize_[cluster.chip]->Fill(cluster.size);
+            h_clusterCharge_[cluster.chip]->Fill(cluster.charge);
+        }
+    }
+    clusters.clear();
+}
+
+TAFlowEvent* AnaPixelClusters::AnalyzeFlowEvent(TARunInfo*, TAFlags* flags, TAFlowEvent* flow) {
+
+    if(!enabled_ || !flow) return flow;
+
+    HitVectorFlowEvent* hitevent = flow->Find<HitVectorFlowEvent>();
+    if(!hitevent) return flow;
+
+    // Clusters can span events, so the finder keeps its state and only the completed ones are filled
+    const PixelColumns& pixels = hitevent->columns().pixel;
+    for (size_t i = 0; i < pixels.size(); i++) {
+        // ToT as in AnaQuadHistos, with ckdivend = 0 and ckdivend2 = 31
+        const uint32_t localTime = pixels.time[i] % (1 << 11);
+        const uint32_t tot = ((0x1F + 1) + pixels.tot[i] - ((localTime / 32) & 0x1F)) & 0x1F;
+        finder_.add(pixels.chip[i], pixels.col[i], pixels.row[i], pixels.time[i], tot);
+    }
+
+    h_nClusters->Fill(finder_.clusters().size());
+    fill_clusters();
+
+    return flow;
+}
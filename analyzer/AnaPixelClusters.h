@@ -0,0 +1,47 @@
+#ifndef ANAPIXELCLUSTERS_H
+#define ANAPIXELCLUSTERS_H
+
+#include "manalyzer.h"
+#include "musip/dqm/dqmfwd.hpp"
+#include <boost/property_tree/ptree_fwd.hpp>
+#include "PixelClusterFinder.h"
+#include <vector>
+
+// Groups the pixel hits of each chip into clusters with PixelClusterFinder and fills cluster size
+// and charge distributions. The charge of a hit is its ToT, computed as in AnaQuadHistos.
+class AnaPixelClusters : public TARunObject {
+public:
+    AnaPixelClusters(const boost::property_tree::ptree& config, TARunInfo* runinfo);
+    ~AnaPixelClusters();
+    void BeginRun(TARunInfo* runinfo);
+    void EndRun(TARunInfo* runinfo);
+    TAFlowEvent* Analyze(TARunInfo*, TMEvent*, TAFlags* flags, TAFlowEvent* flow) {
+        // This function doesn't analyze anything, so we use flags
+        // to have the profiler ignore it
+        *flags |= TAFlag_SKIP_PROFILE;
+        return flow;
+    };
+    TAFlowEvent* AnalyzeFlowEvent(TARunInfo*, TAFlags* flags, TAFlowEvent* flow);
+
+private:
+    static constexpr size_t kNChips = 24;
+    static constexpr double kPixelTickNs = 8; // unit of pixelhit::time()
+
+    bool enabled_;
+    double time_window_ns_ = 40; // filled from config clusters.time_window_ns
+    size_t max_open_hits_ = 4096; // filled from config clusters.max_open_hits, per chip
+    PixelClusterFinder finder_;
+
+    musip::dqm::PlotCollection* pPlotCollection_ {};
+
+    musip::dqm::Histogram1DD* h_nClusters {};   // clusters completed per event
+    musip::dqm::Histogram1DD* h_clusterSize {}; // all chips
+    musip::dqm::Histogram1DD* h_clusterCharge {}; // all chips
+    musip::dqm::Histogram2DF* h_clusterSizeCharge {}; // charge vs size, all chips
+    std::vector<musip::dqm::Histogram1DD*> h_clusterSize_; // per chip
+    std::vector<musip::dqm::Histogram1DD*> h_clusterCharge_; // per chip
+
+    void fill_clusters();
+};
+
+#endif
@@ -7,8 +7,15 @@
 
 #include "musip/dqm/PlotCollection.hpp"
 #include "musip/dqm/DQMManager.hpp"
+#include "musip/HitmapFile.hpp"
 #include <TH1D.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <future>
+#include <iostream>
 #include <numeric>
+#include <array>
 
 #include "json.h"
 using json = nlohmann::json;
@@ -18,6 +25,13 @@ AnaQuadHistos::AnaQuadHistos(const boost::property_tree::ptree& config, TARunInf
 {
     fModuleName = "QuadHistos";
 
+    mask_output_dir_ = config.get<std::string>("mask_output_dir", "/home/mu3e/musip/output/maskfiles_analyzer");
+    mask_noise_threshold_ = config.get<float>("mask_noise_threshold", 0.5);
+    mask_noise_sigma_ = config.get<float>("mask_noise_sigma", 0);
+    write_masks_ = config.get<bool>("write_masks", true);
+    const int threads = config.get<int>("threads", 1);
+    if (threads > 1) pool_ = std::make_unique<WorkerPool>(threads);
+
     pPlotCollection_ = musip::dqm::DQMManager::instance().getOrCreateCollection("quad");
 }
 
@@ -36,7 +50,6 @@ void AnaQuadHistos::BeginRun(TARunInfo* runinfo) {
 
     /////////  2D histos  ///////////
     for (int i = 0; i < 24; i++) {
-        mask_files.push_back({});
         char quadIDString[256];
         std::string directoryName = std::string("");
         // Create a name from the 4 chip IDs
@@ -119,328 +132,225 @@ void AnaQuadHistos::BeginRun(TARunInfo* runinfo) {
         ));
     }
 
+    build_geometry_lut();
+
     // clear vectors
     vec_tot_noisy_pixels.clear();
 }
 
-std::tuple<uint32_t, uint32_t> AnaQuadHistos::get_quad_global_col_row(pixelhit hit) {
-    size_t chipPosition;
-    size_t layer;
-    float combinedCol = hit.col();
-    float combinedRow = hit.row();
-    switch (hit.chipid()) {
-	case 16:
-		chipPosition = 0;
-		layer = 0;
-		break;
-	case 17:
-		chipPosition = 1;
-		layer = 0;
-		break;
-	case 18:
-		chipPosition = 2;
-		layer = 0;
-		break;
-	case 19:
-		chipPosition = 3;
-		layer = 0;
-		break;
-	case 10:
-		chipPosition = 2;
-		layer = 1;
-		break;
-	case 11:
-		chipPosition = 3;
-		layer = 1;
-		break;
-	case 2:
-		chipPosition = 0;
-		layer = 1;
-		break;
-	case 3:
-		chipPosition = 1;
-		layer = 1;
-		break;
-	case 8:
-		chipPosition = 0;
-		layer = 2;
-		break;
-	case 9:
-		chipPosition = 1;
-		layer = 2;
-		break;
-	case 20:
-		chipPosition = 2;
-		layer = 2;
-		break;
-	case 21:
-		chipPosition = 3;
-		layer = 2;
-		break;
-	case 6:
-		chipPosition = 2;
-		layer = 3;
-		break;
-	case 7:
-		chipPosition = 3;
-		layer = 3;
-		break;
-	case 4:
-		chipPosition = 0;
-		layer = 3;
-		break;
-	case 5:
-		chipPosition = 1;
-		layer = 3;
-		break;
-	case 22:
-		chipPosition = 2;
-		layer = 4;
-		break;
-	case 23:
-		chipPosition = 3;
-		layer = 4;
-		break;
-	case 0:
-		chipPosition = 0;
-		layer = 4;
-		break;
-	case 1:
-		chipPosition = 1;
-		layer = 4;
-		break;
-	case 12:
-		chipPosition = 0;
-		layer = 5;
-		break;
-	case 13:
-		chipPosition = 1;
-		layer = 5;
-		break;
-	case 14:
-		chipPosition = 2;
-		layer = 5;
-		break;
-	case 15:
-		chipPosition = 3;
-		layer = 5;
-		break;
-    }
+// Position of each chip in its quad and the layer (= quad) it sits in, indexed by chip ID.
+// Positions: 0 upper left, 1 upper right, 2 lower left, 3 lower right. Layers are numbered like
+// the combined hitmaps.
+const std::array<AnaQuadHistos::ChipPlacement, AnaQuadHistos::kNChips> AnaQuadHistos::chip_placement_ = {{
+    {0, 4}, {1, 4}, {0, 1}, {1, 1}, {0, 3}, {1, 3}, {2, 3}, {3, 3},  // chips  0 -  7
+    {0, 2}, {1, 2}, {2, 1}, {3, 1}, {0, 5}, {1, 5}, {2, 5}, {3, 5},  // chips  8 - 15
+    {0, 0}, {1, 0}, {2, 0}, {3, 0}, {2, 2}, {3, 2}, {2, 4}, {3, 4},  // chips 16 - 23
+}};
+
+void AnaQuadHistos::build_geometry_lut() {
+    // The transformation to quad coordinates is separable: the global column only depends on the
+    // local column and the global row only on the local row. So two small tables per chip are
+    // enough and stay in L1 cache, where a full (chip, col, row) table would be several MB.
+    global_col_.assign(kNChips * kLutSize, 0);
+    global_row_.assign(kNChips * kLutSize, 0);
+
+    for (size_t chip = 0; chip < kNChips; chip++) {
+        const ChipPlacement placement = chip_placement_[chip];
+        for (int i = 0; i < kLutSize; i++) {
+            int combinedCol = i;
+            int combinedRow = i;
+            switch(placement.position) {
+                case 0: // upper left - rotated 180°
+                    combinedCol = 255 - i;  // flip horizontally
+                    combinedRow = 250 + (249 - i);  // flip vertically + offset to upper half
+                    break;
+                case 1: // upper right - rotated 180°
+                    combinedCol = 256 + (255 - i);  // offset + flip horizontally
+                    combinedRow = 250 + (249 - i);  // flip vertically + offset to upper half
+                    break;
+                case 2: // lower left - no rotation
+                    break;
+                case 3: // lower right - no rotation
+                    combinedCol += 256;
+                    break;
+            }
 
-    switch(chipPosition) {
-        case 0: // upper left - rotated 180°
-            combinedCol = 255 - hit.col();  // flip horizontally
-            combinedRow = 250 + (249 - hit.row());  // flip vertically + offset to upper half
-            break;
-        case 1: // upper right - rotated 180°
-            combinedCol = 256 + (255 - hit.col());  // offset + flip horizontally
-            combinedRow = 250 + (249 - hit.row());  // flip vertically + offset to upper half
-            break;
-        case 2: // lower left - no rotation
-            // combinedCol and combinedRow already correct (0-255, 0-249)
-            break;
-        case 3: // lower right - no rotation
-            combinedCol += 256;
-            // combinedRow already correct (0-249)
-            break;
-    }
+            // Every layer is rotated 180° around z, which flips both col and row in the combined
+            // space. Layers 0, 2 and 5 are additionally rotated 180° around x, which flips the row back.
+            int finalCol = 511 - combinedCol;
+            int finalRow = combinedRow;
+            if (placement.layer == 1 || placement.layer == 3 || placement.layer == 4)
+                finalRow = 499 - combinedRow;
 
-    float finalCol = combinedCol;
-    float finalRow = combinedRow;
-
-    switch(layer) {
-        case 0: // Layer 0: 180° around z, then 180° around x
-        case 2: // Layer 2: like layer 0
-	case 5:	// Layer 5: like layer 0
-            // 180° around z: flip both col and row in the combined space
-            finalCol = 511 - combinedCol;  // flip horizontally (0-511 range)
-            finalRow = 499 - combinedRow;  // flip vertically (0-499 range)
-            // 180° around x: flip row again (so row is back to normal, col stays flipped)
-            finalRow = 499 - finalRow; // This makes finalRow = combinedRow again
-            finalCol = 511 - combinedCol;  // flip horizontally (0-511 range)
-            break;
-        case 1: // Layer 1: 180° around z
-        case 3: // Layer 3: like layer 1
-        case 4: // Layer 4: like layer 1
-            // 180° around z: flip both col and row in the combined space
-            finalCol = 511 - combinedCol;  // flip horizontally (0-511 range)
-            finalRow = 499 - combinedRow;  // flip vertically (0-499 range)
-            finalCol = 511 - combinedCol;  // flip horizontally (0-511 range)
-            break;
-        default:
-            // No rotation
-            break;
+            global_col_[chip * kLutSize + i] = finalCol;
+            global_row_[chip * kLutSize + i] = finalRow;
+        }
     }
-
-    return std::make_tuple(finalCol, finalRow);
 }
 
-std::pair<double, double> AnaQuadHistos::CalculateMeanAndSigma(const TH2F* hitmap) {
+std::pair<double, double> AnaQuadHistos::CalculateMeanAndSigma(const std::vector<float>& hitmap) {
 
     //calculate mean of entries, then sigma, ignoring bins with 0 entry
     double sum = 0;
-    std::vector<double> contents;
-
-    for (int binx = 1; binx <= hitmap->GetXaxis()->GetNbins(); binx++) {
-        for (int biny = 1; biny <= hitmap->GetYaxis()->GetNbins(); biny++) {
-            if (hitmap->GetBinContent(binx, biny) < 0.00001) continue;
-            sum += hitmap->GetBinContent(binx, biny);
-            contents.push_back(hitmap->GetBinContent(binx, biny));
-        }
-    }
-
-    double mean = (contents.size() > 0) ? sum / contents.size() : 0;
-    double sigma = 0;
-    for ( uint i = 0; i < contents.size(); i++ ) {
-        sigma+=(mean-contents.at(i))*(mean-contents.at(i));
+    double sum2 = 0;
+    size_t n = 0;
+    for (float content : hitmap) {
+        if (content < 0.00001) continue;
+        sum += content;
+        sum2 += double(content) * content;
+        n++;
     }
-    sigma = sqrt(sigma / contents.size());
 
-    std::pair<double, double> MeanAndSigma_;
-    MeanAndSigma_.first=mean;
-    MeanAndSigma_.second=sigma;
-    return MeanAndSigma_;
+    double mean = (n > 0) ? sum / n : 0;
+    double sigma = (n > 0) ? sqrt(std::max(0.0, sum2 / n - mean * mean)) : 0;
+    return std::make_pair(mean, sigma);
 }
 
-std::vector<uint8_t> AnaQuadHistos::create_mask_file(const TH2F* hitmap, uint32_t chipID, float noiseThreshold) {
-
-    std::vector<uint8_t> vec;
-    int Ncol = hitmap->GetXaxis()->GetNbins();
-    int Nrow = hitmap->GetYaxis()->GetNbins();
+musip::TDACFile AnaQuadHistos::create_mask_file(const std::vector<float>& hitmap, float noiseThreshold, uint32_t& noisyPixels) {
 
-    std::pair<double, double> MeanAndSigma = CalculateMeanAndSigma(hitmap);
-    double mean = MeanAndSigma.first;
-    double sigma = MeanAndSigma.second;
-    double noiseLimit = mean + 3 * sigma;
+    musip::TDACFile mask;
+    noisyPixels = 0;
 
-    if (( Ncol != 256) || (Nrow != 250)) std::cout<< "WARNING! In DQAnomalyChecker::DetectAndMaskNoisyPixelsFromHitmap: Ncol vs Nrows in pixel hitmap doesn't match what is expected! Ncol = " << Ncol << ", Nrow = " << Nrow << ". The pixel mask might be nonsense."<< std::endl;
+    // Same layout as musip::HitmapFile: 256 columns of 250 rows
+    constexpr unsigned Ncol = musip::HitmapFile::numberOfColumns;
+    constexpr unsigned Nrow = musip::HitmapFile::numberOfRows;
+    if (hitmap.size() != Ncol * Nrow) {
+        std::cout << "WARNING! In AnaQuadHistos::create_mask_file: hitmap has " << hitmap.size() << " bins, expected " << Ncol * Nrow << ". Not masking anything." << std::endl;
+    }
 
-    int tot_noisy_pixels = 0;
-    for (int binx = 1; binx <= Ncol; binx++) {
-        for (int biny = 1; biny <= Nrow; biny++) {
-            if (hitmap->GetBinContent(binx, biny) > noiseThreshold) { //noiseLimit) {
-                vec.push_back(0x00);
-                tot_noisy_pixels++;
-                maskmap[chipID]->Fill(binx-1, biny-1);
-            } else {
-                vec.push_back(0x47);
-            }
+    for (unsigned col = 0; col < Ncol; col++) {
+        for (unsigned row = 0; row < Nrow; row++) {
+            const bool noisy = hitmap.size() == Ncol * Nrow && hitmap[col * Nrow + row] > noiseThreshold;
+            // 0x47 is enabled with both trims at maximum, 0x00 is masked
+            mask.pixel(col, row) = noisy ? 0x00 : 0x47;
+            if (noisy) noisyPixels++;
         }
-        // fill up col
-        // -- store 0xdada as end-of-col marker
-        vec.push_back(0xda);
-        vec.push_back(0xda);
-        // -- store number of col
-        vec.push_back(0xda);
-        vec.push_back(binx-1);
-        // -- store LVDS error flag
-        vec.push_back(0xda);
-        vec.push_back(0x00); // for now we don't use this
+        // The rows 250 to 255 are the end-of-col marker 0xdada, the number of the col and the
+        // LVDS error flag, which we don't use for now. TDACFile sets everything but the col number.
+        mask.pixel(col, 253) = col;
     }
-    vec_tot_noisy_pixels.push_back(tot_noisy_pixels);
 
-    return vec;
+    return mask;
 }
 
 void AnaQuadHistos::EndRun(TARunInfo* runinfo) {
 
     printf("AnaQuadHistos::EndRun, run %d, file %s\n", runinfo->fRunNo, runinfo->fFileName.c_str());
 
-    // write mask file
-    std::string path = "/home/mu3e/musip/output/maskfiles_analyzer";
-    for ( int index = 0; index < 24; index++ ) {
-        mask_files[index] = create_mask_file(hitmaps[index]->asRootObject("myHistogram", "My histogram title").get(), index, 0.5);
-
-        std::string data = "/mask_" + std::to_string(index) + "_run_" + std::to_string(runinfo->fRunNo) + ".bin";
+    if (!write_masks_) return;
+
+    const std::string run = std::to_string(runinfo->fRunNo);
+    std::error_code error;
+    std::filesystem::create_directories(mask_output_dir_, error);
+    if (error) printf("AnaQuadHistos::EndRun, cannot create %s: %s\n", mask_output_dir_.c_str(), error.message().c_str());
+
+    // Compute and write the masks of all chips in parallel, directly from the DQM histogram storage
+    struct ChipResult {
+        std::vector<float> hitmap;
+        musip::TDACFile mask;
+        uint32_t noisyPixels = 0;
+        std::error_code error;
+    };
+    std::vector<std::future<ChipResult>> futures;
+    for (size_t index = 0; index < kNChips; index++) {
+        futures.push_back(std::async(std::launch::async, [this, index, &run]() {
+            ChipResult result;
+            result.hitmap = hitmaps[index]->binContents();
+            float threshold = mask_noise_threshold_;
+            if (mask_noise_sigma_ > 0) {
+                const auto [mean, sigma] = CalculateMeanAndSigma(result.hitmap);
+                threshold = std::max<float>(threshold, mean + mask_noise_sigma_ * sigma);
+            }
+            result.mask = create_mask_file(result.hitmap, threshold, result.noisyPixels);
+
+            const std::filesystem::path maskFilename = mask_output_dir_ / ("mask_" + std::to_string(index) + "_run_" + run + ".bin");
+            result.mask.saveToFile(maskFilename.c_str(), result.error);
+            if (result.error || result.hitmap.size() != musip::HitmapFile::numberOfColumns * musip::HitmapFile::numberOfRows) return result;
+
+            // Also keep the hitmap the mask was made from, saturated at 8 bits
+            musip::HitmapFile hitmapFile;
+            for (unsigned col = 0; col < musip::HitmapFile::numberOfColumns; col++) {
+                for (unsigned row = 0; row < musip::HitmapFile::numberOfRows; row++) {
+                    const float content = result.hitmap[col * musip::HitmapFile::numberOfRows + row];
+                    hitmapFile.pixel(col, row) = std::min(content, 255.f);
+                }
+            }
+            const std::filesystem::path hitmapFilename = mask_output_dir_ / ("hitmap_" + std::to_string(index) + "_run_" + run + ".bin");
+            hitmapFile.saveToFile(hitmapFilename.c_str(), result.error);
+            return result;
+        }));
+    }
 
-        // write new file
-        std::ofstream out_file;
-        out_file.open(path + data, std::ios::binary);
-        out_file.write((char*) mask_files[index].data(), mask_files[index].size() * sizeof(uint8_t));
-        out_file.close();
+    vec_tot_noisy_pixels.clear();
+    for (size_t index = 0; index < kNChips; index++) {
+        ChipResult result = futures[index].get();
+        if (result.error) printf("AnaQuadHistos::EndRun, cannot write mask of chip %zu to %s: %s\n", index, mask_output_dir_.c_str(), result.error.message().c_str());
+        vec_tot_noisy_pixels.push_back(result.noisyPixels);
+
+        // Filling is serialised by the collection mutex anyway, so do it here rather than in the threads
+        for (unsigned col = 0; col < musip::HitmapFile::numberOfColumns; col++)
+            for (unsigned row = 0; row < musip::HitmapFile::numberOfRows; row++)
+                if (result.mask.isMasked(col, row)) maskmap[index]->Fill(col, row);
     }
 
     // write json for masking data
     json j;
     for (size_t i = 0; i < vec_tot_noisy_pixels.size(); ++i)
         j[std::to_string(i)] = vec_tot_noisy_pixels[i];
-    std::ofstream file(path + "/mask_meta_run_" + std::to_string(runinfo->fRunNo) + ".json");
+    std::ofstream file(mask_output_dir_ / ("mask_meta_run_" + run + ".json"));
     file << j.dump(4);
     file.close();
 
 }
 
-TAFlowEvent* AnaQuadHistos::AnalyzeFlowEvent(TARunInfo*, TAFlags* flags, TAFlowEvent* flow) {
-
-    if(!flow) return flow;
-
-    HitVectorFlowEvent* hitevent = flow->Find<HitVectorFlowEvent>();
-    if(!hitevent) return flow;
+void AnaQuadHistos::fill_hits(const PixelColumns& pixels, size_t begin, size_t end) {
+    using musip::dqm::Lock;
 
-    for ( auto& cur_hit : hitevent->hits ) {
+    chipID->fillN<Lock::Sharded>(pixels.chip.data() + begin, end - begin);
 
-        if (!cur_hit.is_pixel()) continue;
+    for ( size_t i = begin; i < end; i++ ) {
 
-        auto hit = cur_hit.as_pixel();
-        chipID->Fill(hit.chipid());
+        const uint8_t chip = pixels.chip[i];
 
-        if (hit.chipid() >= 24) continue;
+        if (chip >= 24) continue;
 
         // fill hitmap histograms
         uint32_t col, row;
-        std::tie(col, row) = get_quad_global_col_row(hit);
-	switch (hit.chipid()) {
-	case 16:
-	case 17:
-	case 18:
-	case 19:
-		combinedHitmap[0]->Fill(col,row);
-		break;
-	case 10:
-	case 11:
-	case 2:
-	case 3:
-		combinedHitmap[1]->Fill(col,row);
-		break;
-	case 8:
-	case 9:
-	case 20:
-	case 21:
-		combinedHitmap[2]->Fill(col,row);
-		break;
-	case 6:
-	case 7:
-	case 4:
-	case 5:
-		combinedHitmap[3]->Fill(col,row);
-		break;
-	case 22:
-	case 23:
-	case 0:
-	case 1:
-		combinedHitmap[4]->Fill(col,row);
-		break;
-	case 12:
-	case 13:
-	case 14:
-	case 15:
-		combinedHitmap[5]->Fill(col,row);
-		break;
-	default:
-		break;
-	}
-        hitmaps[hit.chipid()]->Fill(hit.col(), hit.row());
+        std::tie(col, row) = get_quad_global_col_row(chip, pixels.col[i], pixels.row[i]);
+        combinedHitmap[chip_placement_[chip].layer]->Fill<Lock::Sharded>(col, row);
+        hitmaps[chip]->Fill<Lock::Sharded>(pixels.col[i], pixels.row[i]);
 
         // fill timing histogram
         uint32_t ckdivend = 0;
         uint32_t ckdivend2 = 31;
-        uint32_t localTime = hit.time() % (1 << 11);  // local pixel time is first 11 bits of the global time
+        uint32_t localTime = pixels.time[i] % (1 << 11);  // local pixel time is first 11 bits of the global time
         uint32_t cur_hitToA = localTime * 8/*ns*/ * (ckdivend + 1);
-        uint32_t cur_hitToT = ( ( (0x1F+1) + hit.tot() -  ( (localTime * (ckdivend+1) / (ckdivend2+1) ) & 0x1F) ) & 0x1F);//  * 8 * (ckdivend2+1) ;
-        hitToT[hit.chipid()]->Fill(cur_hitToT);
-        hitToA[hit.chipid()]->Fill(cur_hitToA);
-        hitTime[hit.chipid()]->Fill(localTime);
+        uint32_t cur_hitToT = ( ( (0x1F+1) + pixels.tot[i] -  ( (localTime * (ckdivend+1) / (ckdivend2+1) ) & 0x1F) ) & 0x1F);//  * 8 * (ckdivend2+1) ;
+        hitToT[chip]->Fill<Lock::Sharded>(cur_hitToT);
+        hitToA[chip]->Fill<Lock::Sharded>(cur_hitToA);
+        hitTime[chip]->Fill<Lock::Sharded>(localTime);
+
+    }
+}
+
+TAFlowEvent* AnaQuadHistos::AnalyzeFlowEvent(TARunInfo*, TAFlags* flags, TAFlowEvent* flow) {
+
+    if(!flow) return flow;
+
+    HitVectorFlowEvent* hitevent = flow->Find<HitVectorFlowEvent>();
+    if(!hitevent) return flow;
 
+    // Banks are independent, so they are spread over the workers. The sharded fills give each thread its own
+    // buffers, which the histograms add up whenever they are read.
+    const HitColumns& columns = hitevent->columns();
+    const std::vector<size_t>& offset = columns.pixel_bank_offset;
+    if (pool_) {
+        pool_->parallel_for(columns.nbanks(), [this, &columns, &offset](size_t bank, size_t) {
+            fill_hits(columns.pixel, offset[bank], offset[bank + 1]);
+        });
+    } else {
+        for (size_t bank = 0; bank < columns.nbanks(); bank++)
+            fill_hits(columns.pixel, offset[bank], offset[bank + 1]);
     }
 
     return flow;
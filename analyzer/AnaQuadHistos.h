@@ -5,10 +5,17 @@
 #include "musip/dqm/dqmfwd.hpp"
 #include <boost/property_tree/ptree_fwd.hpp>
 #include "hits.h"
-#include <TH2F.h>
+#include <array>
+#include <tuple>
+#include <vector>
+#include "musip/TDACFile.hpp"
+#include "WorkerPool.h"
+#include <memory>
+#include <filesystem>
 
 // Forward declarations
 class TH1D;
+struct PixelColumns;
 
 class AnaQuadHistos : public TARunObject {
 public:
@@ -16,9 +23,17 @@ public:
     ~AnaQuadHistos();
     void BeginRun(TARunInfo* runinfo);
     void EndRun(TARunInfo* runinfo);
-    std::tuple<uint32_t, uint32_t> get_quad_global_col_row(pixelhit hit);
-    std::vector<uint8_t> create_mask_file(const TH2F* hitmap, uint32_t chipID, float noiseThreshold);
-    std::pair<double, double> CalculateMeanAndSigma(const TH2F* hitmap);
+    // Global quad coordinates of a pixel hit, looked up in the tables built at BeginRun.
+    // Only valid for chip IDs below kNChips.
+    std::tuple<uint32_t, uint32_t> get_quad_global_col_row(uint8_t chip, uint8_t col, uint8_t row) const {
+        return std::make_tuple(global_col_[chip * kLutSize + col], global_row_[chip * kLutSize + row]);
+    }
+    std::tuple<uint32_t, uint32_t> get_quad_global_col_row(pixelhit hit) const {
+        return get_quad_global_col_row(hit.chipid(), hit.col(), hit.row());
+    }
+    // Both take the bin contents of a chip hitmap, as returned by Histogram2DF::binContents
+    static musip::TDACFile create_mask_file(const std::vector<float>& hitmap, float noiseThreshold, uint32_t& noisyPixels);
+    static std::pair<double, double> CalculateMeanAndSigma(const std::vector<float>& hitmap);
     TAFlowEvent* Analyze(TARunInfo*, TMEvent*, TAFlags* flags, TAFlowEvent* flow) {
         // This function doesn't analyze anything, so we use flags
         // to have the profiler ignore it
@@ -28,6 +43,19 @@ public:
     TAFlowEvent* AnalyzeFlowEvent(TARunInfo*, TAFlags* flags, TAFlowEvent* flow);
 
 protected:
+    static constexpr size_t kNChips = 24;
+    static constexpr int kLutSize = 256; // local columns and rows are 8 bit
+
+    struct ChipPlacement {
+        uint8_t position; // position of the chip in its quad
+        uint8_t layer;    // layer of the quad, also the index into combinedHitmap
+    };
+    static const std::array<ChipPlacement, kNChips> chip_placement_;
+
+    // Pixel geometry lookup tables, indexed by chip * kLutSize + local col (row)
+    std::vector<uint16_t> global_col_;
+    std::vector<uint16_t> global_row_;
+    void build_geometry_lut();
 
     musip::dqm::PlotCollection* pPlotCollection_ {};
 
@@ -39,9 +67,17 @@ protected:
     std::vector<musip::dqm::Histogram1DD*> hitToT;
     std::vector<musip::dqm::Histogram1DD*> hitToA;
     std::vector<musip::dqm::Histogram1DD*> hitTime;
-    std::vector<std::vector<uint8_t>> mask_files;
     std::vector<uint32_t> vec_tot_noisy_pixels;
 
+    std::filesystem::path mask_output_dir_; // filled from config quad.mask_output_dir
+    float mask_noise_threshold_ = 0.5; // filled from config quad.mask_noise_threshold, pixels with more hits are masked
+    float mask_noise_sigma_ = 0; // filled from config quad.mask_noise_sigma, if set also mask pixels above mean + n sigma
+    bool write_masks_ = true; // filled from config quad.write_masks, off for the partial runs of quadreplay
+
+    std::unique_ptr<WorkerPool> pool_; // only if config quad.threads > 1
+    // Fills with Lock::Sharded, so the workers never wait for each other on the collection mutex
+    void fill_hits(const PixelColumns& pixels, size_t begin, size_t end);
+
 };
 
 #endif
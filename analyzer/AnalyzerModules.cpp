@@ -0,0 +1,24 @@
+#include "AnalyzerModules.h"
+
+#include "AnaQuadHistos.h"
+#include "AnaMutrigHistos.h"
+#include "AnaPixelClusters.h"
+#include "AnaMutrigCalibration.h"
+#include "AnaFillHits.h"
+//#include "AnaMusip.h"
+
+// Definitions of the static members
+boost::property_tree::ptree Configuration::config_;
+
+std::vector<TAFactory*> createModuleFactories() {
+    // The first parameter in the constructor is the name of the config file entry for that module.
+    // The second parameter is whether the module is enabled by default when not otherwise specified.
+    return {
+        new TAFactoryTemplateWithConfig<AnaFillHits>("fillhits", true),
+        new TAFactoryTemplateWithConfig<AnaQuadHistos>("quad", true),
+        new TAFactoryTemplateWithConfig<AnaMutrigHistos>("mutrig", true),
+        new TAFactoryTemplateWithConfig<AnaPixelClusters>("clusters", true),
+        new TAFactoryTemplateWithConfig<AnaMutrigCalibration>("mutrigcal", true),
+        //new TAFactoryWrapper<AnaMusipFactory>("musip", true),
+    };
+}
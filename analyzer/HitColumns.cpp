@@ -0,0 +1,111 @@
+#include "HitColumns.h"
+
+#include <mutex>
+
+void PixelColumns::resize(size_t n) {
+    chip.resize(n);
+    col.resize(n);
+    row.resize(n);
+    tot.resize(n);
+    time.resize(n);
+}
+
+void MutrigColumns::resize(size_t n) {
+    asic.resize(n);
+    channel.resize(n);
+    energy.resize(n);
+    finetime.resize(n);
+    timestamp.resize(n);
+    raw.resize(n);
+}
+
+void HitColumns::clear() {
+    pixel.resize(0);
+    mutrig.resize(0);
+    pixel_bank_offset.assign(1, 0);
+    mutrig_bank_offset.assign(1, 0);
+}
+
+void HitColumns::append_bank(const hit* first, const hit* last) {
+    if (pixel_bank_offset.empty()) clear();
+
+    // Split the bank by hit type first, this is the only branchy part
+    pixel_words_.clear();
+    const size_t mutrigStart = mutrig.size();
+    mutrig.raw.reserve(mutrigStart + (last - first));
+    for (const hit* current = first; current != last; ++current) {
+        if (current->is_pixel()) pixel_words_.push_back(current->raw());
+        else mutrig.raw.push_back(current->raw());
+    }
+
+    // Then extract each field in its own straight loop over contiguous words, which vectorises.
+    // The shifts and masks are the ones of pixelhit in hits.h.
+    const size_t pixelStart = pixel.size();
+    const size_t npixel = pixel_words_.size();
+    pixel.resize(pixelStart + npixel);
+    const uint64_t* words = pixel_words_.data();
+    uint8_t* chip = pixel.chip.data() + pixelStart;
+    uint8_t* col = pixel.col.data() + pixelStart;
+    uint8_t* row = pixel.row.data() + pixelStart;
+    uint8_t* tot = pixel.tot.data() + pixelStart;
+    uint64_t* time = pixel.time.data() + pixelStart;
+    for (size_t i = 0; i < npixel; i++) chip[i] = (words[i] >> 58) & 0x1F;
+    for (size_t i = 0; i < npixel; i++) col[i] = (words[i] >> 50) & 0xFF;
+    for (size_t i = 0; i < npixel; i++) row[i] = (words[i] >> 42) & 0xFF;
+    for (size_t i = 0; i < npixel; i++) tot[i] = (words[i] >> 37) & 0x1F;
+    for (size_t i = 0; i < npixel; i++) time[i] = words[i] & 0x1FFFFFFFFFULL;
+
+    // Same for the mutrig hits, shifts and masks from mutrighit
+    const size_t nmutrig = mutrig.raw.size() - mutrigStart;
+    mutrig.resize(mutrigStart + nmutrig);
+    const uint64_t* raw = mutrig.raw.data() + mutrigStart;
+    uint8_t* asic = mutrig.asic.data() + mutrigStart;
+    uint8_t* channel = mutrig.channel.data() + mutrigStart;
+    uint16_t* energy = mutrig.energy.data() + mutrigStart;
+    uint8_t* finetime = mutrig.finetime.data() + mutrigStart;
+    uint64_t* timestamp = mutrig.timestamp.data() + mutrigStart;
+    for (size_t i = 0; i < nmutrig; i++) asic[i] = (raw[i] >> 61) & 0x3;
+    for (size_t i = 0; i < nmutrig; i++) channel[i] = (raw[i] >> 56) & 0x3F;
+    for (size_t i = 0; i < nmutrig; i++) energy[i] = (raw[i] >> 47) & 0x1FF;
+    for (size_t i = 0; i < nmutrig; i++) finetime[i] = (raw[i] >> 39) & 0xFF;
+    for (size_t i = 0; i < nmutrig; i++) timestamp[i] = (raw[i] & 0x7FFFFFFFFFULL) * 160 + ((raw[i] >> 39) & 0xFF);
+
+    pixel_bank_offset.push_back(pixel.size());
+    mutrig_bank_offset.push_back(mutrig.size());
+}
+
+namespace {
+
+struct FreeColumns {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<HitColumns>> columns;
+};
+
+FreeColumns& free_columns() {
+    static FreeColumns free;
+    return free;
+}
+
+}  // namespace
+
+HitColumnsPool::Handle HitColumnsPool::acquire() {
+    FreeColumns& free = free_columns();
+    std::unique_ptr<HitColumns> columns;
+    {
+        std::lock_guard<std::mutex> lock(free.mutex);
+        if (!free.columns.empty()) {
+            columns = std::move(free.columns.back());
+            free.columns.pop_back();
+        }
+    }
+    if (!columns) columns.reset(new HitColumns);
+    columns->clear();
+    return Handle(columns.release());
+}
+
+void HitColumnsPool::Release::operator()(HitColumns* columns) const {
+    std::unique_ptr<HitColumns> owned(columns);
+    FreeColumns& free = free_columns();
+    std::lock_guard<std::mutex> lock(free.mutex);
+    if (free.columns.size() < kMaxFree) free.columns.push_back(std::move(owned));
+}
@@ -0,0 +1,79 @@
+#ifndef HITCOLUMNS_H
+#define HITCOLUMNS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "hits.h"
+
+// Structure-of-arrays view of decoded hits.
+//
+// Instead of every module calling the bit-field accessors of pixelhit/mutrighit hit by hit, the
+// hits of an event are decoded once into one array per field. The decoding loops only do shifts and
+// masks on contiguous arrays, so the compiler vectorises them. Modules then read the columns they
+// need. The fields are the same as the accessors of the same name in hits.h.
+
+struct PixelColumns {
+    std::vector<uint8_t> chip;   // pixelhit::chipid()
+    std::vector<uint8_t> col;    // pixelhit::col()
+    std::vector<uint8_t> row;    // pixelhit::row()
+    std::vector<uint8_t> tot;    // pixelhit::tot()
+    std::vector<uint64_t> time;  // pixelhit::time()
+
+    size_t size() const { return time.size(); }
+    void resize(size_t n);
+};
+
+struct MutrigColumns {
+    std::vector<uint8_t> asic;          // mutrighit::asic()
+    std::vector<uint8_t> channel;       // mutrighit::channel()
+    std::vector<uint16_t> energy;       // mutrighit::et(), also known as tot()
+    std::vector<uint8_t> finetime;      // mutrighit::finetime_extended()
+    std::vector<uint64_t> timestamp;    // mutrighit::timestamp(), in units of 50ps
+    std::vector<uint64_t> raw;          // the hit word, to get back a mutrighit
+
+    size_t size() const { return raw.size(); }
+    void resize(size_t n);
+};
+
+struct HitColumns {
+    PixelColumns pixel;
+    MutrigColumns mutrig;
+
+    // The hits of bank i are [pixel_bank_offset[i], pixel_bank_offset[i+1]) in the pixel columns,
+    // and the same for the mutrig columns. Hits keep their order within and across banks.
+    std::vector<size_t> pixel_bank_offset;
+    std::vector<size_t> mutrig_bank_offset;
+
+    // Start over, keeping the allocated memory
+    void clear();
+
+    // Decode the hits in [first, last) and append them as a new bank
+    void append_bank(const hit* first, const hit* last);
+
+    size_t nbanks() const { return pixel_bank_offset.empty() ? 0 : pixel_bank_offset.size() - 1; }
+
+private:
+    std::vector<uint64_t> pixel_words_;  // scratch, raw words of the pixel hits of the current bank
+};
+
+// Recycles HitColumns across events. Each flow event needs its own columns, since several events
+// can be in flight on different module threads, but the buffers of a finished event are handed to
+// the next one instead of allocating all columns again.
+class HitColumnsPool {
+public:
+    struct Release {
+        void operator()(HitColumns* columns) const;
+    };
+    using Handle = std::unique_ptr<HitColumns, Release>;
+
+    // Cleared columns, keeping the memory of released ones if there are any. Thread safe.
+    static Handle acquire();
+
+private:
+    static constexpr size_t kMaxFree = 16;  // more are only in flight at once if a queue backs up
+};
+
+#endif
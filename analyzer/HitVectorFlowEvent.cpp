@@ -1,15 +1,25 @@
 #include "HitVectorFlowEvent.h"
 
+#include <type_traits>
+
+static_assert(sizeof(hit) == sizeof(uint64_t) && std::is_standard_layout<hit>::value,
+              "hit has to be a plain view of a 64 bit hit word");
+
+HitVectorFlowEvent::HitVectorFlowEvent(TAFlowEvent* flow)
+    : TAFlowEvent(flow)
+{
+}
+
 HitVectorFlowEvent::HitVectorFlowEvent(
     TAFlowEvent* flow,
-    uint64_t* hitstart,
+    const uint64_t* hitstart,
     uint32_t nhits
 )
     : TAFlowEvent(flow)
-    , hits(hitstart, hitstart + nhits)
-    // Note that this does perform copies. In place construction would mess up ownership, so C++ does not really allow it.
-    // Advantage: We can do type conversion to our structs as we go along
 {
+    // hit is a standard layout wrapper around a single uint64_t, so the words can be viewed as hits in place
+    const hit* first = reinterpret_cast<const hit*>(hitstart);
+    AddBank(first, first + nhits);
 }
 
 HitVectorFlowEvent::HitVectorFlowEvent(
@@ -17,6 +27,24 @@ HitVectorFlowEvent::HitVectorFlowEvent(
     std::vector<hit>&& hits
 )
     : TAFlowEvent(flow)
-    , hits(std::move(hits))
+    , owned_hits_(std::move(hits))
 {
+    AddBank(owned_hits_.data(), owned_hits_.data() + owned_hits_.size());
+}
+
+void HitVectorFlowEvent::AddBank(const hit* first, const hit* last) {
+    if(nbanks_ < kInlineBanks)
+        inline_banks_[nbanks_] = HitSpan(first, last);
+    else
+        overflow_banks_.emplace_back(first, last);
+    ++nbanks_;
+    nhits_ += last - first;
+}
+
+const HitColumns& HitVectorFlowEvent::columns() const {
+    std::call_once(decoded_, [this]() {
+        columns_ = HitColumnsPool::acquire();
+        for(std::size_t i = 0; i < nbanks_; ++i) columns_->append_bank(bank(i).begin(), bank(i).end());
+    });
+    return *columns_;
 }
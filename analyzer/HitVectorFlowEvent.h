@@ -2,30 +2,139 @@
 #define HITVECTORFLOWEVENT_H
 
 #include "manalyzer.h"
+#include <array>
+#include <cstddef>
+#include <iterator>
+#include <mutex>
 #include <vector>
 
 #include "hits.h"
+#include "HitColumns.h"
 
-// flow event creating vectors for the hits
+// Read-only view of a contiguous range of hits, usually the payload of one MIDAS bank.
+class HitSpan {
+public:
+    HitSpan() noexcept = default;
+    HitSpan(const hit* first, const hit* last) noexcept : first_(first), last_(last) {}
+
+    const hit* begin() const { return first_; }
+    const hit* end() const { return last_; }
+    std::size_t size() const { return last_ - first_; }
+    bool empty() const { return first_ == last_; }
+    const hit& operator[](std::size_t i) const { return first_[i]; }
+
+private:
+    const hit* first_ = nullptr;
+    const hit* last_ = nullptr;
+};
+
+// flow event giving access to the hits of one event
+//
+// The hits are not copied: the flow event only stores a span per hit bank, pointing straight into
+// the bank data of the TMEvent. The TMEvent outlives all flow events created for it, so the spans
+// stay valid while the flow is analysed. Iterate either bank by bank through `bank(i)`, which is
+// the cheapest, or over all hits at once through `hits`.
 class HitVectorFlowEvent : public TAFlowEvent {
 public:
+    // Number of bank spans stored inline. Events with more hit banks spill into a vector.
+    static constexpr std::size_t kInlineBanks = 32;
+
+    // Forward iterator over the hits of all banks, in bank order.
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = hit;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const hit*;
+        using reference = const hit&;
+
+        const_iterator() = default;
+        const_iterator(const HitVectorFlowEvent* event, std::size_t bank) : event_(event), bank_(bank) {
+            settle();
+        }
+
+        reference operator*() const { return *current_; }
+        pointer operator->() const { return current_; }
+        const_iterator& operator++() {
+            if(++current_ == event_->bank(bank_).end()) {
+                ++bank_;
+                settle();
+            }
+            return *this;
+        }
+        const_iterator operator++(int) { const_iterator tmp = *this; ++*this; return tmp; }
+        bool operator==(const const_iterator& other) const { return bank_ == other.bank_ && current_ == other.current_; }
+        bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+    private:
+        // Move to the first hit of the next non-empty bank, or to end().
+        void settle() {
+            while(bank_ < event_->nbanks() && event_->bank(bank_).empty()) ++bank_;
+            current_ = bank_ < event_->nbanks() ? event_->bank(bank_).begin() : nullptr;
+        }
+
+        const HitVectorFlowEvent* event_ = nullptr;
+        std::size_t bank_ = 0;
+        const hit* current_ = nullptr;
+    };
 
+    // All hits of the event as one range, so that `for (const hit& h : event->hits)` works.
+    class HitRange {
+    public:
+        explicit HitRange(const HitVectorFlowEvent* event) : event_(event) {}
+        const_iterator begin() const { return const_iterator(event_, 0); }
+        const_iterator end() const { return const_iterator(event_, event_->nbanks()); }
+        std::size_t size() const { return event_->nhits(); }
+        bool empty() const { return event_->nhits() == 0; }
+
+    private:
+        const HitVectorFlowEvent* event_;
+    };
+
+    // Empty event, fill it with AddBank.
+    explicit HitVectorFlowEvent(TAFlowEvent* flow);
+
+    // View on a single range of hits. Nothing is copied, the data has to outlive the flow event.
     HitVectorFlowEvent(
         TAFlowEvent* flow,
-        uint64_t* hitstart,
+        const uint64_t* hitstart,
         uint32_t nhits
     );
 
-    // Constructor using move semantics for the vectors. If your data is already in typed vectors and you
-    // no longer need it, this is preferable to other constructor. If you need the data afterwards, use
-    // the other constructor because it makes a copy of the data.
+    // Constructor taking ownership of the hits. Use this if the hits do not live in a TMEvent,
+    // e.g. because they were sorted or merged first.
     HitVectorFlowEvent(
         TAFlowEvent* flow,
         std::vector<hit>&& hits
     );
 
+    HitVectorFlowEvent(const HitVectorFlowEvent&) = delete;
+    HitVectorFlowEvent& operator=(const HitVectorFlowEvent&) = delete;
+
+    // Append the hits in [first, last) as a new bank. Does not allocate for the first kInlineBanks banks.
+    void AddBank(const hit* first, const hit* last);
+
+    std::size_t nbanks() const { return nbanks_; }
+    std::size_t nhits() const { return nhits_; }
+    const HitSpan& bank(std::size_t i) const { return i < kInlineBanks ? inline_banks_[i] : overflow_banks_[i - kInlineBanks]; }
+
+    // All hits decoded into columns, bank by bank. Decoded on the first call, so the cost is paid
+    // once per event however many modules use it. Safe to call from several threads. The buffers
+    // come from HitColumnsPool and go back there with the event.
+    const HitColumns& columns() const;
+
     eventheader header;
-    std::vector<hit> hits;
+    const HitRange hits{this};
+
+private:
+    std::array<HitSpan, kInlineBanks> inline_banks_;
+    std::vector<HitSpan> overflow_banks_;
+    std::size_t nbanks_ = 0;
+    std::size_t nhits_ = 0;
+    std::vector<hit> owned_hits_;
+
+    mutable std::once_flag decoded_;
+    mutable HitColumnsPool::Handle columns_;
 };
 
 #endif
@@ -0,0 +1,90 @@
+#include "MutrigTimeCalibration.h"
+
+#include <algorithm>
+#include <cmath>
+
+MutrigTimeCalibration::MutrigTimeCalibration(const Settings& settings) : settings_(settings) {
+    bin_bits_ = 0;
+    while ((1u << bin_bits_) < settings.energy_bins && bin_bits_ < kEnergyBits) bin_bits_++;
+    energy_shift_ = kEnergyBits - bin_bits_;
+    reset();
+}
+
+void MutrigTimeCalibration::reset() {
+    correction_.assign(kChannels << bin_bits_, 0.);
+    entries_.assign(kChannels << bin_bits_, 0);
+    rejected_ = 0;
+}
+
+void MutrigTimeCalibration::apply(const uint8_t* channel, const uint16_t* energy, const uint64_t* timestamp, size_t n, double* calibrated) const {
+    const double* table = correction_.data();
+    for (size_t i = 0; i < n; i++)
+        calibrated[i] = double(timestamp[i]) - table[bin(channel[i] & (kChannels - 1), energy[i])];
+}
+
+bool MutrigTimeCalibration::update(size_t index, double target) {
+    double& correction = correction_[index];
+    uint32_t& entries = entries_[index];
+    if (entries >= settings_.warmup && std::fabs(target - correction) > settings_.outlier) return false;
+
+    const double rate = std::max(1. / (entries + 1), settings_.min_rate);
+    correction += rate * (target - correction);
+    if (entries < UINT32_MAX) entries++;
+    return true;
+}
+
+bool MutrigTimeCalibration::learn(uint8_t channelA, uint16_t energyA, uint64_t timeA, uint8_t channelB, uint16_t energyB, uint64_t timeB) {
+    if (channelA == channelB || channelA >= kChannels || channelB >= kChannels) return false;
+    const size_t a = bin(channelA, energyA);
+    const size_t b = bin(channelB, energyB);
+
+    // Both targets are taken before either bin moves
+    const double targetA = double(timeA) - (double(timeB) - correction_[b]);
+    const double targetB = double(timeB) - (double(timeA) - correction_[a]);
+    const bool okA = update(a, targetA);
+    const bool okB = update(b, targetB);
+    if (!okA || !okB) rejected_++;
+    return okA && okB;
+}
+
+double MutrigTimeCalibration::offset(uint8_t channel) const {
+    double sum = 0;
+    uint64_t n = 0;
+    for (unsigned e = 0; e < energy_bins(); e++) {
+        const size_t index = size_t(channel) << bin_bits_ | e;
+        sum += correction_[index] * entries_[index];
+        n += entries_[index];
+    }
+    return n ? sum / n : 0.;
+}
+
+double MutrigTimeCalibration::timewalk(uint8_t channel, unsigned energy_bin) const {
+    const size_t index = size_t(channel) << bin_bits_ | energy_bin;
+    return entries_[index] ? correction_[index] - offset(channel) : 0.;
+}
+
+void MutrigTimeCalibration::normalise() {
+    double sum = 0;
+    unsigned n = 0;
+    for (size_t channel = 0; channel < kChannels; channel++) {
+        bool calibrated = false;
+        for (unsigned e = 0; e < energy_bins(); e++) calibrated |= entries_[channel << bin_bits_ | e] > 0;
+        if (!calibrated) continue;
+        sum += offset(channel);
+        n++;
+    }
+    if (n == 0) return;
+    const double mean = sum / n;
+    for (size_t i = 0; i < correction_.size(); i++)
+        if (entries_[i] > 0) correction_[i] -= mean;
+
+    // Energy bins without entries of a calibrated channel get the channel offset, so that rare
+    // energies are not left uncorrected
+    for (size_t channel = 0; channel < kChannels; channel++) {
+        const double channel_offset = offset(channel);
+        for (unsigned e = 0; e < energy_bins(); e++) {
+            const size_t index = channel << bin_bits_ | e;
+            if (entries_[index] == 0) correction_[index] = channel_offset;
+        }
+    }
+}
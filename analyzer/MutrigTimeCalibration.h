@@ -0,0 +1,75 @@
+#ifndef MUTRIGTIMECALIBRATION_H
+#define MUTRIGTIMECALIBRATION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Per-channel time offsets and timewalk corrections for MuTRiG hits, learned during the run.
+//
+// The correction of a hit depends on its channel and its energy, binned into `energy_bins` bins.
+// The calibrated time is the timestamp minus the correction. The offset of a channel is the mean
+// correction over its energy bins, weighted with the entries, and the timewalk curve is what is
+// left when the offset is subtracted.
+//
+// The corrections are learned from coincidences, i.e. pairs of hits in two channels that belong to
+// the same particle. For such a pair the corrected times should agree, so each hit's bin is moved
+// towards the difference between its raw time and the partner's corrected time. Every bin is a
+// running mean that turns into an exponential average with rate `min_rate` once it has enough
+// entries, so it follows slow changes during the run. Samples far from the current correction are
+// rejected as accidental coincidences once the bin has `warmup` entries.
+//
+// Only time differences are defined, so the corrections have a free common offset. `normalise`
+// sets the mean offset of all calibrated channels to zero. All times are in units of the
+// timestamp, 50ps.
+class MutrigTimeCalibration {
+public:
+    static constexpr size_t kChannels = 64;
+    static constexpr unsigned kEnergyBits = 9; // mutrighit::et()
+
+    struct Settings {
+        unsigned energy_bins = 32;    // rounded up to a power of two, at most 1 << kEnergyBits
+        double min_rate = 0.01;
+        double outlier = 100;         // 5ns
+        uint32_t warmup = 20;
+    };
+
+    explicit MutrigTimeCalibration(const Settings& settings);
+    MutrigTimeCalibration() : MutrigTimeCalibration(Settings()) {}
+
+    unsigned energy_bins() const { return 1u << bin_bits_; }
+    size_t bin(uint8_t channel, uint16_t energy) const {
+        return size_t(channel) << bin_bits_ | (energy & ((1u << kEnergyBits) - 1)) >> energy_shift_;
+    }
+
+    double correction(uint8_t channel, uint16_t energy) const { return correction_[bin(channel, energy)]; }
+
+    // Calibrated times of n hits, calibrated[i] = timestamp[i] - correction(channel[i], energy[i])
+    void apply(const uint8_t* channel, const uint16_t* energy, const uint64_t* timestamp, size_t n, double* calibrated) const;
+
+    // Learn from a coincidence of two hits in different channels. Returns false if it was rejected.
+    bool learn(uint8_t channelA, uint16_t energyA, uint64_t timeA, uint8_t channelB, uint16_t energyB, uint64_t timeB);
+
+    // Shift all corrections so that the mean offset of the channels with entries is zero, and set
+    // the energy bins without entries to the offset of their channel
+    void normalise();
+
+    double offset(uint8_t channel) const;
+    double timewalk(uint8_t channel, unsigned energy_bin) const;
+    uint32_t entries(uint8_t channel, unsigned energy_bin) const { return entries_[size_t(channel) << bin_bits_ | energy_bin]; }
+    uint64_t rejected() const { return rejected_; }
+
+    void reset();
+
+private:
+    bool update(size_t index, double target);
+
+    Settings settings_;
+    unsigned bin_bits_;
+    unsigned energy_shift_;
+    std::vector<double> correction_;   // indexed by bin()
+    std::vector<uint32_t> entries_;
+    uint64_t rejected_ = 0;
+};
+
+#endif
@@ -0,0 +1,145 @@
+#include "PixelClusterFinder.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+constexpr uint32_t kNoCluster = std::numeric_limits<uint32_t>::max();
+}
+
+PixelClusterFinder::PixelClusterFinder(uint64_t time_window, size_t max_open_hits)
+    : time_window_(time_window), max_open_hits_(std::max<size_t>(max_open_hits, 1)) {}
+
+void PixelClusterFinder::add(uint8_t chip, uint8_t col, uint8_t row, uint64_t time, uint32_t charge) {
+    if (chip >= chips_.size()) chips_.resize(chip + 1);
+    ChipState& state = chips_[chip];
+
+    if (!state.window.empty() && time < state.now) {
+        ++out_of_order_;
+        while (!state.window.empty()) expire_front(chip, state);
+    }
+    state.now = time;
+
+    // Everything left in the grid afterwards is within the time window of this hit
+    while (!state.window.empty() && state.window.front().time + time_window_ < time) expire_front(chip, state);
+    while (state.window.size() >= max_open_hits_) expire_front(chip, state);
+
+    // Join the clusters of all neighbouring pixels, merging them if there are several
+    uint32_t cluster = kNoCluster;
+    for (int dc = -1; dc <= 1; dc++) {
+        const int c = col + dc;
+        if (c < 0 || c > 255) continue;
+        for (int dr = -1; dr <= 1; dr++) {
+            const int r = row + dr;
+            if (r < 0 || r > 255) continue;
+            auto it = state.grid.find(key(c, r));
+            if (it == state.grid.end()) continue;
+            uint32_t other = it->second.cluster;
+            if (cluster == kNoCluster) {
+                cluster = other;
+            } else if (other != cluster) {
+                // Relabel the smaller one
+                if (state.clusters[other].live > state.clusters[cluster].live) std::swap(cluster, other);
+                merge(state, cluster, other);
+            }
+        }
+    }
+    if (cluster == kNoCluster) {
+        cluster = new_cluster(state);
+        state.clusters[cluster].first_time = time;
+    }
+
+    OpenCluster& open = state.clusters[cluster];
+    const uint16_t k = key(col, row);
+    auto [it, inserted] = state.grid.try_emplace(k, Cell{cluster, time});
+    if (inserted) {
+        open.live++;
+        open.pixels.push_back(k);
+    } else {
+        // Same pixel again, it is its own neighbour so it is in this cluster already
+        it->second.time = time;
+    }
+    open.size++;
+    open.charge += charge;
+    open.last_time = time;
+    open.sum_col += col;
+    open.sum_row += row;
+
+    state.window.push_back(Pending{time, k});
+}
+
+void PixelClusterFinder::flush() {
+    for (size_t chip = 0; chip < chips_.size(); chip++) {
+        ChipState& state = chips_[chip];
+        while (!state.window.empty()) expire_front(chip, state);
+    }
+}
+
+size_t PixelClusterFinder::open_hits() const {
+    size_t n = 0;
+    for (const auto& state : chips_) n += state.grid.size();
+    return n;
+}
+
+uint32_t PixelClusterFinder::new_cluster(ChipState& state) {
+    if (!state.free_clusters.empty()) {
+        const uint32_t cluster = state.free_clusters.back();
+        state.free_clusters.pop_back();
+        return cluster;
+    }
+    state.clusters.emplace_back();
+    return state.clusters.size() - 1;
+}
+
+void PixelClusterFinder::merge(ChipState& state, uint32_t into, uint32_t from) {
+    OpenCluster& a = state.clusters[into];
+    OpenCluster& b = state.clusters[from];
+
+    for (const uint16_t k : b.pixels) {
+        auto it = state.grid.find(k);
+        if (it == state.grid.end() || it->second.cluster != from) continue;
+        it->second.cluster = into;
+        a.pixels.push_back(k);
+    }
+    a.live += b.live;
+    a.size += b.size;
+    a.charge += b.charge;
+    a.first_time = std::min(a.first_time, b.first_time);
+    a.last_time = std::max(a.last_time, b.last_time);
+    a.sum_col += b.sum_col;
+    a.sum_row += b.sum_row;
+
+    b.pixels.clear();
+    b = OpenCluster{std::move(b.pixels)};
+    state.free_clusters.push_back(from);
+}
+
+void PixelClusterFinder::expire_front(uint8_t chip, ChipState& state) {
+    const Pending pending = state.window.front();
+    state.window.pop_front();
+
+    // The pixel may have been hit again since, then the later hit keeps it in the grid
+    auto it = state.grid.find(pending.pixel);
+    if (it == state.grid.end() || it->second.time != pending.time) return;
+
+    const uint32_t cluster = it->second.cluster;
+    state.grid.erase(it);
+    if (--state.clusters[cluster].live == 0) close(chip, state, cluster);
+}
+
+void PixelClusterFinder::close(uint8_t chip, ChipState& state, uint32_t cluster) {
+    OpenCluster& open = state.clusters[cluster];
+
+    Cluster& done = completed_.emplace_back();
+    done.chip = chip;
+    done.size = open.size;
+    done.charge = open.charge;
+    done.time = open.first_time;
+    done.duration = open.last_time - open.first_time;
+    done.col = float(open.sum_col) / open.size;
+    done.row = float(open.sum_row) / open.size;
+
+    open.pixels.clear();
+    open = OpenCluster{std::move(open.pixels)};
+    state.free_clusters.push_back(cluster);
+}
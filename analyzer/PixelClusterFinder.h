@@ -0,0 +1,92 @@
+#ifndef PIXELCLUSTERFINDER_H
+#define PIXELCLUSTERFINDER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+// Streaming cluster finder for pixel hits.
+//
+// Hits are fed one at a time with `add`, in time order per chip. Two hits belong to the same cluster
+// if they are on the same chip, on neighbouring pixels (including diagonals, or the same pixel) and
+// at most `time_window` apart; clusters are the connected groups of such hits. Per chip the finder
+// keeps a sparse grid of the pixels hit within the last time window, and a queue of these hits in
+// time order. When the time moves on, hits leave the window and are removed from the grid; a
+// cluster is complete once none of its hits is left in the window. Memory is therefore bounded by
+// the number of hits in one time window, and in addition capped by `max_open_hits` per chip.
+//
+// A hit that is earlier than the previous hit of the same chip (e.g. from the next bank, or after
+// the time stamp wrapped) closes all open clusters of that chip first.
+class PixelClusterFinder {
+public:
+    struct Cluster {
+        uint8_t chip = 0;
+        uint32_t size = 0;       // number of hits
+        uint32_t charge = 0;     // sum of the charges given to `add`
+        uint64_t time = 0;       // time of the first hit
+        uint64_t duration = 0;   // time of the last hit - time of the first hit
+        float col = 0;           // mean column of the hits
+        float row = 0;           // mean row of the hits
+    };
+
+    explicit PixelClusterFinder(uint64_t time_window, size_t max_open_hits = 4096);
+
+    // Add one hit. Completed clusters are appended to `clusters()`.
+    void add(uint8_t chip, uint8_t col, uint8_t row, uint64_t time, uint32_t charge);
+
+    // Close all open clusters, e.g. at the end of a run
+    void flush();
+
+    // Clusters completed so far. The caller takes them out and clears the vector.
+    std::vector<Cluster>& clusters() { return completed_; }
+
+    // Number of hits currently waiting in the time windows of all chips
+    size_t open_hits() const;
+
+    // Number of hits that arrived out of time order and forced a flush of their chip
+    uint64_t out_of_order() const { return out_of_order_; }
+
+private:
+    struct Cell {
+        uint32_t cluster;
+        uint64_t time;
+    };
+    struct Pending {
+        uint64_t time;
+        uint16_t pixel;
+    };
+    struct OpenCluster {
+        std::vector<uint16_t> pixels;   // grid keys of the hits, may contain expired or repeated keys
+        uint32_t live = 0;              // number of grid cells pointing to this cluster
+        uint32_t size = 0;
+        uint32_t charge = 0;
+        uint64_t first_time = 0;
+        uint64_t last_time = 0;
+        uint64_t sum_col = 0;
+        uint64_t sum_row = 0;
+    };
+    struct ChipState {
+        std::unordered_map<uint16_t, Cell> grid;   // key col << 8 | row
+        std::deque<Pending> window;                 // hits in time order
+        std::vector<OpenCluster> clusters;
+        std::vector<uint32_t> free_clusters;
+        uint64_t now = 0;
+    };
+
+    static uint16_t key(uint8_t col, uint8_t row) { return uint16_t(col) << 8 | row; }
+
+    uint32_t new_cluster(ChipState& state);
+    void merge(ChipState& state, uint32_t into, uint32_t from);
+    void expire_front(uint8_t chip, ChipState& state);
+    void close(uint8_t chip, ChipState& state, uint32_t cluster);
+
+    uint64_t time_window_;
+    size_t max_open_hits_;
+    std::vector<ChipState> chips_;   // indexed by chip ID, grown on demand
+    std::vector<Cluster> completed_;
+    uint64_t out_of_order_ = 0;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(size_t nworkers) {
+    for (size_t worker = 1; worker < nworkers; worker++)
+        threads_.emplace_back(&WorkerPool::run, this, worker);
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    start_.notify_all();
+    for (auto& thread : threads_) thread.join();
+}
+
+void WorkerPool::parallel_for(size_t ntasks, const std::function<void(size_t, size_t)>& task) {
+    if (ntasks == 0) return;
+
+    // Not worth waking anybody up
+    if (threads_.empty() || ntasks == 1) {
+        for (size_t index = 0; index < ntasks; index++) task(index, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = &task;
+        ntasks_ = ntasks;
+        next_ = 0;
+        busy_ = threads_.size();
+        ++generation_;
+    }
+    start_.notify_all();
+
+    work(0);
+
+    // The task has to stay alive until every worker has stopped looking at it
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return busy_ == 0; });
+    task_ = nullptr;
+}
+
+void WorkerPool::run(size_t worker) {
+    size_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+            if (stop_) return;
+            seen = generation_;
+        }
+
+        work(worker);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--busy_ == 0) done_.notify_one();
+    }
+}
+
+void WorkerPool::work(size_t worker) {
+    for (size_t index = next_++; index < ntasks_; index = next_++)
+        (*task_)(index, worker);
+}
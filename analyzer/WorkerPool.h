@@ -0,0 +1,50 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed pool of threads to spread the work of one event over several cores.
+//
+// `parallel_for` hands out task indices to the workers and blocks until all tasks are done. The
+// calling thread takes part as worker 0, so a pool of size 1 has no extra threads and simply runs
+// everything in the caller. The worker index passed to the task is stable for a thread, so it can
+// be used to pick a thread local shard of the output without any locking.
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t nworkers);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Number of workers, including the calling thread
+    size_t size() const { return threads_.size() + 1; }
+
+    // Run task(index, worker) for every index in [0, ntasks). Not reentrant.
+    void parallel_for(size_t ntasks, const std::function<void(size_t, size_t)>& task);
+
+private:
+    void run(size_t worker);
+    void work(size_t worker);
+
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+
+    // State of the current parallel_for, protected by mutex_ except for the atomics
+    const std::function<void(size_t, size_t)>* task_ = nullptr;
+    size_t ntasks_ = 0;
+    size_t generation_ = 0;
+    size_t busy_ = 0;
+    bool stop_ = false;
+    std::atomic<size_t> next_{0};
+};
+
+#endif
@@ -2,10 +2,7 @@
 
 #include "manalyzer.h"
 
-#include "AnaQuadHistos.h"
-#include "AnaMutrigHistos.h"
-#include "AnaFillHits.h"
-//#include "AnaMusip.h"
+#include "AnalyzerModules.h"
 #include "musip/dqm/DQMManager.hpp"
 
 #include "odbxx.h"
@@ -15,209 +12,6 @@
 #include <iostream>
 #include <filesystem>
 
-namespace { // Use the unnamed namespace for things only used in this file
-
-/** @brief Singleton class to hold the boost::property_tree configuration.
- *
- * Control flow for this is a little weird because we can't use any ODB methods until
- * after `manalyzer_main` is called - and we lose flow control to Midas at that point.
- * So we put code that accesses the ODB in the constructor, and only ask for an instance
- * right before Midas creates new TARunObjects, i.e. after `manalyzer_main` is called.
- * However, we also need to access the config before that to read from the json file, so
- * we have the config as a static member so that it can be retrieved at any point. Pretty
- * dumb but we need to work around Midas manalyzer.
- */
-class Configuration {
-    const std::string odbPath_;
-    midas::odb odbConfig_;
-    std::mutex configMutex_;
-    static boost::property_tree::ptree config_;
-
-    Configuration()
-        : odbPath_("/Equipment/AnaMusip/Settings/") {
-
-        if(TMFE::Instance()->fDB == 0) {
-            // This will only happen if we are running offline. And if we are running offline
-            // then we don't have access to the ODB. So don't try and read or set a watch.
-            printf("Running offline, so won't try and get minalyzer configuration from the ODB\n");
-            return;
-        }
-
-        // Connect to the ODB and iterate through the keys, updating the config with any settings we find.
-        // Note that we don't bother with a thread lock since this is a singleton, so it will only be created
-        // on a single thread.
-        odbConfig_.connect(odbPath_);
-        for(auto& subKey : odbConfig_) {
-            recursiveApplyFromODB(subKey, subKey.get_odb().get_name());
-        }
-
-        // Set the watch so that the configuration gets updated when settings change. Note that
-        // the configuration is only applied when TARunObject instances are created, i.e. at run
-        // start.
-        odbConfig_.watch(std::bind(&Configuration::watchCallback, this, std::placeholders::_1));
-    }
-    void watchCallback(midas::odb& odb) {
-        // We need a thread lock, because we could try reading and writing at the same time from
-        // different threads.
-        std::lock_guard<std::mutex> lock = getThreadLock();
-
-        std::string name;
-        const std::string parentPath = odb.get_parent_path();
-        if(parentPath.size() < odbPath_.size()) {
-            name = odb.get_name();
-        }
-        else {
-            name = parentPath.substr(odbPath_.size()) + "." + odb.get_name();
-        }
-
-        recursiveApplyFromODB(odb, name);
-    }
-    template<typename data_type>
-    void setFromODB(midas::odb& odb, const std::string& parameterName) {
-        if(odb.size() == 1) {
-            const data_type valueFromODB = static_cast<data_type>(odb);
-            const boost::optional<data_type> currentValue = config_.get_optional<data_type>(parameterName);
-            // Only print info if the value is being changed to a different value
-            if(currentValue.has_value() && (currentValue.value() != valueFromODB)) {
-                printf("Config parameter %s overwritten by ODB.\n", parameterName.c_str());
-            }
-            config_.put(parameterName, valueFromODB);
-        }
-        else printf("Can't set '%s' because it is an array\n", parameterName.c_str());
-    }
-    void recursiveApplyFromODB(midas::odb& odb, const std::string& parameterName) {
-        switch(odb.get_tid()) {
-            case TID_UINT8    : setFromODB<uint8_t>(odb, parameterName); break;
-            case TID_INT8     : setFromODB<int8_t>(odb, parameterName); break;
-            // case TID_CHAR     : setFromODB<const char*>(odb, parameterName); break;
-            case TID_UINT16   : setFromODB<uint16_t>(odb, parameterName); break;
-            case TID_INT16    : setFromODB<int16_t>(odb, parameterName); break;
-            case TID_UINT32   : setFromODB<uint32_t>(odb, parameterName); break;
-            case TID_INT32    : setFromODB<int32_t>(odb, parameterName); break;
-            case TID_BOOL     : setFromODB<bool>(odb, parameterName); break;
-            case TID_FLOAT32  : setFromODB<float>(odb, parameterName); break;
-            case TID_FLOAT64  : setFromODB<double>(odb, parameterName); break;
-            case TID_STRING   : setFromODB<std::string>(odb, parameterName); break;
-            case TID_INT64    : setFromODB<int64_t>(odb, parameterName); break;
-            case TID_UINT64   : setFromODB<uint64_t>(odb, parameterName); break;
-            // case TID_BITFIELD : printf("%s = TID_BITFIELD\n", parameterName.c_str()); break;
-            // case TID_STRUCT   : printf("%s = TID_STRUCT\n", parameterName.c_str()); break;
-            // case TID_LINK     : printf("%s = TID_LINK\n", parameterName.c_str()); break;
-            // case TID_LAST     : printf("%s = TID_LAST\n", parameterName.c_str()); break;
-            // case TID_ARRAY    : printf("%s = TID_ARRAY\n", parameterName.c_str()); break;
-            case TID_KEY      :
-                for(auto& subKey : odb) {
-                    recursiveApplyFromODB(subKey, (parameterName.empty() ? "" : parameterName + ".") + subKey.get_odb().get_name());
-                }
-                break;
-            default:
-                fprintf(stderr, "Don't know how to handle ODB entry with tid %d\n", odb.get_tid());
-                break;
-        }
-    } // end of method recursiveApplyFromODB
-public:
-    static Configuration& instance() {
-        static Configuration onlyInstance;
-        return onlyInstance;
-    }
-
-    /** @brief Gets the thread lock that protects the config. To release just let the variable go out of scope.
-     *
-     * Required because the ODB watch function could otherwise write to the config while it is being read
-     * during construction of TARunObjects. */
-    std::lock_guard<std::mutex> getThreadLock() { return std::lock_guard<std::mutex>(configMutex_); }
-
-    // Unfortunately this has to be static, because we need to be able to retreive it before
-    // accessing the ODB; and the ODB needs to be accessed in the constructor.
-    static boost::property_tree::ptree& config() { return config_; }
-};
-
-// Definitions of the static members
-boost::property_tree::ptree Configuration::config_;
-
-/** @brief Basically the same as TAFactoryTemplate but passes on the boost::property_tree.
- *
- * The constructor takes the name of the config child entry that is used to configure the module.
- */
-template <class T>
-class TAFactoryTemplateWithConfig : public TAFactory {
-    const std::string moduleName_;
-
-    T* NewRunObject(TARunInfo* runinfo) override {
-        Configuration& configuration = Configuration::instance();
-        // We need to get a thread lock in case the ODB is modified while the run object
-        // is reading the configuration.
-        auto lock = configuration.getThreadLock();
-
-        const auto& moduleConfig = configuration.config().get_child(moduleName_);
-        return new T(moduleConfig, runinfo);
-    }
-
-public:
-    TAFactoryTemplateWithConfig(const std::string_view name, bool enabledByDefault)
-        : moduleName_(name) {
-        auto& config = Configuration::config();
-        // First see if the module has any kind of config. If there is one, then we enable
-        // it even if it does not have an "enabled" entry.
-        const bool hasConfig = config.get_child_optional(moduleName_).has_value();
-        const bool enabled = config.get<bool>(moduleName_ + ".enabled", hasConfig || enabledByDefault);
-
-        // We write this back into the config, so that the child entry exists if it didn't before.
-        config.put(moduleName_ + ".enabled", enabled);
-    }
-};
-
-/** @brief Does the same as TAFactoryTemplateWithConfig, but used when there is a custom TAFactory. This wraps the custom factory.
- *
- * Currently only used for AnaMusip. */
-template <class T_wrapped_factory>
-class TAFactoryWrapper : public TAFactory {
-    const std::string moduleName_;
-    std::unique_ptr<T_wrapped_factory> pWrappedFactory_;
-
-    TARunObject* NewRunObject(TARunInfo* runinfo) override {
-        // We need this here in case this is the first TARunObject created, because it triggers
-        // reading from the ODB. Code with non-obvious side effects. Yay!
-        Configuration& configuration = Configuration::instance();
-        // We need to get a thread lock in case the ODB is modified while the run object
-        // is reading the configuration.
-        // The wrapped factory already has a reference to the config that this lock protects,
-        // which is not obvious from how this code is written...
-        auto lock = configuration.getThreadLock();
-
-        return pWrappedFactory_->NewRunObject(runinfo);
-    }
-
-    void Usage() override {
-        pWrappedFactory_->Usage();
-    }
-
-    void Init(const std::vector<std::string>& args) override {
-        return pWrappedFactory_->Init(args);
-    }
-
-    void Finish() override {
-        return pWrappedFactory_->Finish();
-    }
-
-public:
-    TAFactoryWrapper(const std::string_view name, bool enabledByDefault)
-        : moduleName_(name) {
-        auto& config = Configuration::config();
-        // First see if the module has any kind of config. If there is one, then we enable
-        // it even if it does not have an "enabled" entry.
-        const bool hasConfig = config.get_child_optional(moduleName_).has_value();
-        const bool enabled = config.get<bool>(moduleName_ + ".enabled", hasConfig || enabledByDefault);
-
-        // We write this back into the config, so that the child entry exists if it didn't before.
-        config.put(moduleName_ + ".enabled", enabled);
-
-        pWrappedFactory_ = std::make_unique<T_wrapped_factory>(config.get_child(moduleName_));
-    }
-};
-
-} // namespace
-
 void printUsage(std::ostream& out, const boost::program_options::options_description options) {
     out << "Usage: minalyzer [midas options] -- [minalyzer options]\n"
         << "To see [midas options] use: minalyzer --help (\"--help\" BEFORE the \"--\")\n"
@@ -336,13 +130,14 @@ int main(int argc, char* argv[]) {
     dqmManager.addHistoryDirectory(outputPath);
 
     //
-    // Pre-fill the current run with previous output in a root file. This is mainly used for
+    // Pre-fill the current run with previous output in a root file or archive. This is mainly used for
     // debugging custom pages etc. without having to start a run.
     //
     if(configuration.count("prefill")) {
-        const std::string rootFilename = configuration.get<std::string>("prefill");
-        std::cout << "Prefilling DQM histograms with data from " << rootFilename << "\n";
-        dqmManager.addFromRootFile(rootFilename.c_str());
+        const std::string prefillFilename = configuration.get<std::string>("prefill");
+        std::cout << "Prefilling DQM histograms with data from " << prefillFilename << "\n";
+        if(std::filesystem::path(prefillFilename).extension() == ".dqm") dqmManager.addFromArchive(prefillFilename.c_str());
+        else dqmManager.addFromRootFile(prefillFilename.c_str());
     }
 
     // We want to clear all plots at the start of each run. So create a new TARunObject
@@ -357,12 +152,8 @@ int main(int argc, char* argv[]) {
     };
     TARegister clearPlots(new TAFactoryTemplate<ClearPlots>);
 
-    // The first parameter in the constructor is the name of the config file entry for that module.
-    // The second parameter is whether the module is enabled by default when not otherwise specified.
-    TARegister fillhits(new TAFactoryTemplateWithConfig<AnaFillHits>("fillhits", true));
-    TARegister quad(new TAFactoryTemplateWithConfig<AnaQuadHistos>("quad", true));
-    TARegister mutrig(new TAFactoryTemplateWithConfig<AnaMutrigHistos>("mutrig", true));
-    //TARegister musip(new TAFactoryWrapper<AnaMusipFactory>("musip", true));
+    // The modules themselves are listed in AnalyzerModules.cpp.
+    for(TAFactory* factory : createModuleFactories()) TARegister module(factory);
 
     // We want to save all plots at the end of each run. So create a new TARunObject
     // *after* all the other modules so that it gets executed last.
@@ -387,6 +178,10 @@ int main(int argc, char* argv[]) {
 
                 constexpr bool skipEmptyHistograms = false;
                 musip::dqm::DQMManager::instance().saveAsRootFile(outputFilename.c_str(), skipEmptyHistograms);
+
+                // The archive is what previous runs are served from, the root file is for everything else
+                snprintf(filename, sizeof(filename), "dqm_histos_%05d.dqm", runinfo->fRunNo);
+                musip::dqm::DQMManager::instance().saveAsArchive((outputPath_ / filename).c_str(), skipEmptyHistograms);
             }
         };
 
@@ -0,0 +1,277 @@
+//
+// Benchmark of the analysis modules with synthetic events.
+//
+// Builds MIDAS events with hit banks in the format AnaFillHits expects, with a configurable number
+// of hits, set of chips and fraction of MuTRiG hits, and runs them through the same modules as
+// quadana (see AnalyzerModules.cpp). Reports the event and hit rates, the number of allocations
+// and the time spent in each module. Needs neither hardware nor an ODB.
+//
+// The events are generated before the measurement and then cycled, so that only the modules are
+// measured.
+//
+
+#include "manalyzer.h"
+#include "midas.h"
+
+#include "AnalyzerModules.h"
+#include "hits.h"
+
+#include <boost/program_options.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+
+//
+// Count every allocation of the process, so that we can tell how many the modules make per event.
+//
+namespace {
+std::atomic<uint64_t> allocationCount{0};
+std::atomic<uint64_t> allocationBytes{0};
+} // namespace
+
+void* operator new(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(size, std::memory_order_relaxed);
+    if(void* pointer = std::malloc(size ? size : 1)) return pointer;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try { return operator new(size); } catch(...) { return nullptr; }
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    try { return operator new(size); } catch(...) { return nullptr; }
+}
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete[](void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { std::free(pointer); }
+
+namespace { // Use the unnamed namespace for things only used in this file
+
+struct EventSettings {
+    double hitsPerEvent;       // mean, Poisson distributed
+    size_t banksPerEvent;
+    std::vector<uint8_t> chips;
+    double mutrigFraction;
+};
+
+/** @brief Parses a list of chip IDs like "0-3,8,10-11". */
+std::vector<uint8_t> parseChips(const std::string& list) {
+    std::vector<uint8_t> chips;
+    std::stringstream stream(list);
+    std::string item;
+    while(std::getline(stream, item, ',')) {
+        const size_t dash = item.find('-');
+        const int first = std::stoi(item.substr(0, dash));
+        const int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+        for(int chip = first; chip <= last; ++chip) chips.push_back(chip);
+    }
+    return chips;
+}
+
+uint64_t makePixelHit(uint8_t chip, uint8_t col, uint8_t row, uint8_t tot, uint64_t time) {
+    return uint64_t(chip & 0x1F) << 58 | uint64_t(col) << 50 | uint64_t(row) << 42 | uint64_t(tot & 0x1F) << 37
+         | (time & 0x1FFFFFFFFFULL);
+}
+
+uint64_t makeMutrigHit(uint8_t asic, uint8_t channel, uint16_t energy, uint8_t finetime, uint64_t time8ns) {
+    return uint64_t(1) << 63 | uint64_t(asic & 0x3) << 61 | uint64_t(channel & 0x1F) << 56
+         | uint64_t(energy & 0x1FF) << 47 | uint64_t(finetime) << 39 | (time8ns & 0x7FFFFFFFFFULL);
+}
+
+/** @brief One readout event (ID 301) with `banksPerEvent` hit banks, the hits of each bank time sorted. */
+TMEvent* makeEvent(const EventSettings& settings, uint32_t serialNumber, uint64_t startTime, std::mt19937_64& random,
+                   uint64_t& numberOfHits) {
+    std::poisson_distribution<size_t> multiplicity(settings.hitsPerEvent);
+    std::bernoulli_distribution isMutrig(settings.mutrigFraction);
+    std::uniform_int_distribution<size_t> chipIndex(0, settings.chips.size() - 1);
+    std::uniform_int_distribution<int> col(0, 255), row(0, 249), tot(0, 31), asic(0, 1), channel(0, 31),
+        energy(0, 511), finetime(0, 255), timeStep(0, 3);
+
+    TMEvent* pEvent = new TMEvent;
+    pEvent->Init(301, 0, serialNumber, 0);
+
+    const size_t hits = multiplicity(random);
+    numberOfHits += hits;
+    std::vector<uint64_t> bank;
+    for(size_t bankIndex = 0; bankIndex < settings.banksPerEvent; ++bankIndex) {
+        const size_t first = hits * bankIndex / settings.banksPerEvent;
+        const size_t last = hits * (bankIndex + 1) / settings.banksPerEvent;
+        bank.clear();
+        uint64_t time = startTime;
+        for(size_t index = first; index < last; ++index) {
+            time += timeStep(random);
+            if(isMutrig(random)) bank.push_back(makeMutrigHit(asic(random), channel(random), energy(random), finetime(random), time));
+            else bank.push_back(makePixelHit(settings.chips[chipIndex(random)], col(random), row(random), tot(random), time));
+        }
+        char bankName[5];
+        snprintf(bankName, sizeof(bankName), "HT%02zu", bankIndex % 100);
+        pEvent->AddBank(bankName, TID_UINT64, reinterpret_cast<const char*>(bank.data()), bank.size() * sizeof(uint64_t));
+    }
+    return pEvent;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    namespace po = boost::program_options;
+
+    po::options_description options("quadbench options");
+    options.add_options()
+        ("help", "help")
+        ("config", po::value<std::string>(), "JSON file to load configuration from")
+        ("events", po::value<size_t>()->default_value(20000), "Number of events to analyse")
+        ("hits", po::value<double>()->default_value(200), "Mean number of hits per event")
+        ("banks", po::value<size_t>()->default_value(4), "Number of hit banks per event")
+        ("chips", po::value<std::string>()->default_value("0-23"), "Pixel chip IDs to put hits on, e.g. 0-3,8")
+        ("mutrig-fraction", po::value<double>()->default_value(0.1), "Fraction of MuTRiG hits")
+        ("distinct-events", po::value<size_t>()->default_value(256), "Number of different events generated and cycled through")
+        ("readout-rate", po::value<double>(), "Event rate of the readout in Hz, to tell if the analysis keeps up")
+        ("seed", po::value<uint64_t>()->default_value(1), "Random seed");
+
+    po::variables_map variableMap;
+    try {
+        po::store(po::parse_command_line(argc, argv, options), variableMap);
+        po::notify(variableMap);
+    } catch(const std::exception& exception) {
+        std::cerr << "Unable to parse command line: " << exception.what() << "\n\n" << options;
+        return -1;
+    }
+    if(variableMap.count("help")) {
+        std::cout << "Usage: quadbench [options]\n" << options;
+        return 0;
+    }
+
+    boost::property_tree::ptree& configuration = Configuration::config();
+    if(variableMap.count("config")) {
+        const std::string configFilename = variableMap["config"].as<std::string>();
+        try {
+            boost::property_tree::read_json(configFilename, configuration);
+        } catch(const std::exception& exception) {
+            std::cerr << "Unable to parse the config file '" << configFilename << "' because: " << exception.what()
+                      << "\n";
+            return -1;
+        }
+    }
+
+    // Don't write mask files unless the config asks for it
+    if(!configuration.get_optional<bool>("quad.write_masks")) configuration.put("quad.write_masks", false);
+
+    EventSettings settings;
+    settings.hitsPerEvent = variableMap["hits"].as<double>();
+    settings.banksPerEvent = std::max<size_t>(variableMap["banks"].as<size_t>(), 1);
+    settings.chips = parseChips(variableMap["chips"].as<std::string>());
+    settings.mutrigFraction = variableMap["mutrig-fraction"].as<double>();
+    if(settings.chips.empty()) {
+        std::cerr << "No chips given\n";
+        return -1;
+    }
+    const size_t numberOfEvents = variableMap["events"].as<size_t>();
+    const size_t distinctEvents = std::max<size_t>(variableMap["distinct-events"].as<size_t>(), 1);
+
+    //
+    // Generate the events
+    //
+    std::mt19937_64 random(variableMap["seed"].as<uint64_t>());
+    std::vector<std::unique_ptr<TMEvent>> events;
+    std::vector<uint64_t> hitsInEvent;
+    uint64_t time = 0;
+    for(size_t index = 0; index < distinctEvents; ++index) {
+        uint64_t hits = 0;
+        events.emplace_back(makeEvent(settings, index, time, random, hits));
+        hitsInEvent.push_back(hits);
+        time += 4 * settings.hitsPerEvent / settings.banksPerEvent + 16;
+    }
+
+    //
+    // Set up the modules like manalyzer does for a run
+    //
+    const std::vector<std::string> args(argv, argv + argc);
+    std::vector<std::unique_ptr<TAFactory>> factories;
+    for(TAFactory* factory : createModuleFactories()) {
+        factories.emplace_back(factory);
+        factory->Init(args);
+    }
+    TARunInfo runinfo(1, "synthetic", args);
+    std::vector<std::unique_ptr<TARunObject>> modules;
+    for(auto& factory : factories) modules.emplace_back(factory->NewRunObject(&runinfo));
+    for(auto& module : modules) module->BeginRun(&runinfo);
+
+    //
+    // Measure
+    //
+    using clock = std::chrono::steady_clock;
+    std::vector<clock::duration> moduleTime(modules.size(), clock::duration::zero());
+    uint64_t numberOfHits = 0;
+    const uint64_t allocationsBefore = allocationCount.load();
+    const uint64_t bytesBefore = allocationBytes.load();
+    const clock::time_point start = clock::now();
+
+    for(size_t index = 0; index < numberOfEvents; ++index) {
+        TMEvent* pEvent = events[index % distinctEvents].get();
+        numberOfHits += hitsInEvent[index % distinctEvents];
+
+        TAFlags flags = 0;
+        TAFlowEvent* pFlow = nullptr;
+        for(size_t module = 0; module < modules.size(); ++module) {
+            const clock::time_point before = clock::now();
+            pFlow = modules[module]->Analyze(&runinfo, pEvent, &flags, pFlow);
+            moduleTime[module] += clock::now() - before;
+        }
+        for(size_t module = 0; module < modules.size(); ++module) {
+            const clock::time_point before = clock::now();
+            pFlow = modules[module]->AnalyzeFlowEvent(&runinfo, &flags, pFlow);
+            moduleTime[module] += clock::now() - before;
+        }
+        delete pFlow;
+    }
+
+    const clock::duration total = clock::now() - start;
+    const uint64_t allocations = allocationCount.load() - allocationsBefore;
+    const uint64_t bytes = allocationBytes.load() - bytesBefore;
+
+    std::vector<std::string> moduleNames;
+    for(auto& module : modules) {
+        module->EndRun(&runinfo);
+        moduleNames.push_back(module->fModuleName);
+    }
+    modules.clear();
+    for(auto& factory : factories) factory->Finish();
+
+    //
+    // Report
+    //
+    const double seconds = std::chrono::duration<double>(total).count();
+    const double eventRate = numberOfEvents / seconds;
+    printf("\n%zu events, %lu hits (%.1f per event), %zu chips, %.0f%% MuTRiG\n", numberOfEvents,
+           (unsigned long)numberOfHits, double(numberOfHits) / numberOfEvents, settings.chips.size(),
+           100 * settings.mutrigFraction);
+    printf("%-16s %10.3f s\n", "time", seconds);
+    printf("%-16s %10.0f events/s\n", "event rate", eventRate);
+    printf("%-16s %10.3g hits/s\n", "hit rate", numberOfHits / seconds);
+    printf("%-16s %10.1f per event, %.0f bytes per event\n", "allocations", double(allocations) / numberOfEvents,
+           double(bytes) / numberOfEvents);
+
+    printf("\n%-20s %12s %12s %8s\n", "module", "total [ms]", "[us/event]", "share");
+    for(size_t module = 0; module < moduleTime.size(); ++module) {
+        const double moduleSeconds = std::chrono::duration<double>(moduleTime[module]).count();
+        printf("%-20s %12.1f %12.2f %7.1f%%\n", moduleNames[module].c_str(),
+               1e3 * moduleSeconds, 1e6 * moduleSeconds / numberOfEvents, 100 * moduleSeconds / seconds);
+    }
+
+    if(variableMap.count("readout-rate")) {
+        const double readoutRate = variableMap["readout-rate"].as<double>();
+        printf("\nreadout rate %.0f events/s: %s (%.2fx)\n", readoutRate,
+               eventRate >= readoutRate ? "keeps up" : "FALLS BEHIND", eventRate / readoutRate);
+        return eventRate >= readoutRate ? 0 : 2;
+    }
+    return 0;
+}
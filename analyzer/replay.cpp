@@ -0,0 +1,411 @@
+//
+// Offline replay of MIDAS files through the analysis modules, in parallel.
+//
+// The files of each run are split into contiguous parts, one per worker. Every part is processed
+// in its own process, which runs the same modules as quadana (see AnalyzerModules.cpp) and saves
+// its DQM histograms to a partial file. Inside a worker, reading and decompressing, decoding the
+// hits and filling the histograms run in three threads connected by bounded queues. Once all
+// parts are done, the partial files of each run are added up and passed through the EndRun of the
+// modules once more, so that run level outputs like the masks are made from the whole run. The
+// result is written to dqm_histos_%05d.root and dqm_histos_%05d.dqm like quadana does.
+//
+// Workers are processes rather than threads because the modules and the DQMManager are written
+// for one instance of each module per process.
+//
+
+#include "manalyzer.h"
+
+#include "AnalyzerModules.h"
+#include "HitVectorFlowEvent.h"
+#include "musip/dqm/DQMManager.hpp"
+
+#include <boost/program_options.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <regex>
+#include <thread>
+
+namespace { // Use the unnamed namespace for things only used in this file
+
+/** @brief Queue between two pipeline stages. Blocks the producer when full, so that a fast reader
+ * cannot run away from the analysis. */
+template<typename T>
+class BoundedQueue {
+    std::mutex mutex_;
+    std::condition_variable notFull_;
+    std::condition_variable notEmpty_;
+    std::deque<T> items_;
+    const size_t capacity_;
+    bool closed_ = false;
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(std::max<size_t>(capacity, 1)) {}
+
+    /** @brief Returns false if the queue was closed, in which case `item` was not added. */
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+        if(closed_) return false;
+        items_.push_back(std::move(item));
+        notEmpty_.notify_one();
+        return true;
+    }
+
+    /** @brief Returns an empty optional once the queue is closed and drained. */
+    std::optional<T> pop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if(items_.empty()) return std::nullopt;
+        T item = std::move(items_.front());
+        items_.pop_front();
+        notFull_.notify_one();
+        return item;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notFull_.notify_all();
+        notEmpty_.notify_all();
+    }
+};
+
+/** @brief Part of a run that is processed by one worker. */
+struct WorkUnit {
+    int runNumber;
+    std::vector<std::string> files;
+    std::filesystem::path partialFilename;
+};
+
+bool isSpecialEvent(const TMEvent& event) {
+    // Begin of run, end of run and message events
+    return (event.event_id & 0xFF00) == 0x8000;
+}
+
+/** @brief Runs one part of a run through the modules and saves the DQM histograms of it.
+ *
+ * Called in the worker process. Returns the exit code for the process. */
+int replayPart(const std::vector<TAFactory*>& factories, const WorkUnit& unit, size_t queueDepth,
+               const std::vector<std::string>& args) {
+    TARunInfo runinfo(unit.runNumber, unit.files.front().c_str(), args);
+    std::vector<std::unique_ptr<TARunObject>> modules;
+    for(TAFactory* factory : factories) modules.emplace_back(factory->NewRunObject(&runinfo));
+
+    musip::dqm::DQMManager::instance().clearAll();
+    for(auto& module : modules) module->BeginRun(&runinfo);
+
+    struct DecodedEvent {
+        TMEvent* event;
+        TAFlowEvent* flow;
+    };
+    BoundedQueue<TMEvent*> rawEvents(queueDepth);
+    BoundedQueue<DecodedEvent> decodedEvents(queueDepth);
+    bool readError = false;
+
+    // Stage 1: read and decompress
+    std::thread reader([&]() {
+        for(const std::string& filename : unit.files) {
+            std::unique_ptr<TMReaderInterface> pReader(TMNewReader(filename.c_str()));
+            if(pReader->fError) {
+                fprintf(stderr, "Cannot open %s: %s\n", filename.c_str(), pReader->fErrorString.c_str());
+                readError = true;
+                break;
+            }
+            bool stop = false;
+            while(TMEvent* pEvent = TMReadEvent(pReader.get())) {
+                if(!rawEvents.push(pEvent)) {
+                    delete pEvent;
+                    stop = true;
+                    break;
+                }
+            }
+            pReader->Close();
+            if(stop) break;
+        }
+        rawEvents.close();
+    });
+
+    // Stage 2: the Analyze() of all modules, which creates the flow events, and the hit decoding
+    std::thread decoder([&]() {
+        while(std::optional<TMEvent*> pEvent = rawEvents.pop()) {
+            if(isSpecialEvent(**pEvent)) {
+                delete *pEvent;
+                continue;
+            }
+
+            TAFlags flags = 0;
+            TAFlowEvent* pFlow = nullptr;
+            for(auto& module : modules) {
+                pFlow = module->Analyze(&runinfo, *pEvent, &flags, pFlow);
+                if(flags & (TAFlag_SKIP | TAFlag_QUIT)) break;
+            }
+            if(flags & TAFlag_QUIT) {
+                delete pFlow;
+                delete *pEvent;
+                rawEvents.close();
+                break;
+            }
+            if(pFlow == nullptr || (flags & TAFlag_SKIP)) {
+                delete pFlow;
+                delete *pEvent;
+                continue;
+            }
+
+            if(HitVectorFlowEvent* pHits = pFlow->Find<HitVectorFlowEvent>()) pHits->columns();
+            if(!decodedEvents.push(DecodedEvent{*pEvent, pFlow})) {
+                delete pFlow;
+                delete *pEvent;
+            }
+        }
+        decodedEvents.close();
+    });
+
+    // Stage 3: the AnalyzeFlowEvent() of all modules, in this thread
+    while(std::optional<DecodedEvent> decoded = decodedEvents.pop()) {
+        TAFlags flags = 0;
+        TAFlowEvent* pFlow = decoded->flow;
+        for(auto& module : modules) {
+            pFlow = module->AnalyzeFlowEvent(&runinfo, &flags, pFlow);
+            if(flags & (TAFlag_SKIP | TAFlag_QUIT)) break;
+        }
+        // The flow events point into the event data, so they have to go first
+        delete pFlow;
+        delete decoded->event;
+        if(flags & TAFlag_QUIT) {
+            rawEvents.close();
+            decodedEvents.close();
+            break;
+        }
+    }
+    // Drain anything left behind after a quit
+    while(std::optional<DecodedEvent> decoded = decodedEvents.pop()) {
+        delete decoded->flow;
+        delete decoded->event;
+    }
+    reader.join();
+    decoder.join();
+    while(std::optional<TMEvent*> pEvent = rawEvents.pop()) delete *pEvent;
+
+    for(auto& module : modules) module->PreEndRun(&runinfo);
+    for(auto& module : modules) module->EndRun(&runinfo);
+
+    constexpr bool skipEmptyHistograms = false;
+    musip::dqm::DQMManager::instance().saveAsArchive(unit.partialFilename.c_str(), skipEmptyHistograms);
+    return readError ? 1 : 0;
+}
+
+/** @brief Adds up the partial files of a run and saves the result. Called in the parent process. */
+void mergeRun(const std::vector<TAFactory*>& factories, int runNumber, const std::vector<const WorkUnit*>& units,
+              const std::filesystem::path& outputPath, const std::vector<std::string>& args) {
+    musip::dqm::DQMManager& dqmManager = musip::dqm::DQMManager::instance();
+    dqmManager.clearAll();
+
+    // The modules get a BeginRun so that all their histograms exist, then the partial results are
+    // added, then EndRun makes the run level outputs from the sum.
+    TARunInfo runinfo(runNumber, units.front()->files.front().c_str(), args);
+    std::vector<std::unique_ptr<TARunObject>> modules;
+    for(TAFactory* factory : factories) modules.emplace_back(factory->NewRunObject(&runinfo));
+    for(auto& module : modules) module->BeginRun(&runinfo);
+
+    for(const WorkUnit* unit : units) {
+        dqmManager.addFromArchive(unit->partialFilename.c_str());
+        std::error_code error;
+        std::filesystem::remove(unit->partialFilename, error);
+    }
+
+    for(auto& module : modules) module->PreEndRun(&runinfo);
+    for(auto& module : modules) module->EndRun(&runinfo);
+
+    char filename[64];
+    snprintf(filename, sizeof(filename), "dqm_histos_%05d.root", runNumber);
+    const std::filesystem::path outputFilename = outputPath / filename;
+
+    constexpr bool skipEmptyHistograms = false;
+    dqmManager.saveAsRootFile(outputFilename.c_str(), skipEmptyHistograms);
+    snprintf(filename, sizeof(filename), "dqm_histos_%05d.dqm", runNumber);
+    dqmManager.saveAsArchive((outputPath / filename).c_str(), skipEmptyHistograms);
+    std::cout << "Run " << runNumber << " written to " << outputFilename << "\n";
+}
+
+/** @brief The run number from a MIDAS file name like run01234_005.mid.lz4, or -1. */
+int runNumberFromFilename(const std::string& filename) {
+    static const std::regex pattern("run0*([0-9]+)");
+    std::smatch match;
+    const std::string name = std::filesystem::path(filename).filename().string();
+    if(std::regex_search(name, match, pattern)) return std::stoi(match[1].str());
+    return -1;
+}
+
+/** @brief Splits the files of a run into at most `parts` contiguous groups of similar size.
+ *
+ * Contiguous so that each worker sees a continuous stretch of the run, which is what the modules
+ * keeping state between events (e.g. the cluster finder) expect. */
+std::vector<std::vector<std::string>> splitFiles(const std::vector<std::string>& files, size_t parts) {
+    parts = std::clamp<size_t>(parts, 1, files.size());
+    std::vector<uintmax_t> sizes;
+    uintmax_t total = 0;
+    for(const std::string& filename : files) {
+        std::error_code error;
+        const uintmax_t size = std::filesystem::file_size(filename, error);
+        sizes.push_back(error ? 1 : std::max<uintmax_t>(size, 1));
+        total += sizes.back();
+    }
+
+    std::vector<std::vector<std::string>> result(1);
+    uintmax_t done = 0;
+    for(size_t index = 0; index < files.size(); ++index) {
+        const size_t filesLeft = files.size() - index;
+        const size_t partsLeft = parts - result.size();
+        // Start a new part once this one has its share, or if every remaining file needs its own part
+        const bool full = done >= total * result.size() / parts;
+        if(!result.back().empty() && partsLeft > 0 && (full || filesLeft <= partsLeft)) result.emplace_back();
+        result.back().push_back(files[index]);
+        done += sizes[index];
+    }
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    namespace po = boost::program_options;
+
+    po::options_description options("quadreplay options");
+    options.add_options()
+        ("help", "help")
+        ("config", po::value<std::string>(), "JSON file to load configuration from")
+        ("output,o", po::value<std::string>()->default_value("root_output_files"), "Directory for the dqm_histos_*.root and *.dqm files")
+        ("jobs,j", po::value<size_t>()->default_value(std::max(1u, std::thread::hardware_concurrency())), "Number of worker processes")
+        ("run", po::value<int>(), "Run number of all files, instead of taking it from the file names")
+        ("queue-depth", po::value<size_t>()->default_value(64), "Events buffered between the pipeline stages of a worker")
+        ("files", po::value<std::vector<std::string>>()->multitoken(), "MIDAS files (.mid, .mid.lz4, ...)");
+    po::positional_options_description positional;
+    positional.add("files", -1);
+
+    po::variables_map variableMap;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(options).positional(positional).run(), variableMap);
+        po::notify(variableMap);
+    } catch(const std::exception& exception) {
+        std::cerr << "Unable to parse command line: " << exception.what() << "\n\n" << options;
+        return -1;
+    }
+
+    if(variableMap.count("help") || !variableMap.count("files")) {
+        std::cout << "Usage: quadreplay [options] file1.mid.lz4 [file2.mid.lz4 ...]\n" << options;
+        return variableMap.count("help") ? 0 : -1;
+    }
+
+    boost::property_tree::ptree& configuration = Configuration::config();
+    if(variableMap.count("config")) {
+        const std::string configFilename = variableMap["config"].as<std::string>();
+        try {
+            boost::property_tree::read_json(configFilename, configuration);
+        } catch(const std::exception& exception) {
+            std::cerr << "Unable to parse the config file '" << configFilename << "' because: " << exception.what()
+                      << "\n";
+            return -1;
+        }
+    }
+
+    const std::filesystem::path outputPath = variableMap["output"].as<std::string>();
+    const size_t jobs = std::max<size_t>(variableMap["jobs"].as<size_t>(), 1);
+    const size_t queueDepth = variableMap["queue-depth"].as<size_t>();
+    std::filesystem::create_directories(outputPath);
+
+    // Group the files by run
+    std::map<int, std::vector<std::string>> runs;
+    for(const std::string& filename : variableMap["files"].as<std::vector<std::string>>()) {
+        const int runNumber = variableMap.count("run") ? variableMap["run"].as<int>() : runNumberFromFilename(filename);
+        if(runNumber < 0) {
+            std::cerr << "Cannot tell the run number of " << filename << ", use --run\n";
+            return -1;
+        }
+        runs[runNumber].push_back(filename);
+    }
+
+    std::vector<WorkUnit> units;
+    for(auto& [runNumber, files] : runs) {
+        std::sort(files.begin(), files.end());
+        const auto parts = splitFiles(files, jobs);
+        for(size_t part = 0; part < parts.size(); ++part) {
+            char filename[64];
+            snprintf(filename, sizeof(filename), "dqm_histos_%05d.part%03zu.dqm", runNumber, part);
+            units.push_back(WorkUnit{runNumber, parts[part], outputPath / filename});
+        }
+    }
+
+    const std::vector<std::string> args(argv, argv + argc);
+    std::vector<std::unique_ptr<TAFactory>> factoryOwners;
+    std::vector<TAFactory*> factories = createModuleFactories();
+    for(TAFactory* factory : factories) {
+        factoryOwners.emplace_back(factory);
+        factory->Init(args);
+    }
+
+    //
+    // Run the workers. Threads do not survive a fork, so nothing in this process may start any
+    // before all workers are started. The DQMManager already exists, it is constructed during
+    // static initialisation, but it only starts its history loader on the first request for
+    // previous runs, which never happens here. Root must not be given work for its implicit
+    // multithreading pool before the fork either.
+    //
+    std::map<pid_t, const WorkUnit*> running;
+    size_t failures = 0;
+    auto reapOne = [&]() {
+        int status = 0;
+        const pid_t pid = waitpid(-1, &status, 0);
+        if(pid <= 0) return;
+        const WorkUnit* unit = running[pid];
+        running.erase(pid);
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::cerr << "Worker for run " << unit->runNumber << " (" << unit->files.front() << " ...) failed\n";
+            ++failures;
+        }
+    };
+    for(const WorkUnit& unit : units) {
+        while(running.size() >= jobs) reapOne();
+
+        fflush(nullptr); // so that buffered output isn't written twice
+        const pid_t pid = fork();
+        if(pid < 0) {
+            perror("fork");
+            ++failures;
+            break;
+        }
+        if(pid == 0) {
+            // The partial runs must not write masks, the merged run below does that
+            Configuration::config().put("quad.write_masks", false);
+            const int exitCode = replayPart(factories, unit, queueDepth, args);
+            fflush(nullptr);
+            _exit(exitCode); // skip the destructors of the parent's singletons
+        }
+        running[pid] = &unit;
+    }
+    while(!running.empty()) reapOne();
+
+    if(failures > 0) {
+        std::cerr << failures << " worker(s) failed, not merging\n";
+        return 1;
+    }
+
+    for(const auto& [runNumber, files] : runs) {
+        std::vector<const WorkUnit*> runUnits;
+        for(const WorkUnit& unit : units)
+            if(unit.runNumber == runNumber) runUnits.push_back(&unit);
+        mergeRun(factories, runNumber, runUnits, outputPath, args);
+    }
+
+    for(TAFactory* factory : factories) factory->Finish();
+    return 0;
+}
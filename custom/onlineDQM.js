@@ -12,7 +12,7 @@ function decodeHistogram(arraybuffer) {
     let currentByte = 0;
     let version = dataView.getUint8(currentByte++, little_endian);
 
-    if(version != 1) throw new Error("Don't know how to decode a histogram with version " + version);
+    if(version != 1 && version != 2) throw new Error("Don't know how to decode a histogram with version " + version);
 
     let histogram = {};
 
@@ -71,11 +71,47 @@ function decodeHistogram(arraybuffer) {
     currentByte += 8;
 
     currentByte = alignTo(currentByte, ordinateSize); // data will be aligned to its size
-    if(ordinateSize == 4 && !isIntegerType) histogram.data = new Float32Array(arraybuffer, currentByte, totalBins);
-    else if(ordinateSize == 4 && isIntegerType) histogram.data = new Uint32Array(arraybuffer, currentByte, totalBins);
-    else if(ordinateSize == 8) histogram.data = new Float64Array(arraybuffer, currentByte, totalBins);
+
+    let ArrayType;
+    if(ordinateSize == 4 && !isIntegerType) ArrayType = Float32Array;
+    else if(ordinateSize == 4 && isIntegerType) ArrayType = Uint32Array;
+    else if(ordinateSize == 8) ArrayType = Float64Array;
     else throw new Error("Don't know how to decode a histogram with ordinate size " + ordinateSize);
 
+    if(version == 1) {
+        histogram.data = new ArrayType(arraybuffer, currentByte, totalBins);
+        return histogram;
+    }
+
+    // Version 2 has a payload header saying how the bins are stored. See HistogramEncoder.hpp.
+    //  * 0: dense - every bin, as in version 1
+    //  * 1: sparse - a Uint32 index for each non-zero bin, then the values aligned to their size
+    //  * 2: runs - a Uint32 pair (first bin, length) for each run of non-zero bins, then the values
+    const encoding = dataView.getUint32(currentByte, little_endian);
+    const numberOfRecords = dataView.getUint32(currentByte + 4, little_endian);
+    currentByte += 8;
+
+    if(encoding == 0) {
+        histogram.data = new ArrayType(arraybuffer, currentByte, totalBins);
+    }
+    else if(encoding == 1) {
+        const indices = new Uint32Array(arraybuffer, currentByte, numberOfRecords);
+        const values = new ArrayType(arraybuffer, alignTo(currentByte + 4 * numberOfRecords, ordinateSize), numberOfRecords);
+        histogram.data = new ArrayType(totalBins);
+        for(let record = 0; record < numberOfRecords; ++record) histogram.data[indices[record]] = values[record];
+    }
+    else if(encoding == 2) {
+        const runs = new Uint32Array(arraybuffer, currentByte, 2 * numberOfRecords);
+        let valueByte = currentByte + 8 * numberOfRecords;
+        histogram.data = new ArrayType(totalBins);
+        for(let record = 0; record < numberOfRecords; ++record) {
+            const length = runs[2 * record + 1];
+            histogram.data.set(new ArrayType(arraybuffer, valueByte, length), runs[2 * record]);
+            valueByte += length * ordinateSize;
+        }
+    }
+    else throw new Error("Don't know how to decode histogram bins with encoding " + encoding);
+
     return histogram;
 }
 
@@ -129,8 +165,14 @@ function decodeHistogramMetadata(arraybuffer) {
 
 /** For internal use. Makes an RPC request and if the result was truncated by Midas make another request with the correct max_reply_length.
  *
- * This assumes that the response has an 8 byte header saying the actual message size and the type of the message (as all DQM responses do). */
-function dqmRemoteCall(cmd, args, expectedMessageType, dqmProgname, max_reply_length) {
+ * This assumes that the response has an 8 byte header saying the actual message size and the type of the message (as all DQM responses do).
+ * `expectedMessageType` can be an array if more than one type of reply is possible. The returned arraybuffer has the
+ * type of the reply set in its `messageType` property. */
+function dqmRemoteCall(cmd, args, expectedMessageType, dqmProgname, max_reply_length, attempt = 0) {
+    const messageType_wait = 0x77616974; // "wait", previous runs are still being loaded
+    const waitRetryDelay = 250; // milliseconds
+    const maximumWaitAttempts = 240; // i.e. give up after a minute
+
     return mjsonrpc_call("brpc", { "client_name": dqmProgname, "max_reply_length": max_reply_length, "cmd": cmd, "args": args}, "arraybuffer").then(
         function(rpc) {
             if(rpc.byteLength == 0) throw new Error("Empty response");
@@ -142,7 +184,15 @@ function dqmRemoteCall(cmd, args, expectedMessageType, dqmProgname, max_reply_le
             let dataView = new DataView(rpc);
             let expectedMessageLength = dataView.getUint32(0, true /*little endian*/);
             let messageType = dataView.getUint32(4); // Note that we read as big endian here. It's a 4 byte sequence we're reading, and order matters.
-            if(messageType != expectedMessageType) console.log("dqmRemoteCall() Warning: Unexpected message type '" + messageType + "'");
+
+            // The DQM instance is loading previous runs in the background. Ask again in a moment.
+            if(messageType == messageType_wait) {
+                if(attempt >= maximumWaitAttempts) throw new Error("Timed out waiting for previous runs to load");
+                return new Promise((resolve) => setTimeout(resolve, waitRetryDelay)).then(
+                    () => dqmRemoteCall(cmd, args, expectedMessageType, dqmProgname, max_reply_length, attempt + 1)
+                );
+            }
+            if(![].concat(expectedMessageType).includes(messageType)) console.log("dqmRemoteCall() Warning: Unexpected message type '" + messageType + "'");
 
             if(rpc.byteLength < expectedMessageLength) {
                 console.log("dqmRemoteCall() RPC call of size " + expectedMessageLength + " was truncated. Trying again with adequate \"max_reply_length\".");
@@ -152,15 +202,20 @@ function dqmRemoteCall(cmd, args, expectedMessageType, dqmProgname, max_reply_le
                         let dataView = new DataView(rpc);
                         let expectedMessageLength = dataView.getUint32(0, true /*little endian*/);
                         let messageType = dataView.getUint32(4); // Note that we read as big endian here. It's a 4 byte sequence we're reading, and order matters.
-                        if(messageType != expectedMessageType) console.log("dqmRemoteCall() Warning: Unexpected message type '" + messageType + "'");
+                        if(![].concat(expectedMessageType).includes(messageType)) console.log("dqmRemoteCall() Warning: Unexpected message type '" + messageType + "'");
 
                         if(rpc.byteLength < expectedMessageLength) throw new Error("Couldn't get full histogram data after second attempt");
-                        else return rpc.slice(8);
+
+                        let response = rpc.slice(8);
+                        response.messageType = messageType;
+                        return response;
                     }
                 );
             }
 
-            return rpc.slice(8);
+            let response = rpc.slice(8);
+            response.messageType = messageType;
+            return response;
         }
     );
 }
@@ -168,14 +223,54 @@ function dqmRemoteCall(cmd, args, expectedMessageType, dqmProgname, max_reply_le
 /** Asynchronously retrieves a histogram object from a DQM instance.
  *
  * The `runs` argument is an array of the run numbers that you want the histogram for, where `0` is
- * the current run. The default is `[0]` i.e. only the current run. */
-function getHistogram(name, runs = [0], dqmProgname = "ana") {
+ * the current run. The default is `[0]` i.e. only the current run.
+ *
+ * If `previous` is the histogram returned by an earlier call for the same name and runs, the DQM instance only
+ * sends the bins that changed since then. If nothing changed `previous` itself is returned, so callers can skip
+ * redrawing with `histogram === previous`. Otherwise a new histogram is returned and `previous` is left as it was. */
+function getHistogram(name, runs = [0], dqmProgname = "ana", previous = undefined) {
     const messageType_hist = 0x68697374; // equivalent to the 4 byte sequence "hist".
+    const messageType_vhst = 0x76687374; // "vhst", a full histogram with a version
+    const messageType_dlta = 0x646c7461; // "dlta", the bins that changed since the version we have
+    const messageType_nmod = 0x6e6d6f64; // "nmod", nothing changed since the version we have
     const initial_max_reply_length = 1048576;
 
-    return dqmRemoteCall("dqm::histogram", JSON.stringify({name: name, runs: runs}), messageType_hist, dqmProgname, initial_max_reply_length).then(
+    let args = {name: name, runs: runs};
+    // Versions are only given out for the current run, nothing else changes
+    if(runs.length == 1 && runs[0] == 0) args.since = (previous !== undefined && previous.version !== undefined ? previous.version : 0);
+
+    const messageTypes = [messageType_hist, messageType_vhst, messageType_dlta, messageType_nmod];
+    return dqmRemoteCall("dqm::histogram", JSON.stringify(args), messageTypes, dqmProgname, initial_max_reply_length).then(
         (response) => {
-            return decodeHistogram(response);
+            if(response.messageType == messageType_hist) return decodeHistogram(response);
+
+            // The versioned replies start with a 16 byte header, see the C++ DQMManager::UpdateHeader
+            const little_endian = true;
+            let dataView = new DataView(response);
+            const version = dataView.getUint32(0, little_endian);
+            const numberOfChangedBins = dataView.getUint32(4, little_endian);
+            const entries = dataView.getBigUint64(8, little_endian);
+
+            if(response.messageType == messageType_vhst) {
+                let histogram = decodeHistogram(response.slice(16));
+                histogram.version = version;
+                return histogram;
+            }
+            else if(response.messageType == messageType_nmod && previous !== undefined) {
+                return previous;
+            }
+            else if(response.messageType == messageType_dlta && previous !== undefined) {
+                // The indices of the changed bins, then their values aligned to 8 bytes
+                const indices = new Uint32Array(response, 16, numberOfChangedBins);
+                const values = new previous.data.constructor(response, 16 + Math.ceil(numberOfChangedBins / 2) * 8, numberOfChangedBins);
+                let histogram = Object.assign({}, previous);
+                histogram.data = previous.data.slice(); // a copy, so that `previous` is untouched
+                for(let index = 0; index < numberOfChangedBins; ++index) histogram.data[indices[index]] = values[index];
+                histogram.entries = entries;
+                histogram.version = version;
+                return histogram;
+            }
+            else throw new Error("Unexpected reply to a histogram request with type " + response.messageType);
         }
     );
 }
@@ -388,11 +483,21 @@ class PlotAutoUpdater {
                 if(sourceAsArray[index].hasOwnProperty("name")) name = sourceAsArray[index].name;
                 if(sourceAsArray[index].hasOwnProperty("prog")) dqmProg = sourceAsArray[index].prog;
 
-                return getHistogram(name, runs, dqmProg).then((histogram) => {
+                // Keep the last histogram of each series, so that we only get sent what changed since
+                const key = JSON.stringify([name, runs, dqmProg]);
+                if(mPlotGraph.dqmPrevious === undefined) mPlotGraph.dqmPrevious = [];
+                let previous = mPlotGraph.dqmPrevious[index];
+                if(previous !== undefined && previous.key !== key) previous = undefined;
+
+                return getHistogram(name, runs, dqmProg, previous === undefined ? undefined : previous.histogram).then((histogram) => {
                     mPlotGraph.error = null;
+                    if(previous !== undefined && histogram === previous.histogram) return; // Not modified, nothing to redraw
+                    mPlotGraph.dqmPrevious[index] = {key: key, histogram: histogram};
                     displayHistogram(histogram, mPlotGraph, index);
                 },
                 (error) => {
+                    // Whatever comes next has to be the full histogram, since the plot is cleared
+                    mPlotGraph.dqmPrevious[index] = undefined;
                     // We couldn't get the new histogram. We can't leave what was there before or
                     // people will think they're seeing the histogram they asked for. This is the
                     // only way I know to clear an MPlotGraph.
@@ -0,0 +1,93 @@
+/**
+ * @file deadband.h
+ * @brief Deadband and maximum republish interval for slow-control readbacks.
+ *
+ * Slow-control frontends read their channels every cycle, but most values do not change
+ * between two reads. Writing each of them to the ODB anyway costs an ODB write (and
+ * hotlink/history traffic) per channel and cycle. `DeadbandFilter` decides per channel
+ * whether a new reading is worth publishing: it is if it moved by more than the deadband
+ * from the last published value, or if the last publication is older than the maximum
+ * republish interval, so that a flat value still shows up regularly.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+class DeadbandFilter {
+   public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * @param n Number of channels.
+     * @param deadband Absolute change needed before a value is published again.
+     * @param max_interval A value is republished after this time even if it did not change.
+     *                     Zero disables the republishing.
+     */
+    explicit DeadbandFilter(size_t n = 0, float deadband = 0.f,
+                            clock::duration max_interval = std::chrono::seconds(60))
+        : m_default_deadband(deadband), m_max_interval(max_interval) {
+        resize(n);
+    }
+
+    /** @brief Change the number of channels, new channels get the default deadband. */
+    void resize(size_t n) {
+        m_deadband.resize(n, m_default_deadband);
+        m_published.resize(n, 0.f);
+        m_last_publish.resize(n, clock::time_point());
+        m_valid.resize(n, false);
+    }
+    size_t size() const { return m_deadband.size(); }
+
+    /** @brief Set the deadband of all channels. */
+    void set_deadband(float deadband) {
+        m_default_deadband = deadband;
+        m_deadband.assign(m_deadband.size(), deadband);
+    }
+    void set_deadband(size_t i, float deadband) { m_deadband.at(i) = deadband; }
+    void set_max_interval(clock::duration max_interval) { m_max_interval = max_interval; }
+
+    /**
+     * @brief Decide whether `value` has to be published for channel `i`.
+     *
+     * Returns true, and remembers `value` as the published one, if this is the first value,
+     * if it changed by more than the deadband, if it changed between NaN and a number, or if
+     * the maximum republish interval has passed. Otherwise returns false.
+     */
+    bool update(size_t i, float value, clock::time_point now = clock::now()) {
+        bool publish = !m_valid.at(i);
+        if (!publish) {
+            const float last = m_published[i];
+            if (std::isnan(value) || std::isnan(last))
+                publish = std::isnan(value) != std::isnan(last);
+            else
+                publish = std::fabs(value - last) > m_deadband[i];
+        }
+        if (!publish && m_max_interval != clock::duration::zero())
+            publish = now - m_last_publish[i] >= m_max_interval;
+
+        if (publish) {
+            m_published[i] = value;
+            m_last_publish[i] = now;
+            m_valid[i] = true;
+        }
+        return publish;
+    }
+
+    /** @brief Forget the published values, the next update of every channel publishes. */
+    void reset() { m_valid.assign(m_valid.size(), false); }
+
+    /** @brief The value last published for channel `i`. */
+    float published(size_t i) const { return m_published.at(i); }
+
+   private:
+    float m_default_deadband;
+    clock::duration m_max_interval;
+    std::vector<float> m_deadband;
+    std::vector<float> m_published;
+    std::vector<clock::time_point> m_last_publish;
+    std::vector<bool> m_valid;
+};
@@ -1,18 +0,0 @@
-/********************************************************************\
-
-  Name:         tcpip_rs232.h
-  Created by:   Thomas Prokscha
-
-  Contents:     Header file for TCPIP bus driver for RS232 devices
-
-  $Log$
-  Revision 1.1  2004/05/10 21:18:04  prokscha
-  Moved source code from midas/busd to midas/drivers/bus.
-
-  Revision 1.1  2002/08/28 11:47:02  nemu
-  Initial version.
-
-
-\********************************************************************/
-
-INT tcpip_rs232(INT cmd, ...);
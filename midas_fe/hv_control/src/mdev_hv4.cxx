@@ -7,7 +7,9 @@
 
 \********************************************************************/
 
+#include <future>
 #include <iostream>
+#include <map>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
@@ -17,6 +19,7 @@
 
 #include "mdev_hv4.h"
 
+#include <chrono>
 #include <cmath>
 
 void mdev_hv4::add_card(int address, std::vector<std::string> names, float voltage_limit, float current_limit) {
@@ -66,7 +69,11 @@ void mdev_hv4::odb_setup(void) {
            { "Names",              std::string(31, '\0')},
            { "Board",              std::string(31, '\0')},
            { "MSCB",               std::string(31, '\0')},
-           { "Group",              false}
+           { "Group",              false},
+
+           { "Deadband Voltage",   0.02f},  // V
+           { "Deadband Current",   0.05f},  // uA
+           { "Max Republish Interval", 60}  // s
    };
    settings.connect("/Equipment/" + m_equipment_name + "/Settings");
    m_settings.connect("/Equipment/" + m_equipment_name + "/Settings");
@@ -105,6 +112,12 @@ void mdev_hv4::init(void) {
 
    mscb_set_max_retry(1);
 
+   std::chrono::seconds max_interval((int) m_settings["Max Republish Interval"]);
+   m_voltage_filter = DeadbandFilter(m_length, m_settings["Deadband Voltage"], max_interval);
+   m_current_filter = DeadbandFilter(m_length, m_settings["Deadband Current"], max_interval);
+   m_voltage_mirror.assign(m_length, (float) ss_nan());
+   m_current_mirror.assign(m_length, (float) ss_nan());
+
    int n=0;
    for (hv4_card &card : m_card) {
 
@@ -155,12 +168,36 @@ void mdev_hv4::init(void) {
          m_output_on_mirror.push_back((*card.m_mscb)[card.m_mscb->idx("On0")+i]);
          m_settings["Output On"][n] = m_output_on_mirror[n];
 
-         m_variables["Voltage"][n] = (float) (*card.m_mscb)["HVMeas"];
-         m_variables["Current"][n] = (float) (*card.m_mscb)[card.m_mscb->idx("I0")+i];
+         m_voltage_mirror[n] = (float) (*card.m_mscb)["HVMeas"];
+         m_current_mirror[n] = (float) (*card.m_mscb)[card.m_mscb->idx("I0")+i];
+         m_voltage_filter.update(n, m_voltage_mirror[n]);
+         m_current_filter.update(n, m_current_mirror[n]);
+         m_variables["Voltage"][n] = m_voltage_mirror[n];
+         m_variables["Current"][n] = m_current_mirror[n];
       }
    }
 
+   m_enabled.resize(m_length);
+   for (int i = 0; i < m_length; i++)
+      m_enabled[i] = m_settings["Enabled"][i];
+   m_tripped.assign(m_length, false);
+
+   // group the cards by submaster, one readout task per group
+   std::map<std::string, size_t> submaster_index;
+   m_submaster_cards.clear();
+   for (size_t c = 0; c < m_card.size(); c++) {
+      auto result = submaster_index.emplace(m_card[c].m_submaster, m_submaster_cards.size());
+      if (result.second)
+         m_submaster_cards.emplace_back();
+      m_submaster_cards[result.first->second].push_back(c);
+   }
+
    // install callbacks
+   m_settings["Enabled"].watch([this](midas::odb &o) {
+      for (int i = 0; i < m_length; i++)
+         m_enabled[i] = o[i];
+   });
+
    m_settings["Output On"].watch([this](midas::odb &o) {
       // set output state on or off
       for (int i = 0; i < m_length; i++) {
@@ -209,48 +246,97 @@ void mdev_hv4::exit(void) {
 
 /*------------------------------------------------------------------*/
 
+// Issue one read_range() per card, which fetches all channels of the node in a single
+// transaction. Submasters are independent network connections, so each of them gets its own
+// task; cards behind the same submaster are read one after the other.
+void mdev_hv4::read_cards(std::vector<int>& status) {
+   status.assign(m_card.size(), MSCB_SUCCESS);
+
+   std::vector<std::future<void>> tasks;
+   for (const auto& cards : m_submaster_cards) {
+      tasks.push_back(std::async(std::launch::async, [this, &cards, &status]() {
+         for (size_t c : cards) {
+            bool enabled = false;
+            for (size_t i = 4 * c; i < 4 * c + 4; i++)
+               enabled = enabled || m_enabled[i];
+            if (enabled && m_card[c].m_mscb)
+               status[c] = m_card[c].m_mscb->read_range();
+         }
+      }));
+   }
+   for (auto& task : tasks)
+      task.get();
+}
+
 void mdev_hv4::loop(void) {
    static DWORD last_time_measured = 0;
 
    // read values once per second
    if (ss_millitime() - last_time_measured > 1000) {
-      int status = MSCB_SUCCESS;
+      std::vector<int> card_status;
+      read_cards(card_status);
+      cm_yield(0);
+
       for (int i = 0; i < m_length; i++) {
-         cm_yield(0);
-         if (!m_settings["Enabled"][i])
+         if (!m_enabled[i])
             continue;
 
          auto m = m_card[i/4].m_mscb;
-         if (i % 4 == 0)
-            status = m->read_range();
+         int status = card_status[i/4];
 
          if (status != MSCB_SUCCESS) {
-            m_demand_mirror[i] = (float)ss_nan();
-            m_variables["Demand"][i] = m_demand_mirror[i];
-
-            m_output_on_mirror[i] = false;
-            m_settings["Output On"][i] = m_output_on_mirror[i];
-
-            m_variables["Voltage"][i] = (float)ss_nan();
-            m_variables["Current"][i] = (float)ss_nan();
+            if (!std::isnan(m_demand_mirror[i])) {
+               m_demand_mirror[i] = (float)ss_nan();
+               m_variables["Demand"][i] = m_demand_mirror[i];
+            }
+
+            if (m_output_on_mirror[i]) {
+               m_output_on_mirror[i] = false;
+               m_settings["Output On"][i] = m_output_on_mirror[i];
+            }
+
+            m_voltage_mirror[i] = (float)ss_nan();
+            m_current_mirror[i] = (float)ss_nan();
+            if (m_voltage_filter.update(i, m_voltage_mirror[i]))
+               m_variables["Voltage"][i] = m_voltage_mirror[i];
+            if (m_current_filter.update(i, m_current_mirror[i]))
+               m_variables["Current"][i] = m_current_mirror[i];
 
             std::string s = "Communication error with \"" +
                     m->get_submaster() + ":" +
                     std::to_string(m->get_node_address()) + "\"";
             mthrow1(s);
          } else {
-            m_demand_mirror[i] = (*m)["HV"];
-            m_variables["Demand"][i] = m_demand_mirror[i];
-
-            m_output_on_mirror[i] = (bool) (*m)[m->idx("On0") + (i % 4)];
-            m_settings["Output On"][i] = m_output_on_mirror[i];
+            // every ODB write triggers hotlinks and history, so only write what changed
+            float demand = (float) (*m)["HV"];
+            if (demand != m_demand_mirror[i]) {
+               m_demand_mirror[i] = demand;
+               m_variables["Demand"][i] = m_demand_mirror[i];
+            }
+
+            bool on = (bool) (*m)[m->idx("On0") + (i % 4)];
+            if (on != m_output_on_mirror[i]) {
+               m_output_on_mirror[i] = on;
+               m_settings["Output On"][i] = m_output_on_mirror[i];
+            }
 
             float f = (*m)["HVMeas"];
             f = std::round(f * 100) / 100;
             if (!m_output_on_mirror[i])
                f = 0;
-            m_variables["Voltage"][i] = f;
-            m_variables["Current"][i] = (float) (*m)[m->idx("I0") + (i % 4)];
+            m_voltage_mirror[i] = f;
+            m_current_mirror[i] = (float) (*m)[m->idx("I0") + (i % 4)];
+            if (m_voltage_filter.update(i, m_voltage_mirror[i]))
+               m_variables["Voltage"][i] = m_voltage_mirror[i];
+            if (m_current_filter.update(i, m_current_mirror[i]))
+               m_variables["Current"][i] = m_current_mirror[i];
+
+            // report trips and current spikes right away rather than waiting for the history
+            bool tripped = m_current_limit[i] > 0 && m_current_mirror[i] > m_current_limit[i];
+            if (tripped && !m_tripped[i])
+               cm_msg(MERROR, "mdev_hv4", "Current %1.2lfuA exceeds limit of %1.2lfuA for channel \"%s\" (index %d)",
+                      m_current_mirror[i], m_current_limit[i], m_names[i].c_str(), i);
+            m_tripped[i] = tripped;
          }
       }
       last_time_measured = ss_millitime();
@@ -265,16 +351,17 @@ int mdev_hv4::read_event(char *pevent, int off) {
    // init bank structure
    bk_init32a(pevent);
 
-   // create a bank with measured voltage values
+   // create a bank with measured voltage values, taken from the last readback rather than the
+   // ODB so that the event has full resolution independent of the deadband
    bk_create(pevent, "SVOL", TID_FLOAT, (void **)&pdata);
    for (int i = 0; i < m_length; i++)
-      *pdata++ = m_variables["Voltage"][i];
+      *pdata++ = m_voltage_mirror[i];
    bk_close(pevent, pdata);
 
    // create a bank with measured current values
    bk_create(pevent, "SCUR", TID_FLOAT, (void **)&pdata);
    for (int i = 0; i < m_length; i++)
-      *pdata++ = m_variables["Current"][i];
+      *pdata++ = m_current_mirror[i];
    bk_close(pevent, pdata);
 
    return bk_size(pevent);
@@ -14,6 +14,8 @@
 #include "mscbxx.h"
 #include "mdev.h"
 
+#include "../../deadband.h"
+
 class hv4_card {
    public:
     std::string m_submaster;
@@ -43,9 +45,23 @@ class mdev_hv4 : public mdev {
 
     std::vector<float> m_demand_mirror;
     std::vector<bool> m_output_on_mirror;
+    std::vector<float> m_voltage_mirror;
+    std::vector<float> m_current_mirror;
+
+    // only readbacks that moved by more than the deadband are written to the ODB
+    DeadbandFilter m_voltage_filter;
+    DeadbandFilter m_current_filter;
 
     std::vector<hv4_card> m_card;
 
+    // Enabled flags mirrored from the ODB, so the readout does not hit the ODB per channel
+    std::vector<bool> m_enabled;
+    // card indices per submaster: cards behind different submasters are read concurrently
+    std::vector<std::vector<size_t>> m_submaster_cards;
+    std::vector<bool> m_tripped;
+
+    void read_cards(std::vector<int>& status);
+
    public:
     mdev_hv4(std::string equipment_name)
         : mdev(equipment_name), m_length(0), m_group_flag(false) {};
@@ -10,6 +10,8 @@ class BaseClient {
     virtual bool Connect();
     virtual bool Write(std::string str);
     virtual bool ReadReply(std::string* str, size_t = 3);
+    // false once the transport noticed that the instrument dropped the connection
+    virtual bool IsConnected() { return true; }
     virtual int GetWaitTime() { return default_wait; }
     virtual void SetDefaultWaitTime(int value) { default_wait = value; }
 
@@ -187,6 +187,7 @@ INT Keithley2450Driver::ReadAll() {
         fvalue = ReadCurrent(i, err);
         err_accumulated = err_accumulated | err;
         if (fabs(current[i] - fvalue) > fabs(relevantchange * current[i])) {
+            const std::lock_guard<std::mutex> lock(power_mutex);  // checked by the ramp thread
             current[i] = fvalue;
             variables["Current"][i] = fvalue;
         }
@@ -14,6 +14,9 @@ PowerDriver::~PowerDriver() {
     if (readthread.joinable()) {
         readthread.join();
     }
+    if (rampthread.joinable()) {
+        rampthread.join();
+    }
 }
 
 INT PowerDriver::ConnectODB() {
@@ -34,9 +37,18 @@ INT PowerDriver::ConnectODB() {
     settings["Stop Bits"](1.0);
     settings["Flow Control"]("Software");
     settings["DriverName"]("");
+    settings["Connect Timeout"](2000);               // ms
+    settings["Reconnect Backoff Min"](1000);         // ms
+    settings["Reconnect Backoff Max"](60000);        // ms
+    settings["Ramp Step"](0.f);                      // V, 0 sets the demand voltage in one go
+    settings["Ramp Rate"](1.f);                      // V/s
+    settings["Ramp Abort Current Fraction"](0.95f);  // of the current limit
 
     // Variables
     variables.connect("/Equipment/" + name + "/Variables");
+    variables["Connected"](false);
+    variables["Connect Time"](0.f);     // ms needed for the last successful connect
+    variables["Outage Duration"](0.f);  // s without connection, for the current or last outage
     // decimal places to check
     relevantchange = 0.001;  // only take action when values change more than this value
 
@@ -60,8 +72,10 @@ INT PowerDriver::Connect() {
                 std::cout << "Set hostname key as " << settings["Hostnafme"] << std::endl;
             }
         }
-        client =
+        TCPClient* tcpclient =
             new TCPClient(settings["IP"], settings["port"], settings["reply timout"], hostname);
+        tcpclient->SetConnectTimeout(settings["Connect Timeout"]);
+        client = tcpclient;
     } else if (conn_type == "Serial") {
         std::string usbp(settings["USB_PORT"]);
         std::string parit(settings["Parity"]);
@@ -76,21 +90,81 @@ INT PowerDriver::Connect() {
     std::string ip(settings["IP"]);
     min_reply_length = settings["min reply"];
 
-    if (!client->Connect()) {
+    if (!ConnectClient()) {
         cm_msg(MERROR, "Connect to power supply ... ", "could not connect to %s.", ip.c_str());
         return FE_ERR_HW;
     } else {
         cm_msg(MINFO, "power_fe", "Init Connection to %s alive.", ip.c_str());
     }
 
-    // Also start the read thread here
+    // Also start the read and ramp threads here
     readthread = std::thread(&PowerDriver::ReadLoop, this);
+    rampthread = std::thread(&PowerDriver::RampLoop, this);
 
     return FE_SUCCESS;
 }
 
+bool PowerDriver::ConnectClient() {
+    auto start = std::chrono::steady_clock::now();
+    bool success = client->Connect();
+    if (success) {
+        std::chrono::duration<float, std::milli> connect_time =
+            std::chrono::steady_clock::now() - start;
+        variables["Connect Time"] = connect_time.count();
+    }
+    variables["Connected"] = success;
+    return success;
+}
+
+// Called from the read thread as long as the client reports a lost connection. Every driver has
+// its own read thread, so an instrument that is down only stalls itself and the other supplies
+// keep updating.
+void PowerDriver::Reconnect() {
+    auto now = std::chrono::steady_clock::now();
+    if (!reconnecting) {
+        reconnecting = true;
+        outage_start = now;
+        next_reconnect = now;
+        reconnect_backoff = std::chrono::milliseconds(int(settings["Reconnect Backoff Min"]));
+        variables["Connected"] = false;
+        cm_msg(MERROR, "power_fe", "Lost connection to %s, trying to reconnect", name.c_str());
+        set_equipment_status(name.c_str(), "Reconnecting...", "yellowLight");
+    }
+    if (now < next_reconnect)
+        return;
+
+    bool success;
+    {
+        const std::lock_guard<std::mutex> lock(power_mutex);
+        success = ConnectClient();
+    }
+
+    now = std::chrono::steady_clock::now();
+    std::chrono::duration<float> outage = now - outage_start;
+    variables["Outage Duration"] = outage.count();
+
+    if (success) {
+        reconnecting = false;
+        cm_msg(MINFO, "power_fe", "Reconnected to %s after %.1f s", name.c_str(), outage.count());
+        set_equipment_status(name.c_str(), "Ok", "greenLight");
+        return;
+    }
+
+    // exponential backoff, so a supply that is switched off is not hammered with connects
+    next_reconnect = now + reconnect_backoff;
+    reconnect_backoff = std::min(reconnect_backoff * 2,
+                                 std::chrono::milliseconds(int(settings["Reconnect Backoff Max"])));
+}
+
 void PowerDriver::ReadLoop() {
     while (!stop) {
+        if (!client->IsConnected()) {
+            readstatus = FE_ERR_HW;
+            Reconnect();
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+
         if (read) {
             std::this_thread::sleep_for(std::chrono::milliseconds(10));
             // cm_msg(MINFO, "Power Fe ... ", "Call Read All ... ");
@@ -111,6 +185,153 @@ void PowerDriver::ReadLoop() {
     }
 }
 
+void PowerDriver::StartRamp(int index, float value) {
+    // ramp_mutex only guards the Ramp state, the ODB is written after it is released
+    bool resized(false);
+    float start;
+    {
+        const std::lock_guard<std::mutex> lock(ramp_mutex);
+        if (ramps.size() != demandvoltage.size()) {
+            ramps.resize(demandvoltage.size());
+            resized = true;
+        }
+
+        // a new demand during a ramp continues from the set point reached so far
+        Ramp& ramp = ramps[index];
+        if (!ramp.active)
+            ramp.setpoint = DemandVoltage(index);
+        ramp.start = ramp.setpoint;
+        ramp.target = value;
+        ramp.step = fabs(float(settings["Ramp Step"]));
+        float rate = settings["Ramp Rate"];
+        ramp.interval = std::chrono::steady_clock::duration::zero();
+        if (rate > 0)
+            ramp.interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<float>(ramp.step / rate));
+        ramp.next_step = std::chrono::steady_clock::now();
+        ramp.active = true;
+        ramp.generation++;
+        start = ramp.start;
+    }
+    if (resized)
+        variables["Ramp Progress"] = std::vector<float>(demandvoltage.size(), 1.f);
+    variables["Ramp Progress"][index] = 0.f;
+
+    cm_msg(MINFO, "Power supply ... ", "ramping %s channel %d from %f to %f", name.c_str(),
+           instrumentID[index], start, value);
+}
+
+void PowerDriver::RampLoop() {
+    // settings and variables belong to the main thread and its watches, the ramp thread uses
+    // its own handles
+    midas::odb rampsettings("/Equipment/" + name + "/Settings");
+    midas::odb rampvariables("/Equipment/" + name + "/Variables");
+
+    // ends the ramp unless StartRamp has started a new one since the copy was taken
+    auto stopRamp = [this](unsigned int i, unsigned int generation) {
+        const std::lock_guard<std::mutex> lock(ramp_mutex);
+        if (ramps[i].generation != generation)
+            return false;
+        ramps[i].active = false;
+        return true;
+    };
+
+    while (!stop) {
+        // step copies of the active ramps, so that StartRamp in the main thread never waits
+        // for the writes to a slow instrument
+        std::vector<std::pair<unsigned int, Ramp>> active;
+        {
+            const std::lock_guard<std::mutex> lock(ramp_mutex);
+            for (unsigned int i = 0; i < ramps.size(); i++)
+                if (ramps[i].active)
+                    active.emplace_back(i, ramps[i]);
+        }
+
+        float abort_fraction(0);
+        if (!active.empty())
+            abort_fraction = rampsettings["Ramp Abort Current Fraction"];
+        auto now = std::chrono::steady_clock::now();
+        for (const auto& [i, ramp] : active) {
+            // abort on over-current on every pass, also while waiting for the next step, using
+            // the latest readback of the read thread
+            float readback(0), limit(0);
+            {
+                const std::lock_guard<std::mutex> powerlock(power_mutex);
+                if (i < current.size() && i < currentlimit.size()) {
+                    readback = current[i];
+                    limit = currentlimit[i];
+                }
+            }
+            if (limit > 0 && fabs(readback) >= abort_fraction * limit) {
+                if (!stopRamp(i, ramp.generation))
+                    continue;
+                rampvariables["Demand Voltage"][i] = ramp.setpoint;
+                cm_msg(MERROR, "Power supply ... ",
+                       "ramp of %s channel %d aborted at %f, current %f close to limit %f",
+                       name.c_str(), instrumentID[i], ramp.setpoint, readback, limit);
+                continue;
+            }
+
+            if (now < ramp.next_step)
+                continue;
+
+            float next = ramp.target;
+            if (ramp.step > 0) {
+                if (ramp.target > ramp.setpoint)
+                    next = std::min(ramp.setpoint + ramp.step, ramp.target);
+                else
+                    next = std::max(ramp.setpoint - ramp.step, ramp.target);
+            }
+
+            // the target was checked against the limits before the ramp was started
+            INT err;
+            WriteVoltage(i, next, err);
+            if (err != FE_SUCCESS) {
+                if (!stopRamp(i, ramp.generation))
+                    continue;
+                rampvariables["Demand Voltage"][i] = ramp.setpoint;
+                cm_msg(MERROR, "Power supply ... ",
+                       "ramp of %s channel %d failed at %f, error %d", name.c_str(),
+                       instrumentID[i], next, err);
+                continue;
+            }
+
+            float progress(1.f);
+            bool done(false);
+            {
+                const std::lock_guard<std::mutex> lock(ramp_mutex);
+                // the supply is at next also if the ramp was restarted during the write, a new
+                // ramp continues from there
+                Ramp& state = ramps[i];
+                state.setpoint = next;
+                {
+                    const std::lock_guard<std::mutex> powerlock(power_mutex);
+                    demandvoltage[i] = next;
+                }
+                if (state.generation != ramp.generation)
+                    continue;
+                state.next_step = now + state.interval;
+                if (state.target != state.start)
+                    progress = (next - state.start) / (state.target - state.start);
+                if (next == state.target) {
+                    state.active = false;
+                    done = true;
+                }
+            }
+            rampvariables["Ramp Progress"][i] = progress;
+            if (done)
+                cm_msg(MINFO, "Power supply ... ", "ramp of %s channel %d to %f done",
+                       name.c_str(), instrumentID[i], ramp.target);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+float PowerDriver::DemandVoltage(int index) {
+    const std::lock_guard<std::mutex> lock(power_mutex);
+    return demandvoltage[index];
+}
+
 bool PowerDriver::Enabled() {
     midas::odb common("/Equipment/" + name + "/Common");
 
@@ -578,8 +799,7 @@ void PowerDriver::SetCurrentLimit(int index, float value, INT& error) {
     }
 }
 
-void PowerDriver::SetVoltage(int index, float value, INT& error) {
-    error = FE_SUCCESS;
+bool PowerDriver::VoltageAllowed(float value) {
     std::string classname(getDriverName());
 
     if (classname == "Keithley2450") {
@@ -588,9 +808,7 @@ void PowerDriver::SetVoltage(int index, float value, INT& error) {
         if (sourceMode == "CURR") {
             cm_msg(MERROR, "Power supply ... ",
                    "voltage change is not allowed for this device given the source mode.");
-            variables["Demand Voltage"][index] = demandvoltage[index];  // Disable request
-            error = FE_ERR_DISABLED;
-            return;
+            return false;
         }
     }
 
@@ -598,9 +816,7 @@ void PowerDriver::SetVoltage(int index, float value, INT& error) {
     if ((classname.find("Keithley") == std::string::npos)  // not a Keithley
         && (value < -0.1 || value > 25.)) {
         cm_msg(MERROR, "Power supply ... ", "voltage of %f not allowed.", value);
-        variables["Demand Voltage"][index] = demandvoltage[index];  // Disable request
-        error = FE_ERR_DISABLED;
-        return;
+        return false;
     }
 
     // For some reason making sure that Keithleys cant set the voltage (except the 6487 ofc)
@@ -610,11 +826,27 @@ void PowerDriver::SetVoltage(int index, float value, INT& error) {
         // && (classname.find("6487") != std::string::npos) // the Keithley6487
     ) {
         cm_msg(MERROR, "Power supply ... ", "voltage of %f not allowed.", value);
-        variables["Demand Voltage"][index] = demandvoltage[index];  // Disable request
+        return false;
+    }
+
+    return true;
+}
+
+void PowerDriver::SetVoltage(int index, float value, INT& error) {
+    error = FE_SUCCESS;
+
+    if (!VoltageAllowed(value)) {
+        variables["Demand Voltage"][index] = DemandVoltage(index);  // Disable request
         error = FE_ERR_DISABLED;
         return;
     }
 
+    WriteVoltage(index, value, error);
+}
+
+void PowerDriver::WriteVoltage(int index, float value, INT& error) {
+    error = FE_SUCCESS;
+
     // Have to lock it here, otherwise you might change the wrong channel
     // as a consequence you can not call the Read functions or, you try to lock a second time
     const std::lock_guard<std::mutex> lock(power_mutex);
@@ -772,6 +1004,7 @@ void PowerDriver::CurrentLimitChanged() {
                 cm_msg(MINFO, "Power supply ... ", "changing %s current limit of channel %d to %f",
                        name.c_str(), instrumentID[i], value);
                 nChannelsChanged++;
+                const std::lock_guard<std::mutex> lock(power_mutex);  // checked by the ramp thread
                 currentlimit[i] = value;
             } else {
                 variables["Current Limit"][i] = currentlimit[i];  // Set back to local book keeping
@@ -816,20 +1049,46 @@ void PowerDriver::SetStateChanged() {
 void PowerDriver::DemandVoltageChanged() {
     INT err;
     int nChannelsChanged(0);
+    bool ramped = float(settings["Ramp Step"]) > 0;
     for (unsigned int i(0); i < demandvoltage.size(); i++) {
         float value(variables["Demand Voltage"][i]);
-        if (fabs(value - demandvoltage[i]) >
-            fabs(relevantchange *
-                 demandvoltage[i])) {  // Compare to local book keeping, look for significant change
+        // during a ramp demandvoltage follows the steps, the request is compared to the target
+        float demand;
+        bool rampactive(false);
+        {
+            const std::lock_guard<std::mutex> lock(ramp_mutex);
+            demand = DemandVoltage(i);
+            if (i < ramps.size() && ramps[i].active) {
+                rampactive = true;
+                demand = ramps[i].target;
+            }
+        }
+        // while a ramp runs the ramp thread owns the channel, with ramping switched off
+        // StartRamp makes it set the rest in one go
+        if ((rampactive && !ramped) ||
+            fabs(value - demand) >
+                fabs(relevantchange *
+                     demand)) {  // Compare to local book keeping, look for significant change
+            if (ramped || rampactive) {
+                // the ramp thread does the writes, demandvoltage follows the ramp
+                if (!VoltageAllowed(value)) {
+                    variables["Demand Voltage"][i] = demand;  // Disable request
+                    continue;
+                }
+                StartRamp(i, value);
+                nChannelsChanged++;
+                continue;
+            }
             SetVoltage(i, value, err);
             if (err == FE_SUCCESS) {
                 cm_msg(MINFO, "Power supply ... ", "changing %s voltage of channel %d to %f",
                        name.c_str(), instrumentID[i], value);
                 nChannelsChanged++;
+                const std::lock_guard<std::mutex> lock(power_mutex);
                 demandvoltage[i] = value;
             } else {
                 variables["Demand Voltage"][i] =
-                    demandvoltage[i];  // Set back to local book keeping
+                    DemandVoltage(i);  // Set back to local book keeping
                 cm_msg(MERROR, "Power supply ... ",
                        "changing %s voltage of channel %d to %f failed, error %d", name.c_str(),
                        instrumentID[i], value, err);
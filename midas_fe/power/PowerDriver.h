@@ -9,6 +9,7 @@
 #define POWERDRIVER_H
 
 #include <atomic>
+#include <chrono>
 #include <iostream>
 #include <mutex>
 #include <thread>
@@ -74,8 +75,10 @@ class PowerDriver {
 
     INT Connect();
     INT GetReadStatus() { return readstatus; }
+    bool Reconnecting() const { return reconnecting; }
 
     void ReadLoop();
+    void RampLoop();
     void StartReading() {
         read = 1;
         readonlythisindex = -1;
@@ -147,6 +150,32 @@ class PowerDriver {
     std::atomic<INT> readstatus;
     std::atomic<int> readonlythisindex;
 
+    // reconnect state machine, only touched from the read thread
+    std::atomic<bool> reconnecting{false};
+    std::chrono::steady_clock::time_point outage_start;
+    std::chrono::steady_clock::time_point next_reconnect;
+    std::chrono::milliseconds reconnect_backoff{0};
+    void Reconnect();
+    bool ConnectClient();
+
+    // Voltage ramps, stepped by their own thread so that the read thread keeps reading back
+    // in between the set-point writes
+    struct Ramp {
+        bool active = false;
+        float start = 0;
+        float target = 0;
+        float setpoint = 0;
+        float step = 0;
+        std::chrono::steady_clock::duration interval{0};
+        std::chrono::steady_clock::time_point next_step;
+        unsigned int generation = 0;  // counts the StartRamp calls, the ramp thread works on copies
+    };
+    std::vector<Ramp> ramps;
+    std::mutex ramp_mutex;
+    std::thread rampthread;
+    void StartRamp(int, float);
+    float DemandVoltage(int);  // demandvoltage is written by the ramp thread, under power_mutex
+
     // read
     float Read(std::string, INT&);
     float ReadSetVoltage(int, INT&);
@@ -165,6 +194,8 @@ class PowerDriver {
     void SetStateChanged();
     void SetState(int, bool, INT&);
     void SetVoltage(int, float, INT&);
+    bool VoltageAllowed(float);
+    void WriteVoltage(int, float, INT&);
     void SetCurrent(int, float, INT&);
     void DemandVoltageChanged();
     void DemandCurrentChanged();
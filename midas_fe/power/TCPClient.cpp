@@ -17,9 +17,18 @@ TCPClient::TCPClient(std::string IP, int P, int to, std::string hn) : BaseClient
 
 bool TCPClient::Connect() {
     boost::system::error_code ec;
+    // a reconnect starts from a fresh socket, whatever state the old one was left in
+    if (socket->is_open())
+        socket->close(ec);
+    connected = false;
+
+    boost::asio::ip::tcp::endpoint endpoint;
     if (hostname.length() < 1) {
-        socket->connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address(ip), port),
-                        ec);
+        endpoint = boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address(ip, ec), port);
+        if (ec) {
+            std::cout << " invalid ip " << ip << ": " << ec.message() << std::endl;
+            return false;
+        }
     } else {
         std::cout << "hostname " << hostname << std::endl;
 
@@ -27,36 +36,65 @@ bool TCPClient::Connect() {
 
         // Resolve hostname with empty service (you can replace "" with a service like "http" if
         // needed)
-        auto iter = resolver.resolve(hostname, "");
+        auto results = resolver.resolve(hostname, "", ec);
+        if (ec || results.empty()) {
+            std::cout << " resolving " << hostname << " failed: " << ec.message() << std::endl;
+            return false;
+        }
 
         // Use the first resolved endpoint and set the desired port
-        boost::asio::ip::tcp::endpoint endpoint = iter.begin()->endpoint();
+        endpoint = results.begin()->endpoint();
         endpoint.port(port);
 
         std::cout << "ip derived " << endpoint.address() << " " << endpoint.port() << std::endl;
+    }
 
-        // Connect using the socket and capture any error
-        socket->connect(endpoint, ec);
+    // Connect asynchronously and only wait connect_time_out for it, a blocking connect to a dead
+    // instrument only returns after the kernel gives up (minutes)
+    ec = boost::asio::error::would_block;
+    socket->async_connect(endpoint, [&ec](const boost::system::error_code& result) { ec = result; });
+    io_context.restart();
+    io_context.run_for(std::chrono::milliseconds(connect_time_out));
+    if (!io_context.stopped()) {
+        // timed out, cancel the pending connect and let its handler run
+        boost::system::error_code ignored;
+        socket->close(ignored);
+        io_context.run();
+        ec = boost::asio::error::timed_out;
     }
+
     if (ec) {
         std::cout << " socket->connect failed with err:" << ec << std::endl;
         return false;
     }
     socket->non_blocking(true);
+    connected = true;
     FlushQueu();
     return true;
 }
 
+void TCPClient::LostConnection(const boost::system::error_code& error) {
+    if (!connected)
+        return;
+    cm_msg(MERROR, "TCPClient", "connection to %s lost: %s",
+           (hostname.empty() ? ip : hostname).c_str(), error.message().c_str());
+    connected = false;
+    boost::system::error_code ignored;
+    socket->close(ignored);
+}
+
 TCPClient::~TCPClient() { socket->close(); }
 
 bool TCPClient::Write(std::string str) {
-    if (!socket->is_open())
+    if (!connected || !socket->is_open())
         return false;
     boost::system::error_code error;
     boost::asio::write(*socket, boost::asio::buffer(str), error);
     if (!error) {
     } else {
         std::cout << "send failed: " << error.message() << std::endl;
+        if (error != boost::asio::error::would_block)
+            LostConnection(error);
         return false;
     }
 
@@ -75,6 +113,8 @@ bool TCPClient::FlushQueu() {
     while (int(data_size) > 0) {
         socket->read_some(boost::asio::buffer(data), error);
         if (error) {
+            if (error == boost::asio::error::eof || error == boost::asio::error::connection_reset)
+                LostConnection(error);
             std::cout << " size request failed " << std::endl;
             return false;
         }
@@ -93,11 +133,18 @@ bool TCPClient::ReadReply(std::string* str, size_t min_size) {
     int time_elapsed = 0;
     boost::system::error_code error;
 
+    if (!connected) {
+        str->clear();
+        return false;
+    }
+
     // wait for at least 3 characters (minimum reply for  is "*\n")
     while (time_elapsed < read_time_out && data_size < min_size) {
         data_size = socket->available(error);
-        if (error)
+        if (error) {
             std::cout << " size request failed " << std::endl;
+            break;
+        }
         std::this_thread::sleep_for(std::chrono::milliseconds(default_wait));
         auto end = std::chrono::system_clock::now();
         time_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
@@ -108,9 +155,13 @@ bool TCPClient::ReadReply(std::string* str, size_t min_size) {
 
     // read
     boost::asio::streambuf buf;
-    try {
-        read_until(*socket, buf, read_stop);
-    } catch (...) {
+    read_until(*socket, buf, read_stop, error);
+    if (error == boost::asio::error::eof || error == boost::asio::error::connection_reset ||
+        error == boost::asio::error::broken_pipe || error == boost::asio::error::not_connected) {
+        LostConnection(error);
+        str->clear();
+        return false;
+    } else if (error) {
         cm_msg(MERROR, "ReadReply", "read_until failed");
     }
 
@@ -1,6 +1,7 @@
 #ifndef TCPCLIENT_H
 #define TCPCLIENT_H
 
+#include <atomic>
 #include <boost/asio.hpp>
 
 #include "BaseClient.h"
@@ -14,6 +15,8 @@ class TCPClient : public BaseClient {
     bool Write(std::string str) override;
     bool ReadReply(std::string* str, size_t min_size = 3) override;
     bool FlushQueu();
+    bool IsConnected() override { return connected; }
+    void SetConnectTimeout(int value) { connect_time_out = value; }
     int GetWaitTime() override { return default_wait; }
     void SetDefaultWaitTime(int value) override { default_wait = value; }
 
@@ -23,6 +26,13 @@ class TCPClient : public BaseClient {
     std::string ip;
     std::string hostname;
     int port;
+
+    // connect() is done asynchronously so that an unreachable instrument can not block for the
+    // full kernel TCP timeout
+    int connect_time_out = 2000;  // ms
+    std::atomic<bool> connected{false};  // polled by the read thread, set by the others
+
+    void LostConnection(const boost::system::error_code&);
 };
 
 #endif
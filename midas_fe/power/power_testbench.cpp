@@ -576,6 +576,9 @@ INT read_power(float* pdata, const std::string& eq_name) {
 
         if (d->GetName() != eq_name)
             continue;
+        // the driver's read thread is reconnecting with backoff, these are not read faults
+        if (d->Reconnecting())
+            continue;
         error = d->GetReadStatus();
         if (error == FE_SUCCESS) {
             std::vector<float> voltage = d->GetVoltage();
@@ -12,7 +12,7 @@
 #include "midas.h"
 #include "class/multi.h"
 #include "pump.h"
-#include "sps_tcpip.h"
+#include "tcpip_rs232.h"
 
 //-- Globals -------------------------------------------------------
 
@@ -40,8 +40,8 @@ INT event_buffer_size = 10*10000;
 
 //! device driver list
 DEVICE_DRIVER pump_driver[] = {
-  { "pump_in",  pump_in,  PUMP_IN_VARS,   sps_tcpip, DF_INPUT  },
-  { "pump_out", pump_out, PUMP_OUT_VARS,  sps_tcpip, DF_OUTPUT  },
+  { "pump_in",  pump_in,  PUMP_IN_VARS,   tcpip_rs232, DF_INPUT  },
+  { "pump_out", pump_out, PUMP_OUT_VARS,  tcpip_rs232, DF_OUTPUT  },
   { "" }
 };
 
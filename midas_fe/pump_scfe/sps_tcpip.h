@@ -1,15 +0,0 @@
-/********************************************************************\
-
-  Name:         sps_tcpip.h
-  Created by:   Andreas Suter (based on Stefan Ritt's tcpip.h)
-
-  Contents:     Header file for TCPIP bus driver
-
-  $Log$
-  Revision 1.1  2005/02/10 13:49:14  nemu
-  newly added
-
-
-\********************************************************************/
-
-INT sps_tcpip(INT cmd, ...);
@@ -17,22 +17,6 @@
 #include "tcpip_rs232.h"
 #include "ets_logout.h"
 
-typedef struct {
-  char host[256];
-  int  port;
-  int  debug;
-} TCPIP_RS232_SETTINGS;
-
-typedef struct {
-  TCPIP_RS232_SETTINGS settings;
-  int fd;                        //!< device handle for socket device 
-} TCPIP_RS232_INFO;
-
-extern int tcpip_rs232_open(char *host, int port);
-extern int tcpip_rs232_exit(TCPIP_RS232_INFO *info);
-extern int tcpip_rs232_puts(TCPIP_RS232_INFO *info, char *str);
-extern int tcpip_rs232_gets(TCPIP_RS232_INFO *info, char *str, int size, char *pattern, int millisec);
-
 //----------------------------------------------------------------------------
 /*!
  * <p>The 'string' returned by the ets is not a C like string, since it contains characters '\\0'!!<br>
@@ -121,9 +105,14 @@ int ets_logout(void *info, int wait, int detailed_msg)
   bd_info = (TCPIP_RS232_INFO *)info;
 
   do {  
-    // port 23 for telnet
-    bd_info->fd = tcpip_rs232_open(bd_info->settings.host, 23);
-    if (bd_info->fd <= 0) 
+    // port 23 for telnet. Drop the device connection first, the bus driver
+    // reconnects to the device port on its next access.
+    tcpip_rs232_exit(bd_info);
+    // the device is usually on hold when we get here, which must not block the ets session
+    bd_info->holdoff_until = 0;
+    bd_info->n_timeouts = 0;
+    bd_info->fd = tcpip_rs232_open(bd_info->settings.host, 23, bd_info->settings.connect_timeout);
+    if (bd_info->fd < 0)
       return 0;
   
     // send logout commands
@@ -176,6 +165,8 @@ int ets_logout(void *info, int wait, int detailed_msg)
     tcpip_rs232_puts(bd_info, cmd);
     
     tcpip_rs232_exit(bd_info);
+    bd_info->holdoff_until = 0;
+    bd_info->n_timeouts = 0;
 
   } while (!done && (count < 5)); // try maximal 5 times
   
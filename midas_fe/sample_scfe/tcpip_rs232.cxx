@@ -7,29 +7,44 @@
 
   Contents:     TCP/IP socket communication routines
 
+  Shared bus driver of the slow control frontends (sample_scfe,
+  ls340_scfs, hc3500_scfe, pump_scfe). The socket is kept in
+  non-blocking mode:
+
+  - connect is done with a timeout (Connect timeout) instead of
+    waiting for the kernel to give up on a dead terminal server.
+  - writes go to a per-device output queue which is flushed without
+    blocking; whatever is left is flushed before the next read.
+  - received data is buffered, so that bytes following a gets pattern
+    are kept for the next call instead of being read one by one.
+  - the millisec argument of read/gets is a deadline for the whole
+    call, not a timeout per received byte.
+  - a device which failed to answer three times in a row is put on
+    hold for Holdoff ms. During that time all calls return
+    immediately, so that a dead device costs a few timeouts per
+    holdoff and not one per channel and readout cycle. A lost
+    connection is reopened after the holdoff.
+
 \********************************************************************/
 
+#include <fcntl.h>
+
 #include "midas.h"
 #include "msystem.h"
 
-static int debug_last = 0, debug_first = TRUE;
+#include "tcpip_rs232.h"
 
-typedef struct {
-  char host[256];
-  int  port;
-  int  debug;
-} TCPIP_RS232_SETTINGS;
+static int debug_last = 0, debug_first = TRUE;
 
 #define TCPIP_RS232_SETTINGS_STR "\
 Host = STRING : [256] myhost.my.domain\n\
 Port = INT : 23\n\
 Debug = INT : 0\n\
+Connect timeout = INT : 3000\n\
+Holdoff = INT : 10000\n\
 "
 
-typedef struct {
-  TCPIP_RS232_SETTINGS settings;
-  int fd;                        /* device handle for socket device */
-} TCPIP_RS232_INFO;
+#define TCPIP_RS232_MAX_TIMEOUTS 3
 
 /*----------------------------------------------------------------------------*/
 
@@ -59,11 +74,58 @@ void tcpip_rs232_debug(TCPIP_RS232_INFO *info, char *dbg_str)
 
 /*------------------------------------------------------------------*/
 
-int tcpip_rs232_open(char *host, int port)
+/* milliseconds left until deadline, 0 if it has passed */
+static int tcpip_rs232_remaining(DWORD deadline)
+{
+  int remaining = (int) (deadline - ss_millitime());
+
+  return remaining > 0 ? remaining : 0;
+}
+
+/*------------------------------------------------------------------*/
+
+/* wait until fd is readable (or writable), at most millisec ms; returns TRUE if it is */
+static int tcpip_rs232_wait(int fd, int for_write, int millisec)
+{
+  fd_set         fds;
+  struct timeval timeout;
+  int            status;
+  DWORD          deadline;
+
+  deadline = ss_millitime() + millisec;
+
+  do
+    {
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+
+    timeout.tv_sec  = millisec / 1000;
+    timeout.tv_usec = (millisec % 1000) * 1000;
+
+    if (for_write)
+      status = select(fd+1, NULL, &fds, NULL, &timeout);
+    else
+      status = select(fd+1, &fds, NULL, NULL, &timeout);
+
+    /* if an alarm signal was cought, restart select with the time left */
+    if (status == -1 && errno == EINTR)
+      millisec = tcpip_rs232_remaining(deadline);
+    else
+      break;
+
+    } while (1);
+
+  return status > 0 && FD_ISSET(fd, &fds);
+}
+
+/*------------------------------------------------------------------*/
+
+int tcpip_rs232_open(char *host, int port, int millisec)
 {
   struct sockaddr_in   bind_addr;
   struct hostent       *phe;
-  int                  status, fd;
+  int                  status, fd, opt;
+  socklen_t            len;
 
 #ifdef OS_WINNT
   {
@@ -93,7 +155,8 @@ int tcpip_rs232_open(char *host, int port)
   if (status < 0)
     {
     perror("tcpip_rs232_open:bind");
-    return fd;
+    closesocket(fd);
+    return -1;
     }
 
   /* connect to remote node */
@@ -102,38 +165,49 @@ int tcpip_rs232_open(char *host, int port)
   bind_addr.sin_addr.s_addr = 0;
   bind_addr.sin_port        = htons((short) port);
 
-#ifdef OS_VXWORKS
-  {
-  INT host_addr;
-
-  host_addr = hostGetByName(host);
-  memcpy((char *)&(bind_addr.sin_addr), &host_addr, 4);
-  }
-#else
   phe = gethostbyname(host);
   if (phe == NULL)
     {
     printf("\ntcpip_rs232_open: unknown host name %s\n", host);
+    closesocket(fd);
     return -1;
     }
   memcpy((char *)&(bind_addr.sin_addr), phe->h_addr, phe->h_length);
-#endif
 
-#ifdef OS_UNIX
-  do
+  /* the socket stays non-blocking for its whole life time */
+  opt = fcntl(fd, F_GETFL, NULL);
+  if (opt < 0 || fcntl(fd, F_SETFL, opt | O_NONBLOCK) < 0)
     {
-    status = connect(fd, (const sockaddr*) &bind_addr, sizeof(bind_addr));
-
-    /* don't return if an alarm signal was cought */
-    } while (status == -1 && errno == EINTR); 
-#else
-  status = connect(fd, (void *) &bind_addr, sizeof(bind_addr));
-#endif  
+    perror("tcpip_rs232_open: couldn't set O_NONBLOCK");
+    closesocket(fd);
+    return -1;
+    }
 
-  if (status != 0)
+  status = connect(fd, (const sockaddr*) &bind_addr, sizeof(bind_addr));
+  if (status < 0)
     {
-    perror("tcpip_rs232_open:connect");
-    return -1;
+    if (errno != EINPROGRESS)
+      {
+      perror("tcpip_rs232_open:connect");
+      closesocket(fd);
+      return -1;
+      }
+
+    if (!tcpip_rs232_wait(fd, TRUE, millisec))
+      {
+      printf("\ntcpip_rs232_open: connect to %s:%d timed out\n", host, port);
+      closesocket(fd);
+      return -1;
+      }
+
+    /* get background error status */
+    len = sizeof(status);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &status, &len) < 0 || status != 0)
+      {
+      printf("\ntcpip_rs232_open: connect to %s:%d failed: %s\n", host, port, strerror(status));
+      closesocket(fd);
+      return -1;
+      }
     }
 
   return fd;
@@ -141,9 +215,132 @@ int tcpip_rs232_open(char *host, int port)
 
 /*----------------------------------------------------------------------------*/
 
+static void tcpip_rs232_close(TCPIP_RS232_INFO *info)
+{
+  if (info->fd >= 0)
+    closesocket(info->fd);
+  info->fd   = -1;
+  info->rx_n = 0;
+  info->tx_n = 0;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* put the device on hold after it failed, see header */
+static void tcpip_rs232_hold(TCPIP_RS232_INFO *info, const char *reason)
+{
+  if (info->holdoff_until == 0)
+    cm_msg(MERROR, "tcpip_rs232", "%s:%d %s, holding off for %d ms",
+           info->settings.host, info->settings.port, reason, info->settings.holdoff);
+  info->holdoff_until = ss_millitime() + info->settings.holdoff;
+  if (info->holdoff_until == 0)
+    info->holdoff_until = 1;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* returns TRUE if the device may be accessed now, reconnects if necessary */
+static int tcpip_rs232_ready(TCPIP_RS232_INFO *info)
+{
+  if (info->holdoff_until != 0)
+    {
+    if ((int) (info->holdoff_until - ss_millitime()) > 0)
+      return FALSE;
+    info->holdoff_until = 0;
+    }
+
+  if (info->fd < 0)
+    {
+    info->fd = tcpip_rs232_open(info->settings.host, info->settings.port,
+                                info->settings.connect_timeout);
+    if (info->fd < 0)
+      {
+      tcpip_rs232_hold(info, "reconnect failed");
+      return FALSE;
+      }
+    cm_msg(MINFO, "tcpip_rs232", "reconnected to %s:%d", info->settings.host, info->settings.port);
+    }
+
+  return TRUE;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* send as much of the output queue as possible before deadline */
+static int tcpip_rs232_flush(TCPIP_RS232_INFO *info, DWORD deadline)
+{
+  int i;
+
+  while (info->tx_n > 0)
+    {
+    i = send(info->fd, info->tx, info->tx_n, MSG_NOSIGNAL);
+    if (i > 0)
+      {
+      info->tx_n -= i;
+      memmove(info->tx, info->tx+i, info->tx_n);
+      }
+    else if (i < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+      {
+      if (!tcpip_rs232_wait(info->fd, TRUE, tcpip_rs232_remaining(deadline)))
+        return FALSE;
+      }
+    else
+      {
+      perror("tcpip_rs232_flush");
+      tcpip_rs232_close(info);
+      tcpip_rs232_hold(info, "lost connection");
+      return FALSE;
+      }
+    }
+
+  return TRUE;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* receive whatever is available into the rx buffer, waiting at most until deadline;
+   returns the number of bytes received, 0 on timeout, -1 if the connection is gone */
+static int tcpip_rs232_fill(TCPIP_RS232_INFO *info, DWORD deadline)
+{
+  int i;
+
+  if (info->rx_n >= TCPIP_RS232_BUFFER_SIZE)
+    return 0;
+
+  do
+    {
+    i = recv(info->fd, info->rx+info->rx_n, TCPIP_RS232_BUFFER_SIZE-info->rx_n, 0);
+    if (i > 0)
+      {
+      info->rx_n += i;
+      return i;
+      }
+    if (i == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+      {
+      tcpip_rs232_close(info);
+      tcpip_rs232_hold(info, "lost connection");
+      return -1;
+      }
+    } while (tcpip_rs232_wait(info->fd, FALSE, tcpip_rs232_remaining(deadline)));
+
+  return 0;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* move n bytes from the rx buffer to data */
+static void tcpip_rs232_consume(TCPIP_RS232_INFO *info, char *data, int n)
+{
+  memcpy(data, info->rx, n);
+  info->rx_n -= n;
+  memmove(info->rx, info->rx+n, info->rx_n);
+}
+
+/*----------------------------------------------------------------------------*/
+
 int tcpip_rs232_exit(TCPIP_RS232_INFO *info)
 {
-  closesocket(info->fd);
+  tcpip_rs232_close(info);
 
   return SUCCESS;
 }
@@ -153,69 +350,62 @@ int tcpip_rs232_exit(TCPIP_RS232_INFO *info)
 int tcpip_rs232_write(TCPIP_RS232_INFO *info, char *data, int size)
 {
   int i;
- 
+
   if (info->settings.debug)
     {
     char dbg_str[256];
 
     sprintf(dbg_str, "write: ");
-    for (i=0 ; (int)i<size ; i++)
+    for (i=0 ; (int)i<size && i<80 ; i++)
       sprintf(dbg_str+strlen(dbg_str), "%X ", data[i]);
 
     tcpip_rs232_debug(info, dbg_str);
     }
- 
-  i = send(info->fd, data, size, 0);
 
-  return i;
+  if (!tcpip_rs232_ready(info))
+    return -1;
+
+  /* flush whatever is still queued, then queue the new data */
+  if (info->tx_n + size > TCPIP_RS232_BUFFER_SIZE &&
+      !tcpip_rs232_flush(info, ss_millitime() + info->settings.connect_timeout))
+    return -1;
+  if (info->tx_n + size > TCPIP_RS232_BUFFER_SIZE)
+    return -1;
+
+  memcpy(info->tx+info->tx_n, data, size);
+  info->tx_n += size;
+  tcpip_rs232_flush(info, ss_millitime());
+
+  return size;
 }
 
-/*----------------------------------------------------------------------------*/ 
+/*----------------------------------------------------------------------------*/
 
 int tcpip_rs232_read(TCPIP_RS232_INFO *info, char *data, int size, int millisec)
 {
-  fd_set         readfds;
-  struct timeval timeout;
-  int            i, status, n;
+  int   i, n;
+  DWORD deadline;
 
   n = 0;
   memset(data, 0, size);
+  deadline = ss_millitime() + (millisec > 0 ? millisec : 0);
 
-  do
+  if (tcpip_rs232_ready(info) && tcpip_rs232_flush(info, deadline))
     {
-    if (millisec > 0)
+    do
       {
-      FD_ZERO(&readfds);
-      FD_SET(info->fd, &readfds);
-
-      timeout.tv_sec  = millisec / 1000;
-      timeout.tv_usec = (millisec % 1000) * 1000;
-
-      do
-	      {
-	      status = select(FD_SETSIZE, &readfds, NULL, NULL, &timeout);
-
-	      /* if an alarm signal was cought, restart select with reduced timeout */
-	      if (status == -1 && timeout.tv_sec >= WATCHDOG_INTERVAL / 1000)
-          timeout.tv_sec -= WATCHDOG_INTERVAL / 1000;
-
-	      } while (status == -1); /* dont return if an alarm signal was cought */
-
-      if (!FD_ISSET(info->fd, &readfds))
+      if (info->rx_n > 0)
+        {
+        i = info->rx_n < size-n ? info->rx_n : size-n;
+        tcpip_rs232_consume(info, data+n, i);
+        n += i;
+        }
+
+      if (n >= size)
         break;
-      }
-
-    i = recv(info->fd, data+n, 1, 0);
-
-    if (i<=0)
-      break;
-
-    n++;
-
-    if (n >= size)
-      break;
 
-    } while (1); /* while (buffer[n-1] && buffer[n-1] != 10); */
+      } while (tcpip_rs232_fill(info, deadline) > 0);
+    }
 
   if (info->settings.debug)
     {
@@ -226,7 +416,7 @@ int tcpip_rs232_read(TCPIP_RS232_INFO *info, char *data, int size, int millisec)
     if (n == 0)
       sprintf(dbg_str+strlen(dbg_str), "<TIMEOUT>");
     else
-      for (i=0 ; i<n ; i++)
+      for (i=0 ; i<n && i<80 ; i++)
         sprintf(dbg_str+strlen(dbg_str), "%X ", data[i]);
 
     tcpip_rs232_debug(info, dbg_str);
@@ -240,88 +430,109 @@ int tcpip_rs232_read(TCPIP_RS232_INFO *info, char *data, int size, int millisec)
 int tcpip_rs232_puts(TCPIP_RS232_INFO *info, char *str)
 {
   int i;
- 
+
   if (info->settings.debug)
     {
     char dbg_str[256];
 
-    sprintf(dbg_str, "puts: %s, strlen = %d", str, (int)strlen(str)); 
+    snprintf(dbg_str, sizeof(dbg_str), "puts: %s, strlen = %d", str, (int)strlen(str));
     tcpip_rs232_debug(info, dbg_str);
     }
 
-//  i = send(info->fd, str, strlen(str)+1, 0);
-  i = send(info->fd, str, strlen(str), 0);
-  if (i < 0) 
-    perror("tcpip_rs232_puts");
+  if (!tcpip_rs232_ready(info))
+    return -1;
+
+  i = (int) strlen(str);
+  if (info->tx_n + i > TCPIP_RS232_BUFFER_SIZE &&
+      !tcpip_rs232_flush(info, ss_millitime() + info->settings.connect_timeout))
+    return -1;
+  if (info->tx_n + i > TCPIP_RS232_BUFFER_SIZE)
+    return -1;
+
+  /* don't send the terminating '\0' */
+  memcpy(info->tx+info->tx_n, str, i);
+  info->tx_n += i;
+  tcpip_rs232_flush(info, ss_millitime());
 
   return i;
 }
 
-/*----------------------------------------------------------------------------*/ 
+/*----------------------------------------------------------------------------*/
 
 int tcpip_rs232_gets(TCPIP_RS232_INFO *info, char *str, int size, char *pattern, int millisec)
 {
-  fd_set         readfds;
-  struct timeval timeout;
-  int            i, status, n;
+  int   i, n, plen;
+  char  *found;
+  DWORD deadline;
 
   n = 0;
   memset(str, 0, size);
+  deadline = ss_millitime() + (millisec > 0 ? millisec : 0);
+  plen = (pattern && pattern[0]) ? (int) strlen(pattern) : 0;
 
-  do
-  {
-    if (millisec > 0)
+  if (tcpip_rs232_ready(info) && tcpip_rs232_flush(info, deadline))
+    {
+    do
       {
-      FD_ZERO(&readfds);
-      FD_SET(info->fd, &readfds);
-
-      timeout.tv_sec  = millisec / 1000;
-      timeout.tv_usec = (millisec % 1000) * 1000;
-
-      do
-	      {
-	      status = select(FD_SETSIZE, &readfds, NULL, NULL, &timeout);
-
-	      /* if an alarm signal was cought, restart select with reduced timeout */
-	      if (status == -1 && timeout.tv_sec >= WATCHDOG_INTERVAL / 1000)
-          timeout.tv_sec -= WATCHDOG_INTERVAL / 1000;
-
-	      } while (status == -1); /* dont return if an alarm signal was cought */
-
-      if (!FD_ISSET(info->fd, &readfds))
+      /* look for the pattern in what has been received so far */
+      found = NULL;
+      if (plen > 0 && info->rx_n >= plen)
+        {
+        for (i=0 ; i+plen<=info->rx_n ; i++)
+          if (memcmp(info->rx+i, pattern, plen) == 0)
+            {
+            found = info->rx+i;
+            break;
+            }
+        }
+
+      if (found)
+        n = (int) (found - info->rx) + plen;
+      else
+        n = info->rx_n;
+      if (n > size-1)
+        n = size-1;
+
+      if (found || n >= size-1)
+        {
+        info->n_timeouts = 0;
+        tcpip_rs232_consume(info, str, n);
+        str[n] = 0;
         break;
-      }
-
-    i = recv(info->fd, str+n, 1, 0);
-
-    if (i<=0)
-      break;
-
-    n += i;
-
-    if (pattern && pattern[0])
-      if (strstr(str, pattern) != NULL)
+        }
+
+      n = 0;
+      i = tcpip_rs232_fill(info, deadline);
+      if (i <= 0)
+        {
+        /* timeout: hand out what we have, like the byte-wise version did */
+        n = info->rx_n < size-1 ? info->rx_n : size-1;
+        tcpip_rs232_consume(info, str, n);
+        str[n] = 0;
+        if (i == 0 && plen > 0 && ++info->n_timeouts >= TCPIP_RS232_MAX_TIMEOUTS)
+          {
+          info->n_timeouts = 0;
+          tcpip_rs232_hold(info, "does not answer");
+          }
         break;
-
-    if (n >= size)
-      break;
-
-  } while (1); /* while (buffer[n-1] && buffer[n-1] != 10); */
+        }
+      } while (1);
+    }
 
   if (info->settings.debug)
     {
     char dbg_str[256];
 
-    sprintf(dbg_str, "gets [%s]: ", pattern);
+    snprintf(dbg_str, sizeof(dbg_str), "gets [%s]: ", pattern);
 
     if (str[0] == 0)
       sprintf(dbg_str+strlen(dbg_str), "<TIMEOUT>");
     else
-      sprintf(dbg_str+strlen(dbg_str), "%s", str);
+      snprintf(dbg_str+strlen(dbg_str), sizeof(dbg_str)-strlen(dbg_str), "%s", str);
 
     tcpip_rs232_debug(info, dbg_str);
     }
- 
+
   return n;
 }
 
@@ -336,6 +547,7 @@ int tcpip_rs232_init(HNDLE hkey, TCPIP_RS232_INFO **pinfo)
   /* allocate info structure */
   info = (TCPIP_RS232_INFO*)calloc(1, sizeof(TCPIP_RS232_INFO));
   *pinfo = info;
+  info->fd = -1;
 
   cm_get_experiment_database(&hDB, NULL);
 
@@ -347,9 +559,10 @@ int tcpip_rs232_init(HNDLE hkey, TCPIP_RS232_INFO **pinfo)
   db_find_key(hDB, hkey, "BD", &hkeybd);
   size = sizeof(info->settings);
   db_get_record(hDB, hkeybd, &info->settings, &size, 0);
- 
+
   /* open port */
-  info->fd = tcpip_rs232_open(info->settings.host, info->settings.port);
+  info->fd = tcpip_rs232_open(info->settings.host, info->settings.port,
+                              info->settings.connect_timeout);
   if (info->fd < 0)
     return FE_ERR_HW;
 
@@ -5,6 +5,10 @@
 
   Contents:     Header file for TCPIP bus driver for RS232 devices
 
+  The settings and info structures are here, and not only in
+  tcpip_rs232.cxx, because device drivers like ets_logout work on
+  the info structure of the bus driver directly.
+
   $Log$
   Revision 1.1  2004/05/10 21:18:04  prokscha
   Moved source code from midas/busd to midas/drivers/bus.
@@ -15,4 +19,39 @@
 
 \********************************************************************/
 
+#ifndef _TCPIP_RS232_H_
+#define _TCPIP_RS232_H_
+
+#include "midas.h"
+
+typedef struct {
+  char host[256];
+  int  port;
+  int  debug;
+  int  connect_timeout;          /* ms */
+  int  holdoff;                  /* ms */
+} TCPIP_RS232_SETTINGS;
+
+#define TCPIP_RS232_BUFFER_SIZE 4096
+
+typedef struct {
+  TCPIP_RS232_SETTINGS settings;
+  int   fd;                      /* device handle for socket device, -1 if not connected */
+  char  rx[TCPIP_RS232_BUFFER_SIZE]; /* received but not yet consumed data */
+  int   rx_n;
+  char  tx[TCPIP_RS232_BUFFER_SIZE]; /* queued but not yet sent data */
+  int   tx_n;
+  int   n_timeouts;              /* consecutive gets timeouts */
+  DWORD holdoff_until;           /* ss_millitime() until which the device is not accessed */
+} TCPIP_RS232_INFO;
+
+int tcpip_rs232_open(char *host, int port, int millisec);
+int tcpip_rs232_exit(TCPIP_RS232_INFO *info);
+int tcpip_rs232_write(TCPIP_RS232_INFO *info, char *data, int size);
+int tcpip_rs232_read(TCPIP_RS232_INFO *info, char *data, int size, int millisec);
+int tcpip_rs232_puts(TCPIP_RS232_INFO *info, char *str);
+int tcpip_rs232_gets(TCPIP_RS232_INFO *info, char *str, int size, char *pattern, int millisec);
+
 INT tcpip_rs232(INT cmd, ...);
+
+#endif  // _TCPIP_RS232_H_
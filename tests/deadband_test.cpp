@@ -0,0 +1,72 @@
+#include "../midas_fe/deadband.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <limits>
+
+using namespace std::chrono_literals;
+
+TEST(DeadbandFilterTest, FirstValueIsPublished) {
+    DeadbandFilter filter(2, 0.1f);
+    const auto now = DeadbandFilter::clock::now();
+
+    EXPECT_TRUE(filter.update(0, 1.f, now));
+    EXPECT_TRUE(filter.update(1, 1.f, now));
+    EXPECT_FLOAT_EQ(filter.published(0), 1.f);
+}
+
+TEST(DeadbandFilterTest, SmallChangesAreSuppressed) {
+    DeadbandFilter filter(1, 0.1f);
+    const auto now = DeadbandFilter::clock::now();
+
+    EXPECT_TRUE(filter.update(0, 1.f, now));
+    EXPECT_FALSE(filter.update(0, 1.05f, now + 1s));
+    EXPECT_FALSE(filter.update(0, 0.95f, now + 2s));
+    // The change is measured against the published value, not the last reading
+    EXPECT_TRUE(filter.update(0, 1.15f, now + 3s));
+    EXPECT_FLOAT_EQ(filter.published(0), 1.15f);
+}
+
+TEST(DeadbandFilterTest, RepublishedAfterMaxInterval) {
+    DeadbandFilter filter(1, 0.1f, 10s);
+    const auto now = DeadbandFilter::clock::now();
+
+    EXPECT_TRUE(filter.update(0, 1.f, now));
+    EXPECT_FALSE(filter.update(0, 1.f, now + 9s));
+    EXPECT_TRUE(filter.update(0, 1.f, now + 10s));
+    EXPECT_FALSE(filter.update(0, 1.f, now + 15s));
+}
+
+TEST(DeadbandFilterTest, ZeroIntervalNeverRepublishes) {
+    DeadbandFilter filter(1, 0.1f, DeadbandFilter::clock::duration::zero());
+    const auto now = DeadbandFilter::clock::now();
+
+    EXPECT_TRUE(filter.update(0, 1.f, now));
+    EXPECT_FALSE(filter.update(0, 1.f, now + 1000h));
+}
+
+TEST(DeadbandFilterTest, NaNTransitionsArePublished) {
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    DeadbandFilter filter(1, 0.1f);
+    const auto now = DeadbandFilter::clock::now();
+
+    EXPECT_TRUE(filter.update(0, 1.f, now));
+    EXPECT_TRUE(filter.update(0, nan, now));
+    EXPECT_FALSE(filter.update(0, nan, now));
+    EXPECT_TRUE(filter.update(0, 1.f, now));
+}
+
+TEST(DeadbandFilterTest, PerChannelDeadbandAndReset) {
+    DeadbandFilter filter(2, 0.1f);
+    filter.set_deadband(1, 1.f);
+    const auto now = DeadbandFilter::clock::now();
+
+    filter.update(0, 0.f, now);
+    filter.update(1, 0.f, now);
+    EXPECT_TRUE(filter.update(0, 0.5f, now));
+    EXPECT_FALSE(filter.update(1, 0.5f, now));
+
+    filter.reset();
+    EXPECT_TRUE(filter.update(1, 0.5f, now));
+}
@@ -0,0 +1,398 @@
+#include "musip/dqm/PlotCollection.hpp"
+#include "musip/dqm/HistogramEncoder.hpp"
+#include "musip/dqm/HistogramRevisions.hpp"
+#include "musip/dqm/PlotSource.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace musip::dqm;
+
+namespace {
+
+// Runs `function(threadIndex)` on `numberOfThreads` threads that all run at the same time
+template<typename function_type>
+void runConcurrently(size_t numberOfThreads, function_type function) {
+    std::mutex mutex;
+    std::condition_variable allStarted;
+    size_t started = 0;
+    std::vector<std::thread> threads;
+    for(size_t thread = 0; thread < numberOfThreads; ++thread) {
+        threads.emplace_back([&, thread]() {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if(++started == numberOfThreads) allStarted.notify_all();
+                else allStarted.wait(lock, [&]() { return started == numberOfThreads; });
+            }
+            function(thread);
+        });
+    }
+    for(auto& thread : threads) thread.join();
+}
+
+// The encoded bytes of a histogram, to compare two histograms bin by bin
+template<typename histogram_type>
+std::vector<uint8_t> encoded(const histogram_type& histogram, uint8_t version = HistogramEncoder::latestVersion) {
+    const PlotCollection::object_type object(histogram);
+    std::vector<uint8_t> buffer(HistogramEncoder::requiredSize(object, version));
+    std::error_code error;
+    buffer.resize(HistogramEncoder::encode(object, buffer.data(), buffer.size(), error, version));
+    EXPECT_FALSE(error);
+    return buffer;
+}
+
+} // end of the unnamed namespace
+
+TEST(DQMHistogramTest, ShardedFillsFromManyThreads) {
+    std::mutex collectionMutex;
+    Histogram1DI histogram1D(&collectionMutex, 10, 0, 10);
+    Histogram2DF histogram2D(&collectionMutex, 4, 0, 4, 4, 0, 4);
+
+    constexpr size_t numberOfThreads = 8;
+    constexpr size_t fillsPerThread = 100000;
+    runConcurrently(numberOfThreads, [&](size_t thread) {
+        for(size_t fill = 0; fill < fillsPerThread; ++fill) {
+            histogram1D.fill<Lock::Sharded>(fill % 10);
+            histogram2D.fill<Lock::Sharded>(thread % 4, fill % 4, 0.5);
+        }
+    });
+
+    EXPECT_EQ(histogram1D.entries(), numberOfThreads * fillsPerThread);
+    EXPECT_EQ(histogram2D.entries(), numberOfThreads * fillsPerThread);
+
+    const std::vector<float> contents = histogram2D.binContents();
+    for(size_t x = 0; x < 4; ++x) {
+        for(size_t y = 0; y < 4; ++y) EXPECT_FLOAT_EQ(contents[x * 4 + y], 0.5 * 2 * fillsPerThread / 4);
+    }
+}
+
+TEST(DQMHistogramTest, ShardedFillsMoreThreadsThanSlots) {
+    const size_t numberOfThreads = detail::ThreadSlot::maxThreadSlots + 8;
+    std::mutex collectionMutex;
+    Histogram1DD locked(&collectionMutex, 1, 0, 1);
+    runConcurrently(numberOfThreads, [&](size_t) {
+        for(size_t fill = 0; fill < 1000; ++fill) locked.fill<Lock::Sharded>(0.5);
+    });
+    EXPECT_EQ(locked.entries(), numberOfThreads * 1000);
+}
+
+TEST(DQMHistogramTest, ShardsFollowClearCopyAndAdd) {
+    Histogram1DD histogram(nullptr, 2, 0, 2);
+    histogram.fill<Lock::Sharded>(0.5, 2);
+
+    // A copy takes the pending fills with it
+    Histogram1DD copy(histogram);
+    EXPECT_EQ(copy.entries(), 1u);
+
+    // Adding drains the shards of the other histogram
+    Histogram1DD sum(nullptr, 2, 0, 2);
+    std::error_code error;
+    sum.add(histogram, error);
+    EXPECT_FALSE(error);
+    EXPECT_EQ(sum.entries(), 1u);
+    EXPECT_EQ(histogram.entries(), 1u);
+
+    histogram.fill<Lock::Sharded>(1.5);
+    histogram.clear();
+    EXPECT_EQ(histogram.entries(), 0u);
+}
+
+TEST(DQMHistogramTest, FillNMatchesFill) {
+    std::mt19937 random(5);
+    std::uniform_real_distribution<float> value(-2, 12);
+    // More than a thread buffers with Lock::Sharded, so that part goes through the fallback
+    std::vector<float> xs(3000), ys(3000), weights(3000);
+    for(size_t index = 0; index < xs.size(); ++index) {
+        xs[index] = value(random);
+        ys[index] = value(random);
+        weights[index] = value(random);
+    }
+    // Edges, out of range and NaN go to the same bins as with fill
+    xs[0] = 0; xs[1] = 10; xs[2] = std::nextafter(10.f, 0.f); xs[3] = std::numeric_limits<float>::quiet_NaN();
+    xs[4] = -std::numeric_limits<float>::infinity(); xs[5] = 1e30f; ys[6] = std::numeric_limits<float>::quiet_NaN();
+
+    Histogram1DF single1D(nullptr, 7, 0, 10), bulk1D(nullptr, 7, 0, 10), sharded1D(nullptr, 7, 0, 10);
+    Histogram2DF single2D(nullptr, 7, 0, 10, 3, 0, 10), bulk2D(nullptr, 7, 0, 10, 3, 0, 10);
+    for(size_t index = 0; index < xs.size(); ++index) {
+        single1D.fill(xs[index], weights[index]);
+        single2D.fill(xs[index], ys[index]);
+    }
+    bulk1D.fillN(xs.data(), xs.size(), weights.data());
+    sharded1D.fillN<Lock::Sharded>(xs.data(), xs.size(), weights.data());
+    bulk2D.fillN<Lock::Sharded>(xs.data(), ys.data(), xs.size());
+
+    EXPECT_EQ(encoded(bulk1D), encoded(single1D));
+    EXPECT_EQ(encoded(sharded1D), encoded(single1D));
+    EXPECT_EQ(encoded(bulk2D), encoded(single2D));
+}
+
+TEST(DQMHistogramTest, FillNFromIntegerColumns) {
+    const std::vector<uint8_t> channels = {0, 1, 1, 63, 64, 200};
+    Histogram1DI bulk(nullptr, 64, -0.5, 63.5), single(nullptr, 64, -0.5, 63.5);
+    for(uint8_t channel : channels) single.fill(channel);
+    bulk.fillN(channels.data(), channels.size());
+    EXPECT_EQ(encoded(bulk), encoded(single));
+
+    RollingHistogram2DF rolling(nullptr, 4, std::chrono::seconds(10), 64, -0.5, 63.5, 2, -0.5, 1.5);
+    const std::vector<uint8_t> asics = {0, 1, 0, 1, 0, 1};
+    rolling.fillN(channels.data(), asics.data(), channels.size());
+    EXPECT_EQ(rolling.entries(), channels.size());
+}
+
+TEST(DQMHistogramTest, RollingTotalFollowsSlices) {
+    // Fill while slices come and go, the running total always has to match what's still in the time window
+    RollingHistogram2DF rolling(nullptr, 4, std::chrono::milliseconds(20), 8, 0, 8, 2, 0, 2);
+    const auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(200);
+    for(unsigned fill = 0; std::chrono::steady_clock::now() < end; ++fill) {
+        rolling.fill(fill % 8, fill % 2);
+        const Histogram2DF total = rolling.total();
+        const std::vector<float> contents = total.binContents();
+        double sum = 0;
+        for(float content : contents) sum += content;
+        ASSERT_EQ(sum, static_cast<double>(total.entries()));
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+
+    // Once the whole window has passed everything has to be gone, not just close to zero
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(rolling.entries(), 0u);
+    for(float content : rolling.total().binContents()) EXPECT_EQ(content, 0.0f);
+}
+
+TEST(DQMHistogramTest, EncodingRoundTrips) {
+    // Empty, a few scattered bins, a contiguous block and completely full, so each encoding gets used
+    Histogram2DI empty(nullptr, 256, 0, 256, 250, 0, 250);
+    Histogram2DI scattered(empty), block(empty);
+    Histogram1DD full(nullptr, 100, 0, 100);
+    for(unsigned hit = 0; hit < 40; ++hit) scattered.fill(hit * 6.3, hit * 5.9);
+    for(unsigned x = 100; x < 140; ++x) block.fill(x, 17, x);
+    for(unsigned x = 0; x < 100; ++x) full.fill(x, 0.25 * x + 1);
+
+    for(const PlotCollection::object_type& object : std::vector<PlotCollection::object_type>{empty, scattered, block, full}) {
+        for(uint8_t version : {1, 2}) {
+            std::vector<uint8_t> buffer(HistogramEncoder::requiredSize(object, version));
+            std::error_code error;
+            buffer.resize(HistogramEncoder::encode(object, buffer.data(), buffer.size(), error, version));
+            ASSERT_FALSE(error);
+            EXPECT_EQ(buffer[0], version);
+
+            const auto decoded = HistogramEncoder::decode(buffer.data(), buffer.size(), error);
+            ASSERT_FALSE(error);
+            ASSERT_TRUE(decoded.has_value());
+            std::visit([&object](const auto& histogram) {
+                using histogram_type = typename std::decay<decltype(histogram)>::type;
+                EXPECT_EQ(encoded(histogram), encoded(std::get<histogram_type>(object)));
+                EXPECT_EQ(histogram.entries(), std::get<histogram_type>(object).entries());
+            }, decoded.value());
+        }
+    }
+
+    // A sparse hitmap is far smaller than the dense version 1 encoding, and a full histogram is no bigger
+    EXPECT_LT(encoded(scattered).size() * 100, encoded(scattered, 1).size());
+    EXPECT_LT(encoded(block).size() * 100, encoded(block, 1).size());
+    EXPECT_LE(encoded(full).size(), encoded(full, 1).size() + 8);
+}
+
+TEST(DQMHistogramTest, DecodeRejectsCorruptBins) {
+    Histogram1DF histogram(nullptr, 10, 0, 10);
+    histogram.fill(3);
+    std::vector<uint8_t> buffer = encoded(histogram);
+
+    std::error_code error;
+    EXPECT_FALSE(HistogramEncoder::decode(buffer.data(), buffer.size() - 1, error).has_value());
+    EXPECT_TRUE(error);
+
+    // The only run points past the last bin
+    error.clear();
+    std::vector<uint8_t> corrupt = buffer;
+    const uint32_t firstBin = 12;
+    std::memcpy(corrupt.data() + corrupt.size() - 12, &firstBin, sizeof(firstBin));
+    EXPECT_FALSE(HistogramEncoder::decode(corrupt.data(), corrupt.size(), error).has_value());
+    EXPECT_TRUE(error);
+}
+
+TEST(DQMHistogramTest, AddEncodedMatchesAdd) {
+    Histogram2DF first(nullptr, 256, 0, 256, 250, 0, 250), second(first);
+    for(unsigned hit = 0; hit < 40; ++hit) {
+        first.fill(hit * 6.3, hit * 5.9);
+        second.fill(hit * 3.1, 100, 0.5);
+    }
+
+    for(uint8_t version : {1, 2}) {
+        PlotCollection::object_type sum(first);
+        const std::vector<uint8_t> buffer = encoded(second, version);
+        std::error_code error;
+        HistogramEncoder::addEncoded(sum, buffer.data(), buffer.size(), error);
+        ASSERT_FALSE(error);
+
+        Histogram2DF expected(first);
+        expected.add(second, error);
+        EXPECT_EQ(encoded(std::get<Histogram2DF>(sum)), encoded(expected));
+    }
+
+    // Different binning or a different type are refused, and nothing is added
+    PlotCollection::object_type sum(first);
+    std::error_code error;
+    const std::vector<uint8_t> otherBinning = encoded(Histogram2DF(nullptr, 256, 0, 256, 250, 0, 500));
+    HistogramEncoder::addEncoded(sum, otherBinning.data(), otherBinning.size(), error);
+    EXPECT_TRUE(error);
+    error.clear();
+    const std::vector<uint8_t> otherType = encoded(Histogram2DI(nullptr, 256, 0, 256, 250, 0, 250));
+    HistogramEncoder::addEncoded(sum, otherType.data(), otherType.size(), error);
+    EXPECT_TRUE(error);
+    EXPECT_EQ(encoded(std::get<Histogram2DF>(sum)), encoded(first));
+}
+
+TEST(DQMHistogramTest, RevisionsGiveDeltas) {
+    using Kind = HistogramRevisions::Kind;
+    HistogramRevisions revisions;
+    Histogram2DF hitmap(nullptr, 256, 0, 256, 250, 0, 250);
+    hitmap.fill(10, 10);
+
+    const auto first = revisions.update("quads", "hitmap", hitmap, 0);
+    EXPECT_EQ(first.kind, Kind::full);
+    EXPECT_NE(first.version, 0u);
+    EXPECT_EQ(revisions.update("quads", "hitmap", hitmap, first.version).kind, Kind::notModified);
+
+    // Two clients, one a version further behind than the other
+    hitmap.fill(20, 30, 2);
+    const auto second = revisions.update("quads", "hitmap", hitmap, first.version);
+    hitmap.fill(10, 10);
+    const auto third = revisions.update("quads", "hitmap", hitmap, second.version);
+    const auto catchUp = revisions.update("quads", "hitmap", hitmap, first.version);
+
+    // Bins are counted with under- and overflow, 258 to a row
+    EXPECT_EQ(second.kind, Kind::delta);
+    EXPECT_EQ(second.changedBins, std::vector<uint32_t>{31 * 258 + 21});
+    EXPECT_EQ(third.changedBins, std::vector<uint32_t>{11 * 258 + 11});
+    EXPECT_EQ(catchUp.kind, Kind::delta);
+    EXPECT_EQ(catchUp.version, third.version);
+    EXPECT_EQ(catchUp.entries, 3u);
+    EXPECT_EQ(catchUp.changedBins, (std::vector<uint32_t>{11 * 258 + 11, 31 * 258 + 21}));
+    float value;
+    std::memcpy(&value, &catchUp.values[sizeof(float)], sizeof(float));
+    EXPECT_EQ(value, 2.f);
+
+    // Versions nobody handed out, and changes to most bins, give the full histogram
+    EXPECT_EQ(revisions.update("quads", "hitmap", hitmap, third.version + 1000).kind, Kind::full);
+    for(unsigned x = 0; x < 256; ++x) {
+        for(unsigned y = 0; y < 250; ++y) hitmap.fill(x, y);
+    }
+    EXPECT_EQ(revisions.update("quads", "hitmap", hitmap, third.version).kind, Kind::full);
+}
+
+TEST(DQMHistogramTest, ArchiveRoundTrips) {
+    PlotSource<> source;
+    std::error_code error;
+    PlotCollection* pQuads = source.getOrCreateCollection("quads");
+    Histogram2DI* pHitmap = pQuads->getOrCreateHistogram2DI("hitmap/chip3", 256, 0, 256, 250, 0, 250, error);
+    Histogram1DD* pEnergy = source.getOrCreateCollection("mutrig")->getOrCreateHistogram1DD("energy", 100, 0, 512, error);
+    RollingHistogram2DF* pRolling = pQuads->getOrCreateRollingHistogram2DF("rolling", 4, std::chrono::seconds(10), 8, 0, 8, 2, 0, 2, error);
+    ASSERT_FALSE(error);
+    pHitmap->fill(17, 30);
+    pEnergy->fill(100, 0.5);
+    pRolling->fill(3, 1);
+
+    const std::filesystem::path filename = std::filesystem::temp_directory_path() / "dqm_histogram_test_archive.dqm";
+    source.saveAsArchive(filename, false, error);
+    ASSERT_FALSE(error);
+
+    // Looked up by name, the blob is the histogram exactly as the encoder gives it
+    {
+        const Archive archive(filename, error);
+        ASSERT_FALSE(error);
+        ASSERT_EQ(archive.size(), 3u);
+        EXPECT_EQ(archive.name(0), "mutrig/energy");
+        const Archive::Blob blob = archive.find("quads/hitmap/chip3");
+        ASSERT_NE(blob.data, nullptr);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(blob.data) % Archive::blobAlignment, 0u);
+        EXPECT_EQ(std::vector<uint8_t>(blob.data, blob.data + blob.size), encoded(*pHitmap));
+        EXPECT_EQ(archive.find("quads/hitmap").data, nullptr);
+    }
+
+    // Loading twice adds up, and the rolling histogram comes back as its total
+    PlotSource<> loaded;
+    loaded.addFromArchive(filename, error);
+    loaded.addFromArchive(filename, error);
+    ASSERT_FALSE(error);
+    const PlotCollection::object_type* pLoadedEnergy = loaded.getCollection("mutrig")->get("energy");
+    ASSERT_NE(pLoadedEnergy, nullptr);
+    pEnergy->fill(100, 0.5);
+    EXPECT_EQ(encoded(std::get<Histogram1DD>(*pLoadedEnergy)), encoded(*pEnergy));
+    const PlotCollection::object_type* pLoadedRolling = loaded.getCollection("quads")->get("rolling");
+    ASSERT_NE(pLoadedRolling, nullptr);
+    EXPECT_EQ(std::get<Histogram2DF>(*pLoadedRolling).entries(), 2u);
+
+    std::filesystem::remove(filename);
+
+    // Anything that isn't an archive is rejected
+    const Archive notAnArchive(std::filesystem::path("/dev/null"), error);
+    EXPECT_TRUE(error);
+    EXPECT_EQ(notAnArchive.size(), 0u);
+}
+
+TEST(DQMHistogramTest, ArchiveRejectsTruncatedAndCorruptFiles) {
+    PlotSource<> source;
+    std::error_code error;
+    source.getOrCreateCollection("quads")->getOrCreateHistogram1DD("hits", 10, 0, 10, error)->fill(1);
+    const std::filesystem::path filename = std::filesystem::temp_directory_path() / "dqm_histogram_test_corrupt.dqm";
+    source.saveAsArchive(filename, false, error);
+    ASSERT_FALSE(error);
+
+    std::vector<char> original(std::filesystem::file_size(filename));
+    std::ifstream(filename, std::ios_base::binary).read(original.data(), original.size());
+    Archive::FileHeader header;
+    std::memcpy(&header, original.data(), sizeof(header));
+
+    // Writes `bytes` over the archive, which then has to be rejected without anything being read from it
+    auto expectRejected = [&filename](const std::vector<char>& bytes) {
+        std::ofstream(filename, std::ios_base::binary | std::ios_base::trunc).write(bytes.data(), bytes.size());
+        std::error_code error;
+        const Archive archive(filename, error);
+        EXPECT_TRUE(error);
+        EXPECT_EQ(archive.size(), 0u);
+
+        error.clear();
+        PlotSource<> loaded;
+        loaded.addFromArchive(filename, error);
+        EXPECT_TRUE(error);
+        EXPECT_TRUE(loaded.list(false).empty());
+    };
+
+    // Cut off within the header, and within the names at the end
+    expectRejected(std::vector<char>(original.begin(), original.begin() + sizeof(header) / 2));
+    expectRejected(std::vector<char>(original.begin(), original.end() - 1));
+
+    // Not the magic number, or a layout version this build doesn't know
+    std::vector<char> corrupt = original;
+    corrupt[0] ^= 0xff;
+    expectRejected(corrupt);
+    corrupt = original;
+    corrupt[offsetof(Archive::FileHeader, version)] += 1;
+    expectRejected(corrupt);
+
+    // An index entry pointing past the end of the file
+    corrupt = original;
+    const uint64_t pastTheEnd = (original.size() / Archive::blobAlignment + 1) * Archive::blobAlignment;
+    std::memcpy(corrupt.data() + header.indexOffset + offsetof(Archive::IndexEntry, offset), &pastTheEnd, sizeof(pastTheEnd));
+    expectRejected(corrupt);
+
+    // Only the changes made it unreadable
+    std::ofstream(filename, std::ios_base::binary | std::ios_base::trunc).write(original.data(), original.size());
+    const Archive archive(filename, error);
+    EXPECT_FALSE(error);
+    EXPECT_EQ(archive.size(), 1u);
+
+    std::filesystem::remove(filename);
+}
@@ -0,0 +1,63 @@
+#include "musip/dqm/DQMManager.hpp"
+#include "musip/dqm/PlotSource.hpp"
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace musip::dqm;
+
+namespace {
+
+// Saves a run with a single histogram, named like the files DQMManager looks for
+void saveRun(const std::filesystem::path& directory, int runNumber) {
+    PlotSource<> source;
+    std::error_code error;
+    source.getOrCreateCollection("quads")->getOrCreateHistogram1DD("hits", 10, 0, 10, error)->fill(1);
+    char filename[32];
+    snprintf(filename, sizeof(filename), "dqm_histos_%05d.dqm", runNumber);
+    source.saveAsArchive(directory / filename, false, error);
+    ASSERT_FALSE(error);
+}
+
+// The reply to dqm::list for a previous run, asking again for as long as the DQMManager replies "wait"
+std::string listRun(int runNumber) {
+    using RPCHeader = DQMManager::RPCHeader;
+    TMFeRpcHandlerInterface& handler = DQMManager::instance();
+    const std::string args = "{\"runs\": [" + std::to_string(runNumber) + "]}";
+    for(int attempt = 0; attempt < 100; ++attempt) {
+        std::vector<char> result;
+        handler.HandleBinaryRpc("dqm::list", args.c_str(), result);
+        if(result.size() < sizeof(RPCHeader)) break;
+        const RPCHeader& header = *reinterpret_cast<const RPCHeader*>(result.data());
+        if(header.messageType != RPCHeader::MessageType::wait) return std::string(result.data() + sizeof(RPCHeader), header.messageSize - sizeof(RPCHeader));
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ADD_FAILURE() << "No reply for run " << runNumber;
+    return {};
+}
+
+} // end of the unnamed namespace
+
+TEST(DQMHistoryTest, PrefetchedMissingRunIsLoadedOnceItsFileExists) {
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / ("dqm_history_test_" + std::to_string(getpid()));
+    std::filesystem::create_directories(directory);
+    DQMManager::instance().addHistoryDirectory(directory);
+
+    // Browsing run 5 prefetches run 6, which has no file yet like the run that is still being taken
+    saveRun(directory, 5);
+    EXPECT_EQ(listRun(5), "quads/hits");
+    std::this_thread::sleep_for(std::chrono::milliseconds(200)); // for the prefetches to finish
+
+    // Once the run has ended and its file is there, it is served
+    saveRun(directory, 6);
+    EXPECT_EQ(listRun(6), "quads/hits");
+
+    std::filesystem::remove_all(directory);
+}
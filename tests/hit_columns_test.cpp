@@ -0,0 +1,88 @@
+#include "../analyzer/HitColumns.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+namespace {
+
+std::vector<hit> random_hits(size_t n, uint32_t seed) {
+    std::mt19937_64 rng(seed);
+    std::vector<hit> hits;
+    hits.reserve(n);
+    for(size_t i = 0; i < n; ++i) hits.emplace_back(rng());
+    return hits;
+}
+
+}  // namespace
+
+TEST(HitColumnsTest, FieldsMatchAccessors) {
+    const auto hits = random_hits(1000, 42);
+    HitColumns columns;
+    columns.append_bank(hits.data(), hits.data() + hits.size());
+
+    size_t p = 0, m = 0;
+    for(const hit& h : hits) {
+        if(h.is_pixel()) {
+            const pixelhit ph = h.as_pixel();
+            ASSERT_LT(p, columns.pixel.size());
+            EXPECT_EQ(columns.pixel.chip[p], ph.chipid());
+            EXPECT_EQ(columns.pixel.col[p], ph.col());
+            EXPECT_EQ(columns.pixel.row[p], ph.row());
+            EXPECT_EQ(columns.pixel.tot[p], ph.tot());
+            EXPECT_EQ(columns.pixel.time[p], ph.time());
+            ++p;
+        } else {
+            const mutrighit mh = h.as_mutrig();
+            ASSERT_LT(m, columns.mutrig.size());
+            EXPECT_EQ(columns.mutrig.asic[m], mh.asic());
+            EXPECT_EQ(columns.mutrig.channel[m], mh.channel());
+            EXPECT_EQ(columns.mutrig.energy[m], mh.et());
+            EXPECT_EQ(columns.mutrig.finetime[m], mh.finetime_extended());
+            EXPECT_EQ(columns.mutrig.timestamp[m], mh.timestamp());
+            EXPECT_EQ(columns.mutrig.raw[m], h.raw());
+            ++m;
+        }
+    }
+    EXPECT_EQ(p, columns.pixel.size());
+    EXPECT_EQ(m, columns.mutrig.size());
+}
+
+TEST(HitColumnsTest, BankOffsets) {
+    const auto first = random_hits(100, 1);
+    const auto second = random_hits(37, 2);
+    HitColumns columns;
+    columns.append_bank(first.data(), first.data() + first.size());
+    columns.append_bank(second.data(), second.data());
+    columns.append_bank(second.data(), second.data() + second.size());
+
+    ASSERT_EQ(columns.nbanks(), 3u);
+    EXPECT_EQ(columns.pixel_bank_offset.front(), 0u);
+    EXPECT_EQ(columns.pixel_bank_offset[1], columns.pixel_bank_offset[2]);
+    EXPECT_EQ(columns.mutrig_bank_offset[1], columns.mutrig_bank_offset[2]);
+    EXPECT_EQ(columns.pixel_bank_offset.back() + columns.mutrig_bank_offset.back(),
+              first.size() + second.size());
+
+    columns.clear();
+    EXPECT_EQ(columns.nbanks(), 0u);
+    EXPECT_EQ(columns.pixel.size(), 0u);
+    EXPECT_EQ(columns.mutrig.size(), 0u);
+}
+
+TEST(HitColumnsTest, PoolReusesBuffers) {
+    const auto hits = random_hits(500, 3);
+    const uint64_t* buffer = nullptr;
+    {
+        HitColumnsPool::Handle columns = HitColumnsPool::acquire();
+        columns->append_bank(hits.data(), hits.data() + hits.size());
+        buffer = columns->mutrig.raw.data();
+    }
+
+    HitColumnsPool::Handle columns = HitColumnsPool::acquire();
+    EXPECT_EQ(columns->nbanks(), 0u);
+    EXPECT_EQ(columns->pixel.size(), 0u);
+    EXPECT_EQ(columns->mutrig.size(), 0u);
+    columns->append_bank(hits.data(), hits.data() + hits.size());
+    EXPECT_EQ(columns->mutrig.raw.data(), buffer);
+}
@@ -0,0 +1,81 @@
+#include "../analyzer/MutrigTimeCalibration.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <random>
+
+namespace {
+
+// True delay of a channel in units of 50ps: an offset plus a timewalk falling with the energy
+double delay(uint8_t channel, uint16_t energy) {
+    static const double offsets[4] = {0, 40, -30, 100};
+    return offsets[channel] + (channel + 1) * 2000. / (energy + 50);
+}
+
+}  // namespace
+
+TEST(MutrigTimeCalibrationTest, LearnsOffsetsAndTimewalk) {
+    MutrigTimeCalibration::Settings settings;
+    settings.energy_bins = 16;
+    MutrigTimeCalibration calibration(settings);
+
+    std::mt19937 random(3);
+    std::uniform_int_distribution<int> energy(50, 450);
+    std::normal_distribution<double> jitter(0, 4);
+    const std::pair<uint8_t, uint8_t> pairs[] = {{0, 1}, {0, 2}, {1, 3}, {2, 3}};
+
+    for (int i = 0; i < 400000; i++) {
+        const auto [a, b] = pairs[i % 4];
+        const uint64_t particle = 1000000 + 100 * i;
+        const uint16_t energyA = energy(random), energyB = energy(random);
+        const uint64_t timeA = std::llround(particle + delay(a, energyA) + jitter(random));
+        const uint64_t timeB = std::llround(particle + delay(b, energyB) + jitter(random));
+        calibration.learn(a, energyA, timeA, b, energyB, timeB);
+    }
+    calibration.normalise();
+
+    // Only differences are defined, so compare them to the true ones in the middle of the bins
+    for (uint16_t energyA = 80; energyA < 440; energyA += 64) {
+        for (uint16_t energyB = 80; energyB < 440; energyB += 64) {
+            for (uint8_t a = 0; a < 4; a++) {
+                for (uint8_t b = 0; b < 4; b++) {
+                    const double expected = delay(a, energyA / 32 * 32 + 16) - delay(b, energyB / 32 * 32 + 16);
+                    const double learned = calibration.correction(a, energyA) - calibration.correction(b, energyB);
+                    EXPECT_NEAR(learned, expected, 3) << int(a) << " " << int(b) << " " << energyA << " " << energyB;
+                }
+            }
+        }
+    }
+
+    double sum = 0;
+    for (uint8_t channel = 0; channel < 4; channel++) sum += calibration.offset(channel);
+    EXPECT_NEAR(sum, 0, 1e-6);
+    EXPECT_GT(calibration.offset(3), calibration.offset(2));
+}
+
+TEST(MutrigTimeCalibrationTest, ApplySubtractsCorrection) {
+    MutrigTimeCalibration calibration;
+    for (int i = 0; i < 100; i++) calibration.learn(0, 100, 1000, 1, 100, 1050);
+    calibration.normalise();
+
+    const uint8_t channels[] = {0, 1};
+    const uint16_t energies[] = {100, 100};
+    const uint64_t times[] = {2000, 2050};
+    double calibrated[2];
+    calibration.apply(channels, energies, times, 2, calibrated);
+    EXPECT_NEAR(calibrated[0], calibrated[1], 1e-6);
+    EXPECT_NEAR(calibration.offset(1) - calibration.offset(0), 50, 1e-6);
+}
+
+TEST(MutrigTimeCalibrationTest, RejectsOutliersAfterWarmup) {
+    MutrigTimeCalibration::Settings settings;
+    settings.warmup = 10;
+    settings.outlier = 20;
+    MutrigTimeCalibration calibration(settings);
+    for (int i = 0; i < 10; i++) EXPECT_TRUE(calibration.learn(0, 100, 1000, 1, 100, 1000));
+    EXPECT_FALSE(calibration.learn(0, 100, 1000, 1, 100, 5000));
+    EXPECT_EQ(calibration.rejected(), 1u);
+    EXPECT_NEAR(calibration.correction(0, 100), 0, 1e-9);
+    EXPECT_FALSE(calibration.learn(2, 100, 1000, 2, 100, 1000));
+}
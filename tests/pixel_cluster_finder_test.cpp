@@ -0,0 +1,78 @@
+#include "../analyzer/PixelClusterFinder.h"
+
+#include <gtest/gtest.h>
+
+TEST(PixelClusterFinderTest, AdjacentHitsFormOneCluster) {
+    PixelClusterFinder finder(4);
+    finder.add(0, 10, 10, 100, 3);
+    finder.add(0, 11, 11, 101, 4);  // diagonal neighbour
+    finder.add(0, 12, 11, 102, 5);
+    finder.flush();
+
+    ASSERT_EQ(finder.clusters().size(), 1u);
+    const auto& cluster = finder.clusters()[0];
+    EXPECT_EQ(cluster.size, 3u);
+    EXPECT_EQ(cluster.charge, 12u);
+    EXPECT_EQ(cluster.time, 100u);
+    EXPECT_EQ(cluster.duration, 2u);
+    EXPECT_FLOAT_EQ(cluster.col, 11.f);
+    EXPECT_EQ(finder.open_hits(), 0u);
+}
+
+TEST(PixelClusterFinderTest, SeparatedHitsAndChips) {
+    PixelClusterFinder finder(4);
+    finder.add(0, 10, 10, 100, 1);
+    finder.add(0, 12, 10, 100, 1);  // one empty column in between
+    finder.add(1, 11, 10, 100, 1);  // other chip
+    finder.flush();
+    EXPECT_EQ(finder.clusters().size(), 3u);
+}
+
+TEST(PixelClusterFinderTest, ClustersCloseWhenTimeMovesOn) {
+    PixelClusterFinder finder(4);
+    finder.add(0, 10, 10, 100, 1);
+    finder.add(0, 10, 11, 104, 1);  // still within the window
+    EXPECT_TRUE(finder.clusters().empty());
+
+    finder.add(0, 10, 12, 109, 1);  // too late, the first cluster is complete
+    ASSERT_EQ(finder.clusters().size(), 1u);
+    EXPECT_EQ(finder.clusters()[0].size, 2u);
+    EXPECT_EQ(finder.open_hits(), 1u);
+}
+
+TEST(PixelClusterFinderTest, BridgingHitMergesClusters) {
+    PixelClusterFinder finder(10);
+    finder.add(0, 10, 10, 100, 1);
+    finder.add(0, 12, 10, 101, 1);
+    finder.add(0, 20, 20, 101, 1);
+    finder.add(0, 11, 10, 102, 1);  // joins the first two
+    finder.flush();
+
+    ASSERT_EQ(finder.clusters().size(), 2u);
+    uint32_t sizes = 0;
+    for (const auto& cluster : finder.clusters()) sizes = sizes * 10 + cluster.size;
+    EXPECT_TRUE(sizes == 31 || sizes == 13);
+}
+
+TEST(PixelClusterFinderTest, RepeatedPixelStaysOpen) {
+    PixelClusterFinder finder(4);
+    for (uint64_t t = 0; t < 40; t += 3) finder.add(0, 5, 5, t, 1);
+    EXPECT_TRUE(finder.clusters().empty());
+    EXPECT_EQ(finder.open_hits(), 1u);
+    finder.flush();
+    ASSERT_EQ(finder.clusters().size(), 1u);
+    EXPECT_EQ(finder.clusters()[0].size, 14u);
+}
+
+TEST(PixelClusterFinderTest, OutOfOrderAndMemoryBound) {
+    PixelClusterFinder finder(1000, 8);
+    for (uint8_t col = 0; col < 100; col += 2) finder.add(0, col, 0, 10, 1);
+    EXPECT_LE(finder.open_hits(), 8u);
+    EXPECT_EQ(finder.clusters().size(), 50u - finder.open_hits());
+
+    finder.add(0, 200, 0, 5, 1);
+    EXPECT_EQ(finder.out_of_order(), 1u);
+    EXPECT_EQ(finder.open_hits(), 1u);
+    finder.flush();
+    EXPECT_EQ(finder.clusters().size(), 51u);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace musip::dqm {
+
+/** @brief Read only view of a DQM archive file, the native format for saved runs (dqm_histos_<run number>.dqm).
+ *
+ * The file is a FileHeader, then the HistogramEncoder blob of every histogram, each starting on an 8 byte boundary,
+ * then an index with an IndexEntry for each histogram sorted by its "collection/histogram" name, then the names.
+ * The file is memory mapped and nothing is decoded when it's opened, so opening is cheap however many histograms it
+ * has. `find` does a binary search of the index and gives the encoded histogram as it is in the file, which is
+ * exactly what the `dqm::histogram` RPC call sends.
+ *
+ * This has nothing to do with root, and only knows the histograms as bytes. Use `PlotSource::saveAsArchive` and
+ * `PlotSource::addFromArchive` to convert to and from histograms.
+ */
+class Archive {
+public:
+    struct FileHeader {
+        char magic[8];            // "MUSIPDQM"
+        uint32_t version;         // Of the archive layout, not of the HistogramEncoder blobs
+        uint32_t numberOfEntries;
+        uint64_t indexOffset;     // From the start of the file, `numberOfEntries` IndexEntry
+        uint64_t namesOffset;     // From the start of the file, all the names one after the other without separators
+        uint64_t namesSize;
+    };
+
+    struct IndexEntry {
+        uint64_t offset;          // Of the encoded histogram from the start of the file
+        uint64_t size;
+        uint64_t nameOffset;      // From `FileHeader::namesOffset`
+        uint64_t nameSize;
+    };
+
+    static constexpr char magic[8] = {'M', 'U', 'S', 'I', 'P', 'D', 'Q', 'M'};
+    static constexpr uint32_t latestVersion = 1;
+    static constexpr size_t blobAlignment = 8; // The largest bin type, so bins are aligned in the mapped file
+
+    /** @brief An encoded histogram in the mapped file. `data` is nullptr if the histogram isn't in the archive. */
+    struct Blob {
+        const uint8_t* data = nullptr;
+        size_t size = 0;
+    };
+
+    /** @brief Maps `filename`. If it can't be opened or isn't a valid archive `error` is set and the archive is empty. */
+    Archive(const std::filesystem::path& filename, std::error_code& error);
+    ~Archive();
+
+    Archive(const Archive& other) = delete;
+    Archive& operator=(const Archive& other) = delete;
+
+    /** @brief The number of histograms. */
+    size_t size() const { return numberOfEntries_; }
+
+    /** @brief The "collection/histogram" name of the histogram at `index`, in sorted order. */
+    std::string_view name(size_t index) const;
+
+    /** @brief The encoded histogram at `index`. */
+    Blob blob(size_t index) const;
+
+    /** @brief The encoded histogram with the "collection/histogram" name `path`. */
+    Blob find(std::string_view path) const;
+
+    /** @brief The size of the mapped file in bytes. */
+    size_t fileSize() const { return fileSize_; }
+
+    /** @brief Writes an archive of `histograms`, which are ("collection/histogram" name, encoded histogram) pairs.
+     *
+     * The histograms can be in any order, and the names have to be unique. The file is written under a temporary
+     * name and renamed when complete, so that a reader never maps a partly written file.
+     */
+    static void write(const std::filesystem::path& filename, std::vector<std::pair<std::string, std::vector<uint8_t>>>& histograms, std::error_code& error);
+private:
+    const uint8_t* pFile_ = nullptr;
+    size_t fileSize_ = 0;
+    size_t numberOfEntries_ = 0;
+    const IndexEntry* pIndex_ = nullptr;
+    const char* pNames_ = nullptr;
+}; // end of class Archive
+
+static_assert(sizeof(Archive::FileHeader) == 40);
+static_assert(sizeof(Archive::IndexEntry) == 32);
+
+} // end of namespace musip::dqm
@@ -23,9 +23,12 @@ public:
     using mutex_type = detail::MutexPointer<std::mutex>;
 private:
     mutable mutex_type mutex_;
+    // Buffers of `fill<Lock::Sharded>`. They are added to data_ and entries_ under the mutex before either is
+    // read, which is why those two are mutable: draining the shards doesn't change the logical content.
+    mutable detail::FillShards<content_type> shards_;
     axis_type axis_;
-    std::vector<content_type> data_;
-    size_t entries_;
+    mutable std::vector<content_type> data_;
+    mutable size_t entries_;
 
     // Rather stupidly you can't get these values out of the boost axis, so we have to store a duplicate as well.
     xaxis_type lowEdge_;
@@ -57,6 +60,15 @@ public:
     template<Lock lock = Lock::PerformLock>
     void Fill(xaxis_type value, content_type weight = 1) { return fill<lock>(value, weight); }
 
+    /** @brief Fills `count` values, with the matching entry of `weights` or with weight one if it is null.
+     *
+     * Takes the lock once for all values and works out the bins in a loop the compiler can vectorise, so this
+     * is much cheaper than calling `fill` for each value. `value_type` can be any arithmetic type, e.g. a
+     * column of hit data, and is converted to `xaxis_type`. Accepts `Lock::Sharded` like `fill`.
+     */
+    template<Lock lock = Lock::PerformLock, typename value_type>
+    void fillN(const value_type* values, size_t count, const content_type* weights = nullptr);
+
     template<Lock lock = Lock::PerformLock>
     size_t entries() const;
 
@@ -94,6 +106,11 @@ public:
     template<Lock lock = Lock::PerformLock>
     void clear();
 
+    /** @brief Copies the bin contents without under- and overflow bins. */
+    template<Lock lock = Lock::PerformLock>
+    std::vector<content_type> binContents() const;
+
+#ifdef MUSIP_DQM_WITH_ROOT
     using root_type = typename detail::root_type<1, content_type>::type;
 
     /** @brief Converts to a root (as in root.cern.ch) histogram.
@@ -110,10 +127,14 @@ public:
      */
     template<Lock lock = Lock::PerformLock>
     std::unique_ptr<root_type> asRootObject(const std::string& histogramName, const std::string& histogramTitle) const;
+#endif
 
 private:
     template<Lock lock = Lock::PerformLock, Lock otherLock = Lock::PerformLock, typename histogram_type>
     void addImpl(histogram_type&& other, std::error_code& error);
+
+    /** @brief Adds the thread shards to the data. The mutex must already be locked. */
+    void drainShards() const { shards_.drain(data_, entries_); }
 };
 
 } // end of namespace musip::dqm
@@ -127,18 +148,56 @@ private:
 template<typename xaxis_type_, typename content_type_>
 template<musip::dqm::Lock lock>
 void musip::dqm::BasicHistogram1D<xaxis_type_, content_type_>::fill(xaxis_type value, content_type weight) {
-    typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
+    if constexpr(lock == Lock::Sharded) {
+        const uint32_t bin = axis_.index(value) + bin_offset;
+        if(shards_.push(&bin, &weight, 1) == 1) return;
+
+        // Threads that didn't get a slot, or whose buffer is full, fall back to the shared lock
+        typename detail::guard_type<Lock::PerformLock, mutex_type>::type lockGuard(mutex_);
+        drainShards();
+        data_[bin] += weight;
+        ++entries_;
+    }
+    else {
+        typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
 
-    const int boostIndex = axis_.index(value);
+        const int boostIndex = axis_.index(value);
+
+        data_[ boostIndex + bin_offset ] += weight;
+        ++entries_;
+    }
+}
 
-    data_[ boostIndex + bin_offset ] += weight;
-    ++entries_;
+template<typename xaxis_type_, typename content_type_>
+template<musip::dqm::Lock lock, typename value_type>
+void musip::dqm::BasicHistogram1D<xaxis_type_, content_type_>::fillN(const value_type* values, size_t count, const content_type* weights) {
+    if constexpr(lock == Lock::Sharded) {
+        uint32_t indices[detail::fillChunkSize];
+        for(size_t start = 0; start < count; start += detail::fillChunkSize) {
+            const size_t chunkSize = std::min(detail::fillChunkSize, count - start);
+            const content_type* chunkWeights = (weights != nullptr ? weights + start : nullptr);
+            detail::regularAxisIndices(values + start, chunkSize, lowEdge_, highEdge_, axis_.size(), bin_offset, indices);
+            const size_t taken = shards_.push(indices, chunkWeights, chunkSize);
+            if(taken == chunkSize) continue;
+
+            // What the buffer didn't take is added under the shared lock, like in `fill`
+            typename detail::guard_type<Lock::PerformLock, mutex_type>::type lockGuard(mutex_);
+            drainShards();
+            detail::addToBins(indices + taken, chunkWeights != nullptr ? chunkWeights + taken : nullptr, chunkSize - taken, data_.data());
+            entries_ += chunkSize - taken;
+        }
+    }
+    else {
+        typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
+        detail::fillRegular(values, count, weights, lowEdge_, highEdge_, axis_.size(), bin_offset, data_.data(), entries_);
+    }
 }
 
 template<typename xaxis_type_, typename content_type_>
 template<musip::dqm::Lock lock>
 size_t musip::dqm::BasicHistogram1D<xaxis_type_, content_type_>::entries() const {
     typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
+    drainShards();
 
     return entries_;
 }
@@ -217,14 +276,27 @@ template<musip::dqm::Lock lock>
 void musip::dqm::BasicHistogram1D<xaxis_type_, content_type_>::clear() {
     typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
 
+    shards_.clear();
+
     std::memset(data_.data(), 0, data_.size() * sizeof(content_type));
     entries_ = 0;
 }
 
+template<typename xaxis_type_, typename content_type_>
+template<musip::dqm::Lock lock>
+std::vector<content_type_> musip::dqm::BasicHistogram1D<xaxis_type_, content_type_>::binContents() const {
+    typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
+    drainShards();
+
+    return std::vector<content_type>(data_.begin() + bin_offset, data_.begin() + bin_offset + numberOfBins());
+}
+
+#ifdef MUSIP_DQM_WITH_ROOT
 template<typename xaxis_type_, typename content_type_>
 template<musip::dqm::Lock lock>
 std::unique_ptr<typename musip::dqm::BasicHistogram1D<xaxis_type_, content_type_>::root_type> musip::dqm::BasicHistogram1D<xaxis_type_, content_type_>::asRootObject(const std::string& histogramName, const std::string& histogramTitle) const {
     typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
+    drainShards();
 
     // If a title has been set in the metadata, use that. If not just reuse the name parameter
     const std::string& titleFromMetadata = metadata_.get<Metadata::Category::Title>();
@@ -245,6 +317,7 @@ std::unique_ptr<typename musip::dqm::BasicHistogram1D<xaxis_type_, content_type_
 
     return pHistogram;
 }
+#endif
 
 template<typename xaxis_type_, typename content_type_>
 template<musip::dqm::Lock lock, musip::dqm::Lock otherLock, typename histogram_type>
@@ -271,6 +344,7 @@ void musip::dqm::BasicHistogram1D<xaxis_type_, content_type_>::addImpl(histogram
     // We now need to look at the mutable data, so we need to lock both histograms
     typename detail::guard_type<lock, mutex_type>::type thisLockGuard(mutex_);
     typename detail::guard_type<otherLock, mutex_type>::type otherLockGuard(otherMutex);
+    other.drainShards();
 
     if constexpr(std::is_rvalue_reference<histogram_type&&>::value) {
         // The other histogram is an rvalue reference, i.e. it is a temporary or it was
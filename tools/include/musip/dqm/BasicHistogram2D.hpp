@@ -25,10 +25,13 @@ public:
     using mutex_type = detail::MutexPointer<std::mutex>;
 private:
     mutable mutex_type mutex_;
+    // Buffers of `fill<Lock::Sharded>`. They are added to data_ and entries_ under the mutex before either is
+    // read, which is why those two are mutable: draining the shards doesn't change the logical content.
+    mutable detail::FillShards<content_type> shards_;
     x_axis_type xAxis_;
     y_axis_type yAxis_;
-    std::vector<content_type> data_;
-    size_t entries_;
+    mutable std::vector<content_type> data_;
+    mutable size_t entries_;
 
     // Rather stupidly you can't get these values out of the boost axis, so we have to store a duplicate as well.
     xaxis_type lowXEdge_;
@@ -42,6 +45,7 @@ private:
     friend class PlotCollection;
     friend class DQMManager;
     friend struct HistogramEncoder;
+    template<typename, typename, typename> friend class BasicRollingHistogram2D; // Keeps a running total of its slices
 
 public:
     template<typename... metadata_parameters>
@@ -65,6 +69,15 @@ public:
     template<Lock lock = Lock::PerformLock>
     void Fill(xaxis_type xValue, yaxis_type yValue, content_type weight = 1) { return fill<lock>(xValue, yValue, weight); }
 
+    /** @brief Fills `count` pairs of values, with the matching entry of `weights` or with weight one if it is null.
+     *
+     * Takes the lock once for all values and works out the bins in a loop the compiler can vectorise, so this
+     * is much cheaper than calling `fill` for each pair. The value types can be any arithmetic types, e.g.
+     * columns of hit data, and are converted to the axis types. Accepts `Lock::Sharded` like `fill`.
+     */
+    template<Lock lock = Lock::PerformLock, typename xvalue_type, typename yvalue_type>
+    void fillN(const xvalue_type* xValues, const yvalue_type* yValues, size_t count, const content_type* weights = nullptr);
+
     template<Lock lock = Lock::PerformLock>
     size_t entries() const;
 
@@ -107,6 +120,16 @@ public:
     template<Lock lock = Lock::PerformLock>
     void clear();
 
+    /** @brief Copies the bin contents without under- and overflow bins.
+     *
+     * The result is column major, i.e. the content of x bin `x` and y bin `y` (both counted from zero)
+     * is at `x * numberOfYBins() + y`. This is the layout of the pixel files, so hitmaps can be processed
+     * without going through a root histogram.
+     */
+    template<Lock lock = Lock::PerformLock>
+    std::vector<content_type> binContents() const;
+
+#ifdef MUSIP_DQM_WITH_ROOT
     using root_type = typename detail::root_type<2, content_type>::type;
 
     /** @brief Converts to a root (as in root.cern.ch) histogram.
@@ -123,10 +146,14 @@ public:
      */
     template<Lock lock = Lock::PerformLock>
     std::unique_ptr<root_type> asRootObject(const std::string& histogramName, const std::string& histogramTitle) const;
+#endif
 
 private:
     template<Lock lock = Lock::PerformLock, Lock otherLock = Lock::PerformLock, typename histogram_type>
     void addImpl(histogram_type&& other, std::error_code& error);
+
+    /** @brief Adds the thread shards to the data. The mutex must already be locked. */
+    void drainShards() const { shards_.drain(data_, entries_); }
 };
 
 } // end of namespace musip::dqm
@@ -140,19 +167,63 @@ private:
 template<typename xaxis_type_, typename yaxis_type_, typename content_type_>
 template<musip::dqm::Lock lock>
 void musip::dqm::BasicHistogram2D<xaxis_type_, yaxis_type_, content_type_>::fill(xaxis_type xValue, yaxis_type yValue, content_type weight) {
-    typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
+    if constexpr(lock == Lock::Sharded) {
+        const int boostXIndex = xAxis_.index(xValue);
+        const int boostYIndex = yAxis_.index(yValue);
+        const uint32_t bin = (boostXIndex + bin_offset) + (xAxis_.size() + additional_bins) * (boostYIndex + bin_offset);
+        if(shards_.push(&bin, &weight, 1) == 1) return;
+
+        // Threads that didn't get a slot, or whose buffer is full, fall back to the shared lock
+        typename detail::guard_type<Lock::PerformLock, mutex_type>::type lockGuard(mutex_);
+        drainShards();
+        data_[bin] += weight;
+        ++entries_;
+    }
+    else {
+        typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
 
-    const int boostXIndex = xAxis_.index(xValue);
-    const int boostYIndex = yAxis_.index(yValue);
+        const int boostXIndex = xAxis_.index(xValue);
+        const int boostYIndex = yAxis_.index(yValue);
 
-    data_[ (boostXIndex + bin_offset) + (xAxis_.size() + additional_bins) * (boostYIndex + bin_offset)] += weight;
-    ++entries_;
+        data_[ (boostXIndex + bin_offset) + (xAxis_.size() + additional_bins) * (boostYIndex + bin_offset)] += weight;
+        ++entries_;
+    }
+}
+
+template<typename xaxis_type_, typename yaxis_type_, typename content_type_>
+template<musip::dqm::Lock lock, typename xvalue_type, typename yvalue_type>
+void musip::dqm::BasicHistogram2D<xaxis_type_, yaxis_type_, content_type_>::fillN(const xvalue_type* xValues, const yvalue_type* yValues, size_t count, const content_type* weights) {
+    if constexpr(lock == Lock::Sharded) {
+        uint32_t xIndices[detail::fillChunkSize];
+        uint32_t yIndices[detail::fillChunkSize];
+        const uint32_t rowLength = xAxis_.size() + additional_bins;
+        for(size_t start = 0; start < count; start += detail::fillChunkSize) {
+            const size_t chunkSize = std::min(detail::fillChunkSize, count - start);
+            const content_type* chunkWeights = (weights != nullptr ? weights + start : nullptr);
+            detail::regularAxisIndices(xValues + start, chunkSize, lowXEdge_, highXEdge_, xAxis_.size(), bin_offset, xIndices);
+            detail::regularAxisIndices(yValues + start, chunkSize, lowYEdge_, highYEdge_, yAxis_.size(), bin_offset, yIndices);
+            for(size_t index = 0; index < chunkSize; ++index) xIndices[index] += rowLength * yIndices[index];
+            const size_t taken = shards_.push(xIndices, chunkWeights, chunkSize);
+            if(taken == chunkSize) continue;
+
+            // What the buffer didn't take is added under the shared lock, like in `fill`
+            typename detail::guard_type<Lock::PerformLock, mutex_type>::type lockGuard(mutex_);
+            drainShards();
+            detail::addToBins(xIndices + taken, chunkWeights != nullptr ? chunkWeights + taken : nullptr, chunkSize - taken, data_.data());
+            entries_ += chunkSize - taken;
+        }
+    }
+    else {
+        typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
+        detail::fillRegular2D(xValues, yValues, count, weights, lowXEdge_, highXEdge_, xAxis_.size(), lowYEdge_, highYEdge_, yAxis_.size(), bin_offset, data_.data(), entries_);
+    }
 }
 
 template<typename xaxis_type_, typename yaxis_type_, typename content_type_>
 template<musip::dqm::Lock lock>
 size_t musip::dqm::BasicHistogram2D<xaxis_type_, yaxis_type_, content_type_>::entries() const {
     typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
+    drainShards();
 
     return entries_;
 }
@@ -252,14 +323,36 @@ template<musip::dqm::Lock lock>
 void musip::dqm::BasicHistogram2D<xaxis_type_, yaxis_type_, content_type_>::clear() {
     typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
 
+    shards_.clear();
+
     std::memset(data_.data(), 0, data_.size() * sizeof(content_type));
     entries_ = 0;
 }
 
+template<typename xaxis_type_, typename yaxis_type_, typename content_type_>
+template<musip::dqm::Lock lock>
+std::vector<content_type_> musip::dqm::BasicHistogram2D<xaxis_type_, yaxis_type_, content_type_>::binContents() const {
+    const size_t xBins = numberOfXBins();
+    const size_t yBins = numberOfYBins();
+    std::vector<content_type> contents(xBins * yBins);
+
+    typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
+    drainShards();
+
+    for(size_t y = 0; y < yBins; ++y) {
+        const content_type* pRow = &data_[bin_offset + (xBins + additional_bins) * (y + bin_offset)];
+        for(size_t x = 0; x < xBins; ++x) contents[x * yBins + y] = pRow[x];
+    }
+
+    return contents;
+}
+
+#ifdef MUSIP_DQM_WITH_ROOT
 template<typename xaxis_type_, typename yaxis_type_, typename content_type_>
 template<musip::dqm::Lock lock>
 std::unique_ptr<typename musip::dqm::BasicHistogram2D<xaxis_type_, yaxis_type_, content_type_>::root_type> musip::dqm::BasicHistogram2D<xaxis_type_, yaxis_type_, content_type_>::asRootObject(const std::string& histogramName, const std::string& histogramTitle) const {
     typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
+    drainShards();
 
     // If a title has been set in the metadata, use that. If not just reuse the name parameter
     const std::string& titleFromMetadata = metadata_.get<Metadata::Category::Title>();
@@ -283,6 +376,7 @@ std::unique_ptr<typename musip::dqm::BasicHistogram2D<xaxis_type_, yaxis_type_,
 
     return pHistogram;
 }
+#endif
 
 template<typename xaxis_type_, typename yaxis_type_, typename content_type_>
 template<musip::dqm::Lock lock, musip::dqm::Lock otherLock, typename histogram_type>
@@ -310,6 +404,7 @@ void musip::dqm::BasicHistogram2D<xaxis_type_, yaxis_type_, content_type_>::addI
     // We now need to look at the mutable data, so we need to lock both histograms
     typename detail::guard_type<lock, mutex_type>::type thisLockGuard(mutex_);
     typename detail::guard_type<otherLock, mutex_type>::type otherLockGuard(otherMutex);
+    other.drainShards();
 
     if constexpr(std::is_rvalue_reference<histogram_type&&>::value) {
         // The other histogram is an rvalue reference, i.e. it is a temporary or it was
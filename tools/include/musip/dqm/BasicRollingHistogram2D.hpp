@@ -1,7 +1,9 @@
 #pragma once
 
+#include <algorithm>
 #include <vector>
 #include <chrono>
+#include <type_traits>
 
 #include "musip/dqm/dqmfwd.hpp"
 #include "musip/dqm/detail.hpp"
@@ -44,6 +46,12 @@ private:
     std::chrono::steady_clock::duration sliceDuration_;
     mutable size_t currentSliceIndex_;
     mutable std::chrono::steady_clock::time_point currentSliceTime_;
+    // The sum of every slice except the current one. Slices are added when they stop being current and taken away
+    // when they are cleared for reuse, so `total()` only has to add the current slice instead of all of them.
+    mutable histogram_type closedSlicesTotal_;
+    // For floating point contents the subtraction isn't exact, so closedSlicesTotal_ is summed from scratch once
+    // every time the slices have gone all the way round. This counts the slices closed since then.
+    mutable size_t slicesSinceRecount_;
 
     // This is immutable after construction.
     Metadata metadata_;
@@ -66,6 +74,10 @@ public:
     template<Lock lock = Lock::PerformLock>
     void Fill(xaxis_type xValue, yaxis_type yValue, content_type weight = 1) { return fill<lock>(xValue, yValue, weight); }
 
+    /** @brief Fills `count` pairs of values into the current time slice, see `BasicHistogram2D::fillN`. */
+    template<Lock lock = Lock::PerformLock, typename xvalue_type, typename yvalue_type>
+    void fillN(const xvalue_type* xValues, const yvalue_type* yValues, size_t count, const content_type* weights = nullptr);
+
     template<Lock lock = Lock::PerformLock>
     size_t entries() const;
 
@@ -86,6 +98,7 @@ public:
     template<Lock lock = Lock::PerformLock>
     void clear();
 
+#ifdef MUSIP_DQM_WITH_ROOT
     using root_type = typename histogram_type::root_type;
 
     /** @brief Converts to a root (as in root.cern.ch) histogram.
@@ -102,6 +115,7 @@ public:
      */
     template<Lock lock = Lock::PerformLock>
     std::unique_ptr<root_type> asRootObject(const std::string& histogramName, const std::string& histogramTitle) const;
+#endif
 private:
     template<Lock lock = Lock::PerformLock>
     void updateSlices() const;
@@ -117,6 +131,8 @@ musip::dqm::BasicRollingHistogram2D<xaxis_type_, yaxis_type_, content_type_>::Ba
     : mutex_(pMutex),
       sliceDuration_(sliceDuration),
       currentSliceIndex_(0),
+      closedSlicesTotal_(nullptr, numberOfXBins, lowXEdge, highXEdge, numberOfYBins, lowYEdge, highYEdge),
+      slicesSinceRecount_(0),
       metadata_(std::forward<metadata_parameters>(metadataParams)...) {
     slices_.reserve(numberOfSlices);
     for(unsigned index = 0; index < numberOfSlices; ++index) {
@@ -132,8 +148,10 @@ musip::dqm::BasicHistogram2D<xaxis_type_, yaxis_type_, content_type_> musip::dqm
     typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
     updateSlices<Lock::AlreadyLocked>();
 
+    // A copy of the closed slices plus the current one, so the cost doesn't depend on the number of slices
     std::error_code error;
-    for(const auto& slice : slices_) returnValue.template add<Lock::AlreadyLocked, Lock::AlreadyLocked>(slice, error);
+    returnValue.template add<Lock::AlreadyLocked>(closedSlicesTotal_.data_.data(), closedSlicesTotal_.data_.size(), closedSlicesTotal_.entries_, error);
+    returnValue.template add<Lock::AlreadyLocked, Lock::AlreadyLocked>(slices_[currentSliceIndex_], error);
 
     return returnValue;
 }
@@ -149,9 +167,38 @@ void musip::dqm::BasicRollingHistogram2D<xaxis_type_, yaxis_type_, content_type_
     if(slicesPassed > 0) {
         typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
 
-        for(size_t index = 0; index < std::min(slicesPassed, slices_.size()); ++index) {
-            currentSliceIndex_ = (currentSliceIndex_ + 1) % slices_.size();
-            slices_[currentSliceIndex_].template clear<Lock::AlreadyLocked>();
+        if(slicesPassed >= slices_.size()) {
+            // Everything is out of the time window, no need to keep the total up to date slice by slice
+            for(auto& slice : slices_) slice.template clear<Lock::AlreadyLocked>();
+            closedSlicesTotal_.template clear<Lock::AlreadyLocked>();
+            currentSliceIndex_ = (currentSliceIndex_ + slicesPassed) % slices_.size();
+            slicesSinceRecount_ = 0;
+        }
+        else {
+            std::vector<content_type>& totalData = closedSlicesTotal_.data_;
+            for(size_t index = 0; index < slicesPassed; ++index) {
+                const histogram_type& closingSlice = slices_[currentSliceIndex_];
+                currentSliceIndex_ = (currentSliceIndex_ + 1) % slices_.size();
+                histogram_type& expiringSlice = slices_[currentSliceIndex_];
+
+                // Only the two slices that change need to be touched
+                for(size_t bin = 0; bin < totalData.size(); ++bin) totalData[bin] += closingSlice.data_[bin] - expiringSlice.data_[bin];
+                closedSlicesTotal_.entries_ += closingSlice.entries_;
+                closedSlicesTotal_.entries_ -= expiringSlice.entries_;
+                expiringSlice.template clear<Lock::AlreadyLocked>();
+            }
+
+            if constexpr(std::is_floating_point<content_type>::value) {
+                slicesSinceRecount_ += slicesPassed;
+                if(slicesSinceRecount_ >= slices_.size()) {
+                    std::fill(totalData.begin(), totalData.end(), content_type(0));
+                    for(size_t index = 0; index < slices_.size(); ++index) {
+                        if(index == currentSliceIndex_) continue;
+                        for(size_t bin = 0; bin < totalData.size(); ++bin) totalData[bin] += slices_[index].data_[bin];
+                    }
+                    slicesSinceRecount_ = 0;
+                }
+            }
         }
 
         // The time of this new slice is *not* timeNow, since we're probably somewhere in the middle of the slice.
@@ -168,16 +215,22 @@ void musip::dqm::BasicRollingHistogram2D<xaxis_type_, yaxis_type_, content_type_
     slices_[currentSliceIndex_].template fill<Lock::AlreadyLocked>(std::forward<xaxis_type>(xValue), std::forward<yaxis_type>(yValue), std::forward<content_type>(weight));
 }
 
+template<typename xaxis_type_, typename yaxis_type_, typename content_type_>
+template<musip::dqm::Lock lock, typename xvalue_type, typename yvalue_type>
+void musip::dqm::BasicRollingHistogram2D<xaxis_type_, yaxis_type_, content_type_>::fillN(const xvalue_type* xValues, const yvalue_type* yValues, size_t count, const content_type* weights) {
+    typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
+    updateSlices<Lock::AlreadyLocked>();
+
+    slices_[currentSliceIndex_].template fillN<Lock::AlreadyLocked>(xValues, yValues, count, weights);
+}
+
 template<typename xaxis_type_, typename yaxis_type_, typename content_type_>
 template<musip::dqm::Lock lock>
 size_t musip::dqm::BasicRollingHistogram2D<xaxis_type_, yaxis_type_, content_type_>::entries() const {
     typename detail::guard_type<lock, mutex_type>::type lockGuard(mutex_);
     updateSlices<Lock::AlreadyLocked>();
 
-    size_t entries = 0;
-    for(const auto& slice : slices_) entries += slice.template entries<Lock::AlreadyLocked>();
-
-    return entries;
+    return closedSlicesTotal_.entries_ + slices_[currentSliceIndex_].template entries<Lock::AlreadyLocked>();
 }
 
 template<typename xaxis_type_, typename yaxis_type_, typename content_type_>
@@ -229,10 +282,14 @@ void musip::dqm::BasicRollingHistogram2D<xaxis_type_, yaxis_type_, content_type_
     updateSlices<Lock::AlreadyLocked>();
 
     for(auto& slice : slices_) slice.template clear<Lock::AlreadyLocked>();
+    closedSlicesTotal_.template clear<Lock::AlreadyLocked>();
+    slicesSinceRecount_ = 0;
 }
 
+#ifdef MUSIP_DQM_WITH_ROOT
 template<typename xaxis_type_, typename yaxis_type_, typename content_type_>
 template<musip::dqm::Lock lock>
 std::unique_ptr<typename musip::dqm::BasicHistogram2D<xaxis_type_, yaxis_type_, content_type_>::root_type> musip::dqm::BasicRollingHistogram2D<xaxis_type_, yaxis_type_, content_type_>::asRootObject(const std::string& histogramName, const std::string& histogramTitle) const {
     return const_cast<BasicRollingHistogram2D<xaxis_type_, yaxis_type_, content_type_>*>(this)->total<lock>().asRootObject(histogramName, histogramTitle);
 }
+#endif
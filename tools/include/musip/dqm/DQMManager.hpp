@@ -2,12 +2,19 @@
 
 #include "musip/dqm/dqmfwd.hpp"
 #include "musip/dqm/PlotSource.hpp"
+#include "musip/dqm/HistogramRevisions.hpp"
+#include "musip/dqm/Archive.hpp"
 
 #include <tmfe.h>
 
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
+#include <future>
 #include <optional>
 #include <list>
+#include <thread>
+#include <unordered_map>
 
 namespace musip::dqm {
 
@@ -22,14 +29,23 @@ public:
 
     PlotCollection* getOrCreateCollection(const std::string& name);
 
+#ifdef MUSIP_DQM_WITH_ROOT
     void saveAsRootFile(const char* filename, const char* options = "RECREATE") { return saveAsRootFile(filename, true, options); }
     void saveAsRootFile(const char* filename, bool skipEmptyHistograms, const char* options = "RECREATE");
     void addFromRootFile(const char* filename);
+#endif
 
-    /** @brief Clear all of the histograms in all of the collections. */
+    /** @brief Saves the current run as an Archive, which is what previous runs are preferably served from. */
+    void saveAsArchive(const char* filename, bool skipEmptyHistograms);
+    void addFromArchive(const char* filename);
+
+    /** @brief Clear all of the histograms in all of the collections, and forget the versions sent to clients. */
     void clearAll();
 
     /** @brief Add a directory to search in when previous runs are requested over RPC.
+     *
+     * For each run the directory is searched for dqm_histos_<run number>.dqm, and dqm_histos_<run number>.root if
+     * there is no archive and the build has root. Archives are much quicker to load.
      *
      * The directories are searched in the order they are given to this method, and subsequent directories
      * are not checked once a suitable file is found. So for example, if we first call this method with the
@@ -48,16 +64,43 @@ public:
         /// @brief Little endian size in bytes of the full message, including this header.
         uint32_t messageSize;
 
-        enum class MessageType : uint32_t { unknown = 0x00, list = 0x7473696c, hist = 0x74736968 };
+        enum class MessageType : uint32_t {
+            unknown = 0x00,
+            list = 0x7473696c,               // "list"
+            hist = 0x74736968,               // "hist"
+            versionedHistogram = 0x74736876, // "vhst", see UpdateHeader
+            delta = 0x61746c64,              // "dlta", see UpdateHeader
+            notModified = 0x646f6d6e,        // "nmod", see UpdateHeader
+            wait = 0x74696177                // "wait", previous runs are still being loaded so ask again later
+        };
         MessageType messageType;
     };
 
+    /** @brief Follows the RPCHeader in replies to `dqm::histogram` calls that give a "since" version.
+     *
+     * For `versionedHistogram` the encoded histogram follows. For `delta` the uint32_t index of each changed bin
+     * follows, then padding up to a multiple of 8 bytes, then the new content of those bins. `notModified` has
+     * nothing after it.
+     */
+    struct UpdateHeader {
+        uint32_t version;             // The version the client has once it has applied the reply
+        uint32_t numberOfChangedBins; // Only for `delta`
+        uint64_t entries;
+    };
+
+    /** @brief Writes the reply to a `dqm::histogram` call for `histogram` to `result`, including the RPCHeader.
+     *
+     * Without `pUpdate` the reply is a `hist` message, otherwise the message that the kind of update asks for.
+     */
+    static void encodeHistogramReply(const PlotCollection::object_type& histogram, const HistogramRevisions::Update* pUpdate, std::vector<char>& result);
+
     static_assert(offsetof(RPCHeader, messageSize) == 0);
     static_assert(sizeof(RPCHeader::messageSize) == 4);
     static_assert(offsetof(RPCHeader, messageType) == 4);
     static_assert(sizeof(RPCHeader::messageType) == 4);
     static_assert(sizeof(RPCHeader) == 8);
     static_assert(sizeof(RPCHeader) % 8 == 0); // It's important that the header doesn't mis-align histograms with datatype double
+    static_assert(sizeof(UpdateHeader) % 8 == 0);
     // TODO: Add static_assert that we're on a little endian system (requires C++20)
 protected:
     DQMManager();
@@ -70,6 +113,7 @@ protected:
 
     unsigned verbosity_ = 0;
     musip::dqm::PlotSource<> currentRun_;
+    musip::dqm::HistogramRevisions revisions_; // Versions of the current run histograms that clients have asked for
     struct PreviousRun {
         // We never change the data, so we don't want to lock the thread for reading.
         // This should compile down to no-ops.
@@ -81,33 +125,63 @@ protected:
             void lock_shared() {}
             void unlock_shared() {}
         };
+        using source_type = musip::dqm::PlotSource<null_mutex>;
+
+        /// What the files of a set of runs give. A single run with an archive is served straight from the
+        /// mapped file without decoding anything; anything else is added up into `plots`.
+        struct Contents {
+            std::unique_ptr<Archive> pArchive;
+            source_type plots;
+        };
 
-        /// The time when this run was last accessed, used to clear out old entries from the cache.
-        std::chrono::steady_clock::time_point lastAccess;
-        /// The sorted list of run numbers that this PlotSource is for, so that we can find it again later.
+        /// The sorted list of run numbers that this entry is for, so that we can find it again later.
         std::vector<int> runs;
 
-        // The actual cache entry. We use a shared_ptr so that we can return the ptr and release the
-        // thread lock - the data won't change but whether it's in the cache or not will. So once we
-        // have a copy of the ptr we no longer need the lock.
-        std::shared_ptr<musip::dqm::PlotSource<null_mutex>> data;
+        // The actual cache entry, which becomes ready when the background loader has read the files. Every request
+        // for the same runs gets a copy of the same future, so each set of runs is loaded once. We use a shared_ptr
+        // so that we can return the ptr and release the thread lock - the data won't change but whether it's in the
+        // cache or not will. So once we have a copy of the ptr we no longer need the lock.
+        std::shared_future<std::shared_ptr<Contents>> data;
 
-        // Simple constructor so that we can `emplace` new instances.
-        template<typename time_type, typename runs_type, typename data_type>
-        PreviousRun(time_type&& time, runs_type&& runs, data_type&& dataPointer)
-            : lastAccess(std::forward<time_type>(time)), runs(std::forward<runs_type>(runs)), data(std::forward<data_type>(dataPointer))
-        {}
+        /// Memory taken by the histograms, or the size of the mapped archive. Zero until they're loaded.
+        size_t memoryUsage = 0;
     };
-    std::mutex previousRunsMutex_; // Protects access to `previousRuns_` and `previousRunDirectories_`
-    std::list<PreviousRun> previousRuns_;
-    static constexpr size_t maximumPreviousRunsSize_ = 5; // The maximum size of `previousRuns_` before we start ejecting old entries
+    std::mutex previousRunsMutex_; // Protects everything to do with previous runs below
+    std::list<PreviousRun> previousRuns_; // Most recently used first
+    std::unordered_map<std::string, std::list<PreviousRun>::iterator> previousRunsIndex_; // Entries of `previousRuns_` by their run numbers
+    size_t previousRunsMemory_ = 0; // Sum of `memoryUsage` over `previousRuns_`
+    static constexpr size_t maximumPreviousRunsMemory_ = size_t(1) << 30; // Least recently used entries are ejected above this
     std::vector<std::filesystem::path> previousRunDirectories_; // The list of directories we search for old run files, in order.
 
-    /** @brief Looks in previousRuns_ for a previously loaded set of files and returns the accumulated source. If not
-     * found tries to load all the runs from disk, caches the accumulation in previousRuns_ and return it.
+    // Files are read on a thread of their own, so the RPC thread never waits long for the disk. Requests go on
+    // the front of the queue and prefetches of neighbouring runs on the back. The thread is started by the first
+    // load that gets queued.
+    struct HistoryLoad {
+        std::vector<int> runs;
+        std::promise<std::shared_ptr<PreviousRun::Contents>> promise;
+    };
+    std::deque<HistoryLoad> historyLoads_; // Protected by previousRunsMutex_
+    std::condition_variable historyLoadsChanged_;
+    bool stopHistoryLoader_ = false;
+    std::thread historyLoader_;
+    static constexpr auto maximumHistoryWait_ = std::chrono::milliseconds(100); // How long an RPC waits for a load before replying `wait`
+
+    /** @brief Looks in previousRuns_ for a previously loaded set of files and returns their contents. If not
+     * found, queues the runs to be loaded from disk in the background.
+     *
+     * If the runs are not loaded within `maximumHistoryWait_`, returns nullptr and sets `pending`. The client should
+     * then ask again a bit later. Requests for a single run also queue the runs either side of it, since someone
+     * browsing through old runs will likely want those next.
      *
-     * Returns a shared_ptr so that PlotSource can still be used even if it is ejected from the cache by another thread.*/
-    std::shared_ptr<musip::dqm::PlotSource<PreviousRun::null_mutex>> getHistorySource(std::vector<int>& runs);
+     * Returns a shared_ptr so that the contents can still be used even if they are ejected from the cache by another thread.*/
+    std::shared_ptr<PreviousRun::Contents> getHistorySource(std::vector<int>& runs, bool& pending);
+
+    /** @brief Returns the cache entry for the sorted `runs`, and queues the load if there isn't one yet. The caller must
+     * hold previousRunsMutex_. */
+    std::list<PreviousRun>::iterator findOrQueueHistory(const std::vector<int>& runs, bool prefetch);
+
+    /** @brief Body of `historyLoader_`, loads the queued runs until `stopHistoryLoader_` is set. */
+    void loadHistory();
 
     // Explicitly delete copy, assignment and move.
     DQMManager( const DQMManager& other ) = delete;
@@ -1,28 +1,73 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cstring>
 #include <system_error>
 #include <optional>
+#include <vector>
 #include "musip/dqm/dqmfwd.hpp"
 #include "musip/dqm/PlotCollection.hpp"
 
 namespace musip::dqm {
 
+/** @brief Converts histograms to and from a binary blob, for RPC replies and the web pages.
+ *
+ * Version 1 is the header followed by every bin, including under- and overflow, as a raw copy. Version 2 has the
+ * same header followed by a PayloadHeader that says how the bins are stored. The encoder counts the non-zero bins
+ * and picks whichever of these is smallest:
+ *   - dense: every bin, the same as version 1;
+ *   - sparse: the uint32_t index of every non-zero bin, then their values;
+ *   - runs: a (uint32_t first bin, uint32_t length) pair for every run of non-zero bins, then their values.
+ * Both versions can be decoded. The values always start on a boundary of their type relative to the buffer start.
+ */
 struct HistogramEncoder {
-    static size_t requiredSize(const musip::dqm::PlotCollection::object_type& object);
+    static constexpr uint8_t latestVersion = 2;
+
+    /** @brief The largest size `encode` can return for `object`. Version 2 often needs much less. */
+    static size_t requiredSize(const musip::dqm::PlotCollection::object_type& object, uint8_t version = latestVersion);
 
     template<musip::dqm::Lock lock = Lock::PerformLock, typename byte_type>
-    static size_t encode(const musip::dqm::PlotCollection::object_type& object, byte_type* buffer, size_t bufferSize, std::error_code& error);
+    static size_t encode(const musip::dqm::PlotCollection::object_type& object, byte_type* buffer, size_t bufferSize, std::error_code& error, uint8_t version = latestVersion);
 
     template<typename byte_type>
     static std::optional<musip::dqm::PlotCollection::object_type> decode(const byte_type* buffer, size_t bufferSize, std::error_code& error);
 
+    /** @brief Adds the histogram encoded in `buffer` straight into `sum`, without decoding it into a histogram first.
+     *
+     * `sum` must have the same type and binning as the encoded histogram, otherwise `error` is set and nothing is
+     * added. If the bins turn out to be corrupt `error` is set, and some of them may already have been added.
+     */
+    template<musip::dqm::Lock lock = Lock::PerformLock, typename byte_type>
+    static void addEncoded(musip::dqm::PlotCollection::object_type& sum, const byte_type* buffer, size_t bufferSize, std::error_code& error);
+
+    /** @brief Copies the bin contents of `object`, including under- and overflow, as raw bytes, and its entries.
+     *
+     * Returns the size in bytes of one bin. RollingHistograms give the total of their time slices. Used to find the
+     * bins that changed between two requests for the same histogram.
+     */
+    template<musip::dqm::Lock lock = Lock::PerformLock>
+    static size_t copyBins(const musip::dqm::PlotCollection::object_type& object, std::vector<uint8_t>& bins, uint64_t& entries);
+
 private:
     struct CommonHeader;
 
     template<typename histogram_type>
     struct DataHeader;
 
+    enum class Encoding : uint32_t { dense = 0, sparse = 1, runs = 2 };
+    struct PayloadHeader;
+
+    template<typename content_type>
+    static size_t encodeBins(const std::vector<content_type>& data, uint8_t* buffer, size_t bufferSize);
+
+    // Sets the bins in `data` that are in the buffer, or adds them to `data` if `accumulate` is set
+    template<typename content_type, bool accumulate = false>
+    static bool decodeBins(const uint8_t* buffer, size_t bufferSize, std::vector<content_type>& data);
+
+    template<typename content_type, bool accumulate>
+    static void storeValues(const uint8_t* values, size_t count, content_type* destination);
+
     template<typename histogram_type>
     static size_t requiredSize(const DataHeader<histogram_type>& header);
 
@@ -131,7 +176,7 @@ struct bin_edges_type<musip::dqm::BasicRollingHistogram2D<xaxis_type, yaxis_type
 #include "musip/dqm/detail.hpp"
 
 struct musip::dqm::HistogramEncoder::CommonHeader {
-    const uint8_t version = 1;
+    uint8_t version = 1;
 
     // This data is constant for a given histogram_type. We don't make it constexpr however because we want it
     // in memory so that it is written out. We also need to read it in.
@@ -163,21 +208,179 @@ struct musip::dqm::HistogramEncoder::DataHeader : public CommonHeader {
     static constexpr size_t dataOffset = sizeof(DataHeader) + sizeOfPadding;
 };
 
+// Only in version 2, at `dataOffset`. Its size keeps the bin values that follow aligned.
+struct musip::dqm::HistogramEncoder::PayloadHeader {
+    uint32_t encoding;        // an `Encoding` value
+    uint32_t numberOfRecords; // number of non-zero bins for `sparse`, number of runs for `runs`, unused for `dense`
+};
+
+template<typename content_type>
+size_t musip::dqm::HistogramEncoder::encodeBins(const std::vector<content_type>& data, uint8_t* buffer, size_t bufferSize) {
+    static_assert(sizeof(PayloadHeader) % sizeof(content_type) == 0, "HistogramEncoder::encodeBins() - bin values would not be aligned after the PayloadHeader");
+    constexpr size_t valueSize = sizeof(content_type);
+    constexpr size_t indexSize = sizeof(uint32_t);
+    constexpr size_t runSize = 2 * sizeof(uint32_t);
+
+    // One pass to find the size of each encoding
+    size_t nonZeroBins = 0;
+    size_t runs = 0;
+    bool previousWasZero = true;
+    for(const content_type& value : data) {
+        const bool isZero = (value == content_type(0));
+        nonZeroBins += !isZero;
+        runs += (previousWasZero && !isZero);
+        previousWasZero = isZero;
+    }
+
+    const auto alignToValue = [](size_t size) { return (size + valueSize - 1) / valueSize * valueSize; };
+    const size_t denseSize = data.size() * valueSize;
+    const size_t sparseSize = alignToValue(nonZeroBins * indexSize) + nonZeroBins * valueSize;
+    const size_t runsSize = runs * runSize + nonZeroBins * valueSize;
+
+    PayloadHeader payloadHeader;
+    size_t payloadSize;
+    if(denseSize <= std::min(sparseSize, runsSize)) {
+        payloadHeader = PayloadHeader{static_cast<uint32_t>(Encoding::dense), 0};
+        payloadSize = denseSize;
+    }
+    else if(runsSize <= sparseSize) {
+        payloadHeader = PayloadHeader{static_cast<uint32_t>(Encoding::runs), static_cast<uint32_t>(runs)};
+        payloadSize = runsSize;
+    }
+    else {
+        payloadHeader = PayloadHeader{static_cast<uint32_t>(Encoding::sparse), static_cast<uint32_t>(nonZeroBins)};
+        payloadSize = sparseSize;
+    }
+
+    if(sizeof(PayloadHeader) + payloadSize > bufferSize) return 0;
+    std::memcpy(buffer, &payloadHeader, sizeof(PayloadHeader));
+    uint8_t* pRecord = buffer + sizeof(PayloadHeader);
+
+    switch(static_cast<Encoding>(payloadHeader.encoding)) {
+        case Encoding::dense:
+            std::memcpy(pRecord, data.data(), denseSize);
+            break;
+        case Encoding::sparse:
+            {
+                uint8_t* pValue = pRecord + alignToValue(nonZeroBins * indexSize);
+                std::memset(pRecord, 0xff, pValue - pRecord); // Known padding bytes, so the encoding is reproducible
+                for(size_t bin = 0; bin < data.size(); ++bin) {
+                    if(data[bin] == content_type(0)) continue;
+                    const uint32_t index = static_cast<uint32_t>(bin);
+                    std::memcpy(pRecord, &index, indexSize);
+                    std::memcpy(pValue, &data[bin], valueSize);
+                    pRecord += indexSize;
+                    pValue += valueSize;
+                }
+            }
+            break;
+        case Encoding::runs:
+            {
+                uint8_t* pValue = pRecord + runs * runSize;
+                size_t bin = 0;
+                while(bin < data.size()) {
+                    if(data[bin] == content_type(0)) { ++bin; continue; }
+                    const size_t first = bin;
+                    while(bin < data.size() && data[bin] != content_type(0)) ++bin;
+                    const uint32_t run[2] = {static_cast<uint32_t>(first), static_cast<uint32_t>(bin - first)};
+                    std::memcpy(pRecord, run, runSize);
+                    std::memcpy(pValue, &data[first], run[1] * valueSize);
+                    pRecord += runSize;
+                    pValue += run[1] * valueSize;
+                }
+            }
+            break;
+    }
+
+    return sizeof(PayloadHeader) + payloadSize;
+}
+
+template<typename content_type, bool accumulate>
+void musip::dqm::HistogramEncoder::storeValues(const uint8_t* values, size_t count, content_type* destination) {
+    if constexpr(accumulate) {
+        // The values might not be aligned in a buffer from the network, so copy each one out
+        for(size_t index = 0; index < count; ++index) {
+            content_type value;
+            std::memcpy(&value, values + index * sizeof(content_type), sizeof(content_type));
+            destination[index] += value;
+        }
+    }
+    else std::memcpy(destination, values, count * sizeof(content_type));
+}
+
+template<typename content_type, bool accumulate>
+bool musip::dqm::HistogramEncoder::decodeBins(const uint8_t* buffer, size_t bufferSize, std::vector<content_type>& data) {
+    constexpr size_t valueSize = sizeof(content_type);
+    constexpr size_t indexSize = sizeof(uint32_t);
+    constexpr size_t runSize = 2 * sizeof(uint32_t);
+
+    if(bufferSize < sizeof(PayloadHeader)) return false;
+    PayloadHeader payloadHeader;
+    std::memcpy(&payloadHeader, buffer, sizeof(PayloadHeader));
+    const uint8_t* pRecord = buffer + sizeof(PayloadHeader);
+    const size_t payloadSize = bufferSize - sizeof(PayloadHeader);
+    const size_t records = payloadHeader.numberOfRecords;
+
+    switch(static_cast<Encoding>(payloadHeader.encoding)) {
+        case Encoding::dense:
+            if(payloadSize < data.size() * valueSize) return false;
+            storeValues<content_type, accumulate>(pRecord, data.size(), data.data());
+            return true;
+        case Encoding::sparse:
+            {
+                if(records > data.size()) return false;
+                const size_t indicesSize = (records * indexSize + valueSize - 1) / valueSize * valueSize;
+                if(payloadSize < indicesSize + records * valueSize) return false;
+                const uint8_t* pValue = pRecord + indicesSize;
+                for(size_t record = 0; record < records; ++record) {
+                    uint32_t index;
+                    std::memcpy(&index, pRecord + record * indexSize, indexSize);
+                    if(index >= data.size()) return false;
+                    storeValues<content_type, accumulate>(pValue + record * valueSize, 1, &data[index]);
+                }
+                return true;
+            }
+        case Encoding::runs:
+            {
+                if(records > data.size() || payloadSize < records * runSize) return false;
+                const uint8_t* pValue = pRecord + records * runSize;
+                const uint8_t* const pEnd = pRecord + payloadSize;
+                for(size_t record = 0; record < records; ++record) {
+                    uint32_t run[2];
+                    std::memcpy(run, pRecord + record * runSize, runSize);
+                    if(run[0] > data.size() || run[1] > data.size() - run[0]) return false;
+                    if(static_cast<size_t>(pEnd - pValue) < run[1] * valueSize) return false;
+                    storeValues<content_type, accumulate>(pValue, run[1], &data[run[0]]);
+                    pValue += run[1] * valueSize;
+                }
+                return true;
+            }
+    }
+
+    return false; // unknown encoding
+}
+
 template<musip::dqm::Lock lock, typename byte_type>
-size_t musip::dqm::HistogramEncoder::encode(const musip::dqm::PlotCollection::object_type& object, byte_type* buffer, size_t bufferSize, std::error_code& error) {
+size_t musip::dqm::HistogramEncoder::encode(const musip::dqm::PlotCollection::object_type& object, byte_type* buffer, size_t bufferSize, std::error_code& error, uint8_t version) {
     static_assert(sizeof(byte_type) == 1, "HistogramEncoder::encode() - pointer arithmetic assumes pointers have a size of 1 byte");
 
+    if(version != 1 && version != 2) {
+        error = std::make_error_code(std::errc::invalid_argument);
+        return 0;
+    }
+
     const size_t bytesWritten = std::visit(musip::dqm::detail::overloaded{
-        [buffer, bufferSize, &error](const musip::dqm::RollingHistogram2DF& object) {
+        [buffer, bufferSize, &error, version](const musip::dqm::RollingHistogram2DF& object) {
             // For RollingHistograms we sum all the time slices and encode that.
-            return encode(object.total(), buffer, bufferSize, error);
+            return encode(object.template total<lock>(), buffer, bufferSize, error, version);
         },
-        [buffer, bufferSize, &error](const auto& object) -> size_t {
+        [buffer, bufferSize, &error, version](const auto& object) -> size_t {
             using histogram_type = typename std::decay<decltype(object)>::type;
 
             // Note that we don't lock the `object`s mutex, because data_.size() will not change after construction.
+            // For version 2 this is only the size of the header, the bins are checked once we know how they're encoded.
             const size_t dataSize = object.data_.size() * sizeof(typename histogram_type::content_type); // size in bytes taken up by the bin data
-            const size_t requiredSize = DataHeader<histogram_type>::dataOffset + dataSize; // size in bytes required to write the whole object
+            const size_t requiredSize = DataHeader<histogram_type>::dataOffset + (version == 1 ? dataSize : 0); // size in bytes required to write the whole object
             if(requiredSize > bufferSize) {
                 error = std::make_error_code(std::errc::file_too_large);
                 return 0;
@@ -194,6 +397,7 @@ size_t musip::dqm::HistogramEncoder::encode(const musip::dqm::PlotCollection::ob
             // Use placement new so that the header object is constructed directly inside the buffer
             DataHeader<histogram_type>& header = *new(buffer) DataHeader<histogram_type>;
 
+            header.version = version;
             header.objectType = detail::variant_index<histogram_type, PlotCollection::object_type>::value;
             header.dimensions = histogram_type::dimensions;
             // We don't need to lock to write the binning details, since they never change after construction
@@ -202,17 +406,48 @@ size_t musip::dqm::HistogramEncoder::encode(const musip::dqm::PlotCollection::ob
 
             // At this point we need to lock the mutex, since we're reading data that can change at any time
             typename detail::guard_type<lock, typename histogram_type::mutex_type>::type lockGuard(object.mutex_);
+            object.drainShards();
 
             header.entries = static_cast<uint64_t>(object.template entries<Lock::AlreadyLocked>());
 
-            std::memcpy(buffer + DataHeader<histogram_type>::dataOffset, object.data_.data(), dataSize);
-            return requiredSize;
+            if(version == 1) {
+                std::memcpy(buffer + DataHeader<histogram_type>::dataOffset, object.data_.data(), dataSize);
+                return requiredSize;
+            }
+
+            const size_t payloadSize = encodeBins(object.data_, reinterpret_cast<uint8_t*>(buffer) + DataHeader<histogram_type>::dataOffset, bufferSize - DataHeader<histogram_type>::dataOffset);
+            if(payloadSize == 0) {
+                error = std::make_error_code(std::errc::file_too_large);
+                return 0;
+            }
+            return requiredSize + payloadSize;
         }
     }, object);
 
     return bytesWritten;
 }
 
+template<musip::dqm::Lock lock>
+size_t musip::dqm::HistogramEncoder::copyBins(const musip::dqm::PlotCollection::object_type& object, std::vector<uint8_t>& bins, uint64_t& entries) {
+    return std::visit(musip::dqm::detail::overloaded{
+        [&bins, &entries](const musip::dqm::RollingHistogram2DF& object) {
+            return copyBins<Lock::AlreadyLocked>(object.template total<lock>(), bins, entries);
+        },
+        [&bins, &entries](const auto& object) -> size_t {
+            using content_type = typename std::decay<decltype(object)>::type::content_type;
+            using histogram_type = typename std::decay<decltype(object)>::type;
+
+            typename detail::guard_type<lock, typename histogram_type::mutex_type>::type lockGuard(object.mutex_);
+            object.drainShards();
+
+            bins.resize(object.data_.size() * sizeof(content_type));
+            std::memcpy(bins.data(), object.data_.data(), bins.size());
+            entries = static_cast<uint64_t>(object.template entries<Lock::AlreadyLocked>());
+            return sizeof(content_type);
+        }
+    }, object);
+}
+
 template<typename byte_type>
 std::optional<musip::dqm::PlotCollection::object_type> musip::dqm::HistogramEncoder::decode(const byte_type* buffer, size_t bufferSize, std::error_code& error) {
     static_assert(sizeof(byte_type) == 1, "HistogramEncoder::decode() - pointer arithmetic assumes pointers have a size of 1 byte");
@@ -226,8 +461,8 @@ std::optional<musip::dqm::PlotCollection::object_type> musip::dqm::HistogramEnco
     }
 
     const CommonHeader& tempHeader = *reinterpret_cast<const CommonHeader*>(buffer);
-    if(tempHeader.version != 1) {
-        // We only know how to read version 1 formats.
+    if(tempHeader.version != 1 && tempHeader.version != 2) {
+        // We only know how to read version 1 and 2 formats.
         error = std::make_error_code(std::errc::invalid_argument);
         return return_type();
     }
@@ -290,6 +525,63 @@ std::optional<musip::dqm::PlotCollection::object_type> musip::dqm::HistogramEnco
     } // end of switch(objectType)
 }
 
+template<musip::dqm::Lock lock, typename byte_type>
+void musip::dqm::HistogramEncoder::addEncoded(musip::dqm::PlotCollection::object_type& sum, const byte_type* buffer, size_t bufferSize, std::error_code& error) {
+    static_assert(sizeof(byte_type) == 1, "HistogramEncoder::addEncoded() - pointer arithmetic assumes pointers have a size of 1 byte");
+
+    if(bufferSize < sizeof(CommonHeader)) {
+        error = std::make_error_code(std::errc::bad_message);
+        return;
+    }
+
+    const CommonHeader& commonHeader = *reinterpret_cast<const CommonHeader*>(buffer);
+    if((commonHeader.version != 1 && commonHeader.version != 2) || commonHeader.objectType != sum.index()) {
+        error = std::make_error_code(std::errc::invalid_argument);
+        return;
+    }
+
+    std::visit(musip::dqm::detail::overloaded{
+        [&error](musip::dqm::RollingHistogram2DF&) {
+            // RollingHistograms are always encoded as their total, so can never match
+            error = std::make_error_code(std::errc::invalid_argument);
+        },
+        [buffer, bufferSize, &error](auto& object) {
+            using histogram_type = typename std::decay<decltype(object)>::type;
+            using content_type = typename histogram_type::content_type;
+
+            const auto& header = *reinterpret_cast<const DataHeader<histogram_type>*>(buffer);
+            if(bufferSize < header.dataOffset || header.ordinateSize != sizeof(content_type)) {
+                error = std::make_error_code(std::errc::bad_message);
+                return;
+            }
+
+            // The binning never changes after construction, so we don't need the lock to compare it
+            std::array<uint32_t, histogram_type::dimensions> numberOfBins;
+            detail::bin_edges_type<histogram_type> binEdges;
+            detail::bin_edges_type<histogram_type>::set(object, numberOfBins, binEdges);
+            if(numberOfBins != header.numberOfBins || std::memcmp(&binEdges, &header.binEdges, sizeof(binEdges)) != 0) {
+                error = std::make_error_code(std::errc::invalid_argument);
+                return;
+            }
+
+            typename detail::guard_type<lock, typename histogram_type::mutex_type>::type lockGuard(object.mutex_);
+            object.drainShards();
+
+            const uint8_t* dataStart = reinterpret_cast<const uint8_t*>(buffer) + header.dataOffset;
+            const size_t dataSize = bufferSize - header.dataOffset;
+            bool valid = true;
+            if(header.version == 1) {
+                valid = (dataSize >= object.data_.size() * sizeof(content_type));
+                if(valid) storeValues<content_type, true>(dataStart, object.data_.size(), object.data_.data());
+            }
+            else valid = decodeBins<content_type, true>(dataStart, dataSize, object.data_);
+
+            if(valid) object.entries_ += static_cast<size_t>(header.entries);
+            else error = std::make_error_code(std::errc::bad_message);
+        }
+    }, sum);
+}
+
 template<typename histogram_type>
 std::optional<musip::dqm::PlotCollection::object_type> musip::dqm::HistogramEncoder::decodeAs(const DataHeader<histogram_type>& header, size_t bufferSize, std::error_code& error) {
     std::optional<musip::dqm::PlotCollection::object_type> returnValue;
@@ -305,7 +597,8 @@ std::optional<musip::dqm::PlotCollection::object_type> musip::dqm::HistogramEnco
     for(size_t dimension = 0; dimension < histogram_type::dimensions; ++dimension) {
         totalBins *= (header.numberOfBins[dimension] + 2); // `+2` for under and overflow bins
     }
-    const size_t expectedDataSize = totalBins * sizeof(typename histogram_type::content_type);
+    // Version 2 is checked while decoding the bins, since its size depends on how they're encoded
+    const size_t expectedDataSize = (header.version == 1 ? totalBins * sizeof(typename histogram_type::content_type) : 0);
 
     if(bufferSize < (header.dataOffset + expectedDataSize)) {
         error = std::make_error_code(std::errc::bad_message);
@@ -332,11 +625,17 @@ std::optional<musip::dqm::PlotCollection::object_type> musip::dqm::HistogramEnco
             // pattern matcher to stop the compiler using the general one below for RollingHistogram.
             error = std::make_error_code(std::errc::invalid_argument);
         },
-        [dataStart, &header](auto& object) {
-            std::memcpy(object.data_.data(), dataStart, object.data_.size() * sizeof(typename decltype(object.data_)::value_type));
+        [dataStart, &header, bufferSize, &error](auto& object) {
+            if(header.version == 1) {
+                std::memcpy(object.data_.data(), dataStart, object.data_.size() * sizeof(typename decltype(object.data_)::value_type));
+            }
+            else if(!decodeBins(reinterpret_cast<const uint8_t*>(dataStart), bufferSize - header.dataOffset, object.data_)) {
+                error = std::make_error_code(std::errc::bad_message);
+            }
             object.entries_ = static_cast<size_t>(header.entries);
         }
     }, returnValue.value());
 
+    if(error) returnValue.reset();
     return returnValue;
 }
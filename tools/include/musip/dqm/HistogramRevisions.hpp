@@ -0,0 +1,67 @@
+#pragma once
+
+#include "musip/dqm/PlotCollection.hpp"
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace musip::dqm {
+
+/** @brief Version numbers for histograms served over RPC, so that clients polling a histogram can be sent only the
+ * bins that changed since they last asked, or nothing at all.
+ *
+ * Each collection has a modification counter. Histograms are not versioned while they're filled, since that would
+ * cost on every fill. Instead `update` is given the histogram every time a client asks for it, compares it with
+ * what it saw the last time and takes the next number from the collection's counter if anything changed. The bins
+ * that changed are remembered for the last `maximumHistory` versions, so clients a few versions behind still get
+ * a delta. Version zero means the client has nothing yet.
+ */
+class HistogramRevisions {
+public:
+    enum class Kind { full, delta, notModified };
+
+    struct Update {
+        Kind kind = Kind::full;
+        uint32_t version = 0;
+        uint64_t entries = 0;
+        size_t binSize = 0;
+        std::vector<uint32_t> changedBins; // Only for `delta`, in increasing order
+        std::vector<uint8_t> values;       // Only for `delta`, the raw content of each of `changedBins`
+    };
+
+    static constexpr size_t maximumHistory = 8;
+
+    /** @brief Records `histogram` as the current state of `collectionName/histogramName` and returns what a client
+     * at `sinceVersion` needs to get to it.
+     *
+     * The histogram has to be locked already, or be a copy nobody else can see.
+     */
+    Update update(const std::string& collectionName, const std::string& histogramName, const PlotCollection::object_type& histogram, uint32_t sinceVersion);
+
+    /** @brief Forgets all versions. Clients will be sent the full histogram on their next request. */
+    void clear();
+private:
+    struct Revision {
+        uint32_t fromVersion;
+        uint32_t toVersion;
+        std::vector<uint32_t> changedBins;
+    };
+
+    struct Entry {
+        size_t objectType = 0;
+        size_t binSize = 0;
+        uint32_t version = 0;
+        uint64_t entries = 0;
+        std::vector<uint8_t> bins; // The raw bin contents at `version`
+        std::deque<Revision> history;
+    };
+
+    std::mutex mutex_; // Protects everything below
+    std::unordered_map<std::string, uint32_t> collectionVersions_;
+    std::unordered_map<std::string, Entry> histograms_; // Keyed by "collection/histogram"
+};
+
+} // end of namespace musip::dqm
@@ -8,8 +8,10 @@
 #include <variant>
 #include <unordered_map>
 #include <mutex>
+#ifdef MUSIP_DQM_WITH_ROOT
 // Forward declarations
 class TDirectory;
+#endif
 
 namespace musip::dqm {
 
@@ -70,14 +72,23 @@ public:
     template<Lock lock = Lock::PerformLock>
     const object_type* get(const std::string& path) const;
 
+    /** @brief Adds `object` to the histogram at `path`, or puts a copy of it there if there is no histogram yet.
+     *
+     * Sets `error` if the histogram there has a different type or binning. Used for histograms decoded from an Archive. */
+    template<Lock lock = Lock::PerformLock>
+    void add(const std::string& path, const object_type& object, std::error_code& error);
+
+#ifdef MUSIP_DQM_WITH_ROOT
     void saveAsRootFile(const char* filename, const char* options = "RECREATE") { return saveAsRootFile(filename, true, options); }
     void saveAsRootFile(const char* filename, bool skipEmptyHistograms, const char* options = "RECREATE");
+#endif
 
 protected:
     // Templated method that all the other `getOrCreate...` methods delegate to.
     template<Lock lock, typename histogram_type, typename... constructor_params>
     histogram_type* getOrCreate(const std::string& path, std::error_code& error, constructor_params&&... constructorParams);
 
+#ifdef MUSIP_DQM_WITH_ROOT
     // Helper template function used by addFromRootDirectory
     template<typename root_type, typename dqm_type, Lock lock = Lock::PerformLock>
     void createAndAddFromRoot(TDirectory* pDirectory, const char* objectName, const std::string& fullPath, std::error_code& error);
@@ -93,6 +104,7 @@ protected:
     void saveToRootDirectory(TDirectory* pDirectory, bool skipEmptyHistograms) const;
     template<Lock lock = Lock::PerformLock>
     void addFromRootDirectory(TDirectory* pDirectory, const std::string& directoryPath);
+#endif
 
     // This is the actual std::mutex we use for locking this object and all plots in the collection. Locking can
     // be turned off dynamically though, and this is done by locking on the proxy object `this->mutex`. If locking
@@ -114,10 +126,12 @@ protected:
 // Definitions that need to be in this file because they're templated.
 //
 #include "musip/dqm/detail.hpp"
+#ifdef MUSIP_DQM_WITH_ROOT
 #include <TDirectory.h>
 #include <TAxis.h>
 #include <TKey.h>
 #include <TDirectoryFile.h>
+#endif
 
 template<musip::dqm::Lock lock, typename... metadata_param_types>
 musip::dqm::Histogram1DF* musip::dqm::PlotCollection::getOrCreateHistogram1DF(const std::string& path, size_t numberOfBins, float lowEdge, float highEdge, std::error_code& error, metadata_param_types&&... metadataParams) {
@@ -186,6 +200,27 @@ bool musip::dqm::PlotCollection::clear(const std::string& path) {
     else return false;
 }
 
+template<musip::dqm::Lock lock>
+void musip::dqm::PlotCollection::add(const std::string& path, const object_type& object, std::error_code& error) {
+    typename detail::guard_type<lock, mutex_type>::type lockGuard(this->mutex);
+
+    auto [iNameObjectPair, wasInserted] = objects_.try_emplace(path, object);
+    if(wasInserted) {
+        // The copy has to lock the same mutex as everything else in this collection
+        std::visit([this](auto& histogram) { histogram.mutex_ = mutex_type(this->mutex.pMutex); }, iNameObjectPair->second);
+        return;
+    }
+
+    std::visit([&error](auto& histogram, const auto& other) {
+        using histogram_type = typename std::decay<decltype(histogram)>::type;
+        using other_type = typename std::decay<decltype(other)>::type;
+        if constexpr(std::is_same<histogram_type, other_type>::value && !std::is_same<histogram_type, RollingHistogram2DF>::value) {
+            histogram.template add<Lock::AlreadyLocked, Lock::AlreadyLocked>(other, error);
+        }
+        else error = std::make_error_code(std::errc::file_exists);
+    }, iNameObjectPair->second, object);
+}
+
 template<musip::dqm::Lock lock, typename histogram_type, typename... constructor_params>
 histogram_type* musip::dqm::PlotCollection::getOrCreate(const std::string& path, std::error_code& error, constructor_params&&... constructorParams)
 {
@@ -213,6 +248,7 @@ histogram_type* musip::dqm::PlotCollection::getOrCreate(const std::string& path,
     return pHistogram;
 }
 
+#ifdef MUSIP_DQM_WITH_ROOT
 template<typename root_type, typename dqm_type, musip::dqm::Lock lock>
 void musip::dqm::PlotCollection::createAndAddFromRoot(TDirectory* pDirectory, const char* objectName, const std::string& fullPath, std::error_code& error) {
     addFromRoot<root_type, dqm_type, lock>(pDirectory, objectName, error, [this, &fullPath](std::error_code& error, auto... params) -> dqm_type& {
@@ -283,3 +319,4 @@ void musip::dqm::PlotCollection::addFromRootDirectory(TDirectory* pDirectory, co
         else printf("Don't know how to add '%s' of class '%s'\n", fullPath.c_str(), pKey->GetClassName());
     } // end of loop over TKeys in this TDirectory
 } // end of method PlotCollection::addFromRootDirectory()
+#endif
@@ -2,7 +2,9 @@
 
 #include "musip/dqm/dqmfwd.hpp"
 #include "musip/dqm/PlotCollection.hpp"
+#include "musip/dqm/Archive.hpp"
 
+#include <filesystem>
 #include <optional>
 #include <shared_mutex>
 #include <unordered_map>
@@ -26,11 +28,20 @@ public:
     /** Returns the named collection. If it didn't previously exist nullptr is returned. */
     PlotCollection* getCollection(const std::string& name);
 
+#ifdef MUSIP_DQM_WITH_ROOT
     void saveAsRootFile(const char* filename, std::error_code& error) const { return saveAsRootFile(filename, true, "RECREATE", error); }
     void saveAsRootFile(const char* filename, const char* options, std::error_code& error) const { return saveAsRootFile(filename, true, options, error); }
     void saveAsRootFile(const char* filename, bool skipEmptyHistograms, std::error_code& error) const { return saveAsRootFile(filename, skipEmptyHistograms, "RECREATE", error); }
     void saveAsRootFile(const char* filename, bool skipEmptyHistograms, const char* options, std::error_code& error) const;
     void addFromRootFile(const char* filename, std::error_code& error);
+#endif
+
+    /** @brief Saves all histograms as an Archive. RollingHistograms are saved as the total of their time slices. */
+    void saveAsArchive(const std::filesystem::path& filename, bool skipEmptyHistograms, std::error_code& error) const;
+
+    /** @brief Decodes every histogram in `archive` and adds it to the histogram of the same name, creating it if needed. */
+    void addFromArchive(const Archive& archive, std::error_code& error);
+    void addFromArchive(const std::filesystem::path& filename, std::error_code& error);
 
     /** @brief Clear all of the histograms in all of the collections. */
     void clearAll();
@@ -40,6 +51,9 @@ public:
 
     /** @brief Appends a list of all histogram names to the provided vector. */
     void list(std::vector<std::string>& allNames, bool skipEmptyHistograms) const;
+
+    /** @brief Roughly the memory taken by the bin contents of all histograms, in bytes. */
+    size_t memoryUsage() const;
 protected:
     mutable mutex_type globalMutex_;
     std::unordered_map<std::string,PlotCollection> plotCollections_;
@@ -51,8 +65,10 @@ protected:
 // Definitions of methods required in the header because they're templated.
 //
 
-#include <filesystem>
+#include "musip/dqm/HistogramEncoder.hpp"
+#ifdef MUSIP_DQM_WITH_ROOT
 #include <TFile.h>
+#endif
 
 template<typename mutex_type>
 musip::dqm::PlotCollection* musip::dqm::PlotSource<mutex_type>::getOrCreateCollection(const std::string& name) {
@@ -75,6 +91,7 @@ musip::dqm::PlotCollection* musip::dqm::PlotSource<mutex_type>::getCollection(co
     return nullptr;
 }
 
+#ifdef MUSIP_DQM_WITH_ROOT
 template<typename mutex_type>
 void musip::dqm::PlotSource<mutex_type>::saveAsRootFile(const char* filename, bool skipEmptyHistograms, const char* options, std::error_code& error) const
 {
@@ -130,6 +147,87 @@ void musip::dqm::PlotSource<mutex_type>::addFromRootFile(const char* filename, s
         else printf("PlotSource::addFromRootFile - Ignoring key '%s' of class '%s' in base directory\n", pKey->GetName(), pKey->GetClassName());
     }
 } // end of method PlotSource::addFromRootFile()
+#endif
+
+template<typename mutex_type>
+void musip::dqm::PlotSource<mutex_type>::saveAsArchive(const std::filesystem::path& filename, bool skipEmptyHistograms, std::error_code& error) const {
+    std::vector<std::pair<std::string, std::vector<uint8_t>>> histograms;
+    {
+        std::shared_lock globalLock(globalMutex_);
+
+        for(const auto& [collectionName, plotCollection] : plotCollections_) {
+            std::lock_guard collectionLock(plotCollection.mutex);
+
+            for(const auto& [objectName, object] : plotCollection.objects_) {
+                if(skipEmptyHistograms) {
+                    const bool isEmpty = std::visit([](const auto& histogram) {return histogram.template entries<Lock::AlreadyLocked>() == 0;}, object);
+                    if(isEmpty) continue;
+                }
+
+                std::vector<uint8_t> encoded(HistogramEncoder::requiredSize(object));
+                encoded.resize(HistogramEncoder::encode<Lock::AlreadyLocked>(object, encoded.data(), encoded.size(), error));
+                if(error) return;
+                histograms.emplace_back(collectionName + "/" + objectName, std::move(encoded));
+            } // end of loop over histogram objects
+        } // end of loop over collections
+    }
+
+    // Writing the file doesn't need any of the locks
+    Archive::write(filename, histograms, error);
+} // end of method PlotSource::saveAsArchive
+
+template<typename mutex_type>
+void musip::dqm::PlotSource<mutex_type>::addFromArchive(const Archive& archive, std::error_code& error) {
+    for(size_t index = 0; index < archive.size(); ++index) {
+        const std::string_view path = archive.name(index);
+        const size_t collectionNameSize = path.find_first_of('/');
+        if(collectionNameSize == std::string_view::npos) {
+            printf("PlotSource::addFromArchive - Ignoring '%.*s' which has no collection name\n", static_cast<int>(path.size()), path.data());
+            continue;
+        }
+
+        const Archive::Blob blob = archive.blob(index);
+        std::error_code histogramError;
+        const std::optional<PlotCollection::object_type> object = HistogramEncoder::decode(blob.data, blob.size, histogramError);
+        if(object.has_value()) {
+            // We don't need to lock `globalMutex_` because this call does it
+            PlotCollection* pCollection = getOrCreateCollection(std::string(path.substr(0, collectionNameSize)));
+            pCollection->add(std::string(path.substr(collectionNameSize + 1)), object.value(), histogramError);
+        }
+
+        if(histogramError) {
+            const std::string errorMessage = histogramError.message();
+            fprintf(stderr, "PlotSource::addFromArchive - Couldn't add '%.*s': %s\n", static_cast<int>(path.size()), path.data(), errorMessage.c_str());
+            error = histogramError;
+        }
+    }
+} // end of method PlotSource::addFromArchive()
+
+template<typename mutex_type>
+void musip::dqm::PlotSource<mutex_type>::addFromArchive(const std::filesystem::path& filename, std::error_code& error) {
+    const Archive archive(filename, error);
+    if(!error) addFromArchive(archive, error);
+}
+
+template<typename mutex_type>
+size_t musip::dqm::PlotSource<mutex_type>::memoryUsage() const {
+    std::shared_lock globalLock(globalMutex_);
+
+    size_t bytes = 0;
+    for(const auto& [collectionName, plotCollection] : plotCollections_) {
+        // The number of bins never changes after construction, so we don't need the collection lock
+        for(const auto& [histogramName, object] : plotCollection.objects_) {
+            bytes += std::visit([](const auto& histogram) -> size_t {
+                using histogram_type = typename std::decay<decltype(histogram)>::type;
+                constexpr size_t binSize = sizeof(typename histogram_type::content_type);
+                if constexpr(histogram_type::dimensions == 1) return (histogram.numberOfBins() + 2) * binSize;
+                else return (histogram.numberOfXBins() + 2) * (histogram.numberOfYBins() + 2) * binSize;
+            }, object);
+        }
+    } // end of loop over collections
+
+    return bytes;
+}
 
 template<typename mutex_type>
 void musip::dqm::PlotSource<mutex_type>::clearAll() {
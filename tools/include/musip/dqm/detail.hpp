@@ -2,7 +2,13 @@
 
 #include "musip/dqm/dqmfwd.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <vector>
+
+#ifdef MUSIP_DQM_WITH_ROOT
 // Forward declarations of root types
 class TH1F;
 class TH1D;
@@ -10,6 +16,7 @@ class TH1I;
 class TH2F;
 class TH2D;
 class TH2I;
+#endif
 
 namespace musip::dqm::detail {
 
@@ -32,6 +39,221 @@ struct MutexPointer {
     bool operator==(const MutexPointer& other) { return pMutex == other.pMutex; } // Not sure if two nullptrs should return true or false here
 };
 
+/** @brief A small index for the calling thread, unique among the threads that are running.
+ *
+ * Indices are handed out from zero and given back when the thread exits, so they can index a fixed size array.
+ * Threads beyond the first `maxThreadSlots` that run at the same time get `noThreadSlot`.
+ */
+class ThreadSlot {
+public:
+    static constexpr unsigned maxThreadSlots = 64;
+    static constexpr unsigned noThreadSlot = maxThreadSlots;
+
+    static unsigned current() { thread_local ThreadSlot slot; return slot.index_; }
+
+    ThreadSlot(const ThreadSlot&) = delete;
+    ThreadSlot& operator=(const ThreadSlot&) = delete;
+private:
+    unsigned index_ = noThreadSlot;
+
+    static std::mutex& mutex() { static std::mutex realMutex; return realMutex; }
+    static uint64_t& used() { static uint64_t bits = 0; return bits; } // bit n is set if index n is taken
+
+    ThreadSlot() {
+        std::lock_guard<std::mutex> lockGuard(mutex());
+        for(unsigned index = 0; index < maxThreadSlots; ++index) {
+            if(!(used() & (uint64_t(1) << index))) {
+                used() |= (uint64_t(1) << index);
+                index_ = index;
+                return;
+            }
+        }
+    }
+    ~ThreadSlot() {
+        if(index_ == noThreadSlot) return;
+        std::lock_guard<std::mutex> lockGuard(mutex());
+        used() &= ~(uint64_t(1) << index_);
+    }
+};
+
+/** @brief Adds `weights`, or one for each if it's null, to the bins `indices` of `data`. The caller holds the lock. */
+template<typename content_type>
+void addToBins(const uint32_t* indices, const content_type* weights, size_t count, content_type* data) {
+    if(weights != nullptr) {
+        for(size_t index = 0; index < count; ++index) data[indices[index]] += weights[index];
+    }
+    else {
+        for(size_t index = 0; index < count; ++index) data[indices[index]] += content_type(1);
+    }
+}
+
+/** @brief Per thread fill buffers of a histogram, used by `fill<Lock::Sharded>`.
+ *
+ * Each thread slot buffers the bin index and weight of its fills, up to `capacity` of them. The buffer grows as
+ * it's used, so a thread takes at most `capacity * (4 + sizeof(content_type))` bytes per histogram however many
+ * bins it has. The shard has a mutex of its own, which only the owning thread and `drain` ever take, so filling
+ * doesn't contend with other threads. The histogram calls `drain` with its own mutex held before it looks at its
+ * data, and when a buffer is full.
+ */
+template<typename content_type>
+class FillShards {
+public:
+    static constexpr size_t capacity = 1024;
+
+    // Aligned to a cache line so that the shards of different threads never share one
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::vector<uint32_t> bins;
+        std::vector<content_type> weights;
+    };
+
+    FillShards() : slots_(new std::atomic<Shard*>[ThreadSlot::maxThreadSlots]()) {}
+    FillShards(const FillShards& other) : FillShards() { copyFrom(other); }
+    FillShards(FillShards&& other) noexcept : slots_(std::move(other.slots_)) {}
+    FillShards& operator=(const FillShards& other) {
+        if(this != &other) { release(); if(!slots_) slots_.reset(new std::atomic<Shard*>[ThreadSlot::maxThreadSlots]()); copyFrom(other); }
+        return *this;
+    }
+    FillShards& operator=(FillShards&& other) noexcept {
+        if(this != &other) { release(); slots_ = std::move(other.slots_); }
+        return *this;
+    }
+    ~FillShards() { release(); }
+
+    /** @brief Buffers `count` fills in the shard of the calling thread, with a weight of one if `weights` is null.
+     *
+     * Returns how many were taken. That is fewer than `count` if the thread has no slot or the buffer is full, and
+     * the caller has to add the rest itself with the histogram mutex locked. */
+    size_t push(const uint32_t* bins, const content_type* weights, size_t count) {
+        Shard* pShard = local();
+        if(pShard == nullptr) return 0;
+
+        std::lock_guard<std::mutex> lockGuard(pShard->mutex);
+        const size_t taken = std::min(count, capacity - pShard->bins.size());
+        pShard->bins.insert(pShard->bins.end(), bins, bins + taken);
+        if(weights != nullptr) pShard->weights.insert(pShard->weights.end(), weights, weights + taken);
+        else pShard->weights.resize(pShard->weights.size() + taken, content_type(1));
+        return taken;
+    }
+
+    /** @brief Adds the content of all shards to `data` and `entries`, and empties the shards. */
+    void drain(std::vector<content_type>& data, size_t& entries) {
+        forEach([&data, &entries](Shard& shard) {
+            addToBins(shard.bins.data(), shard.weights.data(), shard.bins.size(), data.data());
+            entries += shard.bins.size();
+            shard.bins.clear();
+            shard.weights.clear();
+        });
+    }
+
+    void clear() {
+        forEach([](Shard& shard) {
+            shard.bins.clear();
+            shard.weights.clear();
+        });
+    }
+private:
+    std::unique_ptr<std::atomic<Shard*>[]> slots_;
+
+    /** @brief The shard of the calling thread, created on first use. Null if the thread has no slot. */
+    Shard* local() {
+        const unsigned slot = ThreadSlot::current();
+        if(slot == ThreadSlot::noThreadSlot || !slots_) return nullptr;
+        Shard* pShard = slots_[slot].load(std::memory_order_acquire);
+        if(pShard == nullptr) {
+            // Only this thread ever creates the shard of its slot, so a plain store is enough
+            pShard = new Shard;
+            slots_[slot].store(pShard, std::memory_order_release);
+        }
+        return pShard;
+    }
+
+    template<typename function_type>
+    void forEach(function_type&& function) const {
+        if(!slots_) return;
+        for(unsigned slot = 0; slot < ThreadSlot::maxThreadSlots; ++slot) {
+            if(Shard* pShard = slots_[slot].load(std::memory_order_acquire)) {
+                std::lock_guard<std::mutex> lockGuard(pShard->mutex);
+                function(*pShard);
+            }
+        }
+    }
+
+    void copyFrom(const FillShards& other) {
+        if(!other.slots_) return;
+        for(unsigned slot = 0; slot < ThreadSlot::maxThreadSlots; ++slot) {
+            if(Shard* pOther = other.slots_[slot].load(std::memory_order_acquire)) {
+                std::lock_guard<std::mutex> lockGuard(pOther->mutex);
+                if(pOther->bins.empty()) continue;
+                Shard* pShard = new Shard;
+                pShard->bins = pOther->bins;
+                pShard->weights = pOther->weights;
+                slots_[slot].store(pShard, std::memory_order_release);
+            }
+        }
+    }
+
+    void release() {
+        if(!slots_) return;
+        for(unsigned slot = 0; slot < ThreadSlot::maxThreadSlots; ++slot) delete slots_[slot].exchange(nullptr);
+    }
+};
+
+/** @brief Bin numbers of `count` values on a regular axis, as given by boost::histogram::axis::regular::index().
+ *
+ * Values below `lowEdge` give -1 and values from `highEdge` up, or NaN, give `numberOfBins`. `indexOffset` is added
+ * to every result. This is the same arithmetic as boost uses, written with selects instead of branches so that the
+ * compiler can vectorise the loop. Used by the `fillN` methods, which work through their input in chunks of
+ * `fillChunkSize`.
+ */
+constexpr size_t fillChunkSize = 256;
+
+template<typename axis_value_type, typename value_type>
+void regularAxisIndices(const value_type* values, size_t count, axis_value_type lowEdge, axis_value_type highEdge, unsigned numberOfBins, unsigned indexOffset, uint32_t* indices) {
+    const axis_value_type delta = highEdge - lowEdge;
+    const axis_value_type bins = static_cast<axis_value_type>(numberOfBins);
+    for(size_t index = 0; index < count; ++index) {
+        const axis_value_type z = (static_cast<axis_value_type>(values[index]) - lowEdge) / delta;
+        // Only convert z to an integer when it's in range, otherwise the conversion is undefined
+        const axis_value_type inRange = (z >= 0 && z < 1) ? z : axis_value_type(0);
+        int bin = static_cast<int>(inRange * bins);
+        bin = (z < 0) ? -1 : bin;
+        bin = (z < 1) ? bin : static_cast<int>(numberOfBins);
+        indices[index] = static_cast<uint32_t>(bin + static_cast<int>(indexOffset));
+    }
+}
+
+/** @brief The body of the 1D `fillN`s. `data` has `binOffset` under- and overflow bins. The caller holds the lock. */
+template<typename axis_value_type, typename value_type, typename content_type>
+void fillRegular(const value_type* values, size_t count, const content_type* weights, axis_value_type lowEdge, axis_value_type highEdge, unsigned numberOfBins, unsigned binOffset, content_type* data, size_t& entries) {
+    uint32_t indices[fillChunkSize];
+    for(size_t start = 0; start < count; start += fillChunkSize) {
+        const size_t chunkSize = std::min(fillChunkSize, count - start);
+        regularAxisIndices(values + start, chunkSize, lowEdge, highEdge, numberOfBins, binOffset, indices);
+        addToBins(indices, weights != nullptr ? weights + start : nullptr, chunkSize, data);
+    }
+    entries += count;
+}
+
+/** @brief The body of the 2D `fillN`s, with the same data layout as `BasicHistogram2D`. The caller holds the lock. */
+template<typename xaxis_value_type, typename yaxis_value_type, typename xvalue_type, typename yvalue_type, typename content_type>
+void fillRegular2D(const xvalue_type* xValues, const yvalue_type* yValues, size_t count, const content_type* weights,
+                   xaxis_value_type lowXEdge, xaxis_value_type highXEdge, unsigned numberOfXBins,
+                   yaxis_value_type lowYEdge, yaxis_value_type highYEdge, unsigned numberOfYBins,
+                   unsigned binOffset, content_type* data, size_t& entries) {
+    uint32_t xIndices[fillChunkSize];
+    uint32_t yIndices[fillChunkSize];
+    const uint32_t rowLength = numberOfXBins + 2 * binOffset;
+    for(size_t start = 0; start < count; start += fillChunkSize) {
+        const size_t chunkSize = std::min(fillChunkSize, count - start);
+        regularAxisIndices(xValues + start, chunkSize, lowXEdge, highXEdge, numberOfXBins, binOffset, xIndices);
+        regularAxisIndices(yValues + start, chunkSize, lowYEdge, highYEdge, numberOfYBins, binOffset, yIndices);
+        for(size_t index = 0; index < chunkSize; ++index) xIndices[index] += rowLength * yIndices[index];
+        addToBins(xIndices, weights != nullptr ? weights + start : nullptr, chunkSize, data);
+    }
+    entries += count;
+}
+
 /** @brief Helpers to choose between a real or fake lock depending on the value of the `Lock` enum. */
 template<Lock lock, typename mutex_type> struct guard_type;
 template<typename mutex_type> struct guard_type<Lock::PerformLock, mutex_type> { using type = std::lock_guard<mutex_type>; };
@@ -44,6 +266,7 @@ struct overloaded : Ts... { using Ts::operator()...; };
 template<class... Ts>
 overloaded(Ts...) -> overloaded<Ts...>;
 
+#ifdef MUSIP_DQM_WITH_ROOT
 /** @brief Gives the equivalent root (as in root.cern.ch package) type for a histogram type. */
 template<size_t dimensions, typename content_type> struct root_type;
 template<> struct root_type<1,float> { using type = TH1F; };
@@ -52,5 +275,6 @@ template<> struct root_type<1,uint32_t> { using type = TH1I; };
 template<> struct root_type<2,float> { using type = TH2F; };
 template<> struct root_type<2,double> { using type = TH2D; };
 template<> struct root_type<2,uint32_t> { using type = TH2I; };
+#endif
 
 } // end of namespace musip::dqm::detail
@@ -19,6 +19,16 @@ using RollingHistogram2DF = BasicRollingHistogram2D<float,float,float>;
 class PlotCollection;
 class DQMManager;
 
-enum class Lock { PerformLock, AlreadyLocked };
+/** @brief How a method deals with the mutex of the histogram's collection.
+ *
+ * `Sharded` is only accepted by `fill` and `fillN`. It adds to a buffer private to the calling thread instead of
+ * taking the collection mutex, and the buffers are added to the histogram the next time it is read, added, cleared
+ * or encoded. Use it when several threads fill the same histograms.
+ *
+ * Each buffer holds the bin index and weight of up to `detail::FillShards::capacity` (1024) fills, so it costs up to
+ * 12 KB per thread and histogram for double bins, whatever the number of bins. A full buffer is added to the
+ * histogram under the collection mutex.
+ */
+enum class Lock { PerformLock, AlreadyLocked, Sharded };
 
 } // end of namespace musip::dqm
@@ -0,0 +1,168 @@
+#include "musip/dqm/Archive.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace { // the unnamed namespace
+
+/** @brief The number of zero bytes needed after `position` to get to a multiple of `alignment`. */
+size_t paddingAfter(size_t position, size_t alignment) {
+    return (alignment - position % alignment) % alignment;
+}
+
+} // end of the unnamed namespace
+
+musip::dqm::Archive::Archive(const std::filesystem::path& filename, std::error_code& error) {
+    const int fileDescriptor = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fileDescriptor < 0) {
+        error = std::error_code(errno, std::generic_category());
+        return;
+    }
+
+    struct stat fileStatus;
+    if(::fstat(fileDescriptor, &fileStatus) != 0 || static_cast<size_t>(fileStatus.st_size) < sizeof(FileHeader)) {
+        ::close(fileDescriptor);
+        error = std::make_error_code(std::errc::invalid_argument);
+        return;
+    }
+
+    // The mapping keeps the file alive, so we don't need the descriptor afterwards
+    void* pMapped = ::mmap(nullptr, fileStatus.st_size, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+    ::close(fileDescriptor);
+    if(pMapped == MAP_FAILED) {
+        error = std::error_code(errno, std::generic_category());
+        return;
+    }
+    pFile_ = static_cast<const uint8_t*>(pMapped);
+    fileSize_ = static_cast<size_t>(fileStatus.st_size);
+
+    // Check everything the accessors rely on once, so that they don't need to
+    FileHeader header;
+    std::memcpy(&header, pFile_, sizeof(FileHeader));
+    bool valid = (std::memcmp(header.magic, magic, sizeof(magic)) == 0) && header.version == latestVersion
+        && header.indexOffset % alignof(IndexEntry) == 0 && header.indexOffset <= fileSize_
+        && header.numberOfEntries <= (fileSize_ - header.indexOffset) / sizeof(IndexEntry)
+        && header.namesOffset <= fileSize_ && header.namesSize <= fileSize_ - header.namesOffset;
+
+    if(valid) {
+        pIndex_ = reinterpret_cast<const IndexEntry*>(pFile_ + header.indexOffset);
+        pNames_ = reinterpret_cast<const char*>(pFile_ + header.namesOffset);
+        for(size_t index = 0; index < header.numberOfEntries && valid; ++index) {
+            const IndexEntry& entry = pIndex_[index];
+            valid = entry.offset <= fileSize_ && entry.size <= fileSize_ - entry.offset && entry.offset % blobAlignment == 0
+                && entry.nameOffset <= header.namesSize && entry.nameSize <= header.namesSize - entry.nameOffset;
+        }
+    }
+
+    if(!valid) {
+        ::munmap(const_cast<uint8_t*>(pFile_), fileSize_);
+        pFile_ = nullptr;
+        fileSize_ = 0;
+        pIndex_ = nullptr;
+        pNames_ = nullptr;
+        error = std::make_error_code(std::errc::invalid_argument);
+        return;
+    }
+
+    numberOfEntries_ = header.numberOfEntries;
+}
+
+musip::dqm::Archive::~Archive() {
+    if(pFile_ != nullptr) ::munmap(const_cast<uint8_t*>(pFile_), fileSize_);
+}
+
+std::string_view musip::dqm::Archive::name(size_t index) const {
+    return std::string_view(pNames_ + pIndex_[index].nameOffset, pIndex_[index].nameSize);
+}
+
+musip::dqm::Archive::Blob musip::dqm::Archive::blob(size_t index) const {
+    return Blob{pFile_ + pIndex_[index].offset, static_cast<size_t>(pIndex_[index].size)};
+}
+
+musip::dqm::Archive::Blob musip::dqm::Archive::find(std::string_view path) const {
+    size_t low = 0, high = numberOfEntries_;
+    while(low < high) {
+        const size_t middle = low + (high - low) / 2;
+        const int comparison = name(middle).compare(path);
+        if(comparison == 0) return blob(middle);
+        else if(comparison < 0) low = middle + 1;
+        else high = middle;
+    }
+    return Blob{};
+}
+
+void musip::dqm::Archive::write(const std::filesystem::path& filename, std::vector<std::pair<std::string, std::vector<uint8_t>>>& histograms, std::error_code& error) {
+    std::sort(histograms.begin(), histograms.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    const auto iDuplicate = std::adjacent_find(histograms.begin(), histograms.end(), [](const auto& a, const auto& b) { return a.first == b.first; });
+    if(iDuplicate != histograms.end() || histograms.size() > std::numeric_limits<uint32_t>::max()) {
+        error = std::make_error_code(std::errc::invalid_argument);
+        return;
+    }
+
+    //
+    // Work out where everything goes
+    //
+    FileHeader header;
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = latestVersion;
+    header.numberOfEntries = static_cast<uint32_t>(histograms.size());
+
+    std::vector<IndexEntry> index(histograms.size());
+    uint64_t position = sizeof(FileHeader);
+    uint64_t namesSize = 0;
+    for(size_t entry = 0; entry < histograms.size(); ++entry) {
+        position += paddingAfter(position, blobAlignment);
+        index[entry] = IndexEntry{position, histograms[entry].second.size(), namesSize, histograms[entry].first.size()};
+        position += histograms[entry].second.size();
+        namesSize += histograms[entry].first.size();
+    }
+    header.indexOffset = position + paddingAfter(position, alignof(IndexEntry));
+    header.namesOffset = header.indexOffset + index.size() * sizeof(IndexEntry);
+    header.namesSize = namesSize;
+
+    //
+    // Write to a temporary file, and only give it the real name once it's complete
+    //
+    const std::filesystem::path parentFolder = filename.parent_path();
+    if(!parentFolder.empty()) std::filesystem::create_directories(parentFolder, error);
+    if(error) return;
+
+    std::filesystem::path temporaryFilename = filename;
+    temporaryFilename += ".tmp";
+    {
+        std::ofstream outputFile(temporaryFilename, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+        if(!outputFile.is_open()) {
+            error = std::make_error_code(std::errc::no_such_file_or_directory);
+            return;
+        }
+
+        const char padding[blobAlignment] = {};
+        outputFile.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+        position = sizeof(FileHeader);
+        for(size_t entry = 0; entry < histograms.size(); ++entry) {
+            outputFile.write(padding, index[entry].offset - position);
+            outputFile.write(reinterpret_cast<const char*>(histograms[entry].second.data()), histograms[entry].second.size());
+            position = index[entry].offset + index[entry].size;
+        }
+        outputFile.write(padding, header.indexOffset - position);
+        outputFile.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(IndexEntry));
+        for(const auto& [name, encoded] : histograms) outputFile.write(name.data(), name.size());
+
+        outputFile.close();
+        if(!outputFile) {
+            error = std::make_error_code(std::errc::io_error);
+            std::error_code removeError;
+            std::filesystem::remove(temporaryFilename, removeError);
+            return;
+        }
+    }
+
+    std::filesystem::rename(temporaryFilename, filename, error);
+} // end of method Archive::write
@@ -8,12 +8,14 @@
 #include <string_view>
 #include <filesystem>
 
+#ifdef MUSIP_DQM_WITH_ROOT
 #include <TROOT.h>
 #include <TFile.h>
 #include <TKey.h>
 #include <TH1F.h>
 #include <TH1D.h>
 #include <TH2F.h>
+#endif
 
 namespace { // the unnamed namespace
 
@@ -40,9 +42,10 @@ struct StartupCode {
  * @param[out] histogramPath The value in the "name" entry. This is a view into the original `json` view. Make sure the buffer is still in scope when this is used.
  * @param[out] includeCurrentRun Set to true if the "runs" entry includes zero (which means current run).
  * @param[out] runNumbers All numbers in the "runs" entry, other than zero.
+ * @param[out] sinceVersion The value in the "since" entry, the version of the histogram the client already has.
  * @param[out] error Gets set if any errors are encountered
  */
-void parseJSONArgs(const std::string_view json, std::string_view& histogramPath, bool& includeCurrentRun, std::vector<int>& runNumbers, std::error_code& error) {
+void parseJSONArgs(const std::string_view json, std::string_view& histogramPath, bool& includeCurrentRun, std::vector<int>& runNumbers, std::optional<uint32_t>& sinceVersion, std::error_code& error) {
     MJsonNode* pRootNode = MJsonNode::Parse(json.data());
 
     if(pRootNode->GetType() == MJSON_ERROR) {
@@ -87,6 +90,14 @@ void parseJSONArgs(const std::string_view json, std::string_view& histogramPath,
                     }
                 } // end of loop over elements in the "runs" array
             } // end of `if name == "runs"`
+            else if(subNodeNames[index] == "since") {
+                if(subNodes[index]->GetType() != MJSON_INT) {
+                    const std::string typeName = MJsonNode::TypeToString(subNodes[index]->GetType());
+                    fprintf(stderr, "DQMManager::HandleRpc - Unable to parse \"since\" node of type %s\n", typeName.c_str());
+                    continue;
+                }
+                sinceVersion = static_cast<uint32_t>(subNodes[index]->GetInt());
+            } // end of `if name == "since"`
             else fprintf(stderr, "DQMManager::HandleRpc - Ignoring unknown arg node \"%s\"\n", subNodeNames[index].c_str());
         } // end of loop over object sub nodes
     } // end of `if pRootNode type == MJSON_OBJECT`
@@ -98,6 +109,23 @@ void parseJSONArgs(const std::string_view json, std::string_view& histogramPath,
     }
 } // end of function parseJSONArgs
 
+/** @brief A reply with only the RPCHeader, telling the client that previous runs are still loading. */
+TMFeResult waitReply(std::vector<char>& result) {
+    using RPCHeader = musip::dqm::DQMManager::RPCHeader;
+    result.resize(sizeof(RPCHeader));
+    RPCHeader& header = *reinterpret_cast<RPCHeader*>(result.data());
+    header.messageSize = static_cast<uint32_t>(sizeof(RPCHeader));
+    header.messageType = RPCHeader::MessageType::wait;
+    return TMFeOk();
+}
+
+/** @brief The key of a set of runs in DQMManager::previousRunsIndex_. */
+std::string historyKey(const std::vector<int>& runs) {
+    std::string key;
+    for(const int run : runs) key += std::to_string(run) + ",";
+    return key;
+}
+
 } // end of the unnamed namespace
 
 musip::dqm::DQMManager& musip::dqm::DQMManager::instance() {
@@ -118,6 +146,7 @@ musip::dqm::PlotCollection* musip::dqm::DQMManager::getOrCreateCollection(const
     return returnValue;
 }
 
+#ifdef MUSIP_DQM_WITH_ROOT
 void musip::dqm::DQMManager::saveAsRootFile(const char* filename, bool skipEmptyHistograms, const char* options)
 {
     std::error_code error;
@@ -134,9 +163,31 @@ void musip::dqm::DQMManager::addFromRootFile(const char* filename) {
         fprintf(stderr, "DQMManager::addFromRootFile - couldn't open file '%s'\n", filename);
     }
 } // end of method DQMManager::addFromRootFile()
+#endif
+
+void musip::dqm::DQMManager::saveAsArchive(const char* filename, bool skipEmptyHistograms) {
+    std::error_code error;
+    currentRun_.saveAsArchive(filename, skipEmptyHistograms, error);
+    if(error) {
+        const std::string errorMessage = error.message();
+        fprintf(stderr, "DQMManager::saveAsArchive - unable to save to '%s': %s\n", filename, errorMessage.c_str());
+    }
+} // end of method DQMManager::saveAsArchive
+
+void musip::dqm::DQMManager::addFromArchive(const char* filename) {
+    std::error_code error;
+    currentRun_.addFromArchive(filename, error);
+    if(error) {
+        const std::string errorMessage = error.message();
+        fprintf(stderr, "DQMManager::addFromArchive - couldn't add from '%s': %s\n", filename, errorMessage.c_str());
+    }
+} // end of method DQMManager::addFromArchive()
 
 void musip::dqm::DQMManager::clearAll() {
-    return currentRun_.clearAll();
+    currentRun_.clearAll();
+    // Called at run start, when the histograms clients were following are gone. Without this every histogram ever
+    // requested would keep its last contents here for the life of the process.
+    revisions_.clear();
 } // end of method DQMManager::clearAll()
 
 void musip::dqm::DQMManager::addHistoryDirectory(const std::filesystem::path& directoryPath) {
@@ -144,19 +195,86 @@ void musip::dqm::DQMManager::addHistoryDirectory(const std::filesystem::path& di
     previousRunDirectories_.push_back(directoryPath);
 }
 
+void musip::dqm::DQMManager::encodeHistogramReply(const PlotCollection::object_type& histogram, const HistogramRevisions::Update* pUpdate, std::vector<char>& result) {
+    using Kind = HistogramRevisions::Kind;
+    std::error_code error;
+
+    // Add a small header so that the client can detect if the response was truncated by Midas.
+    // Note that alignment really matters for this message - javascript will want the histogram data
+    // aligned on a type boundary, so for double histograms this means 8. This is one reason why our
+    // header is 4+4 and not just the size. UpdateHeader is a multiple of 8 for the same reason.
+    size_t headerSize = sizeof(RPCHeader);
+    RPCHeader::MessageType messageType = RPCHeader::MessageType::hist;
+    if(pUpdate != nullptr) {
+        headerSize += sizeof(UpdateHeader);
+        if(pUpdate->kind == Kind::full) messageType = RPCHeader::MessageType::versionedHistogram;
+        else if(pUpdate->kind == Kind::delta) messageType = RPCHeader::MessageType::delta;
+        else messageType = RPCHeader::MessageType::notModified;
+    }
+
+    size_t bodySize = 0;
+    if(messageType == RPCHeader::MessageType::delta) {
+        const size_t indicesSize = (pUpdate->changedBins.size() * sizeof(uint32_t) + 7) / 8 * 8;
+        result.assign(headerSize + indicesSize + pUpdate->values.size(), 0);
+        std::memcpy(result.data() + headerSize, pUpdate->changedBins.data(), pUpdate->changedBins.size() * sizeof(uint32_t));
+        std::memcpy(result.data() + headerSize + indicesSize, pUpdate->values.data(), pUpdate->values.size());
+        bodySize = indicesSize + pUpdate->values.size();
+    }
+    else if(messageType != RPCHeader::MessageType::notModified) {
+        // This is the most the encoding can take. Sparse histograms usually take much less, so we
+        // shrink the result to what was actually written afterwards.
+        const size_t requiredSize = HistogramEncoder::requiredSize(histogram);
+        result.resize(headerSize + requiredSize);
+
+        bodySize = HistogramEncoder::encode<Lock::AlreadyLocked>(histogram, result.data() + headerSize, requiredSize, error);
+        if( error ) {
+            const std::string& errorMessage = error.message();
+            fprintf(stderr, "DQMManager::HandleBinaryRpc() - ERROR while trying to encode histogram: %s\n", errorMessage.c_str());
+        }
+    }
+
+    const size_t totalSize = headerSize + bodySize;
+
+    // I can't see this ever being close to 2^32 bytes, but we should check. If we're sending 4Gb in RPC calls we have bigger problems.
+    if(totalSize > std::numeric_limits<uint32_t>::max()) fprintf(stderr, "DQMManager::HandleRpc - Size of message (%zu bytes) is too large to encode as a uint32_t\n", totalSize);
+
+    result.resize(totalSize);
+
+    // Write the header information
+    RPCHeader& header = *reinterpret_cast<RPCHeader*>(result.data());
+    header.messageSize = static_cast<uint32_t>(totalSize);
+    header.messageType = messageType;
+
+    if(pUpdate != nullptr) {
+        UpdateHeader& updateHeader = *reinterpret_cast<UpdateHeader*>(result.data() + sizeof(RPCHeader));
+        updateHeader.version = pUpdate->version;
+        updateHeader.numberOfChangedBins = static_cast<uint32_t>(pUpdate->changedBins.size());
+        updateHeader.entries = pUpdate->entries;
+    }
+} // end of method DQMManager::encodeHistogramReply
+
 musip::dqm::DQMManager::DQMManager() {
+#ifdef MUSIP_DQM_WITH_ROOT
     // We always want Root to be multithreaded, because there's always a different thread
     // to handle the RPC even when analyzers are not multithreaded. Midas manalyzer only
     // enables this if "--mt" is specified on the command line, hence without these two
     // lines we'd get memory issues if run without "--mt".
     ROOT::EnableImplicitMT();
     ROOT::EnableThreadSafety();
+#endif
 
     TMFE::Instance()->AddRpcHandler(this);
 }
 
 musip::dqm::DQMManager::~DQMManager() {
     TMFE::Instance()->RemoveRpcHandler(this);
+
+    {
+        std::lock_guard<std::mutex> lock(previousRunsMutex_);
+        stopHistoryLoader_ = true;
+    }
+    historyLoadsChanged_.notify_all();
+    if(historyLoader_.joinable()) historyLoader_.join();
 }
 
 TMFeResult musip::dqm::DQMManager::HandleBinaryRpc(const char* cmd, const char* args, std::vector<char>& result) {
@@ -179,9 +297,10 @@ TMFeResult musip::dqm::DQMManager::HandleBinaryRpc(const char* cmd, const char*
         if(!argument.empty()) {
             includeCurrentRun = false; // Now we know there is an argument, only use current run if specified
             std::string_view histogramPath; // We don't expect or care about this, but the function signature requires it.
+            std::optional<uint32_t> sinceVersion; // Same for this
 
             std::error_code error;
-            parseJSONArgs(argument, histogramPath, includeCurrentRun, runNumbers, error);
+            parseJSONArgs(argument, histogramPath, includeCurrentRun, runNumbers, sinceVersion, error);
             if(error) {
                 fprintf(stderr, "DQMManager::HandleRpc - Error parsing JSON arguments for dqm::list call\n");
                 return TMFeErrorMessage("TMFE completely ignores this error. I should put in a patch to Midas.");
@@ -195,8 +314,15 @@ TMFeResult musip::dqm::DQMManager::HandleBinaryRpc(const char* cmd, const char*
         // with this later.
         if(!runNumbers.empty()) {
             // Either get the preloaded accumulation of these runs, or if it doesn't exist yet load from disk.
-            const auto pHistoricSource = getHistorySource(runNumbers);
-            if(pHistoricSource != nullptr) pHistoricSource->list(names, skipEmptyHistograms);
+            bool pending = false;
+            const auto pHistoricSource = getHistorySource(runNumbers, pending);
+            if(pending) return waitReply(result);
+            if(pHistoricSource != nullptr && pHistoricSource->pArchive != nullptr) {
+                // The archive index has the names already, so there's nothing to decode. It doesn't tell us which
+                // histograms are empty, but archives are saved with the empty histograms anyway.
+                for(size_t index = 0; index < pHistoricSource->pArchive->size(); ++index) names.emplace_back(pHistoricSource->pArchive->name(index));
+            }
+            else if(pHistoricSource != nullptr) pHistoricSource->plots.list(names, skipEmptyHistograms);
         }
 
         // Sort the list of names before we return it. This also helps when removing duplicates.
@@ -238,12 +364,13 @@ TMFeResult musip::dqm::DQMManager::HandleBinaryRpc(const char* cmd, const char*
         std::string_view histogramPath;
         bool includeCurrentRun = false;
         std::vector<int> runNumbers;
+        std::optional<uint32_t> sinceVersion;
 
         if(argument.size() > 0 && argument[0] == '{') {
             // The arguments start with '{' so we assume this is a JSON object rather than just
             // a string of the histogram path.
             std::error_code error;
-            parseJSONArgs(argument, histogramPath, includeCurrentRun, runNumbers, error);
+            parseJSONArgs(argument, histogramPath, includeCurrentRun, runNumbers, sinceVersion, error);
             if(error) {
                 fprintf(stderr, "DQMManager::HandleRpc - Error parsing JSON arguments for dqm::histogram call\n");
                 return TMFeErrorMessage("TMFE completely ignores this error. I should put in a patch to Midas.");
@@ -272,10 +399,33 @@ TMFeResult musip::dqm::DQMManager::HandleBinaryRpc(const char* cmd, const char*
 
         if(!runNumbers.empty()) {
             // Either get the preloaded accumulation of these numbers, or if it doesn't exist yet load from disk.
-            const auto pHistoricSource = getHistorySource(runNumbers);
-            if(pHistoricSource != nullptr) {
+            bool pending = false;
+            const auto pHistoricSource = getHistorySource(runNumbers, pending);
+            if(pending) return waitReply(result);
+            if(pHistoricSource != nullptr && pHistoricSource->pArchive != nullptr) {
+                const Archive::Blob blob = pHistoricSource->pArchive->find(histogramPath);
+                if(blob.data != nullptr && !includeCurrentRun) {
+                    // The archive holds the histogram exactly as we would encode it, so send it as it is. The
+                    // RPCHeader keeps the alignment of the bins the archive gave them.
+                    result.resize(sizeof(RPCHeader) + blob.size);
+                    RPCHeader& header = *reinterpret_cast<RPCHeader*>(result.data());
+                    header.messageSize = static_cast<uint32_t>(result.size());
+                    header.messageType = RPCHeader::MessageType::hist;
+                    std::memcpy(result.data() + sizeof(RPCHeader), blob.data, blob.size);
+                    return TMFeOk();
+                }
+                else if(blob.data != nullptr) {
+                    std::error_code error;
+                    accumulatedHistogram = HistogramEncoder::decode(blob.data, blob.size, error);
+                    if(error) {
+                        const std::string errorMessage = error.message();
+                        fprintf(stderr, "DQMManager::HandleBinaryRpc() - Couldn't decode '%.*s' from the archive: %s\n", static_cast<int>(histogramPath.size()), histogramPath.data(), errorMessage.c_str());
+                    }
+                }
+            }
+            else if(pHistoricSource != nullptr) {
                 // Look for the collection in this source
-                const PlotCollection* pHistoricCollection = pHistoricSource->getCollection(collectionName);
+                const PlotCollection* pHistoricCollection = pHistoricSource->plots.getCollection(collectionName);
                 if(pHistoricCollection != nullptr) {
                     auto pHistoricPlot = pHistoricCollection->get(histogramName);
                     if(pHistoricPlot != nullptr) accumulatedHistogram = *pHistoricPlot;
@@ -340,36 +490,14 @@ TMFeResult musip::dqm::DQMManager::HandleBinaryRpc(const char* cmd, const char*
         } // end of `if includeCurrentRun`
 
         if(accumulatedHistogram.has_value()) {
-            std::visit([&result](auto& histogram) {
-                std::error_code error;
-                musip::dqm::HistogramEncoder encoder;
-
-                const size_t requiredSize = encoder.requiredSize(histogram);
-                // Add a small header so that the client can detect if the response was truncated by Midas.
-                // Note that alignment really matters for this message - javascript will want the histogram data
-                // aligned on a type boundary, so for double histograms this means 8. This is one reason why our
-                // header is 4+4 and not just the size.
-                const size_t totalSize = sizeof(RPCHeader) + requiredSize;
-
-                // I can't see this ever being close to 2^32 bytes, but we should check. If we're sending 4Gb in RPC calls we have bigger problems.
-                if(totalSize > std::numeric_limits<uint32_t>::max()) fprintf(stderr, "DQMManager::HandleRpc - Size of message (%zu bytes) is too large to encode as a uint32_t\n", totalSize);
-
-                result.resize(totalSize);
-
-                // Write the header information
-                RPCHeader& header = *reinterpret_cast<RPCHeader*>(result.data());
-                header.messageSize = static_cast<uint32_t>(totalSize);
-                header.messageType = RPCHeader::MessageType::hist;
-
-                const size_t bytesWritten = encoder.encode<Lock::AlreadyLocked>(histogram, result.data() + sizeof(RPCHeader), requiredSize, error);
-                if( error ) {
-                    const std::string& errorMessage = error.message();
-                    fprintf(stderr, "DQMManager::HandleBinaryRpc() - ERROR while trying to encode histogram: %s\n", errorMessage.c_str());
-                }
-                else if(bytesWritten != requiredSize) {
-                    fprintf(stderr, "DQMManager::HandleBinaryRpc() - WARNING only wrote %zu bytes but expected %zu while trying to encode histogram.\n", bytesWritten, requiredSize);
-                }
-            }, accumulatedHistogram.value());
+            if(sinceVersion.has_value() && runNumbers.empty()) {
+                // The client keeps the histogram between requests and told us which version it has, so we might
+                // only need to send the bins that changed, or nothing. Only the current run changes, so there's no
+                // versioning when previous runs are included.
+                const HistogramRevisions::Update update = revisions_.update(collectionName, histogramName, accumulatedHistogram.value(), sinceVersion.value());
+                encodeHistogramReply(accumulatedHistogram.value(), &update, result);
+            }
+            else encodeHistogramReply(accumulatedHistogram.value(), nullptr, result);
         }
         else {
             fprintf(stderr, "DQMManager::HandleBinaryRpc() - Don't have a histogram for request '%.*s'.\n", static_cast<int>(histogramPath.size()), histogramPath.data());
@@ -383,7 +511,7 @@ TMFeResult musip::dqm::DQMManager::HandleBinaryRpc(const char* cmd, const char*
 
         if(argument.empty()) { // No collection or specific plot specified, so clear everything.
             printf("DQMManager::HandleBinaryRpc() - Clearing all histograms for RPC request.\n");
-            currentRun_.clearAll();
+            clearAll();
 
             return TMFeOk();
         } // end of if argument is empty
@@ -426,6 +554,8 @@ TMFeResult musip::dqm::DQMManager::HandleBinaryRpc(const char* cmd, const char*
         // the "online" directory, but now the better file in the "prompt" directory is available.
         std::lock_guard<std::mutex> lock(previousRunsMutex_);
         previousRuns_.clear();
+        previousRunsIndex_.clear();
+        previousRunsMemory_ = 0;
         return TMFeOk();
     }
     else {
@@ -434,77 +564,161 @@ TMFeResult musip::dqm::DQMManager::HandleBinaryRpc(const char* cmd, const char*
     }
 }
 
-std::shared_ptr<musip::dqm::PlotSource<musip::dqm::DQMManager::PreviousRun::null_mutex>> musip::dqm::DQMManager::getHistorySource(std::vector<int>& runs) {
+std::shared_ptr<musip::dqm::DQMManager::PreviousRun::Contents> musip::dqm::DQMManager::getHistorySource(std::vector<int>& runs, bool& pending) {
     std::sort(runs.begin(), runs.end());
-    std::lock_guard<std::mutex> lock(previousRunsMutex_);
+    std::shared_future<std::shared_ptr<PreviousRun::Contents>> data;
+    {
+        std::lock_guard<std::mutex> lock(previousRunsMutex_);
 
-    // We can't do anything if the user never set a directory to load from.
-    if(previousRunDirectories_.empty()) return nullptr;
-
-    // We do a manual loop so that we can also find the oldest entry at the same time, in
-    // case we need to eject an old entry from the cache.
-    decltype(previousRuns_)::iterator iOldest = previousRuns_.end();
-    decltype(previousRuns_)::iterator iSearchResult = previousRuns_.end();
-    for(auto iCurrent = previousRuns_.begin(); iCurrent != previousRuns_.end(); ++iCurrent) {
-        // Check if this is what we're looking for
-        if(iSearchResult == previousRuns_.end()) {
-            // Not found yet, need to look.
-            if(iCurrent->runs == runs) {
-                // We found it.
-                iSearchResult = iCurrent;
-                if(previousRuns_.size() <= maximumPreviousRunsSize_) break; // we don't need to eject, so don't need to find the oldest entry
-            }
+        // We can't do anything if the user never set a directory to load from.
+        if(previousRunDirectories_.empty()) return nullptr;
+
+        // Move the entry to the front, since it's now the most recently used
+        const auto iEntry = findOrQueueHistory(runs, false);
+        previousRuns_.splice(previousRuns_.begin(), previousRuns_, iEntry);
+        data = iEntry->data;
+
+        if(runs.size() == 1) {
+            // Run zero is the current run, so there's nothing to prefetch below run one
+            if(runs.front() > 1) findOrQueueHistory({runs.front() - 1}, true);
+            findOrQueueHistory({runs.front() + 1}, true);
         }
+    }
 
-        // Check if this is the oldest entry
-        if(iOldest == previousRuns_.end()) iOldest = iCurrent;
-        else if(iOldest->lastAccess < iCurrent->lastAccess) iOldest = iCurrent;
-    } // end of loop over previousRuns_
+    // Wait for the load without the lock, so other requests and the loader can carry on
+    if(data.wait_for(maximumHistoryWait_) != std::future_status::ready) {
+        if(verbosity_ > 0) printf("Previous run(s) still loading\n");
+        pending = true;
+        return nullptr;
+    }
 
-    if(iSearchResult != previousRuns_.end()) {
-        // Found a matching history entry
-        if(verbosity_ > 0) printf("Found cached entry for previous run(s)\n");
+    try {
+        return data.get();
+    }
+    catch(const std::future_error& error) {
+        // Only happens if the loader was stopped before it got to these runs
+        return nullptr;
+    }
+} // end of method getHistorySource
 
-        iSearchResult->lastAccess = std::chrono::steady_clock::now();
-        return iSearchResult->data;
+std::list<musip::dqm::DQMManager::PreviousRun>::iterator musip::dqm::DQMManager::findOrQueueHistory(const std::vector<int>& runs, const bool prefetch) {
+    const std::string key = historyKey(runs);
+    if(const auto iIndex = previousRunsIndex_.find(key); iIndex != previousRunsIndex_.end()) {
+        if(verbosity_ > 0 && !prefetch) printf("Found cached entry for previous run(s)\n");
+        return iIndex->second;
     }
-    else {
-        // Not found, need to create the new entry.
-        if(verbosity_ > 0) printf("No cached entry for previous run(s), searching for files\n");
 
-        std::vector<int> foundRuns;
-        auto newHistoryEntry = std::make_shared<PlotSource<PreviousRun::null_mutex>>();
+    if(verbosity_ > 0) printf("No cached entry for previous run(s) %s, queueing load%s\n", key.c_str(), prefetch ? " (prefetch)" : "");
+
+    HistoryLoad load{runs, {}};
+    PreviousRun entry{runs, load.promise.get_future().share(), 0};
+
+    // Requests jump the queue, prefetches wait until nothing else is loading. A prefetched entry has not been
+    // used yet, so it starts as the least recently used.
+    const auto iEntry = (prefetch ? previousRuns_.insert(previousRuns_.end(), std::move(entry)) : previousRuns_.insert(previousRuns_.begin(), std::move(entry)));
+    if(prefetch) historyLoads_.push_back(std::move(load));
+    else historyLoads_.push_front(std::move(load));
+    previousRunsIndex_.emplace(key, iEntry);
+
+    // Started on the first load rather than in the constructor, which runs during static initialisation. Processes
+    // that never look at previous runs, like the forking quadreplay, then have no thread of ours running.
+    if(!historyLoader_.joinable()) historyLoader_ = std::thread(&DQMManager::loadHistory, this);
+    historyLoadsChanged_.notify_one();
+
+    return iEntry;
+} // end of method findOrQueueHistory
+
+void musip::dqm::DQMManager::loadHistory() {
+    std::unique_lock<std::mutex> lock(previousRunsMutex_);
+
+    while(true) {
+        historyLoadsChanged_.wait(lock, [this]() { return stopHistoryLoader_ || !historyLoads_.empty(); });
+        if(stopHistoryLoader_) break;
+
+        HistoryLoad load = std::move(historyLoads_.front());
+        historyLoads_.pop_front();
+        const std::vector<std::filesystem::path> directories = previousRunDirectories_;
+        lock.unlock();
+
+        auto newHistoryEntry = std::make_shared<PreviousRun::Contents>();
+        bool anyMissing = false;
 
         // Load all the requested run numbers into the new entry
-        for(const auto runNumber : runs) {
-            char filename[32];
-            snprintf(filename, sizeof(filename), "dqm_histos_%05d.root", runNumber);
+        for(const auto runNumber : load.runs) {
+            char archiveFilename[32];
+            snprintf(archiveFilename, sizeof(archiveFilename), "dqm_histos_%05d.dqm", runNumber);
+#ifdef MUSIP_DQM_WITH_ROOT
+            char rootFilename[32];
+            snprintf(rootFilename, sizeof(rootFilename), "dqm_histos_%05d.root", runNumber);
+#endif
 
             // Check each directory in turn. Once we find the file we stop, so that earlier directories
-            // in the list take precedence.
+            // in the list take precedence. Within a directory the archive is preferred.
             std::error_code error;
-            for(const auto& path : previousRunDirectories_) {
-                const std::filesystem::path fullPath = path / filename;
+            for(const auto& path : directories) {
+                const std::filesystem::path archivePath = path / archiveFilename;
+
+                error.clear();
+                auto pArchive = std::make_unique<Archive>(archivePath, error);
+                if(!error) {
+                    if(verbosity_ > 0) printf("Found archive for previous run %d at %s\n", runNumber, archivePath.c_str());
+                    // A single run is served from the archive as it is, several have to be added up
+                    if(load.runs.size() == 1) newHistoryEntry->pArchive = std::move(pArchive);
+                    else newHistoryEntry->plots.addFromArchive(*pArchive, error);
+                    break;
+                }
+
+#ifdef MUSIP_DQM_WITH_ROOT
+                const std::filesystem::path rootPath = path / rootFilename;
 
                 error.clear();
-                newHistoryEntry->addFromRootFile(fullPath.c_str(), error);
+                newHistoryEntry->plots.addFromRootFile(rootPath.c_str(), error);
                 if(!error) {
-                    if(verbosity_ > 0) printf("Found file for previous run %d at %s\n", runNumber, fullPath.c_str());
+                    if(verbosity_ > 0) printf("Found file for previous run %d at %s\n", runNumber, rootPath.c_str());
                     break;
                 }
+#endif
             }
 
-            if(error) fprintf(stderr, "Couldn't find plots for run %d\n", runNumber);
-            else foundRuns.push_back(runNumber);
+            if(error) {
+                fprintf(stderr, "Couldn't find plots for run %d\n", runNumber);
+                anyMissing = true;
+            }
         } // End of loop over requested run numbers
 
-        previousRuns_.emplace_front(std::chrono::steady_clock::now(), std::move(foundRuns), newHistoryEntry);
-
-        // If the list of old runs has grown too large, remove an entry.
-        if(previousRuns_.size() > maximumPreviousRunsSize_) {
-            if(iOldest != previousRuns_.end()) previousRuns_.erase(iOldest);
+        // Entries without histograms still count for something, so that they can't pile up forever. A mapped
+        // archive only takes memory for the pages that were read, but counting all of it keeps the number of
+        // mappings bounded.
+        const size_t loadedSize = (newHistoryEntry->pArchive != nullptr ? newHistoryEntry->pArchive->fileSize() : newHistoryEntry->plots.memoryUsage());
+        const size_t memoryUsage = std::max<size_t>(loadedSize, 4096);
+        load.promise.set_value(std::move(newHistoryEntry));
+
+        lock.lock();
+
+        // The entry might have been ejected by `dqm::clearcache` while we were loading, and possibly already queued again
+        const auto iIndex = previousRunsIndex_.find(historyKey(load.runs));
+        if(iIndex == previousRunsIndex_.end() || iIndex->second->memoryUsage != 0) continue;
+        if(iIndex->second->data.wait_for(std::chrono::seconds(0)) != std::future_status::ready) continue;
+
+        // A missing run is usually the one still being taken, typically prefetched as the neighbour of the last run.
+        // Its file appears when the run ends, so the miss is not kept. Whoever waited on it still gets the result.
+        if(anyMissing) {
+            previousRuns_.erase(iIndex->second);
+            previousRunsIndex_.erase(iIndex);
+            continue;
         }
-
-        return newHistoryEntry;
-    }
-} // end of method getHistorySource
+        iIndex->second->memoryUsage = memoryUsage;
+        previousRunsMemory_ += memoryUsage;
+
+        // If the cache has grown too large, eject the least recently used entries. Entries still loading aren't
+        // counted yet so are left alone, and the most recently used entry always stays.
+        for(auto iEntry = std::prev(previousRuns_.end()); previousRunsMemory_ > maximumPreviousRunsMemory_ && iEntry != previousRuns_.begin(); ) {
+            const auto iCurrent = iEntry--;
+            if(iCurrent->memoryUsage == 0) continue;
+            if(verbosity_ > 0) printf("Ejecting previous run(s) %s from the cache\n", historyKey(iCurrent->runs).c_str());
+            previousRunsMemory_ -= iCurrent->memoryUsage;
+            previousRunsIndex_.erase(historyKey(iCurrent->runs));
+            previousRuns_.erase(iCurrent);
+        }
+    } // end of loop until stopHistoryLoader_
+} // end of method loadHistory
@@ -2,8 +2,8 @@
 
 // Most of the methods are templated so they have to be in the header file.
 
-size_t musip::dqm::HistogramEncoder::requiredSize(const musip::dqm::PlotCollection::object_type& object) {
-    return std::visit([](auto& object) -> size_t {
+size_t musip::dqm::HistogramEncoder::requiredSize(const musip::dqm::PlotCollection::object_type& object, const uint8_t version) {
+    return std::visit([version](auto& object) -> size_t {
         using histogram_type = typename std::decay<decltype(object)>::type;
 
         // For RollingHistograms, we just use the information from one of the slices (they're all the same).
@@ -16,6 +16,8 @@ size_t musip::dqm::HistogramEncoder::requiredSize(const musip::dqm::PlotCollecti
         }
 
         // Note that we don't lock the object's mutex, because data_.size() will not change after construction.
-        return DataHeader<histogram_type>::dataOffset + (pData->size() * sizeof(typename histogram_type::content_type));
+        // Version 2 never needs more than the dense encoding plus its PayloadHeader.
+        const size_t payloadHeaderSize = (version == 1 ? 0 : sizeof(PayloadHeader));
+        return DataHeader<histogram_type>::dataOffset + payloadHeaderSize + (pData->size() * sizeof(typename histogram_type::content_type));
     }, object);
 }
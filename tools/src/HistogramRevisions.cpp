@@ -0,0 +1,97 @@
+#include "musip/dqm/HistogramRevisions.hpp"
+
+#include "musip/dqm/HistogramEncoder.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+
+namespace { // the unnamed namespace
+
+/** @brief The next version from a collection's counter. Zero is never handed out, it means "no version". */
+uint32_t nextVersion(uint32_t& counter) {
+    if(counter == 0) {
+        // Start each collection at a random number, so that a client still holding a version from before the
+        // analyzer was restarted doesn't match a version of different content.
+        std::random_device randomDevice;
+        counter = randomDevice();
+    }
+    if(++counter == 0) ++counter;
+    return counter;
+}
+
+} // end of the unnamed namespace
+
+musip::dqm::HistogramRevisions::Update musip::dqm::HistogramRevisions::update(const std::string& collectionName, const std::string& histogramName, const PlotCollection::object_type& histogram, const uint32_t sinceVersion) {
+    // Copy the bins before taking our own lock, this is the expensive part
+    std::vector<uint8_t> bins;
+    uint64_t entries = 0;
+    const size_t binSize = HistogramEncoder::copyBins<Lock::AlreadyLocked>(histogram, bins, entries);
+
+    std::lock_guard<std::mutex> lockGuard(mutex_);
+    Entry& entry = histograms_[collectionName + "/" + histogramName];
+
+    Update update;
+    update.binSize = binSize;
+    update.entries = entries;
+
+    if(entry.version == 0 || entry.objectType != histogram.index() || entry.bins.size() != bins.size()) {
+        // Seen for the first time, or the histogram was recreated with a different binning
+        entry.objectType = histogram.index();
+        entry.binSize = binSize;
+        entry.history.clear();
+        entry.version = nextVersion(collectionVersions_[collectionName]);
+        entry.entries = entries;
+        entry.bins = std::move(bins);
+
+        update.version = entry.version;
+        return update;
+    }
+    else if(entries != entry.entries || bins != entry.bins) {
+        Revision revision{entry.version, 0, {}};
+        for(size_t bin = 0; bin < bins.size() / binSize; ++bin) {
+            if(std::memcmp(&bins[bin * binSize], &entry.bins[bin * binSize], binSize) != 0) revision.changedBins.push_back(static_cast<uint32_t>(bin));
+        }
+        entry.version = revision.toVersion = nextVersion(collectionVersions_[collectionName]);
+        entry.history.push_back(std::move(revision));
+        if(entry.history.size() > maximumHistory) entry.history.pop_front();
+        entry.entries = entries;
+        entry.bins = std::move(bins);
+    }
+
+    update.version = entry.version;
+    if(sinceVersion == 0) return update;
+    if(sinceVersion == entry.version) {
+        update.kind = Kind::notModified;
+        return update;
+    }
+
+    // Find the revision that starts at the client's version, and collect the bins changed in it and all after it.
+    // If the client is further behind than the history goes, it gets the full histogram.
+    const auto iFirst = std::find_if(entry.history.begin(), entry.history.end(), [sinceVersion](const Revision& revision) { return revision.fromVersion == sinceVersion; });
+    if(iFirst == entry.history.end()) return update;
+
+    for(auto iRevision = iFirst; iRevision != entry.history.end(); ++iRevision) {
+        update.changedBins.insert(update.changedBins.end(), iRevision->changedBins.begin(), iRevision->changedBins.end());
+    }
+    std::sort(update.changedBins.begin(), update.changedBins.end());
+    update.changedBins.erase(std::unique(update.changedBins.begin(), update.changedBins.end()), update.changedBins.end());
+
+    // Unless it's smaller than the full content, a delta isn't worth it
+    if(update.changedBins.size() * (sizeof(uint32_t) + binSize) >= entry.bins.size()) {
+        update.changedBins.clear();
+        return update;
+    }
+
+    update.kind = Kind::delta;
+    update.values.resize(update.changedBins.size() * binSize);
+    for(size_t index = 0; index < update.changedBins.size(); ++index) {
+        std::memcpy(&update.values[index * binSize], &entry.bins[update.changedBins[index] * binSize], binSize);
+    }
+    return update;
+}
+
+void musip::dqm::HistogramRevisions::clear() {
+    std::lock_guard<std::mutex> lockGuard(mutex_);
+    histograms_.clear();
+}
@@ -1,9 +1,11 @@
 #include "musip/dqm/PlotCollection.hpp"
 
 #include <filesystem>
+#ifdef MUSIP_DQM_WITH_ROOT
 #include <TFile.h>
 #include <TH1F.h>
 #include <TH2F.h>
+#endif
 
 void musip::dqm::PlotCollection::switchOffThreadProtection() {
     // We don't bother locking to perform this change. It's clear the user considers
@@ -33,6 +35,7 @@ void musip::dqm::PlotCollection::switchOnThreadProtection() {
     }
 }
 
+#ifdef MUSIP_DQM_WITH_ROOT
 void musip::dqm::PlotCollection::saveAsRootFile(const char* filename, bool skipEmptyHistograms, const char* options) {
     // If the parent folder doesn't exist, create it
     const std::filesystem::path parentFolder = std::filesystem::path(filename).parent_path();
@@ -105,3 +108,4 @@ void musip::dqm::PlotCollection::saveToRootDirectory(TDirectory* pDirectory, boo
         }, *pObject);
     } // end of loop over objects in the collection
 } // end of method PlotCollection::saveToRootDirectory()
+#endif
@@ -0,0 +1,375 @@
+//
+// Benchmarks of the DQM histograms (musip::dqm), using google benchmark. Covers what the analyzers and the
+// RPC calls spend their time on: filling, adding histograms together, encoding and decoding for RPC replies,
+// looking histograms up in a PlotCollection, and saving and loading runs.
+//
+// The fill values and bin contents come from fixed random seeds, so runs are comparable. To compare a change,
+// run before and after with e.g.
+//     dqmbench --benchmark_repetitions=5 --benchmark_report_aggregates_only=true --benchmark_out=before.json
+// and compare the json files with the compare.py tool that comes with google benchmark. Use
+// `--benchmark_filter=<regex>` to run a subset. Saving and loading write to a temporary directory.
+//
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+
+#include "musip/dqm/PlotSource.hpp"
+#include "musip/dqm/HistogramEncoder.hpp"
+
+using namespace musip::dqm;
+
+namespace { // the unnamed namespace
+
+constexpr size_t numberOfValues = 4096; // Cycled through by the fill benchmarks, small enough to stay in cache
+
+/** @brief Random values spread a bit beyond [0, range), so that under- and overflow are exercised as well. */
+std::vector<float> randomValues(float range, unsigned seed) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> distribution(-0.05f * range, 1.05f * range);
+    std::vector<float> values(numberOfValues);
+    for(auto& value : values) value = distribution(generator);
+    return values;
+}
+
+/** @brief A square 2D histogram with `numberOfBins` bins along each axis, with `occupancy` percent of them filled. */
+template<typename histogram_type>
+histogram_type filledHistogram2D(std::mutex* pMutex, unsigned numberOfBins, unsigned occupancy) {
+    histogram_type histogram(pMutex, numberOfBins, 0, numberOfBins, numberOfBins, 0, numberOfBins);
+    std::mt19937 generator(12345);
+    std::uniform_int_distribution<unsigned> bin(0, numberOfBins - 1);
+    const size_t binsToFill = static_cast<size_t>(numberOfBins) * numberOfBins * occupancy / 100;
+    for(size_t fill = 0; fill < binsToFill; ++fill) histogram.fill(bin(generator) + 0.5f, bin(generator) + 0.5f, 1 + fill % 7);
+    return histogram;
+}
+
+//
+// Filling
+//
+
+/** @brief Fills one 1D histogram from all threads. Args: number of bins. */
+template<typename histogram_type, Lock lock>
+void BM_Fill1D(benchmark::State& state) {
+    static std::mutex mutex;
+    static std::unique_ptr<histogram_type> pHistogram;
+    const unsigned numberOfBins = static_cast<unsigned>(state.range(0));
+    if(state.thread_index() == 0) pHistogram = std::make_unique<histogram_type>(&mutex, numberOfBins, 0, numberOfBins);
+    const std::vector<float> values = randomValues(numberOfBins, 1 + state.thread_index());
+
+    size_t index = 0;
+    for(auto _ : state) {
+        pHistogram->template fill<lock>(values[index]);
+        index = (index + 1) % numberOfValues;
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    if(state.thread_index() == 0) {
+        benchmark::DoNotOptimize(pHistogram->entries());
+        pHistogram.reset();
+    }
+}
+
+/** @brief Fills one 2D histogram from all threads. Args: number of bins along each axis. */
+template<typename histogram_type, Lock lock>
+void BM_Fill2D(benchmark::State& state) {
+    static std::mutex mutex;
+    static std::unique_ptr<histogram_type> pHistogram;
+    const unsigned numberOfBins = static_cast<unsigned>(state.range(0));
+    if(state.thread_index() == 0) pHistogram = std::make_unique<histogram_type>(&mutex, numberOfBins, 0, numberOfBins, numberOfBins, 0, numberOfBins);
+    const std::vector<float> xValues = randomValues(numberOfBins, 1 + state.thread_index());
+    const std::vector<float> yValues = randomValues(numberOfBins, 101 + state.thread_index());
+
+    size_t index = 0;
+    for(auto _ : state) {
+        pHistogram->template fill<lock>(xValues[index], yValues[index]);
+        index = (index + 1) % numberOfValues;
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    if(state.thread_index() == 0) {
+        benchmark::DoNotOptimize(pHistogram->entries());
+        pHistogram.reset();
+    }
+}
+
+/** @brief Fills one rolling histogram with 1 second slices from all threads. Args: bins along each axis, slices. */
+void BM_FillRolling2D(benchmark::State& state) {
+    static std::mutex mutex;
+    static std::unique_ptr<RollingHistogram2DF> pHistogram;
+    const unsigned numberOfBins = static_cast<unsigned>(state.range(0));
+    if(state.thread_index() == 0) pHistogram = std::make_unique<RollingHistogram2DF>(&mutex, static_cast<unsigned>(state.range(1)), std::chrono::seconds(1), numberOfBins, 0, numberOfBins, numberOfBins, 0, numberOfBins);
+    const std::vector<float> xValues = randomValues(numberOfBins, 1 + state.thread_index());
+    const std::vector<float> yValues = randomValues(numberOfBins, 101 + state.thread_index());
+
+    size_t index = 0;
+    for(auto _ : state) {
+        pHistogram->fill(xValues[index], yValues[index]);
+        index = (index + 1) % numberOfValues;
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    if(state.thread_index() == 0) pHistogram.reset();
+}
+
+/** @brief Fills a 2D histogram a whole column of values at a time with fillN. Args: bins along each axis. */
+template<typename histogram_type>
+void BM_FillN2D(benchmark::State& state) {
+    std::mutex mutex;
+    const unsigned numberOfBins = static_cast<unsigned>(state.range(0));
+    histogram_type histogram(&mutex, numberOfBins, 0, numberOfBins, numberOfBins, 0, numberOfBins);
+    const std::vector<float> xValues = randomValues(numberOfBins, 1);
+    const std::vector<float> yValues = randomValues(numberOfBins, 101);
+
+    for(auto _ : state) histogram.fillN(xValues.data(), yValues.data(), numberOfValues);
+    state.SetItemsProcessed(state.iterations() * numberOfValues);
+    benchmark::DoNotOptimize(histogram.entries());
+}
+
+//
+// Adding
+//
+
+/** @brief Adds one 2D histogram to another. Args: bins along each axis. */
+template<typename histogram_type>
+void BM_Add2D(benchmark::State& state) {
+    std::mutex mutex, otherMutex;
+    const unsigned numberOfBins = static_cast<unsigned>(state.range(0));
+    histogram_type sum(&mutex, numberOfBins, 0, numberOfBins, numberOfBins, 0, numberOfBins);
+    const histogram_type other = filledHistogram2D<histogram_type>(&otherMutex, numberOfBins, 100);
+    sum.fill(0.5f, 0.5f); // So that the add can't take the copy shortcut for an empty histogram
+
+    std::error_code error;
+    for(auto _ : state) sum.add(other, error);
+    if(error) state.SkipWithError("add failed");
+    state.SetBytesProcessed(state.iterations() * sizeof(typename histogram_type::content_type) * (numberOfBins + 2) * (numberOfBins + 2));
+}
+
+/** @brief Adds an encoded histogram, as dqmproxy does with the replies. Args: bins along each axis, occupancy %. */
+template<typename histogram_type>
+void BM_AddEncoded2D(benchmark::State& state) {
+    std::mutex mutex;
+    const unsigned numberOfBins = static_cast<unsigned>(state.range(0));
+    const PlotCollection::object_type other(filledHistogram2D<histogram_type>(nullptr, numberOfBins, static_cast<unsigned>(state.range(1))));
+    std::vector<uint8_t> buffer(HistogramEncoder::requiredSize(other));
+    std::error_code error;
+    buffer.resize(HistogramEncoder::encode(other, buffer.data(), buffer.size(), error));
+    PlotCollection::object_type sum(histogram_type(&mutex, numberOfBins, 0, numberOfBins, numberOfBins, 0, numberOfBins));
+
+    for(auto _ : state) HistogramEncoder::addEncoded(sum, buffer.data(), buffer.size(), error);
+    if(error) state.SkipWithError("addEncoded failed");
+    state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+
+//
+// Encoding and decoding
+//
+
+/** @brief Encodes a 2D histogram as for an RPC reply. Args: bins along each axis, occupancy %, encoder version. */
+template<typename histogram_type>
+void BM_Encode2D(benchmark::State& state) {
+    const unsigned numberOfBins = static_cast<unsigned>(state.range(0));
+    const uint8_t version = static_cast<uint8_t>(state.range(2));
+    const PlotCollection::object_type object(filledHistogram2D<histogram_type>(nullptr, numberOfBins, static_cast<unsigned>(state.range(1))));
+    std::vector<uint8_t> buffer(HistogramEncoder::requiredSize(object, version));
+
+    std::error_code error;
+    size_t encodedSize = 0;
+    for(auto _ : state) {
+        encodedSize = HistogramEncoder::encode(object, buffer.data(), buffer.size(), error, version);
+        benchmark::DoNotOptimize(buffer.data());
+    }
+    if(error) state.SkipWithError("encode failed");
+    state.SetBytesProcessed(state.iterations() * encodedSize);
+    state.counters["encodedBytes"] = encodedSize;
+}
+
+/** @brief Decodes a 2D histogram as dqmproxy does. Args: bins along each axis, occupancy %, encoder version. */
+template<typename histogram_type>
+void BM_Decode2D(benchmark::State& state) {
+    const unsigned numberOfBins = static_cast<unsigned>(state.range(0));
+    const uint8_t version = static_cast<uint8_t>(state.range(2));
+    const PlotCollection::object_type object(filledHistogram2D<histogram_type>(nullptr, numberOfBins, static_cast<unsigned>(state.range(1))));
+    std::vector<uint8_t> buffer(HistogramEncoder::requiredSize(object, version));
+    std::error_code error;
+    buffer.resize(HistogramEncoder::encode(object, buffer.data(), buffer.size(), error, version));
+
+    for(auto _ : state) {
+        auto decoded = HistogramEncoder::decode(buffer.data(), buffer.size(), error);
+        benchmark::DoNotOptimize(decoded);
+    }
+    if(error) state.SkipWithError("decode failed");
+    state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+
+/** @brief Encodes a rolling histogram, which encodes the total of its slices. Args: bins along each axis, slices. */
+void BM_EncodeRolling2D(benchmark::State& state) {
+    const unsigned numberOfBins = static_cast<unsigned>(state.range(0));
+    PlotCollection::object_type object(RollingHistogram2DF(nullptr, static_cast<unsigned>(state.range(1)), std::chrono::hours(1), numberOfBins, 0, numberOfBins, numberOfBins, 0, numberOfBins));
+    auto& rolling = std::get<RollingHistogram2DF>(object);
+    const std::vector<float> xValues = randomValues(numberOfBins, 1);
+    const std::vector<float> yValues = randomValues(numberOfBins, 101);
+    rolling.fillN(xValues.data(), yValues.data(), numberOfValues);
+    std::vector<uint8_t> buffer(HistogramEncoder::requiredSize(object));
+
+    std::error_code error;
+    for(auto _ : state) {
+        HistogramEncoder::encode(object, buffer.data(), buffer.size(), error);
+        benchmark::DoNotOptimize(buffer.data());
+    }
+    if(error) state.SkipWithError("encode failed");
+}
+
+//
+// Looking up histograms
+//
+
+/** @brief Looks up existing histograms by name from all threads, as the analyzer modules do for every event.
+ * Args: number of histograms in the collection. */
+void BM_GetOrCreateLookup(benchmark::State& state) {
+    static PlotSource<> plots;
+    static std::vector<std::string> names;
+    PlotCollection* pCollection = plots.getOrCreateCollection("bench");
+    if(state.thread_index() == 0) {
+        pCollection->clearAll();
+        names.clear();
+        std::error_code error;
+        for(int64_t index = 0; index < state.range(0); ++index) {
+            names.push_back("chip" + std::to_string(index) + "/hitmap");
+            pCollection->getOrCreateHistogram2DI(names.back(), 256, 0, 256, 250, 0, 250, error);
+        }
+    }
+
+    std::error_code error;
+    size_t index = state.thread_index();
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(pCollection->getOrCreateHistogram2DI(names[index], 256, 0, 256, 250, 0, 250, error));
+        index = (index + 1) % names.size();
+    }
+    if(error) state.SkipWithError("getOrCreate failed");
+    state.SetItemsProcessed(state.iterations());
+}
+
+//
+// Saving and loading
+//
+
+/** @brief A run's worth of hitmaps, so saving and loading has realistic sizes. */
+void fillRun(PlotSource<>& plots, int64_t numberOfHistograms) {
+    PlotCollection* pCollection = plots.getOrCreateCollection("quads");
+    std::error_code error;
+    for(int64_t index = 0; index < numberOfHistograms; ++index) {
+        Histogram2DI* pHistogram = pCollection->getOrCreateHistogram2DI("chip" + std::to_string(index) + "/hitmap", 256, 0, 256, 250, 0, 250, error);
+        const std::vector<float> xValues = randomValues(256, index);
+        const std::vector<float> yValues = randomValues(250, 1000 + index);
+        pHistogram->fillN(xValues.data(), yValues.data(), numberOfValues);
+    }
+}
+
+std::filesystem::path benchmarkFile(const char* extension) {
+    return std::filesystem::temp_directory_path() / (std::string("dqmbench_") + std::to_string(::getpid()) + extension);
+}
+
+/** @brief Args: number of histograms. */
+void BM_SaveArchive(benchmark::State& state) {
+    PlotSource<> plots;
+    fillRun(plots, state.range(0));
+    const std::filesystem::path filename = benchmarkFile(".dqm");
+
+    std::error_code error;
+    for(auto _ : state) plots.saveAsArchive(filename, false, error);
+    if(error) state.SkipWithError("saveAsArchive failed");
+    else state.SetBytesProcessed(state.iterations() * std::filesystem::file_size(filename));
+    std::filesystem::remove(filename, error);
+}
+
+/** @brief Args: number of histograms. */
+void BM_LoadArchive(benchmark::State& state) {
+    const std::filesystem::path filename = benchmarkFile(".dqm");
+    std::error_code error;
+    {
+        PlotSource<> plots;
+        fillRun(plots, state.range(0));
+        plots.saveAsArchive(filename, false, error);
+    }
+
+    for(auto _ : state) {
+        PlotSource<> plots;
+        plots.addFromArchive(filename, error);
+    }
+    if(error) state.SkipWithError("addFromArchive failed");
+    else state.SetBytesProcessed(state.iterations() * std::filesystem::file_size(filename));
+    std::filesystem::remove(filename, error);
+}
+
+/** @brief Args: number of histograms. */
+void BM_SaveRootFile(benchmark::State& state) {
+    PlotSource<> plots;
+    fillRun(plots, state.range(0));
+    const std::filesystem::path filename = benchmarkFile(".root");
+
+    std::error_code error;
+    for(auto _ : state) plots.saveAsRootFile(filename.c_str(), false, "RECREATE", error);
+    if(error) state.SkipWithError("saveAsRootFile failed");
+    else state.SetBytesProcessed(state.iterations() * std::filesystem::file_size(filename));
+    std::filesystem::remove(filename, error);
+}
+
+/** @brief Args: number of histograms. */
+void BM_LoadRootFile(benchmark::State& state) {
+    const std::filesystem::path filename = benchmarkFile(".root");
+    std::error_code error;
+    {
+        PlotSource<> plots;
+        fillRun(plots, state.range(0));
+        plots.saveAsRootFile(filename.c_str(), false, "RECREATE", error);
+    }
+
+    for(auto _ : state) {
+        PlotSource<> plots;
+        plots.addFromRootFile(filename.c_str(), error);
+    }
+    if(error) state.SkipWithError("addFromRootFile failed");
+    else state.SetBytesProcessed(state.iterations() * std::filesystem::file_size(filename));
+    std::filesystem::remove(filename, error);
+}
+
+} // end of the unnamed namespace
+
+// 64 bins is a MuTRiG channel histogram, 256 and 1024 cover hitmaps up to a whole ladder
+BENCHMARK(BM_Fill1D<Histogram1DF, Lock::PerformLock>)->Arg(64)->Arg(1024)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_Fill1D<Histogram1DF, Lock::Sharded>)->Arg(64)->Arg(1024)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_Fill1D<Histogram1DI, Lock::PerformLock>)->Arg(64)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_Fill2D<Histogram2DF, Lock::PerformLock>)->Arg(256)->Arg(1024)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_Fill2D<Histogram2DI, Lock::PerformLock>)->Arg(256)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_Fill2D<Histogram2DI, Lock::Sharded>)->Arg(256)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_FillRolling2D)->Args({256, 10})->Args({256, 60})->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_FillN2D<Histogram2DF>)->Arg(256)->Arg(1024);
+BENCHMARK(BM_FillN2D<Histogram2DI>)->Arg(256)->Arg(1024);
+
+BENCHMARK(BM_Add2D<Histogram2DF>)->Arg(256)->Arg(1024);
+BENCHMARK(BM_Add2D<Histogram2DI>)->Arg(256)->Arg(1024);
+BENCHMARK(BM_Add2D<Histogram2DD>)->Arg(256)->Arg(1024);
+BENCHMARK(BM_AddEncoded2D<Histogram2DF>)->Args({256, 1})->Args({256, 100})->Args({1024, 1})->Args({1024, 100});
+BENCHMARK(BM_AddEncoded2D<Histogram2DI>)->Args({256, 1})->Args({256, 100});
+
+BENCHMARK(BM_Encode2D<Histogram2DF>)->ArgsProduct({{256, 1024}, {1, 100}, {1, 2}});
+BENCHMARK(BM_Encode2D<Histogram2DI>)->ArgsProduct({{256, 1024}, {1, 100}, {1, 2}});
+BENCHMARK(BM_Decode2D<Histogram2DF>)->ArgsProduct({{256, 1024}, {1, 100}, {1, 2}});
+BENCHMARK(BM_Decode2D<Histogram2DI>)->ArgsProduct({{256, 1024}, {1, 100}, {1, 2}});
+BENCHMARK(BM_EncodeRolling2D)->Args({256, 10})->Args({256, 60})->Args({256, 600});
+
+BENCHMARK(BM_GetOrCreateLookup)->Arg(10)->Arg(1000)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK(BM_SaveArchive)->Arg(10)->Arg(100)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_LoadArchive)->Arg(10)->Arg(100)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SaveRootFile)->Arg(10)->Arg(100)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_LoadRootFile)->Arg(10)->Arg(100)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
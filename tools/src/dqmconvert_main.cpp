@@ -0,0 +1,53 @@
+//
+// Converts saved DQM histograms between root files and the native archives (see musip/dqm/Archive.hpp).
+// The analyzers write both, but archives of older runs can be made from their root files with this, and
+// root files can be made from archives for anyone who wants to look at them in root.
+//
+// The direction is taken from the file extensions, ".root" or ".dqm". Note that archives don't have the
+// titles of the histograms, so root files made from archives have the histogram names as titles.
+//
+#include <cstdio>
+#include <filesystem>
+#include <string_view>
+#include "musip/dqm/PlotSource.hpp"
+
+int main(int argc, char* argv[]) {
+    if(argc != 3 || std::string_view(argv[1]) == "--help" || std::string_view(argv[1]) == "-h") {
+        printf("dqmconvert - converts DQM histograms between root files and archives.\n"
+            "\n"
+            "Usage:\n"
+            "\tdqmconvert <input file> <output file>\n"
+            "\n"
+            "One file has to end in \".root\" and the other in \".dqm\". Empty histograms are kept.\n"
+            "\n");
+        return (argc == 2 ? 0 : -1);
+    }
+
+    const std::filesystem::path input(argv[1]);
+    const std::filesystem::path output(argv[2]);
+    constexpr bool skipEmptyHistograms = false;
+    musip::dqm::PlotSource<> plots;
+    std::error_code error;
+
+    if(input.extension() == ".root" && output.extension() == ".dqm") {
+        plots.addFromRootFile(input.c_str(), error);
+        if(!error) plots.saveAsArchive(output, skipEmptyHistograms, error);
+    }
+    else if(input.extension() == ".dqm" && output.extension() == ".root") {
+        plots.addFromArchive(input, error);
+        if(!error) plots.saveAsRootFile(output.c_str(), skipEmptyHistograms, error);
+    }
+    else {
+        fprintf(stderr, "ERROR! Can only convert from \".root\" to \".dqm\" or from \".dqm\" to \".root\".\n");
+        return -1;
+    }
+
+    if(error) {
+        const std::string errorMessage = error.message();
+        fprintf(stderr, "ERROR! Couldn't convert '%s' to '%s': %s\n", input.c_str(), output.c_str(), errorMessage.c_str());
+        return -1;
+    }
+
+    printf("Converted '%s' to '%s'\n", input.c_str(), output.c_str());
+    return 0;
+}
@@ -12,16 +12,31 @@
 //
 #include <cstdio>
 #include <chrono>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <optional>
+#include <thread>
+#include <unordered_map>
 #include "midas.h"
 #include "mrpc.h"
 #include "musip/dqm/PlotCollection.hpp"
 #include "musip/dqm/HistogramEncoder.hpp"
 #include "musip/dqm/DQMManager.hpp"
+#include "musip/dqm/HistogramRevisions.hpp"
+#include "mjson.h"
 
 namespace { // the unnamed namespace
+    using RPCHeader = musip::dqm::DQMManager::RPCHeader;
+
+    // How long the DQM instances get to reply to each request, set with --timeout
+    std::chrono::milliseconds global_replyTimeout(5000);
+
     struct RPCConnection {
+        static constexpr size_t initialReplySize = 1048576;
+        static constexpr size_t maximumReplySize = size_t(1) << 30; // Anything claiming to be larger is assumed to be garbage
+        static constexpr unsigned maximumAttempts = 3;
+
         RPCConnection(const char* clientName)
             : clientName_(clientName) {
             connect();
@@ -59,6 +74,7 @@ namespace { // the unnamed namespace
                 printf("Cannot disconnect from frontend '%s' (%d)\n", clientName_.c_str(), result);
             }
             printf("Disconnect from client '%s'\n", clientName_.c_str());
+            hConn_ = 0;
         }
 
         // Forbid copying, otherwise two handles will try and close the connection
@@ -68,7 +84,8 @@ namespace { // the unnamed namespace
         // Custom move construction and assignment to stop the old instance shutting the connection
         RPCConnection(RPCConnection&& other)
             : hConn_(other.hConn_),
-              clientName_(std::move(other.clientName_)) {
+              clientName_(std::move(other.clientName_)),
+              replySize_(other.replySize_) {
             other.hConn_ = 0;
         }
 
@@ -78,26 +95,61 @@ namespace { // the unnamed namespace
 
                 hConn_ = other.hConn_;
                 clientName_ = std::move(other.clientName_);
+                replySize_ = other.replySize_;
                 other.hConn_ = 0;
             }
             return *this;
         }
 
-        std::vector<char> binaryCall(const char* command, const char* arguments, const size_t maximumResultSize = 1048576) {
-            std::vector<char> buffer(maximumResultSize);
-            uint32_t bufferSize = buffer.size();
-
-            const int result = rpc_client_call(hConn_, RPC_BRPC, command, arguments, buffer.data(), &bufferSize);
-            if(result != RPC_SUCCESS) {
-                if(result == RPC_NET_ERROR) {
-                    printf("RPCConnection '%s' has disconnected (RPC_NET_ERROR)\n", clientName_.c_str());
-                    hConn_ = 0;
+        /** @brief Makes the call and returns the reply, or an empty vector if there was no reply before `deadline`.
+         *
+         * If the reply was truncated, the RPCHeader says how large it really is and the call is repeated with a
+         * buffer that size. The size is remembered, since the same histogram is likely to be asked for again.
+         */
+        std::vector<char> binaryCall(const char* command, const char* arguments, const std::chrono::steady_clock::time_point deadline) {
+            std::vector<char> buffer;
+
+            for(unsigned attempt = 0; attempt < maximumAttempts; ++attempt) {
+                const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                if(remaining.count() <= 0) {
+                    printf("RPCConnection '%s' ran out of time before a complete reply\n", clientName_.c_str());
+                    buffer.clear();
+                    return buffer;
                 }
-                else printf("Error with RPCConnection call to '%s': (%d)\n", clientName_.c_str(), result);
-                buffer.resize(0);
-            }
-            else {
+                rpc_set_timeout(hConn_, static_cast<int>(remaining.count()));
+
+                buffer.resize(replySize_);
+                uint32_t bufferSize = buffer.size();
+
+                const int result = rpc_client_call(hConn_, RPC_BRPC, command, arguments, buffer.data(), &bufferSize);
+                if(result != RPC_SUCCESS) {
+                    if(result == RPC_NET_ERROR) {
+                        printf("RPCConnection '%s' has disconnected (RPC_NET_ERROR)\n", clientName_.c_str());
+                        hConn_ = 0;
+                    }
+                    else if(result == RPC_TIMEOUT) {
+                        // The reply might still turn up and be taken as the reply to the next call, so start afresh.
+                        // The main loop reconnects.
+                        printf("RPCConnection '%s' timed out\n", clientName_.c_str());
+                        disconnect();
+                    }
+                    else printf("Error with RPCConnection call to '%s': (%d)\n", clientName_.c_str(), result);
+                    buffer.clear();
+                    return buffer;
+                }
+
                 buffer.resize(bufferSize);
+                if(bufferSize < sizeof(RPCHeader)) return buffer;
+
+                const RPCHeader& header = *reinterpret_cast<const RPCHeader*>(buffer.data());
+                if(header.messageSize <= bufferSize) return buffer;
+                if(header.messageSize > maximumReplySize) {
+                    fprintf(stderr, "RPCConnection '%s' says its reply is %u bytes, which is too large\n", clientName_.c_str(), header.messageSize);
+                    return buffer;
+                }
+
+                printf("RPCConnection '%s' reply was truncated from %u to %u bytes, asking again\n", clientName_.c_str(), header.messageSize, bufferSize);
+                replySize_ = header.messageSize;
             }
 
             return buffer;
@@ -105,6 +157,7 @@ namespace { // the unnamed namespace
 
         HNDLE hConn_;
         std::string clientName_;
+        size_t replySize_ = initialReplySize; // Grows to the largest reply seen
     };
 
     // Note that we don't have a mutex lock on this. It's filled before any RPC calls can be received.
@@ -114,6 +167,7 @@ namespace { // the unnamed namespace
      *
      * The result of each proxy call to a connected RPC client will be added with `add(...)`. Once
      * all of the calls have returned, the combined result can be written with `writeTo(...)`.
+     * Not thread safe, the caller has to make sure only one result is added at a time.
      */
     struct CombinedResult {
         CombinedResult(const char* command);
@@ -230,53 +284,29 @@ namespace { // the unnamed namespace
     }
 
     void CombinedResult::addToHistogram(const char* buffer, size_t bufferSize) {
-        musip::dqm::HistogramEncoder decoder;
         std::error_code error;
-        const auto newHistogramOptional = decoder.decode(buffer, bufferSize, error);
 
+        if(object_.has_value()) {
+            // Add the bins straight into the sum, without decoding into a histogram of its own first. Callers never
+            // add two replies at the same time, so there's no need for the histogram to lock.
+            musip::dqm::HistogramEncoder::addEncoded<musip::dqm::Lock::AlreadyLocked>(object_.value(), buffer, bufferSize, error);
+            if(error) {
+                const std::string errorMessage = error.message();
+                fprintf(stderr, "CombinedResult::addToHistogram: couldn't add the new histogram to the current: %s\n", errorMessage.c_str());
+            }
+            return;
+        }
+
+        // The first reply becomes the sum that the others are added to
+        object_ = musip::dqm::HistogramEncoder::decode(buffer, bufferSize, error);
         if(error) {
             const std::string errorMessage = error.message();
             fprintf(stderr, "CombinedResult::addToHistogram: got an error while decoding the binary buffer: %s\n", errorMessage.c_str());
             return;
         }
-        else if(!newHistogramOptional.has_value()) {
+        else if(!object_.has_value()) {
             fprintf(stderr, "CombinedResult::addToHistogram: no histogram decoded\n");
-            return;
         }
-
-        if(object_.has_value()) {
-            const auto& newHistogram = newHistogramOptional.value();
-
-            // Use a double `visit` so that we have the concrete types of both histograms. Then we can check
-            // if they're both the same type, and if so add them.
-            std::visit(musip::dqm::detail::overloaded{
-                [](musip::dqm::RollingHistogram2DF& object) {
-                    // This should never happen because RollingHistograms are always transported as
-                    // normal histograms. But we need this type-matcher to stop the compiler trying
-                    // to compile the general one below for RollingHistogram.
-                    fprintf(stderr, "CombinedResult::addToHistogram: the current histogram is a RollingHistogram2DF, which should not occur.\n");
-                },
-                [&newHistogram](auto& object) {
-                    std::visit([&object](auto& newObject) {
-                        using histogram_type = typename std::decay<decltype(object)>::type;
-                        using new_histogram_type = typename std::decay<decltype(newObject)>::type;
-
-                        if constexpr(std::is_same<histogram_type, new_histogram_type>::value) {
-                            std::error_code error;
-                            object.add(newObject, error);
-                            if(error) {
-                                const std::string errorMessage = error.message();
-                                fprintf(stderr, "CombinedResult::addToHistogram: got an error while adding the new histogram to the current: %s\n", errorMessage.c_str());
-                            }
-                        }
-                        else {
-                            fprintf(stderr, "CombinedResult::addToHistogram: the new histogram is not the same type as the current one\n");
-                        }
-                    }, newHistogram);
-                }
-            }, object_.value());
-        }
-        else object_ = newHistogramOptional;
     } // end of method CombinedResult::addToHistogram
 
     size_t CombinedResult::writeHistogramTo(char* buffer, size_t bufferSize) const {
@@ -298,37 +328,187 @@ namespace { // the unnamed namespace
         return bytesWritten;
     } // end of method CombinedResult::writeHistogramTo
 
-    int binary_rpc_callback(int index, void *prpc_param[]) {
-        const char* cmd  = static_cast<const char*>(prpc_param[0]);
-        const char* args = static_cast<const char*>(prpc_param[1]);
-        char* return_buf = static_cast<char*>(prpc_param[2]);
-        int& return_max_length = *static_cast<int*>(prpc_param[3]);
+    // Versions of the summed histograms, for clients that send a "since" version. See DQMManager::UpdateHeader.
+    musip::dqm::HistogramRevisions global_revisions;
 
-        printf("Got RPC %d. Cmd = '%s', args = '%s' return_max_length = %d\n", index, cmd, args, return_max_length);
+    /** @brief Takes the "since" entry out of the JSON arguments of a dqm::histogram call.
+     *
+     * The DQM instances are always asked for their full histogram, because only the sum can be versioned. Returns
+     * the arguments to forward on, and sets the other parameters from the original arguments. `sinceVersion` is
+     * only set if the request is for the current run alone, since nothing else changes.
+     */
+    std::string removeSinceVersion(const char* args, std::optional<uint32_t>& sinceVersion, std::string& histogramPath) {
+        if(args[0] != '{') return args; // Not JSON, just the histogram path
 
-        CombinedResult combinedResult(cmd);
+        MJsonNode* pRootNode = MJsonNode::Parse(args);
+        if(pRootNode->GetType() != MJSON_OBJECT) {
+            delete pRootNode;
+            return args; // Let the DQM instances complain about it
+        }
 
+        bool currentRunOnly = true;
+        std::string forwardArgs = "{";
+        const std::vector<std::string>& subNodeNames = *pRootNode->GetObjectNames();
+        const std::vector<MJsonNode*>& subNodes = *pRootNode->GetObjectNodes();
+        for(size_t index = 0; index < subNodeNames.size() && index < subNodes.size(); ++index) {
+            if(subNodeNames[index] == "since") {
+                if(subNodes[index]->GetType() == MJSON_INT) sinceVersion = static_cast<uint32_t>(subNodes[index]->GetInt());
+                continue;
+            }
+            else if(subNodeNames[index] == "name" && subNodes[index]->GetType() == MJSON_STRING) {
+                histogramPath = subNodes[index]->GetString();
+            }
+            else if(subNodeNames[index] == "runs" && subNodes[index]->GetType() == MJSON_ARRAY) {
+                for(const auto& pRunNumberNode : *subNodes[index]->GetArray()) {
+                    if(pRunNumberNode->GetType() != MJSON_INT || pRunNumberNode->GetInt() != 0) currentRunOnly = false;
+                }
+            }
+
+            if(forwardArgs.size() > 1) forwardArgs += ",";
+            forwardArgs += "\"" + subNodeNames[index] + "\":" + subNodes[index]->Stringify();
+        }
+        forwardArgs += "}";
+        delete pRootNode;
+
+        if(!currentRunOnly || histogramPath.find('/') == std::string::npos) sinceVersion.reset();
+        return forwardArgs;
+    }
+
+    /** @brief What the DQM instances replied to one request, added up. */
+    struct FanOutResult {
+        FanOutResult(const char* command) : combinedResult(command) {}
+
+        CombinedResult combinedResult;
         // DQM RPC calls now put a small header at the start of every response. This is so that clients can detect when
         // a response has been truncated by Midas because they didn't supply a large enough value for`return_max_length`.
-        using RPCHeader = musip::dqm::DQMManager::RPCHeader;
         RPCHeader::MessageType messageType = RPCHeader::MessageType::unknown; // We need to pass this on in our reply.
+        bool anyWaiting = false; // Set if any instance replied that it's still loading previous runs
+    };
 
-        // No mutex lock because global_rpcConnections is filled before we accept connections
+    /** @brief Sends the request to all the DQM instances and adds up their replies. */
+    std::shared_ptr<const FanOutResult> fanOut(const char* cmd, const std::string& forwardArgs) {
+        auto pResult = std::make_shared<FanOutResult>(cmd);
+        std::mutex resultMutex; // Protects `pResult`, replies are added by the thread that got them
+
+        // Ask all the instances at once, so that the reply takes as long as the slowest instance rather than the sum
+        // of all of them. Each reply is added as soon as it arrives. Midas allows calls on different connections
+        // from different threads at the same time.
+        const auto deadline = std::chrono::steady_clock::now() + global_replyTimeout;
+        std::vector<std::thread> calls;
+        // No mutex lock because global_rpcConnections is filled before we accept connections, and the connections are
+        // only reconnected from the main loop, which is where we're called from.
         for(auto& connection : global_rpcConnections) {
-            std::vector<char> subResult = connection.binaryCall(cmd, args, return_max_length);
-            if(subResult.size() < sizeof(RPCHeader)) {
-                printf("RPC sub-call got a response of length %zu, which is below the minimum required.\n", subResult.size());
-            }
-            else {
-                printf("RPC sub-call got response with size %zu\n", subResult.size());
-                const RPCHeader& header = *reinterpret_cast<RPCHeader*>(subResult.data());
+            if(!connection.isConnected()) continue;
+
+            calls.emplace_back([&, pConnection = &connection]() {
+                const std::vector<char> subResult = pConnection->binaryCall(cmd, forwardArgs.c_str(), deadline);
+                if(subResult.size() < sizeof(RPCHeader)) {
+                    printf("RPC sub-call to '%s' got a response of length %zu, which is below the minimum required.\n", pConnection->clientName_.c_str(), subResult.size());
+                    return;
+                }
+
+                const RPCHeader& header = *reinterpret_cast<const RPCHeader*>(subResult.data());
                 if(header.messageSize != subResult.size()) {
-                    fprintf(stderr, "RPC sub-call was truncated from %u to %zu bytes\n", header.messageSize, subResult.size());
-                    // TODO resubmit the request with adequate `maximumResultSize`
+                    fprintf(stderr, "RPC sub-call to '%s' was truncated from %u to %zu bytes, ignoring it\n", pConnection->clientName_.c_str(), header.messageSize, subResult.size());
+                    return;
                 }
-                messageType = header.messageType;
-                combinedResult.add(subResult.data() + sizeof(RPCHeader), subResult.size() - sizeof(RPCHeader));
+
+                std::lock_guard<std::mutex> lock(resultMutex);
+                if(header.messageType == RPCHeader::MessageType::wait) {
+                    // This instance is still loading previous runs. The client has to ask again, by when the other
+                    // instances will have theirs loaded as well.
+                    pResult->anyWaiting = true;
+                    return;
+                }
+                pResult->messageType = header.messageType;
+                pResult->combinedResult.add(subResult.data() + sizeof(RPCHeader), subResult.size() - sizeof(RPCHeader));
+            });
+        }
+        for(auto& call : calls) call.join();
+
+        return pResult;
+    }
+
+    // How long combined results are kept for identical requests, set with --cache-ttl
+    std::chrono::milliseconds global_cacheTimeToLive(1000);
+
+    /** @brief Combined results of recent requests, so that several clients asking for the same thing cause one fan-out.
+     *
+     * A result is kept for `global_cacheTimeToLive` after it arrives, and identical requests in that time get it
+     * without asking the instances again. Results where an instance is still loading previous runs are not kept,
+     * since asking again is how the client finds out when the runs are ready.
+     *
+     * No locking, because Midas calls binary_rpc_callback one request at a time from the main loop. For the same
+     * reason a request can never arrive while the same request is still being fanned out.
+     */
+    class ResultCache {
+    public:
+        template<typename function_type>
+        std::shared_ptr<const FanOutResult> get(const std::string& key, function_type&& makeResult) {
+            const auto now = std::chrono::steady_clock::now();
+            for(auto iEntry = entries_.begin(); iEntry != entries_.end(); ) {
+                if(iEntry->second.expires <= now) iEntry = entries_.erase(iEntry);
+                else ++iEntry;
+            }
+            if(const auto iEntry = entries_.find(key); iEntry != entries_.end()) return iEntry->second.pResult;
+
+            std::shared_ptr<const FanOutResult> pResult = makeResult();
+            if(!pResult->anyWaiting && global_cacheTimeToLive.count() > 0) {
+                entries_.emplace(key, Entry{pResult, std::chrono::steady_clock::now() + global_cacheTimeToLive});
+            }
+            return pResult;
+        }
+    private:
+        struct Entry {
+            std::shared_ptr<const FanOutResult> pResult;
+            std::chrono::steady_clock::time_point expires;
+        };
+        std::unordered_map<std::string, Entry> entries_; // Keyed by the command and the forwarded arguments
+    } global_resultCache;
+
+    int binary_rpc_callback(int index, void *prpc_param[]) {
+        const char* cmd  = static_cast<const char*>(prpc_param[0]);
+        const char* args = static_cast<const char*>(prpc_param[1]);
+        char* return_buf = static_cast<char*>(prpc_param[2]);
+        int& return_max_length = *static_cast<int*>(prpc_param[3]);
+
+        printf("Got RPC %d. Cmd = '%s', args = '%s' return_max_length = %d\n", index, cmd, args, return_max_length);
+
+        const CombinedResult::CallType callType = CombinedResult(cmd).callType_;
+
+        // If the client says which version of the histogram it has, we reply with only what changed. The version
+        // isn't forwarded, so clients with different versions share the same cached result.
+        std::optional<uint32_t> sinceVersion;
+        std::string histogramPath;
+        const std::string forwardArgs = (callType == CombinedResult::CallType::histogram ? removeSinceVersion(args, sinceVersion, histogramPath) : std::string(args));
+
+        // Only lists and histograms are cached, anything else (e.g. dqm::clear) has to reach the instances every time
+        const std::shared_ptr<const FanOutResult> pResult = (callType == CombinedResult::CallType::unknown
+            ? fanOut(cmd, forwardArgs)
+            : global_resultCache.get(std::string(cmd) + "\n" + forwardArgs, [cmd, &forwardArgs]() { return fanOut(cmd, forwardArgs); }));
+        const CombinedResult& combinedResult = pResult->combinedResult;
+
+        if(pResult->anyWaiting) {
+            RPCHeader& header = *reinterpret_cast<RPCHeader*>(return_buf);
+            header.messageSize = static_cast<uint32_t>(sizeof(RPCHeader));
+            header.messageType = RPCHeader::MessageType::wait;
+            return_max_length = sizeof(RPCHeader);
+            return RPC_SUCCESS;
+        }
+
+        if(combinedResult.callType_ == CombinedResult::CallType::histogram && !combinedResult.empty()) {
+            std::vector<char> reply;
+            if(sinceVersion.has_value()) {
+                const size_t collectionNameSize = histogramPath.find('/');
+                const auto update = global_revisions.update(histogramPath.substr(0, collectionNameSize), histogramPath.substr(collectionNameSize + 1), combinedResult.object_.value(), sinceVersion.value());
+                musip::dqm::DQMManager::encodeHistogramReply(combinedResult.object_.value(), &update, reply);
             }
+            else musip::dqm::DQMManager::encodeHistogramReply(combinedResult.object_.value(), nullptr, reply);
+            // If this doesn't fit, the header still says the full size so the client can ask again with more space
+            const size_t bytesToCopy = std::min(reply.size(), static_cast<size_t>(return_max_length));
+            std::memcpy(return_buf, reply.data(), bytesToCopy);
+            return_max_length = static_cast<int>(bytesToCopy);
+            return RPC_SUCCESS;
         }
 
         size_t bytesWritten = 0;
@@ -341,7 +521,7 @@ namespace { // the unnamed namespace
 
         RPCHeader& header = *reinterpret_cast<RPCHeader*>(return_buf);
         header.messageSize = static_cast<uint32_t>(sizeof(RPCHeader) + bytesWritten);
-        header.messageType = messageType;
+        header.messageType = pResult->messageType;
 
         return RPC_SUCCESS;
     }
@@ -368,6 +548,9 @@ int main(int argc, char* argv[]) {
                 "(defaults to 'ana').\n"
                 "Available options:\n"
                 "\t--midas-progname <progname> : The RPC name Midas uses to contact this. Defaults to 'dqm'.\n"
+                "\t--timeout <milliseconds>    : How long the minalyzers get to reply to each request. Defaults to 5000.\n"
+                "\t--cache-ttl <milliseconds>  : How long a result is reused for identical requests. Defaults to 1000, 0 turns\n"
+                "\t                              caching off.\n"
                 "\n"
                 "Example:\n"
                 "On two different machines start two instances of minalyzer with different names:\n"
@@ -388,6 +571,26 @@ int main(int argc, char* argv[]) {
                 return -1;
             }
         }
+        else if(0 == std::strcmp(argv[argIndex], "--timeout")) {
+            if(argIndex + 1 < argc && std::atoi(argv[argIndex + 1]) > 0) {
+                global_replyTimeout = std::chrono::milliseconds(std::atoi(argv[argIndex + 1]));
+                ++argIndex; // increment, because we've consumed to arguments
+            }
+            else {
+                fprintf(stderr, "ERROR! command line parameter '--timeout' was given but no positive number of milliseconds was supplied!\n");
+                return -1;
+            }
+        }
+        else if(0 == std::strcmp(argv[argIndex], "--cache-ttl")) {
+            if(argIndex + 1 < argc && std::atoi(argv[argIndex + 1]) >= 0) {
+                global_cacheTimeToLive = std::chrono::milliseconds(std::atoi(argv[argIndex + 1]));
+                ++argIndex; // increment, because we've consumed to arguments
+            }
+            else {
+                fprintf(stderr, "ERROR! command line parameter '--cache-ttl' was given but no number of milliseconds was supplied!\n");
+                return -1;
+            }
+        }
         else dqmInstanceNames.push_back(argv[argIndex]);
     }
 
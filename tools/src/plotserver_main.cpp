@@ -1,7 +1,8 @@
 //
 // This is code for a stand alone executable to serve old run files. When RPC calls for
-// old runs are received, the speficied directories are searched for dqm_histos_<run number>.root
-// files. Plots from these files are loaded and returned over RPC.
+// old runs are received, the speficied directories are searched for dqm_histos_<run number>.dqm
+// archives or, in builds with root, dqm_histos_<run number>.root files. Plots from these files are loaded
+// and returned over RPC.
 // The code to do this is mostly in DQMManager. The mechanism is basically the same as minalyzer
 // does, except that we don't do anything to create plots for the current run.
 //
@@ -37,13 +38,13 @@ int main(int argc, char* argv[]) {
         std::string_view arg(argv[argIndex]);
 
         if((arg == "--help") || (arg == "-h")) {
-            printf("plotserver - serves DQM plots loaded from dqm_histos_<run number>.root files.\n"
+            printf("plotserver - serves DQM plots loaded from dqm_histos_<run number>.dqm or .root files.\n"
                 "\n"
                 "Usage:\n"
                 "\tplotserver [options] <directory1> [[directory2] ...]\n"
                 "\n"
                 "The directories specified are searched in order until a file for the requested run is found. So earlier\n"
-                "directories take higher precedence.\n"
+                "directories take higher precedence. Within a directory the .dqm archive is used if there is one.\n"
                 "Available options:\n"
                 "\t--midas-progname <progname> : The RPC name Midas uses to contact this. Defaults to 'prompt_server'.\n"
                 "--midas-hostname HOSTNAME[:PORT] -- connect to MIDAS mserver on given host and port\n"
@@ -88,7 +89,7 @@ int main(int argc, char* argv[]) {
     }
 
     if(!atLeastOneDirectorySpecified) {
-        fprintf(stderr, "You need to specify at least one directory to look for dqm_histos_<run number>.root in.\n");
+        fprintf(stderr, "You need to specify at least one directory to look for dqm_histos_<run number>.dqm or .root in.\n");
         return -1;
     }
 